@@ -17,23 +17,32 @@ SETUP/TEARDOWN:
 - Mist_ProfileInit(); to init
 - Mist_ProfileTerminate(); to close
 
+PLATFORMS:
+Windows (MSVC) and Linux (GCC/Clang, link with -lpthread and define _GNU_SOURCE or _DEFAULT_SOURCE for syscall()).
+Samples store raw ticks: the invariant TSC on x86 Linux, the performance counter on Windows. Ticks are converted to
+microseconds when the samples are flushed, the TSC is calibrated once against CLOCK_MONOTONIC by Mist_ProfileInit.
+
 NOTE: Chrome://tracing matches these calls by name and category assuring a unique name is important.
 
-WARNING: Category and Name are not stored, their lifetime must exist either until program termination or until the next call to Mist_FlushThreadBuffer and Mist_Flush.
+WARNING: Category and Name are not stored, their lifetime must exist either until program termination or until the samples have been flushed.
 
 USAGE:
-Once a significant amount of samples have been gathered, samples have to be flushed.
-A simple way to do this is shown below
+Every thread writes it's samples to it's own fixed size ring without taking a lock. The rings have to be drained
+regularly, a full ring drops new samples (reported as the "mist" "dropped_samples" counter) rather than stalling the thread.
 
+The simplest way is to let Mist stream the samples to a file from a background thread, memory use stays bounded:
 {
-	// Buffers are only added to the list once they are full. This minimizes contention and allows simple modification of the buffers.
-	// The buffers are also stored as thread local globals, and thus must be flushed from their respective threads.
-	if(Mist_ProfileListSize() == 0)
-	{
-		// Adds the current buffer to the list of buffers even if it hasn't been filled up yet.
-		Mist_FlushThreadBuffer();
-	}
+	Mist_ProfileInit();
+	Mist_StartFlushThread("trace.json", 10, Mist_FormatJson); // Drains the rings every 10ms
+
+	...
 
+	Mist_StopFlushThread(); // Flushes what's left and completes the json
+	Mist_ProfileTerminate();
+}
+
+The rings can also be drained to a string:
+{
 	char* print;
 	size_t bufferSize;
 	Mist_FlushAlloc(&print, &bufferSize);
@@ -42,64 +51,98 @@ A simple way to do this is shown below
 	fprintf(fileHandle, "%s", print);
 	fprintf(fileHandle, "%s", mist_ProfilePostface);
 
-	free(print);
+	Mist_Free(print);
 }
 
-THREADING:
-
-It is important to call Mist_FlushThreadBuffer() before shutting down a thread and 
-before the last flush as the remaining buffers might have some samples left in them.
-
-A multithreaded program could have the format:
+BINARY FORMAT:
+Mist_StartFlushThread(path, interval, Mist_FormatBinary) writes a compact binary trace instead of json, a fraction of the size
+and much cheaper to write. convert_mist_trace.c converts it to chrome://tracing json, which Perfetto also opens.
+The file starts with a Mist_BinaryHeader followed by records. Every record starts with a 1 byte type:
+	'S' string:  varint id, varint length, characters. Defines the id before it's first use.
+	'T' thread:  varint thread id. The following samples belong to this thread, the time stamp delta restarts at 0.
+	'B' 'E' 'I': varint category id, varint name id, zigzag varint delta in ticks from the thread's previous sample
+	             ends are followed by perfCounterCount zigzag varint counter deltas
+	'C' counter: same as above followed by the zigzag varint value
+Ticks become microseconds with the header's calibration: (ticks - tickOrigin) / ticksPerSecond * 1000000 + microSecondOrigin.
+Strings are interned by address, a category or name pointer must always point to the same string.
+
+STATS:
+#define MIST_PROFILE_STATS to aggregate the scopes while the rings are drained: count, total, min, max and a histogram
+for the p50/p95/p99 of every scope on every thread. MIST_PROFILE_FRAME() marks frames, their times are the "mist" "frame" scope.
+Run the flusher with Mist_FormatNone to get the stats without writing a trace:
 {
-	Init Profiler
-	Add mist_ProfilePreface to the file
+	Mist_SetStatsSummary(stdout, 10000, false); // Prints a summary every 10s
+	Mist_StartFlushThread(NULL, 10, Mist_FormatNone);
 
-	Startup job threads
-		Create samples in these threads
-		At thread termination, call Mist_FlushThreadBuffer()
+	...
+
+	Mist_ScopeStats stats;
+	if (Mist_QueryScope("game", "game_tick", MIST_ANY_THREAD, &stats)) ...
+}
 
-	Startup flushing thread
-		Call Mist_ProfileListSize()
-		If there are buffers, flush them to a file
-		At thread termination, call Mist_FlushThreadBuffer()
+PERF COUNTERS:
+#define MIST_PROFILE_PERF_COUNTERS to read the instructions, cycles, LLC misses and dTLB misses of every thread with
+perf_event_open (Linux). Ends carry the counter deltas of their scope: they show up as the slice's args in the trace and
+as per call means in the stats. Reading the counters is a system call on every begin and end, keep it to coarse scopes.
+The counters need kernel.perf_event_paranoid <= 2 and a PMU, they're reported as unavailable otherwise.
+
+FILTERING:
+Scopes, events and counters can be turned on and off at runtime by category:
+	Mist_SetAllCategoriesEnabled(false);
+	Mist_SetCategoryEnabled("cranh", true);
+	Mist_SetCategorySampleRate("physics", 100); // Records 1 in 100 physics scopes
+	Mist_SetCaptureWindow(1000, 1100); // Only records frames 1000 to 1099
+A scope's end is recorded if and only if it's begin was, changing the filters in the middle of a scope is fine.
+Disabled scopes cost a function call and a load. Category names are compared by value, MIST_CATEGORY_MAX categories
+can be filtered separately, the categories after that are never recorded (and assert in debug). Scopes can nest 64 deep.
 
-	Kill all the threads
-	Call Mist_FlushAlloc() to flush the remaining buffers
+THREADING:
 
-	Print to a file
-	Add mist_ProfilePostface to the file
+Call Mist_FlushThreadBuffer() before shutting down a thread, it hands the thread's ring to the flusher which frees it once it's drained.
+Threads that are still running when Mist_ProfileTerminate() is called must not write samples anymore.
 
-	Terminate the profiler
-}
+MIST_RING_SIZE sets the samples per thread, MIST_FLUSH_CHUNK_SIZE the size of the flusher's write buffer.
 
 */
 
 /* -API- */
 
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 
 #define MIST_PROFILE_TYPE_BEGIN 'B'
 #define MIST_PROFILE_TYPE_END 'E'
 #define MIST_PROFILE_TYPE_INSTANT 'I'
+#define MIST_PROFILE_TYPE_COUNTER 'C'
 
 #ifdef MIST_PROFILE_ENABLED
 
-#define MIST_PROFILE_BEGIN(cat, name) Mist_WriteProfileSample(Mist_CreateProfileSample(cat, name, Mist_TimeStamp(), MIST_PROFILE_TYPE_BEGIN));
-#define MIST_PROFILE_END(cat, name) Mist_WriteProfileSample(Mist_CreateProfileSample(cat, name, Mist_TimeStamp(), MIST_PROFILE_TYPE_END));
-#define MIST_PROFILE_EVENT(cat, name) Mist_WriteProfileSample(Mist_CreateProfileSample(cat, name, Mist_TimeStamp(), MIST_PROFILE_TYPE_INSTANT));
+/* Every call site caches it's category's index, the runtime check is a single load of the active mask. */
+#define MIST_PROFILE_BEGIN(cat, name) { static uint32_t mist_Category = MIST_CATEGORY_UNREGISTERED; Mist_ProfileBegin(&mist_Category, cat, name); }
+#define MIST_PROFILE_END(cat, name) Mist_ProfileEnd(cat, name);
+#define MIST_PROFILE_EVENT(cat, name) { static uint32_t mist_Category = MIST_CATEGORY_UNREGISTERED; if (Mist_IsCategoryActive(&mist_Category, cat)) { Mist_WriteProfileSample(Mist_CreateProfileSample(cat, name, Mist_TimeStamp(), MIST_PROFILE_TYPE_INSTANT)); } }
+#define MIST_PROFILE_COUNTER(cat, name, value) { static uint32_t mist_Category = MIST_CATEGORY_UNREGISTERED; if (Mist_IsCategoryActive(&mist_Category, cat)) { Mist_WriteProfileSample(Mist_CreateCounterSample(cat, name, Mist_TimeStamp(), value)); } }
+#define MIST_PROFILE_FRAME() Mist_FrameMark();
 
 #else
 
 #define MIST_PROFILE_BEGIN(cat, name)
 #define MIST_PROFILE_END(cat, name)
 #define MIST_PROFILE_EVENT(cat, name)
+#define MIST_PROFILE_COUNTER(cat, name, value)
+#define MIST_PROFILE_FRAME()
 
 #endif
 
+/* Hardware counters recorded by the scopes with MIST_PROFILE_PERF_COUNTERS, Linux only. */
+#define MIST_PERF_COUNTER_COUNT 4
+static const char* const mist_PerfCounterNames[MIST_PERF_COUNTER_COUNT] = { "instructions", "cycles", "llc_misses", "dtlb_misses" };
+
 typedef struct
 {
 	int64_t timeStamp;
+	int64_t value; /* Only used by counters */
 
 	const char* category;
 	const char* name;
@@ -109,15 +152,77 @@ typedef struct
 
 	char eventType;
 
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	/* Counter deltas since the matching begin, only on ends. -1 when the counter isn't available. */
+	int64_t perf[MIST_PERF_COUNTER_COUNT];
+#endif
+
 }  Mist_ProfileSample;
 
-static const char* mist_ProfilePreface = "{\"traceEvents\":[{},";
-static const char* mist_ProfilePostface = "{}]}";
+/* Binary traces, see BINARY FORMAT */
+#define MIST_BINARY_MAGIC 0x4254534D /* "MSTB" */
+#define MIST_BINARY_VERSION 1
+#define MIST_BINARY_RECORD_STRING 'S'
+#define MIST_BINARY_RECORD_THREAD 'T'
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	int64_t ticksPerSecond;
+	int64_t tickOrigin;
+	int64_t microSecondOrigin;
+	uint32_t processID;
+	uint32_t perfCounterCount; /* 0 or MIST_PERF_COUNTER_COUNT */
+
+} Mist_BinaryHeader;
+
+static const char* const mist_ProfilePreface = "{\"traceEvents\":[{},";
+static const char* const mist_ProfilePostface = "{}]}";
+
+/* Escapes a character of a json string into out and returns the length of the escape.
+Quotes, backslashes and control characters are escaped, the json writer and convert_mist_trace.c share it. */
+static inline size_t Mist_JsonEscapeChar(char c, char* out)
+{
+	static const char hexDigits[] = "0123456789abcdef";
+	if (c == '"' || c == '\\')
+	{
+		out[0] = '\\';
+		out[1] = c;
+		return 2;
+	}
+	else if ((unsigned char)c < 0x20)
+	{
+		out[0] = '\\';
+		out[1] = 'u';
+		out[2] = '0';
+		out[3] = '0';
+		out[4] = hexDigits[(unsigned char)c >> 4];
+		out[5] = hexDigits[(unsigned char)c & 0xF];
+		return 6;
+	}
+
+	out[0] = c;
+	return 1;
+}
+
+static inline size_t Mist_JsonEscapedSize(const char* string)
+{
+	char escape[6];
+	size_t size = 0;
+	for (; *string != '\0'; string++)
+	{
+		size += Mist_JsonEscapeChar(*string, escape);
+	}
+	return size;
+}
 
 void Mist_ProfileInit(void);
 void Mist_ProfileTerminate(void);
 
 Mist_ProfileSample Mist_CreateProfileSample(const char* category, const char* name, int64_t timeStamp, char eventType);
+/* Counters show up as a graph named after the sample name. */
+Mist_ProfileSample Mist_CreateCounterSample(const char* category, const char* name, int64_t timeStamp, int64_t value);
 void Mist_WriteProfileSample(Mist_ProfileSample sample);
 
 uint16_t Mist_ProfileListSize();
@@ -128,7 +233,75 @@ void Mist_FlushAlloc(char** buffer, size_t* bufferSize);
 void Mist_Free(char* buffer);
 void Mist_FlushThreadBuffer(void);
 
+typedef enum
+{
+	Mist_FormatJson,
+	Mist_FormatBinary,
+	Mist_FormatNone /* Only drains the rings, for MIST_PROFILE_STATS without a trace. */
+} Mist_Format;
+
+bool Mist_StartFlushThread(const char* path, uint32_t intervalMs, Mist_Format format);
+void Mist_StopFlushThread(void);
+
+/* Marks the end of a frame, call it from one thread. Shows up as the "mist" "frame" instant event. */
+void Mist_FrameMark(void);
+uint64_t Mist_FrameIndex(void);
+
+/* Runtime filtering, see FILTERING */
+#define MIST_CATEGORY_MAX 64
+#define MIST_CATEGORY_UNREGISTERED UINT32_MAX
+#define MIST_CATEGORY_NONE MIST_CATEGORY_MAX /* Index of the categories past MIST_CATEGORY_MAX */
+
+void Mist_ProfileBegin(uint32_t* categoryIndex, const char* category, const char* name);
+void Mist_ProfileEnd(const char* category, const char* name);
+bool Mist_IsCategoryActive(uint32_t* categoryIndex, const char* category);
+
+void Mist_SetCategoryEnabled(const char* category, bool enabled);
+void Mist_SetAllCategoriesEnabled(bool enabled);
+/* Records 1 in rate scopes of the category on every thread, 0 or 1 records them all. */
+void Mist_SetCategorySampleRate(const char* category, uint32_t rate);
+/* Only records the frames in [firstFrame, endFrame), frames are counted by Mist_FrameMark. */
+void Mist_SetCaptureWindow(uint64_t firstFrame, uint64_t endFrame);
+
+#ifdef MIST_PROFILE_STATS
+#include <stdio.h>
+
+#define MIST_ANY_THREAD UINT16_MAX
+
+typedef struct
+{
+	const char* category;
+	const char* name;
+	uint16_t threadID; /* MIST_ANY_THREAD when merged across threads */
+
+	uint64_t count;
+	double totalUs;
+	double minUs;
+	double maxUs;
+	double p50Us;
+	double p95Us;
+	double p99Us;
+
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	double perfPerCall[MIST_PERF_COUNTER_COUNT]; /* Mean counter delta, -1 when the counter isn't available */
+#endif
+
+} Mist_ScopeStats;
+
+/* Stats cover the samples drained so far, by the flusher thread or Mist_Flush. */
+/* Fills up to maxStats entries, one per scope and thread. Returns the number of entries available. */
+uint32_t Mist_QueryStats(Mist_ScopeStats* stats, uint32_t maxStats);
+/* Names are compared by value. The frame times are the "mist" "frame" scope. */
+bool Mist_QueryScope(const char* category, const char* name, uint16_t threadID, Mist_ScopeStats* stats);
+void Mist_ResetStats(void);
+void Mist_PrintStats(FILE* file, bool json);
+/* The flusher thread prints the stats to the file every interval, 0 turns it off. */
+void Mist_SetStatsSummary(FILE* file, uint32_t intervalMs, bool json);
+#endif /* MIST_PROFILE_STATS */
+
+/* Returns ticks, not microseconds. See Mist_TicksToMicroSeconds. */
 int64_t Mist_TimeStamp(void);
+int64_t Mist_TicksToMicroSeconds(int64_t ticks);
 
 
 
@@ -160,10 +333,24 @@ int64_t Mist_TimeStamp(void);
 #include <stdbool.h>
 #include <inttypes.h>
 #include <stdio.h>
-#include <math.h>
+#include <stdlib.h>
 
 #if MIST_WIN
 #include <Windows.h>
+#elif MIST_UNIX
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && defined(MIST_PROFILE_PERF_COUNTERS)
+#include <linux/perf_event.h>
+#define MIST_PERF 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define MIST_TSC 1
+#endif
 #endif
 
 #define MIST_UNUSED(a) (void)a
@@ -172,12 +359,16 @@ int64_t Mist_TimeStamp(void);
 
 #if MIST_MSVC
 	#define MIST_THREAD_LOCAL __declspec( thread )
+#elif MIST_GCC
+	#define MIST_THREAD_LOCAL _Thread_local
 #else
 	#error "Mist thread local storage not implemented!"
 #endif
 
 #if MIST_WIN
 	typedef CRITICAL_SECTION Mist_Lock;
+#elif MIST_UNIX
+	typedef pthread_mutex_t Mist_Lock;
 #else
 	#error "Mist Mutex not implemented!"
 #endif
@@ -186,6 +377,8 @@ void Mist_InitLock(Mist_Lock* lock)
 {
 #if MIST_WIN
 	InitializeCriticalSection(lock);
+#elif MIST_UNIX
+	pthread_mutex_init(lock, NULL);
 #else
 	#error "Mist_CreateLock not implemented!"
 #endif
@@ -195,6 +388,8 @@ void Mist_TerminateLock(Mist_Lock* lock)
 {
 #if MIST_WIN
 	DeleteCriticalSection(lock);
+#elif MIST_UNIX
+	pthread_mutex_destroy(lock);
 #else
 	#error "Mist_DestroyLock not implemented!"
 #endif
@@ -204,6 +399,8 @@ void Mist_LockSection(Mist_Lock* lock)
 {
 #if MIST_WIN
 	EnterCriticalSection(lock);
+#elif MIST_UNIX
+	pthread_mutex_lock(lock);
 #else
 	#error "Mist_LockMutex not implemented!"
 #endif
@@ -213,15 +410,131 @@ void Mist_UnlockSection(Mist_Lock* lock)
 {
 #if MIST_WIN
 	LeaveCriticalSection(lock);
+#elif MIST_UNIX
+	pthread_mutex_unlock(lock);
 #else
 	#error "Mist_UnlockMutex not implemented!"
 #endif
 }
 
+/* The rings only need acquire/release between one producer and one consumer. */
+static uint32_t Mist_AtomicLoadAcquire(uint32_t* value)
+{
+#if MIST_MSVC
+	/* volatile accesses are acquire/release with /volatile:ms, the default on x86 and x64. */
+	uint32_t result = *(volatile uint32_t*)value;
+	_ReadWriteBarrier();
+	return result;
+#elif MIST_GCC
+	return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+#else
+	#error "Mist_AtomicLoadAcquire not implemented!"
+#endif
+}
+
+static void Mist_AtomicStoreRelease(uint32_t* value, uint32_t newValue)
+{
+#if MIST_MSVC
+	_ReadWriteBarrier();
+	*(volatile uint32_t*)value = newValue;
+#elif MIST_GCC
+	__atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+#else
+	#error "Mist_AtomicStoreRelease not implemented!"
+#endif
+}
+
+/* The filters are read on every scope, relaxed is enough. */
+static uint64_t Mist_AtomicLoadRelaxed64(uint64_t* value)
+{
+#if MIST_MSVC
+	return *(volatile uint64_t*)value;
+#elif MIST_GCC
+	return __atomic_load_n(value, __ATOMIC_RELAXED);
+#else
+	#error "Mist_AtomicLoadRelaxed64 not implemented!"
+#endif
+}
+
+static void Mist_AtomicStoreRelaxed64(uint64_t* value, uint64_t newValue)
+{
+#if MIST_MSVC
+	*(volatile uint64_t*)value = newValue;
+#elif MIST_GCC
+	__atomic_store_n(value, newValue, __ATOMIC_RELAXED);
+#else
+	#error "Mist_AtomicStoreRelaxed64 not implemented!"
+#endif
+}
+
+#if MIST_WIN
+	typedef HANDLE Mist_Thread;
+	typedef LPTHREAD_START_ROUTINE Mist_ThreadFunc;
+	#define MIST_THREAD_FUNC(name) DWORD WINAPI name(LPVOID data)
+	#define MIST_THREAD_RETURN 0
+#elif MIST_UNIX
+	typedef pthread_t Mist_Thread;
+	typedef void* (*Mist_ThreadFunc)(void*);
+	#define MIST_THREAD_FUNC(name) void* name(void* data)
+	#define MIST_THREAD_RETURN NULL
+#else
+	#error "Mist_Thread not implemented!"
+#endif
+
+static bool Mist_StartThread(Mist_Thread* thread, Mist_ThreadFunc func)
+{
+#if MIST_WIN
+	*thread = CreateThread(NULL, 0, func, NULL, 0, NULL);
+	return *thread != NULL;
+#elif MIST_UNIX
+	return pthread_create(thread, NULL, func, NULL) == 0;
+#else
+	#error "Mist_StartThread not implemented!"
+#endif
+}
+
+static void Mist_JoinThread(Mist_Thread thread)
+{
+#if MIST_WIN
+	WaitForSingleObject(thread, INFINITE);
+	CloseHandle(thread);
+#elif MIST_UNIX
+	pthread_join(thread, NULL);
+#else
+	#error "Mist_JoinThread not implemented!"
+#endif
+}
+
+static void Mist_Sleep(uint32_t milliSeconds)
+{
+#if MIST_WIN
+	Sleep(milliSeconds);
+#elif MIST_UNIX
+	struct timespec time = { (time_t)(milliSeconds / 1000), (long)(milliSeconds % 1000) * 1000000 };
+	nanosleep(&time, NULL);
+#else
+	#error "Mist_Sleep not implemented!"
+#endif
+}
+
+#if MIST_UNIX
+/* gettid and getpid are system calls, every sample asks for them. */
+MIST_THREAD_LOCAL uint16_t mist_ThreadID;
+MIST_THREAD_LOCAL bool mist_HasThreadID;
+static uint16_t mist_ProcessID;
+#endif
+
 uint16_t Mist_GetThreadID( void )
 {
 #if MIST_WIN
 	return (uint16_t)GetCurrentThreadId();
+#elif MIST_UNIX
+	if (!mist_HasThreadID)
+	{
+		mist_ThreadID = (uint16_t)syscall(SYS_gettid);
+		mist_HasThreadID = true;
+	}
+	return mist_ThreadID;
 #else
 	#error "Mist_GetThreadId not implemented!"
 #endif
@@ -231,6 +544,8 @@ uint16_t Mist_GetProcessID( void )
 {
 #if MIST_WIN
 	return (uint16_t)GetProcessId(GetCurrentProcess());
+#elif MIST_UNIX
+	return mist_ProcessID;
 #else
 	#error "Mist_GetProcessID not implemented!"
 #endif
@@ -238,27 +553,108 @@ uint16_t Mist_GetProcessID( void )
 
 /* -Timer- */
 
-int64_t Mist_TimeStamp( void )
+/* Samples only store ticks, the conversion to microseconds waits until the samples are flushed. */
+static int64_t mist_TicksPerSecond;
+static int64_t mist_TickOrigin; /* Ticks at mist_MicroSecondOrigin */
+static int64_t mist_MicroSecondOrigin;
+
+#if MIST_UNIX
+static int64_t Mist_MonotonicNanoSeconds( void )
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (int64_t)time.tv_sec * 1000000000 + (int64_t)time.tv_nsec;
+}
+
+#if MIST_TSC
+/* Only an invariant TSC ticks at a constant rate across frequency changes and sleep states. */
+static bool Mist_HasInvariantTSC( void )
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) == 0 || eax < 0x80000007)
+	{
+		return false;
+	}
+
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 8)) != 0;
+}
+
+static bool mist_UseTSC;
+#endif
+#endif
+
+static void Mist_TimerInit( void )
 {
 #if MIST_WIN
 	LARGE_INTEGER frequency;
-	BOOL queryResult = FALSE;
+	BOOL queryResult = QueryPerformanceFrequency(&frequency);
 	MIST_UNUSED(queryResult);
-
-	queryResult = QueryPerformanceFrequency(&frequency);
 	assert(queryResult == TRUE);
 
+	mist_TicksPerSecond = (int64_t)frequency.QuadPart;
+	mist_TickOrigin = 0;
+	mist_MicroSecondOrigin = 0;
+#elif MIST_UNIX
+	mist_TicksPerSecond = 1000000000;
+#if MIST_TSC
+	mist_UseTSC = Mist_HasInvariantTSC();
+	if (mist_UseTSC)
+	{
+		/* Calibrate the TSC against the monotonic clock over ~10ms. */
+		int64_t startNs = Mist_MonotonicNanoSeconds();
+		int64_t startTicks = (int64_t)__rdtsc();
+		int64_t endNs;
+		do
+		{
+			endNs = Mist_MonotonicNanoSeconds();
+		} while (endNs - startNs < 10000000);
+		int64_t endTicks = (int64_t)__rdtsc();
+
+		mist_TicksPerSecond = (int64_t)((double)(endTicks - startTicks) * 1e9 / (double)(endNs - startNs));
+		mist_TickOrigin = startTicks;
+		mist_MicroSecondOrigin = startNs / 1000;
+		return;
+	}
+#endif
+	mist_TickOrigin = 0;
+	mist_MicroSecondOrigin = 0;
+#else
+	#error "Mist_TimerInit not implemented!"
+#endif
+}
+
+int64_t Mist_TimeStamp( void )
+{
+#if MIST_WIN
 	LARGE_INTEGER time;
-	queryResult = QueryPerformanceCounter(&time);
+	BOOL queryResult = QueryPerformanceCounter(&time);
+	MIST_UNUSED(queryResult);
 	assert(queryResult == TRUE);
 
-	int64_t microSeconds = (int64_t)time.QuadPart * 1000000;
-	return microSeconds / (int64_t)frequency.QuadPart;
+	return (int64_t)time.QuadPart;
+#elif MIST_UNIX
+#if MIST_TSC
+	if (mist_UseTSC)
+	{
+		return (int64_t)__rdtsc();
+	}
+#endif
+	return Mist_MonotonicNanoSeconds();
 #else
 	#error "Mist_TimeStamp not implemented!"
 #endif
 }
 
+int64_t Mist_TicksToMicroSeconds(int64_t ticks)
+{
+	/* Split the division, ticks * 1000000 would overflow after a few days of uptime. */
+	int64_t elapsed = ticks - mist_TickOrigin;
+	int64_t seconds = elapsed / mist_TicksPerSecond;
+	int64_t remainder = elapsed - seconds * mist_TicksPerSecond;
+	return mist_MicroSecondOrigin + seconds * 1000000 + remainder * 1000000 / mist_TicksPerSecond;
+}
+
 /* -Profiler- */
 
 Mist_ProfileSample Mist_CreateProfileSample(const char* category, const char* name, int64_t timeStamp, char eventType)
@@ -270,262 +666,1431 @@ Mist_ProfileSample Mist_CreateProfileSample(const char* category, const char* na
 	sample.processorID = Mist_GetProcessID();
 	sample.threadID = Mist_GetThreadID();
 	sample.eventType = eventType;
+	sample.value = 0;
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		sample.perf[i] = -1;
+	}
+#endif
 	return sample;
 }
 
-/* Bigger buffers mean less contention for the list, but also means longer flushes and more memory usage */
-#define MIST_BUFFER_SIZE 1024
+#ifdef MIST_PROFILE_PERF_COUNTERS
+#ifndef MIST_PERF_MAX_DEPTH
+#define MIST_PERF_MAX_DEPTH 32
+#endif
 
 typedef struct
 {
-	Mist_ProfileSample samples[MIST_BUFFER_SIZE];
-	uint16_t nextSampleWrite;
-
-} Mist_ProfileBuffer;
+	bool opened;
+	int leader; /* -1 when no counter could be opened */
+	int fds[MIST_PERF_COUNTER_COUNT];
+	int8_t slots[MIST_PERF_COUNTER_COUNT]; /* Position in the group's read, -1 when the counter isn't available */
+	uint32_t slotCount;
 
-typedef struct
-{
-	Mist_ProfileBuffer buffer;
-	void* next;
+	uint32_t depth; /* Can go past MIST_PERF_MAX_DEPTH, the deeper scopes don't get counters */
+	int64_t begin[MIST_PERF_MAX_DEPTH][MIST_PERF_COUNTER_COUNT];
 
-} Mist_ProfileBufferNode;
+} Mist_PerfThread;
 
+MIST_THREAD_LOCAL Mist_PerfThread mist_PerfThread;
 
-typedef struct
+#if MIST_PERF
+static const uint32_t mist_PerfTypes[MIST_PERF_COUNTER_COUNT] = { PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HW_CACHE };
+static const uint64_t mist_PerfConfigs[MIST_PERF_COUNTER_COUNT] =
 {
-	Mist_ProfileBufferNode* first;
-	Mist_ProfileBufferNode* last;
-	uint16_t listSize;
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+};
+#endif
 
-	Mist_Lock lock;
+/* Opens the thread's counters as one group, they're read with a single system call. */
+static void Mist_PerfOpen(Mist_PerfThread* thread)
+{
+	thread->opened = true;
+	thread->leader = -1;
+	thread->slotCount = 0;
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		thread->fds[i] = -1;
+		thread->slots[i] = -1;
+	}
 
-} Mist_ProfileBufferList;
+#if MIST_PERF
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		struct perf_event_attr attributes;
+		memset(&attributes, 0, sizeof(attributes));
+		attributes.size = sizeof(attributes);
+		attributes.type = mist_PerfTypes[i];
+		attributes.config = mist_PerfConfigs[i];
+		attributes.read_format = PERF_FORMAT_GROUP;
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+
+		/* The first counter that opens leads the group */
+		int fd = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, thread->leader, 0);
+		if (fd < 0)
+		{
+			continue;
+		}
 
-Mist_ProfileBufferList mist_ProfileBufferList;
-MIST_THREAD_LOCAL Mist_ProfileBuffer mist_ProfileBuffer;
+		thread->leader = thread->leader == -1 ? fd : thread->leader;
+		thread->fds[i] = fd;
+		thread->slots[i] = (int8_t)thread->slotCount++;
+	}
+#endif
+}
 
-void Mist_ProfileInit( void )
+static void Mist_PerfClose(Mist_PerfThread* thread)
 {
-	Mist_InitLock(&mist_ProfileBufferList.lock);
+#if MIST_PERF
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		if (thread->fds[i] != -1)
+		{
+			close(thread->fds[i]);
+		}
+	}
+#endif
+	thread->opened = false;
 }
 
-/* Terminate musst be the last thing called, assure that profiling events will no longer be called once this is called */
-void Mist_ProfileTerminate( void )
+static void Mist_PerfRead(Mist_PerfThread* thread, int64_t values[MIST_PERF_COUNTER_COUNT])
 {
-	Mist_ProfileBufferNode* iter;
-	Mist_LockSection(&mist_ProfileBufferList.lock);
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		values[i] = -1;
+	}
 
-	iter = mist_ProfileBufferList.first;
-	mist_ProfileBufferList.first = NULL;
-	mist_ProfileBufferList.last = NULL;
-	mist_ProfileBufferList.listSize = 0;
+#if MIST_PERF
+	if (thread->leader == -1)
+	{
+		return;
+	}
 
-	Mist_UnlockSection(&mist_ProfileBufferList.lock);
+	/* Format: counter count, then the values in the order they were opened */
+	uint64_t group[1 + MIST_PERF_COUNTER_COUNT];
+	if (read(thread->leader, group, sizeof(uint64_t) * (1 + thread->slotCount)) != (ssize_t)(sizeof(uint64_t) * (1 + thread->slotCount)))
+	{
+		return;
+	}
 
-	Mist_TerminateLock(&mist_ProfileBufferList.lock);
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		if (thread->slots[i] != -1)
+		{
+			values[i] = (int64_t)group[1 + thread->slots[i]];
+		}
+	}
+#else
+	MIST_UNUSED(thread);
+#endif
+}
 
-	while (iter != NULL)
+/* Begins remember the counters, ends get the deltas since their begin. */
+static void Mist_PerfSample(Mist_ProfileSample* sample)
+{
+	Mist_PerfThread* thread = &mist_PerfThread;
+	if (sample->eventType == MIST_PROFILE_TYPE_BEGIN)
 	{
-		Mist_ProfileBufferNode* next = (Mist_ProfileBufferNode*)iter->next;
-		free(iter);
-		iter = next;
+		if (!thread->opened)
+		{
+			Mist_PerfOpen(thread);
+		}
+
+		if (thread->depth < MIST_PERF_MAX_DEPTH)
+		{
+			Mist_PerfRead(thread, thread->begin[thread->depth]);
+		}
+		thread->depth++;
+	}
+	else if (sample->eventType == MIST_PROFILE_TYPE_END && thread->depth > 0)
+	{
+		thread->depth--;
+		if (thread->depth < MIST_PERF_MAX_DEPTH)
+		{
+			int64_t values[MIST_PERF_COUNTER_COUNT];
+			Mist_PerfRead(thread, values);
+			for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+			{
+				int64_t begin = thread->begin[thread->depth][i];
+				sample->perf[i] = values[i] == -1 || begin == -1 ? -1 : values[i] - begin;
+			}
+		}
 	}
 }
+#endif /* MIST_PROFILE_PERF_COUNTERS */
 
-uint16_t Mist_ProfileListSize()
+Mist_ProfileSample Mist_CreateCounterSample(const char* category, const char* name, int64_t timeStamp, int64_t value)
 {
-	return mist_ProfileBufferList.listSize;
+	Mist_ProfileSample sample = Mist_CreateProfileSample(category, name, timeStamp, MIST_PROFILE_TYPE_COUNTER);
+	sample.value = value;
+	return sample;
 }
 
-/* Not thread safe */
-static void Mist_ProfileAddBufferToList(Mist_ProfileBuffer* buffer)
+/* The filters fold into mist_ActiveMask, a category's scopes are recorded while it's bit is set. */
+typedef struct
 {
-	Mist_ProfileBufferNode* node = (Mist_ProfileBufferNode*)malloc(sizeof(Mist_ProfileBufferNode));
-	memcpy(&node->buffer, buffer, sizeof(Mist_ProfileBuffer));
-	node->next = NULL;
+	const char* names[MIST_CATEGORY_MAX];
+	uint32_t count;
+	uint32_t sampleRates[MIST_CATEGORY_MAX];
+	uint64_t enabledMask;
 
-	if (mist_ProfileBufferList.first == NULL)
-	{
-		assert(mist_ProfileBufferList.last == NULL);
-		mist_ProfileBufferList.first = node;
-		mist_ProfileBufferList.last = node;
-		mist_ProfileBufferList.listSize = 1;
-	}
-	else
-	{
-		assert(mist_ProfileBufferList.listSize != UINT16_MAX);
-		assert(mist_ProfileBufferList.last->next == NULL);
+	uint64_t frameIndex;
+	uint64_t firstFrame;
+	uint64_t endFrame;
 
-		mist_ProfileBufferList.last->next = node;
-		mist_ProfileBufferList.last = node;
-		mist_ProfileBufferList.listSize++;
-	}
-}
+	Mist_Lock lock;
 
-/* Format: process Id, thread Id,  timestamp, event, category, name */
-static const char* const mist_ProfileSample = "{\"pid\":%" PRIu16 ", \"tid\":%" PRIu16 ", \"ts\":%" PRId64 ", \"ph\":\"%c\", \"cat\": \"%s\", \"name\": \"%s\", \"args\":{\"tool\":\"Mist_Profile\"}},";
+} Mist_Filters;
 
-static size_t Mist_SampleSize(Mist_ProfileSample* sample)
+Mist_Filters mist_Filters;
+uint64_t mist_ActiveMask = UINT64_MAX;
+
+/* A bit per open scope, set if it's begin was recorded */
+MIST_THREAD_LOCAL uint64_t mist_ScopeBits;
+MIST_THREAD_LOCAL uint32_t mist_SampleCountdowns[MIST_CATEGORY_MAX];
+
+/* Must hold the filter lock */
+static void Mist_UpdateActiveMask(void)
 {
-	size_t sampleSize = sizeof("{\"pid\":") - 1;
-	sampleSize += sample->processorID == 0 ? 1 : (size_t)log10f((float)sample->processorID);
-	sampleSize += sizeof(",\"tid\":") - 1;
-	sampleSize += sample->threadID == 0 ? 1 : (size_t)log10f((float)sample->threadID);
-	sampleSize += sizeof(",\"ts\":") - 1;
-	sampleSize += sample->timeStamp == 0 ? 1 : (size_t)log10((double)sample->timeStamp);
-	sampleSize += sizeof(",\"ph\":\"") - 1;
-	sampleSize += 1; /* sample char */
-	sampleSize += sizeof("\",\"cat\":\"") - 1;
-	sampleSize += strlen(sample->category);
-	sampleSize += sizeof("\", \"name\": \"") - 1;
-	sampleSize += strlen(sample->name);
-	sampleSize += sizeof("\", \"args\":{\"tool\":\"Mist_Profile\"}},") - 1;
-	return sampleSize;
+	bool capturing = mist_Filters.frameIndex >= mist_Filters.firstFrame && mist_Filters.frameIndex < mist_Filters.endFrame;
+	Mist_AtomicStoreRelaxed64(&mist_ActiveMask, capturing ? mist_Filters.enabledMask : 0);
 }
 
-static void Mist_Reverse(char* start, char* end)
+/* Must hold the filter lock. Returns MIST_CATEGORY_NONE once every index is taken */
+static uint32_t Mist_FindCategory(const char* category)
 {
-	end -= 1;
-	for (; start < end; start++, end--)
+	for (uint32_t i = 0; i < mist_Filters.count; i++)
 	{
-		char t = *start;
-		*start = *end;
-		*end = t;
+		if (strcmp(mist_Filters.names[i], category) == 0)
+		{
+			return i;
+		}
 	}
+
+	assert(mist_Filters.count < MIST_CATEGORY_MAX);
+	if (mist_Filters.count == MIST_CATEGORY_MAX)
+	{
+		return MIST_CATEGORY_NONE;
+	}
+
+	mist_Filters.names[mist_Filters.count] = category;
+	return mist_Filters.count++;
 }
 
-static void Mist_WriteU16(uint16_t val, char* writeBuffer, size_t* writePos)
+bool Mist_IsCategoryActive(uint32_t* categoryIndex, const char* category)
 {
-	size_t start = *writePos;
-	while (val >= 10)
+	uint32_t index = Mist_AtomicLoadAcquire(categoryIndex);
+	if (index == MIST_CATEGORY_UNREGISTERED)
 	{
-		// Avoid modulo for debug builds
-		uint16_t t = val / 10;
-		writeBuffer[(*writePos)++] = '0' + (char)(val - t * 10);
-		val = t;
+		Mist_LockSection(&mist_Filters.lock);
+		index = Mist_FindCategory(category);
+		Mist_UnlockSection(&mist_Filters.lock);
+		Mist_AtomicStoreRelease(categoryIndex, index);
 	}
-	writeBuffer[(*writePos)++] = '0' + (char)val;
 
-	Mist_Reverse(writeBuffer + start, writeBuffer + *writePos);
+	if (index == MIST_CATEGORY_NONE)
+	{
+		return false;
+	}
+
+	return ((Mist_AtomicLoadRelaxed64(&mist_ActiveMask) >> index) & 1) != 0;
 }
 
-static void Mist_WriteI64(int64_t val, char* writeBuffer, size_t* writePos)
+static bool Mist_IsSampled(uint32_t categoryIndex)
 {
-	size_t start = *writePos;
-	while (val >= 10)
+	uint32_t rate = Mist_AtomicLoadAcquire(&mist_Filters.sampleRates[categoryIndex]);
+	if (rate <= 1)
 	{
-		// Avoid modulo for debug builds
-		int64_t t = val / 10;
-		writeBuffer[(*writePos)++] = '0' + (char)(val - t * 10);
-		val = t;
+		return true;
 	}
-	writeBuffer[(*writePos)++] = '0' + (char)val;
 
-	Mist_Reverse(writeBuffer + start, writeBuffer + *writePos);
+	if (mist_SampleCountdowns[categoryIndex] == 0)
+	{
+		mist_SampleCountdowns[categoryIndex] = rate - 1;
+		return true;
+	}
+	mist_SampleCountdowns[categoryIndex]--;
+	return false;
 }
 
-#define MIST_MEMCPY_CONST_STR(str, writeBuffer, writePos) \
-	{ \
-		memcpy(writeBuffer + *writePos, str, sizeof(str) - 1); \
-		*writePos += sizeof(str) - 1; \
+void Mist_SetCategoryEnabled(const char* category, bool enabled)
+{
+	Mist_LockSection(&mist_Filters.lock);
+	uint32_t index = Mist_FindCategory(category);
+	if (index != MIST_CATEGORY_NONE)
+	{
+		uint64_t bit = 1ull << index;
+		mist_Filters.enabledMask = enabled ? mist_Filters.enabledMask | bit : mist_Filters.enabledMask & ~bit;
+		Mist_UpdateActiveMask();
 	}
+	Mist_UnlockSection(&mist_Filters.lock);
+}
 
-static void Mist_WriteSample(Mist_ProfileSample* sample, char* writeBuffer, size_t* writePos)
+void Mist_SetAllCategoriesEnabled(bool enabled)
 {
-	MIST_MEMCPY_CONST_STR("{\"pid\":", writeBuffer, writePos);
-	Mist_WriteU16(sample->processorID, writeBuffer, writePos);
-	MIST_MEMCPY_CONST_STR(",\"tid\":", writeBuffer, writePos);
-	Mist_WriteU16(sample->threadID, writeBuffer, writePos);
-	MIST_MEMCPY_CONST_STR(",\"ts\":", writeBuffer, writePos);
-	Mist_WriteI64(sample->timeStamp, writeBuffer, writePos);
+	Mist_LockSection(&mist_Filters.lock);
+	mist_Filters.enabledMask = enabled ? UINT64_MAX : 0;
+	Mist_UpdateActiveMask();
+	Mist_UnlockSection(&mist_Filters.lock);
+}
+
+void Mist_SetCategorySampleRate(const char* category, uint32_t rate)
+{
+	Mist_LockSection(&mist_Filters.lock);
+	uint32_t index = Mist_FindCategory(category);
+	if (index != MIST_CATEGORY_NONE)
+	{
+		Mist_AtomicStoreRelease(&mist_Filters.sampleRates[index], rate);
+	}
+	Mist_UnlockSection(&mist_Filters.lock);
+}
+
+void Mist_SetCaptureWindow(uint64_t firstFrame, uint64_t endFrame)
+{
+	Mist_LockSection(&mist_Filters.lock);
+	mist_Filters.firstFrame = firstFrame;
+	mist_Filters.endFrame = endFrame;
+	Mist_UpdateActiveMask();
+	Mist_UnlockSection(&mist_Filters.lock);
+}
+
+uint64_t Mist_FrameIndex(void)
+{
+	return Mist_AtomicLoadRelaxed64(&mist_Filters.frameIndex);
+}
+
+/* Every thread writes to it's own ring, the flusher drains them. Bigger rings drop less samples when the flusher falls behind
+   but use more memory, MIST_RING_SIZE * sizeof(Mist_ProfileSample) per thread. Must be a power of 2. */
+#ifndef MIST_RING_SIZE
+#define MIST_RING_SIZE 4096
+#endif
+
+#if (MIST_RING_SIZE & (MIST_RING_SIZE - 1)) != 0
+	#error "MIST_RING_SIZE must be a power of 2!"
+#endif
+
+/* Size of the chunks the flusher thread formats before writing them to the file. */
+#ifndef MIST_FLUSH_CHUNK_SIZE
+#define MIST_FLUSH_CHUNK_SIZE (64 * 1024)
+#endif
+
+#ifdef MIST_PROFILE_STATS
+#ifndef MIST_STATS_MAX_DEPTH
+#define MIST_STATS_MAX_DEPTH 32
+#endif
+
+typedef struct
+{
+	const char* category;
+	const char* name;
+	int64_t begin;
+
+} Mist_OpenScope;
+
+/* Log-linear histogram: 8 buckets per power of 2 keep the percentiles within ~6%, up to 2^48 ticks. */
+#define MIST_STATS_SUB_BUCKET_BITS 3
+#define MIST_STATS_MAX_EXPONENT 48
+#define MIST_STATS_BUCKET_COUNT ((MIST_STATS_MAX_EXPONENT - MIST_STATS_SUB_BUCKET_BITS + 1) << MIST_STATS_SUB_BUCKET_BITS)
+
+typedef struct
+{
+	uint32_t buckets[MIST_STATS_BUCKET_COUNT];
+	uint64_t count;
+	uint64_t totalTicks;
+	uint64_t minTicks;
+	uint64_t maxTicks;
+
+} Mist_Histogram;
+
+typedef struct
+{
+	const char* category; /* NULL for an empty slot */
+	const char* name;
+	uint16_t threadID;
+	Mist_Histogram histogram;
+
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	uint64_t perfTotals[MIST_PERF_COUNTER_COUNT];
+	uint64_t perfCounts[MIST_PERF_COUNTER_COUNT];
+#endif
+
+} Mist_ScopeEntry;
+
+/* Only touched by the consumer, under the list lock */
+typedef struct
+{
+	Mist_ScopeEntry* entries;
+	uint32_t capacity; /* Power of 2 */
+	uint32_t count;
+	int64_t lastFrame;
+
+	FILE* summaryFile;
+	uint32_t summaryIntervalMs;
+	bool summaryJson;
+	int64_t lastSummary;
+
+} Mist_Stats;
+
+Mist_Stats mist_Stats;
+#endif
+
+typedef struct Mist_ProfileRing
+{
+	/* Written by the producer, the samples keep them away from the consumer's cache line */
+	uint32_t head;
+	uint32_t cachedTail;
+	uint32_t dropped; /* Samples that didn't fit, the producer never waits for the consumer */
+	uint32_t retired; /* The thread is done with the ring, the consumer frees it once it's drained */
+
+	Mist_ProfileSample samples[MIST_RING_SIZE];
+
+	/* Written by the consumer */
+	uint32_t tail;
+	uint32_t reportedDropped;
+	uint16_t threadID;
+	struct Mist_ProfileRing* next;
+
+#ifdef MIST_PROFILE_STATS
+	Mist_OpenScope openScopes[MIST_STATS_MAX_DEPTH];
+	uint32_t openScopeCount; /* Can go past MIST_STATS_MAX_DEPTH, the deeper scopes aren't aggregated */
+	uint32_t statsDropped;
+#endif
+
+} Mist_ProfileRing;
+
+/* The lock only guards the list of rings and serializes the consumers, samples are written without it. */
+typedef struct
+{
+	Mist_ProfileRing* first;
+	uint16_t ringCount;
+
+	Mist_Lock lock;
+
+} Mist_ProfileRingList;
+
+typedef struct
+{
+	Mist_Thread thread;
+	FILE* file;
+	char* chunk;
+	uint32_t intervalMs;
+	Mist_Format format;
+	uint32_t stop;
+	bool running;
+
+} Mist_ProfileFlusher;
+
+Mist_ProfileRingList mist_ProfileRingList;
+Mist_ProfileFlusher mist_ProfileFlusher;
+MIST_THREAD_LOCAL Mist_ProfileRing* mist_ProfileRing;
+
+void Mist_ProfileInit( void )
+{
+	Mist_InitLock(&mist_ProfileRingList.lock);
+	Mist_InitLock(&mist_Filters.lock);
+	mist_Filters.enabledMask = UINT64_MAX;
+	mist_Filters.endFrame = UINT64_MAX;
+	Mist_TimerInit();
+#if MIST_UNIX
+	mist_ProcessID = (uint16_t)getpid();
+#endif
+}
+
+/* Terminate musst be the last thing called, assure that profiling events will no longer be called once this is called */
+void Mist_ProfileTerminate( void )
+{
+	Mist_StopFlushThread();
+
+	Mist_ProfileRing* iter;
+	Mist_LockSection(&mist_ProfileRingList.lock);
+
+	iter = mist_ProfileRingList.first;
+	mist_ProfileRingList.first = NULL;
+	mist_ProfileRingList.ringCount = 0;
+
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+
+	Mist_TerminateLock(&mist_ProfileRingList.lock);
+	Mist_TerminateLock(&mist_Filters.lock);
+
+	while (iter != NULL)
+	{
+		Mist_ProfileRing* next = iter->next;
+		free(iter);
+		iter = next;
+	}
+	mist_ProfileRing = NULL;
+
+#ifdef MIST_PROFILE_STATS
+	free(mist_Stats.entries);
+	memset(&mist_Stats, 0, sizeof(mist_Stats));
+#endif
+}
+
+/* Number of thread rings, retired rings are counted until they're drained */
+uint16_t Mist_ProfileListSize()
+{
+	return mist_ProfileRingList.ringCount;
+}
+
+/* Thread safe, called once per thread */
+static Mist_ProfileRing* Mist_ProfileCreateRing(void)
+{
+	Mist_ProfileRing* ring = (Mist_ProfileRing*)malloc(sizeof(Mist_ProfileRing));
+	ring->head = 0;
+	ring->cachedTail = 0;
+	ring->dropped = 0;
+	ring->retired = 0;
+	ring->tail = 0;
+	ring->reportedDropped = 0;
+	ring->threadID = Mist_GetThreadID();
+#ifdef MIST_PROFILE_STATS
+	ring->openScopeCount = 0;
+	ring->statsDropped = 0;
+#endif
+
+	Mist_LockSection(&mist_ProfileRingList.lock);
+
+	assert(mist_ProfileRingList.ringCount != UINT16_MAX);
+	ring->next = mist_ProfileRingList.first;
+	mist_ProfileRingList.first = ring;
+	mist_ProfileRingList.ringCount++;
+
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+
+	mist_ProfileRing = ring;
+	return ring;
+}
+
+/* Format: process Id, thread Id,  timestamp, event, category, name. Counters replace the closing "} with ","args":{"value":%d}} */
+static const char* const mist_ProfileSample = "{\"pid\":%" PRIu16 ",\"tid\":%" PRIu16 ",\"ts\":%" PRId64 ",\"ph\":\"%c\",\"cat\":\"%s\",\"name\":\"%s\"},";
+
+static size_t Mist_DigitCount(uint64_t value)
+{
+	size_t digits = 1;
+	for (; value >= 10; value /= 10)
+	{
+		digits++;
+	}
+	return digits;
+}
+
+#ifdef MIST_PROFILE_PERF_COUNTERS
+static bool Mist_HasPerf(Mist_ProfileSample* sample)
+{
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		if (sample->perf[i] >= 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+#endif
+
+/* Exact size of Mist_WriteSample's output */
+static size_t Mist_SampleSize(Mist_ProfileSample* sample)
+{
+	size_t sampleSize = sizeof("{\"pid\":") - 1;
+	sampleSize += Mist_DigitCount(sample->processorID);
+	sampleSize += sizeof(",\"tid\":") - 1;
+	sampleSize += Mist_DigitCount(sample->threadID);
+	sampleSize += sizeof(",\"ts\":") - 1;
+	sampleSize += Mist_DigitCount((uint64_t)Mist_TicksToMicroSeconds(sample->timeStamp));
+	sampleSize += sizeof(",\"ph\":\"") - 1;
+	sampleSize += 1; /* sample char */
+	sampleSize += sizeof("\",\"cat\":\"") - 1;
+	sampleSize += Mist_JsonEscapedSize(sample->category);
+	sampleSize += sizeof("\",\"name\":\"") - 1;
+	sampleSize += Mist_JsonEscapedSize(sample->name);
+	if (sample->eventType == MIST_PROFILE_TYPE_COUNTER)
+	{
+		sampleSize += sizeof("\",\"args\":{\"value\":") - 1;
+		sampleSize += sample->value < 0 ? 1 : 0;
+		sampleSize += Mist_DigitCount(sample->value < 0 ? 0 - (uint64_t)sample->value : (uint64_t)sample->value);
+		sampleSize += sizeof("}},") - 1;
+	}
+	else
+	{
+#ifdef MIST_PROFILE_PERF_COUNTERS
+		if (Mist_HasPerf(sample))
+		{
+			sampleSize += sizeof("\",\"args\":{") - 1;
+			for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+			{
+				if (sample->perf[i] >= 0)
+				{
+					sampleSize += strlen(mist_PerfCounterNames[i]) + sizeof("\"\":,") - 1 + Mist_DigitCount((uint64_t)sample->perf[i]);
+				}
+			}
+			sampleSize += sizeof("}},") - 1;
+			return sampleSize;
+		}
+#endif
+		sampleSize += sizeof("\"},") - 1;
+	}
+	return sampleSize;
+}
+
+static void Mist_Reverse(char* start, char* end)
+{
+	end -= 1;
+	for (; start < end; start++, end--)
+	{
+		char t = *start;
+		*start = *end;
+		*end = t;
+	}
+}
+
+static void Mist_WriteU16(uint16_t val, char* writeBuffer, size_t* writePos)
+{
+	size_t start = *writePos;
+	while (val >= 10)
+	{
+		// Avoid modulo for debug builds
+		uint16_t t = val / 10;
+		writeBuffer[(*writePos)++] = '0' + (char)(val - t * 10);
+		val = t;
+	}
+	writeBuffer[(*writePos)++] = '0' + (char)val;
+
+	Mist_Reverse(writeBuffer + start, writeBuffer + *writePos);
+}
+
+static void Mist_WriteI64(int64_t val, char* writeBuffer, size_t* writePos)
+{
+	size_t start = *writePos;
+	while (val >= 10)
+	{
+		// Avoid modulo for debug builds
+		int64_t t = val / 10;
+		writeBuffer[(*writePos)++] = '0' + (char)(val - t * 10);
+		val = t;
+	}
+	writeBuffer[(*writePos)++] = '0' + (char)val;
+
+	Mist_Reverse(writeBuffer + start, writeBuffer + *writePos);
+}
+
+#define MIST_MEMCPY_CONST_STR(str, writeBuffer, writePos) \
+	{ \
+		memcpy(writeBuffer + *writePos, str, sizeof(str) - 1); \
+		*writePos += sizeof(str) - 1; \
+	}
+
+static void Mist_WriteJsonString(const char* string, char* writeBuffer, size_t* writePos)
+{
+	for (; *string != '\0'; string++)
+	{
+		*writePos += Mist_JsonEscapeChar(*string, writeBuffer + *writePos);
+	}
+}
+
+static void Mist_WriteSample(Mist_ProfileSample* sample, char* writeBuffer, size_t* writePos)
+{
+	MIST_MEMCPY_CONST_STR("{\"pid\":", writeBuffer, writePos);
+	Mist_WriteU16(sample->processorID, writeBuffer, writePos);
+	MIST_MEMCPY_CONST_STR(",\"tid\":", writeBuffer, writePos);
+	Mist_WriteU16(sample->threadID, writeBuffer, writePos);
+	MIST_MEMCPY_CONST_STR(",\"ts\":", writeBuffer, writePos);
+	Mist_WriteI64(Mist_TicksToMicroSeconds(sample->timeStamp), writeBuffer, writePos);
 	MIST_MEMCPY_CONST_STR(",\"ph\":\"", writeBuffer, writePos);
 	writeBuffer[(*writePos)++] = sample->eventType;
 	MIST_MEMCPY_CONST_STR("\",\"cat\":\"", writeBuffer, writePos);
-	size_t strSize = strlen(sample->category);
-	memcpy(writeBuffer + (*writePos), sample->category, strSize);
-	(*writePos) += strSize;
+	Mist_WriteJsonString(sample->category, writeBuffer, writePos);
 	MIST_MEMCPY_CONST_STR("\",\"name\":\"", writeBuffer, writePos);
-	strSize = strlen(sample->name);
-	memcpy(writeBuffer + (*writePos), sample->name, strSize);
-	(*writePos) += strSize;
-	MIST_MEMCPY_CONST_STR("\",\"args\":{\"tool\":\"Mist_Profile\"}},", writeBuffer, writePos);
+	Mist_WriteJsonString(sample->name, writeBuffer, writePos);
+	if (sample->eventType == MIST_PROFILE_TYPE_COUNTER)
+	{
+		MIST_MEMCPY_CONST_STR("\",\"args\":{\"value\":", writeBuffer, writePos);
+		if (sample->value < 0)
+		{
+			writeBuffer[(*writePos)++] = '-';
+		}
+		Mist_WriteI64(sample->value < 0 ? -sample->value : sample->value, writeBuffer, writePos);
+		MIST_MEMCPY_CONST_STR("}},", writeBuffer, writePos);
+	}
+	else
+	{
+#ifdef MIST_PROFILE_PERF_COUNTERS
+		if (Mist_HasPerf(sample))
+		{
+			MIST_MEMCPY_CONST_STR("\",\"args\":{", writeBuffer, writePos);
+			bool first = true;
+			for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+			{
+				if (sample->perf[i] < 0)
+				{
+					continue;
+				}
+
+				if (!first)
+				{
+					writeBuffer[(*writePos)++] = ',';
+				}
+				writeBuffer[(*writePos)++] = '"';
+				size_t nameSize = strlen(mist_PerfCounterNames[i]);
+				memcpy(writeBuffer + *writePos, mist_PerfCounterNames[i], nameSize);
+				*writePos += nameSize;
+				writeBuffer[(*writePos)++] = '"';
+				writeBuffer[(*writePos)++] = ':';
+				Mist_WriteI64(sample->perf[i], writeBuffer, writePos);
+				first = false;
+			}
+			MIST_MEMCPY_CONST_STR("}},", writeBuffer, writePos);
+			return;
+		}
+#endif
+		MIST_MEMCPY_CONST_STR("\"},", writeBuffer, writePos);
+	}
+}
+
+/* Only the flusher writes binary traces, the interned strings live as long as it's file. */
+typedef struct
+{
+	const char* string;
+	uint32_t id;
+
+} Mist_InternedString;
+
+typedef struct
+{
+	Mist_InternedString* strings;
+	uint32_t capacity; /* Power of 2 */
+	uint32_t count;
+	int64_t previousTicks;
+	bool threadWritten; /* A thread record precedes the ring's samples in this drain */
+
+} Mist_BinaryWriter;
+
+Mist_BinaryWriter mist_BinaryWriter;
+
+/* Largest sample without it's strings: type, 2 ids, time stamp delta, value and counters */
+#define MIST_BINARY_MAX_SAMPLE_SIZE (1 + 5 + 5 + 10 + 10 + 10 * MIST_PERF_COUNTER_COUNT)
+#define MIST_BINARY_MAX_STRING_HEADER_SIZE (1 + 5 + 5)
+#define MIST_BINARY_MAX_THREAD_SIZE (1 + 3)
+
+static void Mist_WriteVarint(uint64_t value, char* writeBuffer, size_t* writePos)
+{
+	while (value >= 0x80)
+	{
+		writeBuffer[(*writePos)++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+	writeBuffer[(*writePos)++] = (char)value;
+}
+
+static uint64_t Mist_ZigZag(int64_t value)
+{
+	return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/* Returns the string's slot, it's string is NULL if it hasn't been interned yet. */
+static Mist_InternedString* Mist_FindString(const char* string)
+{
+	uint64_t hash = ((uint64_t)(uintptr_t)string >> 3) * 0x9E3779B97F4A7C15ull;
+	uint32_t mask = mist_BinaryWriter.capacity - 1;
+	for (uint32_t i = (uint32_t)(hash >> 32) & mask;; i = (i + 1) & mask)
+	{
+		Mist_InternedString* slot = &mist_BinaryWriter.strings[i];
+		if (slot->string == string || slot->string == NULL)
+		{
+			return slot;
+		}
+	}
+}
+
+static void Mist_GrowStrings(void)
+{
+	Mist_InternedString* strings = mist_BinaryWriter.strings;
+	uint32_t capacity = mist_BinaryWriter.capacity;
+
+	mist_BinaryWriter.capacity = capacity == 0 ? 256 : capacity * 2;
+	mist_BinaryWriter.strings = (Mist_InternedString*)calloc(mist_BinaryWriter.capacity, sizeof(Mist_InternedString));
+	for (uint32_t i = 0; i < capacity; i++)
+	{
+		if (strings[i].string != NULL)
+		{
+			*Mist_FindString(strings[i].string) = strings[i];
+		}
+	}
+	free(strings);
+}
+
+static size_t Mist_BinaryStringSize(const char* string)
+{
+	return Mist_FindString(string)->string == NULL ? MIST_BINARY_MAX_STRING_HEADER_SIZE + strlen(string) : 0;
+}
+
+static uint32_t Mist_WriteBinaryString(const char* string, char* writeBuffer, size_t* writePos)
+{
+	Mist_InternedString* slot = Mist_FindString(string);
+	if (slot->string != NULL)
+	{
+		return slot->id;
+	}
+
+	slot->string = string;
+	slot->id = mist_BinaryWriter.count++;
+
+	size_t length = strlen(string);
+	writeBuffer[(*writePos)++] = MIST_BINARY_RECORD_STRING;
+	Mist_WriteVarint(slot->id, writeBuffer, writePos);
+	Mist_WriteVarint(length, writeBuffer, writePos);
+	memcpy(writeBuffer + *writePos, string, length);
+	*writePos += length;
+
+	uint32_t id = slot->id;
+	/* Keep the table at most half full */
+	if (mist_BinaryWriter.count * 2 > mist_BinaryWriter.capacity)
+	{
+		Mist_GrowStrings();
+	}
+	return id;
+}
+
+/* Upper bound of Mist_WriteBinarySample's output */
+static size_t Mist_BinarySampleSize(Mist_ProfileSample* sample)
+{
+	size_t sampleSize = MIST_BINARY_MAX_SAMPLE_SIZE + Mist_BinaryStringSize(sample->category);
+	if (sample->name != sample->category)
+	{
+		sampleSize += Mist_BinaryStringSize(sample->name);
+	}
+	return mist_BinaryWriter.threadWritten ? sampleSize : sampleSize + MIST_BINARY_MAX_THREAD_SIZE;
+}
+
+static void Mist_WriteBinarySample(Mist_ProfileSample* sample, char* writeBuffer, size_t* writePos)
+{
+	if (!mist_BinaryWriter.threadWritten)
+	{
+		writeBuffer[(*writePos)++] = MIST_BINARY_RECORD_THREAD;
+		Mist_WriteVarint(sample->threadID, writeBuffer, writePos);
+		mist_BinaryWriter.previousTicks = 0;
+		mist_BinaryWriter.threadWritten = true;
+	}
+
+	uint32_t categoryID = Mist_WriteBinaryString(sample->category, writeBuffer, writePos);
+	uint32_t nameID = Mist_WriteBinaryString(sample->name, writeBuffer, writePos);
+
+	writeBuffer[(*writePos)++] = sample->eventType;
+	Mist_WriteVarint(categoryID, writeBuffer, writePos);
+	Mist_WriteVarint(nameID, writeBuffer, writePos);
+	Mist_WriteVarint(Mist_ZigZag(sample->timeStamp - mist_BinaryWriter.previousTicks), writeBuffer, writePos);
+	mist_BinaryWriter.previousTicks = sample->timeStamp;
+	if (sample->eventType == MIST_PROFILE_TYPE_COUNTER)
+	{
+		Mist_WriteVarint(Mist_ZigZag(sample->value), writeBuffer, writePos);
+	}
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	else if (sample->eventType == MIST_PROFILE_TYPE_END)
+	{
+		for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+		{
+			Mist_WriteVarint(Mist_ZigZag(sample->perf[i]), writeBuffer, writePos);
+		}
+	}
+#endif
+}
+
+static size_t Mist_FormatSampleSize(Mist_ProfileSample* sample, Mist_Format format)
+{
+	if (format == Mist_FormatNone)
+	{
+		return 0;
+	}
+	return format == Mist_FormatBinary ? Mist_BinarySampleSize(sample) : Mist_SampleSize(sample);
+}
+
+static void Mist_FormatSample(Mist_ProfileSample* sample, Mist_Format format, char* writeBuffer, size_t* writePos)
+{
+	if (format == Mist_FormatBinary)
+	{
+		Mist_WriteBinarySample(sample, writeBuffer, writePos);
+	}
+	else if (format == Mist_FormatJson)
+	{
+		Mist_WriteSample(sample, writeBuffer, writePos);
+	}
+}
+
+static const char* const mist_FrameCategory = "mist";
+static const char* const mist_FrameName = "frame";
+
+void Mist_FrameMark(void)
+{
+	Mist_LockSection(&mist_Filters.lock);
+	Mist_AtomicStoreRelaxed64(&mist_Filters.frameIndex, mist_Filters.frameIndex + 1);
+	Mist_UpdateActiveMask();
+	Mist_UnlockSection(&mist_Filters.lock);
+
+	if (Mist_AtomicLoadRelaxed64(&mist_ActiveMask) != 0)
+	{
+		Mist_WriteProfileSample(Mist_CreateProfileSample(mist_FrameCategory, mist_FrameName, Mist_TimeStamp(), MIST_PROFILE_TYPE_INSTANT));
+	}
+}
+
+#ifdef MIST_PROFILE_STATS
+
+static uint32_t Mist_HighestBit(uint64_t value)
+{
+#if MIST_MSVC
+	unsigned long index;
+	_BitScanReverse64(&index, value);
+	return (uint32_t)index;
+#elif MIST_GCC
+	return 63 - (uint32_t)__builtin_clzll(value);
+#else
+	#error "Mist_HighestBit not implemented!"
+#endif
+}
+
+static uint32_t Mist_StatsBucket(uint64_t ticks)
+{
+	if (ticks < (1 << MIST_STATS_SUB_BUCKET_BITS))
+	{
+		return (uint32_t)ticks;
+	}
+
+	uint32_t exponent = Mist_HighestBit(ticks);
+	if (exponent >= MIST_STATS_MAX_EXPONENT)
+	{
+		return MIST_STATS_BUCKET_COUNT - 1;
+	}
+
+	uint32_t subBucket = (uint32_t)(ticks >> (exponent - MIST_STATS_SUB_BUCKET_BITS)) & ((1 << MIST_STATS_SUB_BUCKET_BITS) - 1);
+	return ((exponent - MIST_STATS_SUB_BUCKET_BITS + 1) << MIST_STATS_SUB_BUCKET_BITS) + subBucket;
+}
+
+/* Middle of the bucket's range */
+static double Mist_StatsBucketValue(uint32_t bucket)
+{
+	if (bucket < (1 << MIST_STATS_SUB_BUCKET_BITS))
+	{
+		return (double)bucket;
+	}
+
+	uint32_t exponent = (bucket >> MIST_STATS_SUB_BUCKET_BITS) + MIST_STATS_SUB_BUCKET_BITS - 1;
+	uint32_t subBucket = bucket & ((1 << MIST_STATS_SUB_BUCKET_BITS) - 1);
+	double width = (double)(1ull << (exponent - MIST_STATS_SUB_BUCKET_BITS));
+	return (double)((1 << MIST_STATS_SUB_BUCKET_BITS) + subBucket) * width + width * 0.5;
+}
+
+static void Mist_HistogramAdd(Mist_Histogram* histogram, uint64_t ticks)
+{
+	histogram->buckets[Mist_StatsBucket(ticks)]++;
+	histogram->minTicks = histogram->count == 0 || ticks < histogram->minTicks ? ticks : histogram->minTicks;
+	histogram->maxTicks = ticks > histogram->maxTicks ? ticks : histogram->maxTicks;
+	histogram->totalTicks += ticks;
+	histogram->count++;
 }
 
-/* Calculates the size of the samples, allowing the memory to be allocated in one chunk */
-/* Thread safe */
-size_t Mist_ProfileStringSize(void)
+static void Mist_HistogramMerge(Mist_Histogram* histogram, Mist_Histogram* other)
 {
-	Mist_ProfileBufferNode* start;
-	/* We have to keep the lock while calculating the string size. We don't want the list to be stolen or modified while we're working. */
-	Mist_LockSection(&mist_ProfileBufferList.lock);
+	for (uint32_t i = 0; i < MIST_STATS_BUCKET_COUNT; i++)
+	{
+		histogram->buckets[i] += other->buckets[i];
+	}
+	histogram->minTicks = histogram->count == 0 || (other->count != 0 && other->minTicks < histogram->minTicks) ? other->minTicks : histogram->minTicks;
+	histogram->maxTicks = other->maxTicks > histogram->maxTicks ? other->maxTicks : histogram->maxTicks;
+	histogram->totalTicks += other->totalTicks;
+	histogram->count += other->count;
+}
 
-	start = mist_ProfileBufferList.first;
+static double Mist_HistogramPercentile(Mist_Histogram* histogram, double percentile)
+{
+	uint64_t rank = (uint64_t)(percentile * (double)histogram->count);
+	rank = rank < histogram->count ? rank : histogram->count - 1;
 
-	size_t size = 0;
-	while (start != NULL)
+	uint64_t seen = 0;
+	for (uint32_t i = 0; i < MIST_STATS_BUCKET_COUNT; i++)
 	{
-		for (uint16_t i = 0; i < start->buffer.nextSampleWrite; i++)
+		seen += histogram->buckets[i];
+		if (seen > rank)
 		{
-			Mist_ProfileSample* sample = &start->buffer.samples[i];
-			size += Mist_SampleSize(sample);
+			double value = Mist_StatsBucketValue(i);
+			value = value < (double)histogram->minTicks ? (double)histogram->minTicks : value;
+			return value > (double)histogram->maxTicks ? (double)histogram->maxTicks : value;
 		}
+	}
+	return (double)histogram->maxTicks;
+}
+
+static double Mist_TicksToMicroSecondsDuration(double ticks)
+{
+	return ticks * 1000000.0 / (double)mist_TicksPerSecond;
+}
 
-		start = (Mist_ProfileBufferNode*)start->next;
+static void Mist_HistogramToStats(Mist_Histogram* histogram, Mist_ScopeStats* stats)
+{
+	stats->count = histogram->count;
+	stats->totalUs = Mist_TicksToMicroSecondsDuration((double)histogram->totalTicks);
+	if (histogram->count == 0)
+	{
+		stats->minUs = stats->maxUs = stats->p50Us = stats->p95Us = stats->p99Us = 0.0;
+		return;
 	}
 
-	Mist_UnlockSection(&mist_ProfileBufferList.lock);
-	
-	return size + 1;
+	stats->minUs = Mist_TicksToMicroSecondsDuration((double)histogram->minTicks);
+	stats->maxUs = Mist_TicksToMicroSecondsDuration((double)histogram->maxTicks);
+	stats->p50Us = Mist_TicksToMicroSecondsDuration(Mist_HistogramPercentile(histogram, 0.50));
+	stats->p95Us = Mist_TicksToMicroSecondsDuration(Mist_HistogramPercentile(histogram, 0.95));
+	stats->p99Us = Mist_TicksToMicroSecondsDuration(Mist_HistogramPercentile(histogram, 0.99));
 }
 
-/* Returns a string to be printed, this takes time. */
-/* Thread safe */
-/* bufferSize must be at least >= Mist_SampleStringSize(...) */
-void Mist_Flush( char* buffer, size_t* bufferSize )
+static void Mist_PerfToStats(uint64_t* totals, uint64_t* counts, Mist_ScopeStats* stats)
 {
-	assert(bufferSize != NULL);
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+	{
+		stats->perfPerCall[i] = counts[i] == 0 ? -1.0 : (double)totals[i] / (double)counts[i];
+	}
+#else
+	MIST_UNUSED(totals);
+	MIST_UNUSED(counts);
+	MIST_UNUSED(stats);
+#endif
+}
+
+#ifdef MIST_PROFILE_PERF_COUNTERS
+#define MIST_ENTRY_PERF(entry) (entry)->perfTotals, (entry)->perfCounts
+#else
+#define MIST_ENTRY_PERF(entry) NULL, NULL
+#endif
 
-	if (*bufferSize < 4)
+/* Returns the scope's slot, it's category is NULL if the scope hasn't been seen yet. Scopes are keyed by address. */
+static Mist_ScopeEntry* Mist_FindScope(const char* category, const char* name, uint16_t threadID)
+{
+	uint64_t hash = ((uint64_t)(uintptr_t)category ^ ((uint64_t)(uintptr_t)name << 1) ^ ((uint64_t)threadID << 48)) * 0x9E3779B97F4A7C15ull;
+	uint32_t mask = mist_Stats.capacity - 1;
+	for (uint32_t i = (uint32_t)(hash >> 32) & mask;; i = (i + 1) & mask)
 	{
-		return;
+		Mist_ScopeEntry* entry = &mist_Stats.entries[i];
+		if (entry->category == NULL || (entry->category == category && entry->name == name && entry->threadID == threadID))
+		{
+			return entry;
+		}
+	}
+}
+
+static void Mist_GrowScopes(void)
+{
+	Mist_ScopeEntry* entries = mist_Stats.entries;
+	uint32_t capacity = mist_Stats.capacity;
+
+	mist_Stats.capacity = capacity == 0 ? 64 : capacity * 2;
+	mist_Stats.entries = (Mist_ScopeEntry*)calloc(mist_Stats.capacity, sizeof(Mist_ScopeEntry));
+	for (uint32_t i = 0; i < capacity; i++)
+	{
+		if (entries[i].category != NULL)
+		{
+			Mist_ScopeEntry* entry = Mist_FindScope(entries[i].category, entries[i].name, entries[i].threadID);
+			memcpy(entry, &entries[i], sizeof(Mist_ScopeEntry));
+		}
+	}
+	free(entries);
+}
+
+static Mist_ScopeEntry* Mist_StatsAdd(const char* category, const char* name, uint16_t threadID, uint64_t ticks)
+{
+	if (mist_Stats.count * 2 >= mist_Stats.capacity)
+	{
+		Mist_GrowScopes();
+	}
+
+	Mist_ScopeEntry* entry = Mist_FindScope(category, name, threadID);
+	if (entry->category == NULL)
+	{
+		entry->category = category;
+		entry->name = name;
+		entry->threadID = threadID;
+		mist_Stats.count++;
+	}
+	Mist_HistogramAdd(&entry->histogram, ticks);
+	return entry;
+}
+
+/* Matches the ring's begins and ends, called once per consumed sample. */
+static void Mist_AggregateSample(Mist_ProfileRing* ring, Mist_ProfileSample* sample)
+{
+	if (sample->eventType == MIST_PROFILE_TYPE_BEGIN)
+	{
+		if (ring->openScopeCount < MIST_STATS_MAX_DEPTH)
+		{
+			Mist_OpenScope* scope = &ring->openScopes[ring->openScopeCount];
+			scope->category = sample->category;
+			scope->name = sample->name;
+			scope->begin = sample->timeStamp;
+		}
+		ring->openScopeCount++;
+	}
+	else if (sample->eventType == MIST_PROFILE_TYPE_END)
+	{
+		if (ring->openScopeCount == 0)
+		{
+			return;
+		}
+
+		ring->openScopeCount--;
+		if (ring->openScopeCount < MIST_STATS_MAX_DEPTH)
+		{
+			Mist_OpenScope* scope = &ring->openScopes[ring->openScopeCount];
+			int64_t duration = sample->timeStamp - scope->begin;
+			Mist_ScopeEntry* entry = Mist_StatsAdd(scope->category, scope->name, ring->threadID, duration > 0 ? (uint64_t)duration : 0);
+#ifdef MIST_PROFILE_PERF_COUNTERS
+			for (uint32_t i = 0; i < MIST_PERF_COUNTER_COUNT; i++)
+			{
+				if (sample->perf[i] >= 0)
+				{
+					entry->perfTotals[i] += (uint64_t)sample->perf[i];
+					entry->perfCounts[i]++;
+				}
+			}
+#else
+			MIST_UNUSED(entry);
+#endif
+		}
+	}
+	else if (sample->eventType == MIST_PROFILE_TYPE_INSTANT && sample->name == mist_FrameName)
+	{
+		if (mist_Stats.lastFrame != 0)
+		{
+			int64_t duration = sample->timeStamp - mist_Stats.lastFrame;
+			Mist_StatsAdd(mist_FrameCategory, mist_FrameName, ring->threadID, duration > 0 ? (uint64_t)duration : 0);
+		}
+		mist_Stats.lastFrame = sample->timeStamp;
+	}
+}
+
+uint32_t Mist_QueryStats(Mist_ScopeStats* stats, uint32_t maxStats)
+{
+	Mist_LockSection(&mist_ProfileRingList.lock);
+
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < mist_Stats.capacity; i++)
+	{
+		Mist_ScopeEntry* entry = &mist_Stats.entries[i];
+		if (entry->category == NULL)
+		{
+			continue;
+		}
+
+		if (count < maxStats)
+		{
+			stats[count].category = entry->category;
+			stats[count].name = entry->name;
+			stats[count].threadID = entry->threadID;
+			Mist_HistogramToStats(&entry->histogram, &stats[count]);
+			Mist_PerfToStats(MIST_ENTRY_PERF(entry), &stats[count]);
+		}
+		count++;
+	}
+
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+	return count;
+}
+
+bool Mist_QueryScope(const char* category, const char* name, uint16_t threadID, Mist_ScopeStats* stats)
+{
+	Mist_Histogram* merged = (Mist_Histogram*)calloc(1, sizeof(Mist_Histogram));
+	bool found = false;
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	Mist_ScopeEntry perf;
+	memset(&perf, 0, sizeof(perf));
+#endif
+
+	Mist_LockSection(&mist_ProfileRingList.lock);
+	for (uint32_t i = 0; i < mist_Stats.capacity; i++)
+	{
+		Mist_ScopeEntry* entry = &mist_Stats.entries[i];
+		if (entry->category != NULL && (threadID == MIST_ANY_THREAD || entry->threadID == threadID)
+			&& strcmp(entry->category, category) == 0 && strcmp(entry->name, name) == 0)
+		{
+			Mist_HistogramMerge(merged, &entry->histogram);
+#ifdef MIST_PROFILE_PERF_COUNTERS
+			for (uint32_t p = 0; p < MIST_PERF_COUNTER_COUNT; p++)
+			{
+				perf.perfTotals[p] += entry->perfTotals[p];
+				perf.perfCounts[p] += entry->perfCounts[p];
+			}
+#endif
+			found = true;
+		}
+	}
+
+	if (found)
+	{
+		stats->category = category;
+		stats->name = name;
+		stats->threadID = threadID;
+		Mist_HistogramToStats(merged, stats);
+		Mist_PerfToStats(MIST_ENTRY_PERF(&perf), stats);
+	}
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+
+	free(merged);
+	return found;
+}
+
+void Mist_ResetStats(void)
+{
+	Mist_LockSection(&mist_ProfileRingList.lock);
+	for (uint32_t i = 0; i < mist_Stats.capacity; i++)
+	{
+		memset(&mist_Stats.entries[i].histogram, 0, sizeof(Mist_Histogram));
+#ifdef MIST_PROFILE_PERF_COUNTERS
+		memset(mist_Stats.entries[i].perfTotals, 0, sizeof(mist_Stats.entries[i].perfTotals));
+		memset(mist_Stats.entries[i].perfCounts, 0, sizeof(mist_Stats.entries[i].perfCounts));
+#endif
+	}
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+}
+
+/* Must hold the list lock */
+static void Mist_PrintStatsLocked(FILE* file, bool json)
+{
+	if (json)
+	{
+		fputs("{\"scopes\":[", file);
+	}
+	else
+	{
+		fprintf(file, "%-40s %8s %10s %12s %10s %10s %10s %10s %10s", "scope", "thread", "count", "total_ms", "min_us", "p50_us", "p95_us", "p99_us", "max_us");
+#ifdef MIST_PROFILE_PERF_COUNTERS
+		for (uint32_t p = 0; p < MIST_PERF_COUNTER_COUNT; p++)
+		{
+			fprintf(file, " %14s", mist_PerfCounterNames[p]);
+		}
+#endif
+		fputc('\n', file);
+	}
+
+	bool first = true;
+	for (uint32_t i = 0; i < mist_Stats.capacity; i++)
+	{
+		Mist_ScopeEntry* entry = &mist_Stats.entries[i];
+		if (entry->category == NULL || entry->histogram.count == 0)
+		{
+			continue;
+		}
+
+		Mist_ScopeStats stats;
+		Mist_HistogramToStats(&entry->histogram, &stats);
+		Mist_PerfToStats(MIST_ENTRY_PERF(entry), &stats);
+		if (json)
+		{
+			fprintf(file, "%s{\"cat\":\"%s\",\"name\":\"%s\",\"tid\":%u,\"count\":%" PRIu64 ",\"total_us\":%.3f,\"min_us\":%.3f,\"p50_us\":%.3f,\"p95_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f",
+				first ? "" : ",", entry->category, entry->name, (unsigned int)entry->threadID, stats.count, stats.totalUs, stats.minUs, stats.p50Us, stats.p95Us, stats.p99Us, stats.maxUs);
+#ifdef MIST_PROFILE_PERF_COUNTERS
+			for (uint32_t p = 0; p < MIST_PERF_COUNTER_COUNT; p++)
+			{
+				if (stats.perfPerCall[p] >= 0.0)
+				{
+					fprintf(file, ",\"%s_per_call\":%.1f", mist_PerfCounterNames[p], stats.perfPerCall[p]);
+				}
+			}
+#endif
+			fputc('}', file);
+		}
+		else
+		{
+			char scope[128];
+			snprintf(scope, sizeof(scope), "%s/%s", entry->category, entry->name);
+			fprintf(file, "%-40s %8u %10" PRIu64 " %12.3f %10.2f %10.2f %10.2f %10.2f %10.2f",
+				scope, (unsigned int)entry->threadID, stats.count, stats.totalUs / 1000.0, stats.minUs, stats.p50Us, stats.p95Us, stats.p99Us, stats.maxUs);
+#ifdef MIST_PROFILE_PERF_COUNTERS
+			/* Means per call */
+			for (uint32_t p = 0; p < MIST_PERF_COUNTER_COUNT; p++)
+			{
+				if (stats.perfPerCall[p] >= 0.0)
+				{
+					fprintf(file, " %14.1f", stats.perfPerCall[p]);
+				}
+				else
+				{
+					fprintf(file, " %14s", "-");
+				}
+			}
+#endif
+			fputc('\n', file);
+		}
+		first = false;
+	}
+
+	fputs(json ? "]}\n" : "\n", file);
+	fflush(file);
+}
+
+void Mist_PrintStats(FILE* file, bool json)
+{
+	Mist_LockSection(&mist_ProfileRingList.lock);
+	Mist_PrintStatsLocked(file, json);
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+}
+
+void Mist_SetStatsSummary(FILE* file, uint32_t intervalMs, bool json)
+{
+	Mist_LockSection(&mist_ProfileRingList.lock);
+	mist_Stats.summaryFile = file;
+	mist_Stats.summaryIntervalMs = intervalMs;
+	mist_Stats.summaryJson = json;
+	mist_Stats.lastSummary = Mist_TimeStamp();
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+}
+
+/* Called by the flusher thread */
+static void Mist_PrintStatsSummary(void)
+{
+	Mist_LockSection(&mist_ProfileRingList.lock);
+	if (mist_Stats.summaryFile != NULL && mist_Stats.summaryIntervalMs != 0)
+	{
+		int64_t now = Mist_TimeStamp();
+		if (Mist_TicksToMicroSecondsDuration((double)(now - mist_Stats.lastSummary)) >= (double)mist_Stats.summaryIntervalMs * 1000.0)
+		{
+			Mist_PrintStatsLocked(mist_Stats.summaryFile, mist_Stats.summaryJson);
+			mist_Stats.lastSummary = now;
+		}
+	}
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+}
+#endif /* MIST_PROFILE_STATS */
+
+/* Writes the ring's samples while they fit in the buffer. Returns true once the ring is empty. */
+/* Must hold the list lock, only one consumer at a time. */
+static bool Mist_DrainRing(Mist_ProfileRing* ring, Mist_Format format, char* buffer, size_t bufferSize, size_t* writePos)
+{
+	mist_BinaryWriter.threadWritten = false;
+
+	uint32_t dropped = Mist_AtomicLoadAcquire(&ring->dropped);
+	if (dropped != ring->reportedDropped)
+	{
+		Mist_ProfileSample droppedSample = Mist_CreateCounterSample("mist", "dropped_samples", Mist_TimeStamp(), (int64_t)dropped);
+		droppedSample.threadID = ring->threadID;
+		if (*writePos + Mist_FormatSampleSize(&droppedSample, format) < bufferSize)
+		{
+			Mist_FormatSample(&droppedSample, format, buffer, writePos);
+			ring->reportedDropped = dropped;
+		}
+	}
+
+#ifdef MIST_PROFILE_STATS
+	if (dropped != ring->statsDropped)
+	{
+		/* The begins and ends might not match anymore */
+		ring->openScopeCount = 0;
+		ring->statsDropped = dropped;
 	}
+#endif
 
-	Mist_ProfileBufferNode* start;
-	Mist_LockSection(&mist_ProfileBufferList.lock);
+	uint32_t tail = ring->tail;
+	uint32_t head = Mist_AtomicLoadAcquire(&ring->head);
+	for (; tail != head; tail++)
+	{
+		Mist_ProfileSample* sample = &ring->samples[tail & (MIST_RING_SIZE - 1)];
+		size_t sampleSize = Mist_FormatSampleSize(sample, format);
+		if (*writePos + sampleSize >= bufferSize)
+		{
+			/* A sample that can't fit in an empty buffer is skipped, it never would. */
+			if (*writePos != 0)
+			{
+				break;
+			}
+		}
+		else
+		{
+			Mist_FormatSample(sample, format, buffer, writePos);
+		}
 
-	start = mist_ProfileBufferList.first;
-	mist_ProfileBufferList.first = NULL;
-	mist_ProfileBufferList.last = NULL;
-	mist_ProfileBufferList.listSize = 0;
+#ifdef MIST_PROFILE_STATS
+		Mist_AggregateSample(ring, sample);
+#endif
+	}
 
-	Mist_UnlockSection(&mist_ProfileBufferList.lock);
+	Mist_AtomicStoreRelease(&ring->tail, tail);
+	return tail == head;
+}
 
-	if (start == NULL)
+/* Drains every ring into the buffer and frees the drained retired rings. Returns true once all the rings are empty. */
+/* Must hold the list lock */
+static bool Mist_DrainRings(Mist_Format format, char* buffer, size_t bufferSize, size_t* writePos)
+{
+	bool empty = true;
+	Mist_ProfileRing** link = &mist_ProfileRingList.first;
+	while (*link != NULL)
 	{
-		buffer[0] = '{';
-		buffer[1] = '}';
-		buffer[2] = '\0';
+		Mist_ProfileRing* ring = *link;
+		/* Read retired first, the thread doesn't write after retiring it's ring. */
+		bool retired = Mist_AtomicLoadAcquire(&ring->retired) != 0;
+		if (!Mist_DrainRing(ring, format, buffer, bufferSize, writePos))
+		{
+			empty = false;
+		}
+		else if (retired)
+		{
+			*link = ring->next;
+			mist_ProfileRingList.ringCount--;
+			free(ring);
+			continue;
+		}
+		link = &ring->next;
 	}
+	return empty;
+}
+
+/* Calculates the size of the samples, allowing the memory to be allocated in one chunk */
+/* Thread safe */
+size_t Mist_ProfileStringSize(void)
+{
+	Mist_LockSection(&mist_ProfileRingList.lock);
 
 	size_t size = 0;
-	while (start != NULL)
+	for (Mist_ProfileRing* ring = mist_ProfileRingList.first; ring != NULL; ring = ring->next)
 	{
-		for (uint16_t i = 0; i < start->buffer.nextSampleWrite; i++)
+		uint32_t dropped = Mist_AtomicLoadAcquire(&ring->dropped);
+		if (dropped != ring->reportedDropped)
 		{
-			Mist_ProfileSample* sample = &start->buffer.samples[i];
-			Mist_WriteSample(sample, buffer, &size);
+			Mist_ProfileSample droppedSample = Mist_CreateCounterSample("mist", "dropped_samples", 0, (int64_t)dropped);
+			size += Mist_SampleSize(&droppedSample) + 20; /* The time stamp isn't known yet */
 		}
 
-		Mist_ProfileBufferNode* next = (Mist_ProfileBufferNode*)start->next;
-		free(start);
-		start = next;
+		uint32_t head = Mist_AtomicLoadAcquire(&ring->head);
+		for (uint32_t i = ring->tail; i != head; i++)
+		{
+			size += Mist_SampleSize(&ring->samples[i & (MIST_RING_SIZE - 1)]);
+		}
 	}
 
-	if (size >= *bufferSize)
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+
+	return size + 1;
+}
+
+/* Returns a string to be printed, this takes time. */
+/* Thread safe */
+/* Samples that don't fit in bufferSize stay in their ring for the next flush. */
+void Mist_Flush( char* buffer, size_t* bufferSize )
+{
+	assert(bufferSize != NULL);
+
+	if (*bufferSize < 1)
 	{
-		assert(false);
 		return;
 	}
+
+	size_t size = 0;
+	Mist_LockSection(&mist_ProfileRingList.lock);
+	Mist_DrainRings(Mist_FormatJson, buffer, *bufferSize, &size);
+	Mist_UnlockSection(&mist_ProfileRingList.lock);
+
+	assert(size < *bufferSize);
 	buffer[size] = '\0';
 	*bufferSize = size + 1;
 }
@@ -543,32 +2108,189 @@ void Mist_Free(char* buffer)
 	free(buffer);
 }
 
-/* Thread safe */
+/* Drains the rings to the file until they're empty. Only the flusher thread writes to the file. */
+static void Mist_FlushToFile(void)
+{
+	bool empty = false;
+	while (!empty)
+	{
+		size_t size = 0;
+		Mist_LockSection(&mist_ProfileRingList.lock);
+		empty = Mist_DrainRings(mist_ProfileFlusher.format, mist_ProfileFlusher.chunk, MIST_FLUSH_CHUNK_SIZE, &size);
+		Mist_UnlockSection(&mist_ProfileRingList.lock);
+
+		/* Write outside of the lock, new threads register their ring while we wait on the disk. */
+		if (mist_ProfileFlusher.file != NULL)
+		{
+			fwrite(mist_ProfileFlusher.chunk, 1, size, mist_ProfileFlusher.file);
+		}
+	}
+}
+
+static MIST_THREAD_FUNC(Mist_FlushThread)
+{
+	MIST_UNUSED(data);
+	while (Mist_AtomicLoadAcquire(&mist_ProfileFlusher.stop) == 0)
+	{
+		Mist_Sleep(mist_ProfileFlusher.intervalMs);
+		Mist_FlushToFile();
+#ifdef MIST_PROFILE_STATS
+		Mist_PrintStatsSummary();
+#endif
+	}
+	return MIST_THREAD_RETURN;
+}
+
+/* Streams the samples to a chrome://tracing json file or a binary trace from a background thread until Mist_StopFlushThread. */
+/* Memory stays bounded: the flusher only keeps one chunk and samples are dropped when a thread's ring is full. */
+/* The dropped samples show up as the "dropped_samples" counter. */
+bool Mist_StartFlushThread(const char* path, uint32_t intervalMs, Mist_Format format)
+{
+	assert(!mist_ProfileFlusher.running);
+
+	mist_ProfileFlusher.file = NULL;
+	if (format != Mist_FormatNone)
+	{
+		mist_ProfileFlusher.file = fopen(path, "wb");
+		if (mist_ProfileFlusher.file == NULL)
+		{
+			return false;
+		}
+	}
+
+	if (format == Mist_FormatBinary)
+	{
+		Mist_BinaryHeader header;
+		memset(&header, 0, sizeof(header));
+		header.magic = MIST_BINARY_MAGIC;
+		header.version = MIST_BINARY_VERSION;
+		header.ticksPerSecond = mist_TicksPerSecond;
+		header.tickOrigin = mist_TickOrigin;
+		header.microSecondOrigin = mist_MicroSecondOrigin;
+		header.processID = Mist_GetProcessID();
+#ifdef MIST_PROFILE_PERF_COUNTERS
+		header.perfCounterCount = MIST_PERF_COUNTER_COUNT;
+#endif
+		fwrite(&header, sizeof(header), 1, mist_ProfileFlusher.file);
+		Mist_GrowStrings();
+	}
+	else if (format == Mist_FormatJson)
+	{
+		fputs(mist_ProfilePreface, mist_ProfileFlusher.file);
+	}
+
+	mist_ProfileFlusher.format = format;
+	mist_ProfileFlusher.chunk = (char*)malloc(MIST_FLUSH_CHUNK_SIZE);
+	mist_ProfileFlusher.intervalMs = intervalMs;
+	mist_ProfileFlusher.stop = 0;
+	if (!Mist_StartThread(&mist_ProfileFlusher.thread, Mist_FlushThread))
+	{
+		free(mist_ProfileFlusher.chunk);
+		if (mist_ProfileFlusher.file != NULL)
+		{
+			fclose(mist_ProfileFlusher.file);
+		}
+		return false;
+	}
+
+	mist_ProfileFlusher.running = true;
+	return true;
+}
+
+/* Flushes the remaining samples and closes the file. Call Mist_FlushThreadBuffer on the other threads first. */
+void Mist_StopFlushThread(void)
+{
+	if (!mist_ProfileFlusher.running)
+	{
+		return;
+	}
+
+	Mist_AtomicStoreRelease(&mist_ProfileFlusher.stop, 1);
+	Mist_JoinThread(mist_ProfileFlusher.thread);
+
+	Mist_FlushToFile();
+	if (mist_ProfileFlusher.format == Mist_FormatBinary)
+	{
+		free(mist_BinaryWriter.strings);
+		memset(&mist_BinaryWriter, 0, sizeof(mist_BinaryWriter));
+	}
+	else if (mist_ProfileFlusher.format == Mist_FormatJson)
+	{
+		fputs(mist_ProfilePostface, mist_ProfileFlusher.file);
+	}
+
+	if (mist_ProfileFlusher.file != NULL)
+	{
+		fclose(mist_ProfileFlusher.file);
+	}
+	free(mist_ProfileFlusher.chunk);
+	mist_ProfileFlusher.running = false;
+}
+
+/* Lock free, a full ring drops the sample instead of waiting for the flusher */
 void Mist_WriteProfileSample(Mist_ProfileSample sample)
 {
-	mist_ProfileBuffer.samples[mist_ProfileBuffer.nextSampleWrite] = sample;
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	Mist_PerfSample(&sample);
+#endif
+
+	Mist_ProfileRing* ring = mist_ProfileRing;
+	if (ring == NULL)
+	{
+		ring = Mist_ProfileCreateRing();
+	}
 
-	mist_ProfileBuffer.nextSampleWrite++;
-	if (mist_ProfileBuffer.nextSampleWrite == MIST_BUFFER_SIZE)
+	uint32_t head = ring->head;
+	if (head - ring->cachedTail == MIST_RING_SIZE)
 	{
-		Mist_LockSection(&mist_ProfileBufferList.lock);
+		ring->cachedTail = Mist_AtomicLoadAcquire(&ring->tail);
+		if (head - ring->cachedTail == MIST_RING_SIZE)
+		{
+			Mist_AtomicStoreRelease(&ring->dropped, ring->dropped + 1);
+			return;
+		}
+	}
 
-		Mist_ProfileAddBufferToList(&mist_ProfileBuffer);
-		mist_ProfileBuffer.nextSampleWrite = 0;
+	ring->samples[head & (MIST_RING_SIZE - 1)] = sample;
+	Mist_AtomicStoreRelease(&ring->head, head + 1);
+}
 
-		Mist_UnlockSection(&mist_ProfileBufferList.lock);
+void Mist_ProfileBegin(uint32_t* categoryIndex, const char* category, const char* name)
+{
+	bool record = Mist_IsCategoryActive(categoryIndex, category) && Mist_IsSampled(*categoryIndex);
+	mist_ScopeBits = (mist_ScopeBits << 1) | (record ? 1 : 0);
+	if (record)
+	{
+		Mist_WriteProfileSample(Mist_CreateProfileSample(category, name, Mist_TimeStamp(), MIST_PROFILE_TYPE_BEGIN));
 	}
 }
 
-/* Thread safe */
-void Mist_FlushThreadBuffer( void )
+void Mist_ProfileEnd(const char* category, const char* name)
 {
-	Mist_LockSection(&mist_ProfileBufferList.lock);
+	bool record = (mist_ScopeBits & 1) != 0;
+	mist_ScopeBits >>= 1;
+	if (record)
+	{
+		Mist_WriteProfileSample(Mist_CreateProfileSample(category, name, Mist_TimeStamp(), MIST_PROFILE_TYPE_END));
+	}
+}
 
-	Mist_ProfileAddBufferToList(&mist_ProfileBuffer);
-	mist_ProfileBuffer.nextSampleWrite = 0;
+/* Hands the thread's ring to the consumer, call it before the thread exits. */
+/* The thread gets a new ring if it keeps writing samples. */
+void Mist_FlushThreadBuffer( void )
+{
+	if (mist_ProfileRing != NULL)
+	{
+		Mist_AtomicStoreRelease(&mist_ProfileRing->retired, 1);
+		mist_ProfileRing = NULL;
+	}
 
-	Mist_UnlockSection(&mist_ProfileBufferList.lock);
+#ifdef MIST_PROFILE_PERF_COUNTERS
+	if (mist_PerfThread.opened)
+	{
+		Mist_PerfClose(&mist_PerfThread);
+	}
+#endif
 }
 
 #endif /* MIST_PROFILE_IMPLEMENTATION */
@@ -0,0 +1,495 @@
+//
+// bench_hierarchy.c
+// @brief Headless benchmark for cranberry_hierarchy.h. No window, no GPU, runs on Linux.
+// Builds a set of tree shapes and sweeps the dirty ratio, group count, group size and thread count.
+// Times cranh_transform_locals_to_globals, adds, reads and writes and prints the results as JSON (default) or CSV.
+//
+// Build:
+// gcc -O2 -std=c11 -DCRANBERRY_SSE Source/bench_hierarchy.c -lm -lpthread -o bench_hierarchy
+//
+// Define CRANBERRY_HIERARCHY_BACKEND to benchmark one of the reference backends of cranberry_hierarchy_backends.h instead,
+// the workloads are generated from a fixed seed and are identical between builds:
+// gcc -O2 -std=c11 -DCRANBERRY_SSE -DCRANBERRY_HIERARCHY_BACKEND=cranh_backend_level_order Source/bench_hierarchy.c -lm -lpthread -o bench_level_order
+//
+// Usage:
+// bench_hierarchy [--csv] [--quick] [--shape flat|wide|deep|random|skeleton]
+//
+// ns/transform is the pass time divided by every transform of the hierarchy, not only the dirty ones.
+// GB/s counts the bytes the pass has to touch for the dirty transforms and their descendants:
+// the local and parent handle are read and the global is written. Parent globals are assumed to be in cache.
+//
+
+#define _GNU_SOURCE
+
+#ifdef CRANBERRY_HIERARCHY_BACKEND
+#define CRANBERRY_HIERARCHY_BACKENDS_IMPL
+#include "cranberry_hierarchy_backends.h"
+#else
+#define CRANBERRY_HIERARCHY_IMPL
+#include "cranberry_hierarchy.h"
+#define cranh_backend_name "groups"
+#endif // CRANBERRY_HIERARCHY_BACKEND
+#include "cranberry_math.h"
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define bench_max_thread_count 64
+#define bench_max_rep_count 64
+#define bench_chain_length 64
+#define bench_skeleton_bone_count 32
+#define bench_bytes_per_transform (sizeof(cranm_transform_t) * 2 + sizeof(cranh_handle_t))
+
+typedef enum
+{
+	bench_shape_flat,
+	bench_shape_wide,
+	bench_shape_deep,
+	bench_shape_random,
+	bench_shape_skeleton,
+	bench_shape_count
+} bench_shape_e;
+
+static const char* bench_shape_names[bench_shape_count] = { "flat", "wide", "deep", "random", "skeleton" };
+
+// Pelvis, spine, head, 2 arms with 3 fingers and 2 legs. Parents always come before their children.
+static const int bench_skeleton_parents[bench_skeleton_bone_count] =
+{
+	-1, 0, 1, 2, 3, 4, 5, // pelvis, spine x4, neck, head
+	4, 7, 8, 9, 10, 10, 10, // left clavicle, upper arm, forearm, hand, fingers
+	4, 14, 15, 16, 17, 17, 17, // right clavicle, upper arm, forearm, hand, fingers
+	0, 21, 22, 23, // left thigh, calf, foot, toe
+	0, 25, 26, 27, // right thigh, calf, foot, toe
+	6, 6, 6 // jaw, eyes
+};
+
+typedef struct
+{
+	bench_shape_e shape;
+	unsigned int groupCount;
+	unsigned int groupSize;
+} bench_tree_desc_t;
+
+typedef struct
+{
+	cranh_hierarchy_t* hierarchy;
+	cranh_handle_t* handles; // [group][transform]
+	int* parents; // Index of the parent within the group, -1 for roots
+	unsigned int* dirtyOrder; // Shuffled transforms indices of each group, the first n are written
+	uint8_t* isDirty;
+	unsigned int transformCount; // Per group
+	double addNs;
+} bench_tree_t;
+
+typedef struct
+{
+	const char* shape;
+	unsigned int groupCount;
+	unsigned int groupSize;
+	unsigned int threadCount;
+	float dirtyRatio;
+	unsigned int transformCount;
+	unsigned int recomputedCount;
+	double passNs;
+	double nsPerTransform;
+	double gbPerSecond;
+	double addNsPerTransform;
+	double readNsPerTransform;
+	double writeNsPerTransform;
+} bench_result_t;
+
+static uint64_t bench_rng_state = 0x853c49e6748fea9bULL;
+static uint32_t bench_rand(void)
+{
+	// xorshift64*
+	bench_rng_state ^= bench_rng_state >> 12;
+	bench_rng_state ^= bench_rng_state << 25;
+	bench_rng_state ^= bench_rng_state >> 27;
+	return (uint32_t)((bench_rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static float bench_randf(float min, float max)
+{
+	return ((float)bench_rand() / (float)UINT32_MAX) * (max - min) + min;
+}
+
+static double bench_now_ns(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (double)time.tv_sec * 1e9 + (double)time.tv_nsec;
+}
+
+static cranm_transform_t bench_rand_transform(void)
+{
+	cranm_vec_t axis = { .x = bench_randf(-1.0f, 1.0f),.y = bench_randf(-1.0f, 1.0f),.z = bench_randf(-1.0f, 1.0f), 0.0f };
+	return (cranm_transform_t)
+	{
+		.pos = { bench_randf(-5.0f, 5.0f), bench_randf(-5.0f, 5.0f), bench_randf(-5.0f, 5.0f), 0.0f },
+		.rot = cranm_axis_angleq(cranm_normalize3(axis), bench_randf(0.0f, 6.28f)),
+		.scale = bench_randf(0.5f, 1.5f)
+	};
+}
+
+static int bench_gen_parent(bench_shape_e shape, unsigned int index)
+{
+	switch (shape)
+	{
+	case bench_shape_flat:
+		return -1;
+	case bench_shape_wide:
+		// Like game_init, a single root with every other transform as it's child
+		return index == 0 ? -1 : 0;
+	case bench_shape_deep:
+		return index % bench_chain_length == 0 ? -1 : (int)index - 1;
+	case bench_shape_random:
+		return (index == 0 || bench_rand() % 64 == 0) ? -1 : (int)(bench_rand() % index);
+	case bench_shape_skeleton:
+	{
+		int bone = bench_skeleton_parents[index % bench_skeleton_bone_count];
+		return bone < 0 ? -1 : (int)(index - index % bench_skeleton_bone_count) + bone;
+	}
+	default:
+		return -1;
+	}
+}
+
+static bench_tree_t bench_tree_create(bench_tree_desc_t desc)
+{
+	bench_tree_t tree;
+	// Leave a transform free, a group is full when the children meet the roots.
+	tree.transformCount = desc.groupSize - 1;
+	tree.hierarchy = cranh_create(desc.groupCount, desc.groupSize);
+
+	unsigned int totalCount = tree.transformCount * desc.groupCount;
+	tree.handles = (cranh_handle_t*)malloc(sizeof(cranh_handle_t) * totalCount);
+	tree.parents = (int*)malloc(sizeof(int) * tree.transformCount);
+	tree.dirtyOrder = (unsigned int*)malloc(sizeof(unsigned int) * totalCount);
+	tree.isDirty = (uint8_t*)malloc(tree.transformCount);
+
+	// Every group has the same topology, we generate it once
+	for (unsigned int i = 0; i < tree.transformCount; ++i)
+	{
+		tree.parents[i] = bench_gen_parent(desc.shape, i);
+	}
+
+	cranm_transform_t* transforms = (cranm_transform_t*)malloc(sizeof(cranm_transform_t) * tree.transformCount);
+	for (unsigned int i = 0; i < tree.transformCount; ++i)
+	{
+		transforms[i] = bench_rand_transform();
+	}
+
+	double start = bench_now_ns();
+	for (unsigned int g = 0; g < desc.groupCount; ++g)
+	{
+		cranh_handle_t* groupHandles = tree.handles + g * tree.transformCount;
+		for (unsigned int i = 0; i < tree.transformCount; ++i)
+		{
+			groupHandles[i] = tree.parents[i] < 0 ?
+				cranh_add_to_group(tree.hierarchy, transforms[i], g) :
+				cranh_add_with_parent(tree.hierarchy, transforms[i], groupHandles[tree.parents[i]]);
+		}
+	}
+	tree.addNs = bench_now_ns() - start;
+	free(transforms);
+
+	for (unsigned int g = 0; g < desc.groupCount; ++g)
+	{
+		unsigned int* order = tree.dirtyOrder + g * tree.transformCount;
+		for (unsigned int i = 0; i < tree.transformCount; ++i)
+		{
+			order[i] = i;
+		}
+
+		for (unsigned int i = tree.transformCount - 1; i > 0; --i)
+		{
+			unsigned int swap = bench_rand() % (i + 1);
+			unsigned int t = order[i];
+			order[i] = order[swap];
+			order[swap] = t;
+		}
+
+		cranh_transform_locals_to_globals(tree.hierarchy, g);
+	}
+
+	return tree;
+}
+
+static void bench_tree_destroy(bench_tree_t* tree)
+{
+	cranh_destroy(tree->hierarchy);
+	free(tree->handles);
+	free(tree->parents);
+	free(tree->dirtyOrder);
+	free(tree->isDirty);
+}
+
+// Writes the first dirtyCount transforms of every group, returns the time spent writing.
+static double bench_dirty(bench_tree_t* tree, unsigned int groupCount, unsigned int dirtyCount)
+{
+	double start = bench_now_ns();
+	for (unsigned int g = 0; g < groupCount; ++g)
+	{
+		cranh_handle_t* groupHandles = tree->handles + g * tree->transformCount;
+		unsigned int* order = tree->dirtyOrder + g * tree->transformCount;
+		for (unsigned int i = 0; i < dirtyCount; ++i)
+		{
+			cranh_handle_t handle = groupHandles[order[i]];
+			cranh_write_local(tree->hierarchy, handle, cranh_read_local(tree->hierarchy, handle));
+		}
+	}
+	return bench_now_ns() - start;
+}
+
+// The number of transforms the pass has to recompute, the written transforms and all of their descendants.
+static unsigned int bench_count_recomputed(bench_tree_t* tree, unsigned int groupCount, unsigned int dirtyCount)
+{
+	unsigned int count = 0;
+	for (unsigned int g = 0; g < groupCount; ++g)
+	{
+		unsigned int* order = tree->dirtyOrder + g * tree->transformCount;
+		memset(tree->isDirty, 0, tree->transformCount);
+		for (unsigned int i = 0; i < dirtyCount; ++i)
+		{
+			tree->isDirty[order[i]] = 1;
+		}
+
+		for (unsigned int i = 0; i < tree->transformCount; ++i)
+		{
+			tree->isDirty[i] |= tree->parents[i] >= 0 ? tree->isDirty[tree->parents[i]] : 0;
+			count += tree->isDirty[i];
+		}
+	}
+	return count;
+}
+
+// Worker threads
+
+static pthread_barrier_t bench_start_barrier;
+static pthread_barrier_t bench_end_barrier;
+static volatile bool bench_quit = false;
+static cranh_hierarchy_t* bench_hierarchy;
+static unsigned int bench_group_count;
+static unsigned int bench_thread_count;
+
+static void* bench_worker(void* param)
+{
+	unsigned int threadIndex = (unsigned int)(uintptr_t)param;
+	while (1)
+	{
+		pthread_barrier_wait(&bench_start_barrier);
+		if (bench_quit)
+		{
+			break;
+		}
+
+		for (unsigned int g = threadIndex; g < bench_group_count; g += bench_thread_count)
+		{
+			cranh_transform_locals_to_globals(bench_hierarchy, g);
+		}
+
+		pthread_barrier_wait(&bench_end_barrier);
+	}
+	return NULL;
+}
+
+static int bench_compare_double(const void* l, const void* r)
+{
+	double ld = *(const double*)l;
+	double rd = *(const double*)r;
+	return ld < rd ? -1 : (ld > rd ? 1 : 0);
+}
+
+static void bench_print_result(bench_result_t* result, bool csv, bool first)
+{
+	if (csv)
+	{
+		printf("%s,%s,%u,%u,%u,%.3f,%u,%u,%.0f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+			cranh_backend_name, result->shape, result->groupCount, result->groupSize, result->threadCount, result->dirtyRatio,
+			result->transformCount, result->recomputedCount, result->passNs, result->nsPerTransform, result->gbPerSecond,
+			result->addNsPerTransform, result->readNsPerTransform, result->writeNsPerTransform);
+	}
+	else
+	{
+		printf("%s\n\t{\"backend\":\"%s\",\"shape\":\"%s\",\"groups\":%u,\"group_size\":%u,\"threads\":%u,\"dirty_ratio\":%.3f,"
+			"\"transforms\":%u,\"recomputed\":%u,\"pass_ns\":%.0f,\"ns_per_transform\":%.3f,\"gb_per_s\":%.3f,"
+			"\"add_ns_per_transform\":%.3f,\"read_ns_per_transform\":%.3f,\"write_ns_per_transform\":%.3f}",
+			first ? "" : ",",
+			cranh_backend_name, result->shape, result->groupCount, result->groupSize, result->threadCount, result->dirtyRatio,
+			result->transformCount, result->recomputedCount, result->passNs, result->nsPerTransform, result->gbPerSecond,
+			result->addNsPerTransform, result->readNsPerTransform, result->writeNsPerTransform);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	bool csv = false;
+	bool quick = false;
+	int onlyShape = -1;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (strcmp(argv[i], "--quick") == 0)
+		{
+			quick = true;
+		}
+		else if (strcmp(argv[i], "--shape") == 0 && i + 1 < argc)
+		{
+			++i;
+			for (int s = 0; s < bench_shape_count; ++s)
+			{
+				onlyShape = strcmp(argv[i], bench_shape_names[s]) == 0 ? s : onlyShape;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--csv] [--quick] [--shape flat|wide|deep|random|skeleton]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	const float dirtyRatios[] = { 0.0f, 0.01f, 0.1f, 0.5f, 1.0f };
+	const unsigned int groupCounts[] = { 1, 4, 16 };
+	const unsigned int groupSizes[] = { 4096, 65536 };
+	const unsigned int threadCounts[] = { 1, 2, 4, 8, 16 };
+
+	unsigned int dirtyRatioCount = sizeof(dirtyRatios) / sizeof(dirtyRatios[0]);
+	unsigned int groupCountCount = quick ? 2 : sizeof(groupCounts) / sizeof(groupCounts[0]);
+	unsigned int groupSizeCount = quick ? 1 : sizeof(groupSizes) / sizeof(groupSizes[0]);
+	unsigned int threadCountCount = sizeof(threadCounts) / sizeof(threadCounts[0]);
+	unsigned int repCount = quick ? 5 : 11;
+
+	long processorCount = sysconf(_SC_NPROCESSORS_ONLN);
+	processorCount = processorCount < 1 ? 1 : processorCount;
+
+	if (csv)
+	{
+		printf("backend,shape,groups,group_size,threads,dirty_ratio,transforms,recomputed,pass_ns,ns_per_transform,gb_per_s,"
+			"add_ns_per_transform,read_ns_per_transform,write_ns_per_transform\n");
+	}
+	else
+	{
+		printf("[");
+	}
+
+	bool first = true;
+	for (int shape = 0; shape < bench_shape_count; ++shape)
+	{
+		if (onlyShape >= 0 && shape != onlyShape)
+		{
+			continue;
+		}
+
+		for (unsigned int gc = 0; gc < groupCountCount; ++gc)
+		{
+			for (unsigned int gs = 0; gs < groupSizeCount; ++gs)
+			{
+				bench_tree_desc_t desc = { .shape = (bench_shape_e)shape, .groupCount = groupCounts[gc], .groupSize = groupSizes[gs] };
+				bench_tree_t tree = bench_tree_create(desc);
+				unsigned int totalCount = tree.transformCount * desc.groupCount;
+
+				double readStart = bench_now_ns();
+				float readSink = 0.0f;
+				for (unsigned int i = 0; i < totalCount; ++i)
+				{
+					readSink += cranh_read_global(tree.hierarchy, tree.handles[i]).pos.x;
+				}
+				double readNs = bench_now_ns() - readStart;
+				// Keep the reads alive
+				if (readSink == 12345.0f)
+				{
+					fprintf(stderr, " ");
+				}
+
+				for (unsigned int tc = 0; tc < threadCountCount; ++tc)
+				{
+					unsigned int threadCount = threadCounts[tc];
+					// More threads than groups or processors doesn't tell us anything
+					if (threadCount > desc.groupCount || threadCount > (unsigned int)processorCount || threadCount > bench_max_thread_count)
+					{
+						continue;
+					}
+
+					bench_quit = false;
+					bench_hierarchy = tree.hierarchy;
+					bench_group_count = desc.groupCount;
+					bench_thread_count = threadCount;
+					pthread_barrier_init(&bench_start_barrier, NULL, threadCount + 1);
+					pthread_barrier_init(&bench_end_barrier, NULL, threadCount + 1);
+
+					pthread_t threads[bench_max_thread_count];
+					for (unsigned int t = 0; t < threadCount; ++t)
+					{
+						pthread_create(&threads[t], NULL, bench_worker, (void*)(uintptr_t)t);
+					}
+
+					for (unsigned int d = 0; d < dirtyRatioCount; ++d)
+					{
+						unsigned int dirtyCount = (unsigned int)(dirtyRatios[d] * (float)tree.transformCount);
+						unsigned int recomputedCount = bench_count_recomputed(&tree, desc.groupCount, dirtyCount);
+
+						double writeNs = 0.0;
+						double passTimes[bench_max_rep_count];
+						for (unsigned int r = 0; r < repCount; ++r)
+						{
+							writeNs += bench_dirty(&tree, desc.groupCount, dirtyCount);
+
+							double start = bench_now_ns();
+							pthread_barrier_wait(&bench_start_barrier);
+							pthread_barrier_wait(&bench_end_barrier);
+							passTimes[r] = bench_now_ns() - start;
+						}
+						qsort(passTimes, repCount, sizeof(double), bench_compare_double);
+						double passNs = passTimes[repCount / 2];
+
+						bench_result_t result =
+						{
+							.shape = bench_shape_names[shape],
+							.groupCount = desc.groupCount,
+							.groupSize = desc.groupSize,
+							.threadCount = threadCount,
+							.dirtyRatio = dirtyRatios[d],
+							.transformCount = totalCount,
+							.recomputedCount = recomputedCount,
+							.passNs = passNs,
+							.nsPerTransform = passNs / (double)totalCount,
+							// bytes per ns is GB/s
+							.gbPerSecond = (double)recomputedCount * (double)bench_bytes_per_transform / passNs,
+							.addNsPerTransform = tree.addNs / (double)totalCount,
+							.readNsPerTransform = readNs / (double)totalCount,
+							.writeNsPerTransform = dirtyCount == 0 ? 0.0 : writeNs / ((double)dirtyCount * desc.groupCount * repCount)
+						};
+						bench_print_result(&result, csv, first);
+						first = false;
+					}
+
+					bench_quit = true;
+					pthread_barrier_wait(&bench_start_barrier);
+					for (unsigned int t = 0; t < threadCount; ++t)
+					{
+						pthread_join(threads[t], NULL);
+					}
+					pthread_barrier_destroy(&bench_start_barrier);
+					pthread_barrier_destroy(&bench_end_barrier);
+				}
+
+				bench_tree_destroy(&tree);
+			}
+		}
+	}
+
+	if (!csv)
+	{
+		printf("\n]\n");
+	}
+	return 0;
+}
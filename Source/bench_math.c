@@ -0,0 +1,482 @@
+//
+// bench_math.c
+// @brief Microbenchmark and accuracy check for the cranberry_math.h kernels.
+// Times cranm_mulq, cranm_inverse_mulq, cranm_rot3, cranm_transform and cranm_inverse_transform
+// and compares their results against a double precision reference.
+// Build it once without and once with CRANBERRY_SSE to compare both variants.
+//
+// Build:
+// gcc -O2 -std=c11 Source/bench_math.c -lm -o bench_math_scalar
+// gcc -O2 -std=c11 -DCRANBERRY_SSE Source/bench_math.c -lm -o bench_math_sse
+//
+// Usage:
+// bench_math [--csv] [--quick]
+//
+// cycles/op is measured with rdtsc on x86 and is reported as 0 elsewhere, ns/op uses the monotonic clock.
+// Vector and quaternion errors are in ULPs of the largest component of the reference result,
+// angular errors are in radians. The program returns 1 if a kernel exceeds it's error bounds.
+//
+
+#define _GNU_SOURCE
+
+#include "cranberry_math.h"
+
+#include <float.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define BENCH_HAS_RDTSC
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif // _MSC_VER
+#endif
+
+#ifdef CRANBERRY_SSE
+#define bench_variant "sse"
+#else
+#define bench_variant "scalar"
+#endif // CRANBERRY_SSE
+
+#define bench_input_count 4096
+#define bench_max_rep_count 64
+
+// Double precision reference
+
+typedef struct
+{
+	double x, y, z, w;
+} benchd_quat_t;
+
+typedef struct
+{
+	benchd_quat_t rot;
+	double x, y, z;
+	double scale;
+} benchd_transform_t;
+
+static benchd_quat_t benchd_quat(cranm_quat_t q)
+{
+	return (benchd_quat_t) { .x = q.x, .y = q.y, .z = q.z, .w = q.w };
+}
+
+static benchd_transform_t benchd_transform_from(cranm_transform_t t)
+{
+	return (benchd_transform_t) { .rot = benchd_quat(t.rot), .x = t.pos.x, .y = t.pos.y, .z = t.pos.z, .scale = t.scale };
+}
+
+static benchd_quat_t benchd_mulq(benchd_quat_t l, benchd_quat_t r)
+{
+	return (benchd_quat_t)
+	{
+		.x = l.w * r.x + l.x * r.w - l.y * r.z + l.z * r.y,
+		.y = l.w * r.y + l.x * r.z + l.y * r.w - l.z * r.x,
+		.z = l.w * r.z - l.x * r.y + l.y * r.x + l.z * r.w,
+		.w = l.w * r.w - l.x * r.x - l.y * r.y - l.z * r.z
+	};
+}
+
+static benchd_quat_t benchd_inverseq(benchd_quat_t q)
+{
+	return (benchd_quat_t) { .x = -q.x, .y = -q.y, .z = -q.z, .w = q.w };
+}
+
+// Same formula as cranm_rot3, v' = v + 2w(q x v) + 2q x (q x v).
+// The inputs are not exactly unit quaternions and r * v * r^-1 would measure that instead of the kernel.
+static benchd_quat_t benchd_rot3(benchd_quat_t v, benchd_quat_t r)
+{
+	double tx = 2.0 * (r.y * v.z - r.z * v.y);
+	double ty = 2.0 * (r.z * v.x - r.x * v.z);
+	double tz = 2.0 * (r.x * v.y - r.y * v.x);
+	return (benchd_quat_t)
+	{
+		.x = v.x + r.w * tx + (r.y * tz - r.z * ty),
+		.y = v.y + r.w * ty + (r.z * tx - r.x * tz),
+		.z = v.z + r.w * tz + (r.x * ty - r.y * tx)
+	};
+}
+
+static benchd_transform_t benchd_transform(benchd_transform_t t, benchd_transform_t by)
+{
+	benchd_quat_t pos = benchd_rot3((benchd_quat_t) { .x = t.x * by.scale, .y = t.y * by.scale, .z = t.z * by.scale }, by.rot);
+	return (benchd_transform_t)
+	{
+		.rot = benchd_mulq(t.rot, by.rot),
+		.x = pos.x + by.x, .y = pos.y + by.y, .z = pos.z + by.z,
+		.scale = t.scale * by.scale
+	};
+}
+
+static benchd_transform_t benchd_inverse_transform(benchd_transform_t t, benchd_transform_t by)
+{
+	benchd_quat_t pos = benchd_rot3((benchd_quat_t) { .x = t.x - by.x, .y = t.y - by.y, .z = t.z - by.z }, benchd_inverseq(by.rot));
+	return (benchd_transform_t)
+	{
+		.rot = benchd_mulq(t.rot, benchd_inverseq(by.rot)),
+		.x = pos.x / by.scale, .y = pos.y / by.scale, .z = pos.z / by.scale,
+		.scale = t.scale / by.scale
+	};
+}
+
+// Error metrics
+
+static double bench_ulp_error(const float* result, const double* reference, unsigned int count)
+{
+	double magnitude = 0.0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		magnitude = fmax(magnitude, fabs(reference[i]));
+	}
+
+	if (magnitude == 0.0)
+	{
+		return 0.0;
+	}
+
+	// The spacing of floats around the largest component
+	int exponent;
+	frexp(magnitude, &exponent);
+	double ulp = ldexp(1.0, exponent - FLT_MANT_DIG);
+
+	double error = 0.0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		error = fmax(error, fabs((double)result[i] - reference[i]) / ulp);
+	}
+	return error;
+}
+
+static double bench_quat_ulp_error(cranm_quat_t q, benchd_quat_t reference)
+{
+	float result[4] = { q.x, q.y, q.z, q.w };
+	double expected[4] = { reference.x, reference.y, reference.z, reference.w };
+	return bench_ulp_error(result, expected, 4);
+}
+
+static double bench_vec_ulp_error(cranm_vec_t v, double x, double y, double z)
+{
+	float result[3] = { v.x, v.y, v.z };
+	double expected[3] = { x, y, z };
+	return bench_ulp_error(result, expected, 3);
+}
+
+// The rotation angle between two quaternions, q and -q are the same rotation.
+static double bench_quat_angle_error(cranm_quat_t q, benchd_quat_t reference)
+{
+	double qLength = sqrt((double)q.x * q.x + (double)q.y * q.y + (double)q.z * q.z + (double)q.w * q.w);
+	double rLength = sqrt(reference.x * reference.x + reference.y * reference.y + reference.z * reference.z + reference.w * reference.w);
+	double dot = fabs(q.x * reference.x + q.y * reference.y + q.z * reference.z + q.w * reference.w) / (qLength * rLength);
+	return 2.0 * acos(fmin(dot, 1.0));
+}
+
+// The angle between two directions, atan2 stays accurate for tiny angles where acos does not.
+static double bench_vec_angle_error(cranm_vec_t v, double x, double y, double z)
+{
+	double cx = v.y * z - v.z * y;
+	double cy = v.z * x - v.x * z;
+	double cz = v.x * y - v.y * x;
+	double dot = v.x * x + v.y * y + v.z * z;
+	return atan2(sqrt(cx * cx + cy * cy + cz * cz), dot);
+}
+
+// Inputs
+
+static uint64_t bench_rng_state = 0x853c49e6748fea9bULL;
+static uint32_t bench_rand(void)
+{
+	// xorshift64*
+	bench_rng_state ^= bench_rng_state >> 12;
+	bench_rng_state ^= bench_rng_state << 25;
+	bench_rng_state ^= bench_rng_state >> 27;
+	return (uint32_t)((bench_rng_state * 0x2545F4914F6CDD1DULL) >> 32);
+}
+
+static float bench_randf(float min, float max)
+{
+	return ((float)bench_rand() / (float)UINT32_MAX) * (max - min) + min;
+}
+
+static double bench_now_ns(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (double)time.tv_sec * 1e9 + (double)time.tv_nsec;
+}
+
+static uint64_t bench_cycles(void)
+{
+#ifdef BENCH_HAS_RDTSC
+	return __rdtsc();
+#else
+	return 0;
+#endif // BENCH_HAS_RDTSC
+}
+
+static cranm_quat_t bench_rand_quat(void)
+{
+	cranm_vec_t axis = { .x = bench_randf(-1.0f, 1.0f),.y = bench_randf(-1.0f, 1.0f),.z = bench_randf(-1.0f, 1.0f), 0.0f };
+	return cranm_axis_angleq(cranm_normalize3(axis), bench_randf(0.0f, 6.28f));
+}
+
+static cranm_vec_t bench_rand_vec(float extent)
+{
+	return (cranm_vec_t) { bench_randf(-extent, extent), bench_randf(-extent, extent), bench_randf(-extent, extent), 0.0f };
+}
+
+static cranm_transform_t bench_rand_transform(void)
+{
+	return (cranm_transform_t)
+	{
+		.pos = bench_rand_vec(100.0f),
+		.rot = bench_rand_quat(),
+		.scale = bench_randf(0.1f, 10.0f)
+	};
+}
+
+static cranm_quat_t bench_quats[2][bench_input_count];
+static cranm_vec_t bench_vecs[bench_input_count];
+static cranm_transform_t bench_transforms[2][bench_input_count];
+
+static cranm_quat_t bench_quat_results[bench_input_count];
+static cranm_vec_t bench_vec_results[bench_input_count];
+static cranm_transform_t bench_transform_results[bench_input_count];
+
+// Kernels
+
+typedef enum
+{
+	bench_kernel_mulq,
+	bench_kernel_inverse_mulq,
+	bench_kernel_rot3,
+	bench_kernel_transform,
+	bench_kernel_inverse_transform,
+	bench_kernel_count
+} bench_kernel_e;
+
+static const char* bench_kernel_names[bench_kernel_count] = { "mulq", "inverse_mulq", "rot3", "transform", "inverse_transform" };
+
+// Error bounds, a kernel that exceeds them fails the run.
+// These leave room for FMA contraction and a different operation order, not for approximations.
+static const double bench_max_ulp[bench_kernel_count] = { 4.0, 4.0, 8.0, 16.0, 16.0 };
+static const double bench_max_angle[bench_kernel_count] = { 1e-6, 1e-6, 1e-6, 1e-6, 1e-6 };
+
+// Every kernel reads it's inputs from and writes it's outputs to memory like the hierarchy pass does.
+// Noinline keeps the compiler from hoisting the kernel out of the timing loop.
+__attribute__((noinline)) static void bench_run_kernel(bench_kernel_e kernel)
+{
+	switch (kernel)
+	{
+	case bench_kernel_mulq:
+		for (unsigned int i = 0; i < bench_input_count; ++i)
+		{
+			bench_quat_results[i] = cranm_mulq(bench_quats[0][i], bench_quats[1][i]);
+		}
+		break;
+	case bench_kernel_inverse_mulq:
+		for (unsigned int i = 0; i < bench_input_count; ++i)
+		{
+			bench_quat_results[i] = cranm_inverse_mulq(bench_quats[0][i], bench_quats[1][i]);
+		}
+		break;
+	case bench_kernel_rot3:
+		for (unsigned int i = 0; i < bench_input_count; ++i)
+		{
+			bench_vec_results[i] = cranm_rot3(bench_vecs[i], bench_quats[0][i]);
+		}
+		break;
+	case bench_kernel_transform:
+		for (unsigned int i = 0; i < bench_input_count; ++i)
+		{
+			bench_transform_results[i] = cranm_transform(bench_transforms[0][i], bench_transforms[1][i]);
+		}
+		break;
+	case bench_kernel_inverse_transform:
+		for (unsigned int i = 0; i < bench_input_count; ++i)
+		{
+			bench_transform_results[i] = cranm_inverse_transform(bench_transforms[0][i], bench_transforms[1][i]);
+		}
+		break;
+	default:
+		break;
+	}
+}
+
+typedef struct
+{
+	double maxUlp;
+	double maxAngle;
+	double meanUlp;
+} bench_error_t;
+
+static void bench_accumulate_error(bench_error_t* error, double ulp, double angle)
+{
+	error->maxUlp = fmax(error->maxUlp, ulp);
+	error->maxAngle = fmax(error->maxAngle, angle);
+	error->meanUlp += ulp / bench_input_count;
+}
+
+// Compares the results of the last run of the kernel with the double reference.
+static bench_error_t bench_measure_error(bench_kernel_e kernel)
+{
+	bench_error_t error = { 0 };
+	for (unsigned int i = 0; i < bench_input_count; ++i)
+	{
+		switch (kernel)
+		{
+		case bench_kernel_mulq:
+		{
+			benchd_quat_t reference = benchd_mulq(benchd_quat(bench_quats[0][i]), benchd_quat(bench_quats[1][i]));
+			bench_accumulate_error(&error, bench_quat_ulp_error(bench_quat_results[i], reference), bench_quat_angle_error(bench_quat_results[i], reference));
+			break;
+		}
+		case bench_kernel_inverse_mulq:
+		{
+			benchd_quat_t reference = benchd_mulq(benchd_quat(bench_quats[0][i]), benchd_inverseq(benchd_quat(bench_quats[1][i])));
+			bench_accumulate_error(&error, bench_quat_ulp_error(bench_quat_results[i], reference), bench_quat_angle_error(bench_quat_results[i], reference));
+			break;
+		}
+		case bench_kernel_rot3:
+		{
+			cranm_vec_t v = bench_vecs[i];
+			benchd_quat_t reference = benchd_rot3((benchd_quat_t) { .x = v.x, .y = v.y, .z = v.z }, benchd_quat(bench_quats[0][i]));
+			cranm_vec_t result = bench_vec_results[i];
+			bench_accumulate_error(&error, bench_vec_ulp_error(result, reference.x, reference.y, reference.z), bench_vec_angle_error(result, reference.x, reference.y, reference.z));
+			break;
+		}
+		case bench_kernel_transform:
+		case bench_kernel_inverse_transform:
+		{
+			benchd_transform_t t = benchd_transform_from(bench_transforms[0][i]);
+			benchd_transform_t by = benchd_transform_from(bench_transforms[1][i]);
+			benchd_transform_t reference = kernel == bench_kernel_transform ? benchd_transform(t, by) : benchd_inverse_transform(t, by);
+
+			cranm_transform_t result = bench_transform_results[i];
+			double ulp = fmax(bench_quat_ulp_error(result.rot, reference.rot), bench_vec_ulp_error(result.pos, reference.x, reference.y, reference.z));
+			ulp = fmax(ulp, bench_ulp_error(&result.scale, &reference.scale, 1));
+			bench_accumulate_error(&error, ulp, bench_quat_angle_error(result.rot, reference.rot));
+			break;
+		}
+		default:
+			break;
+		}
+	}
+	return error;
+}
+
+static int bench_compare_double(const void* l, const void* r)
+{
+	double ld = *(const double*)l;
+	double rd = *(const double*)r;
+	return ld < rd ? -1 : (ld > rd ? 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+	bool csv = false;
+	bool quick = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (strcmp(argv[i], "--quick") == 0)
+		{
+			quick = true;
+		}
+		else
+		{
+			fprintf(stderr, "usage: %s [--csv] [--quick]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	for (unsigned int i = 0; i < bench_input_count; ++i)
+	{
+		bench_quats[0][i] = bench_rand_quat();
+		bench_quats[1][i] = bench_rand_quat();
+		bench_vecs[i] = bench_rand_vec(100.0f);
+		bench_transforms[0][i] = bench_rand_transform();
+		bench_transforms[1][i] = bench_rand_transform();
+	}
+
+	unsigned int repCount = quick ? 5 : 31;
+	unsigned int innerCount = quick ? 16 : 64;
+
+	if (csv)
+	{
+		printf("variant,kernel,cycles_per_op,ns_per_op,mops_per_s,max_ulp,mean_ulp,max_angle_rad,pass\n");
+	}
+	else
+	{
+		printf("[");
+	}
+
+	bool allPassed = true;
+	for (int kernel = 0; kernel < bench_kernel_count; ++kernel)
+	{
+		double nsPerOp[bench_max_rep_count];
+		double cyclesPerOp[bench_max_rep_count];
+
+		// Warm up the caches and the branch predictors
+		bench_run_kernel((bench_kernel_e)kernel);
+
+		for (unsigned int r = 0; r < repCount; ++r)
+		{
+			double start = bench_now_ns();
+			uint64_t startCycles = bench_cycles();
+			for (unsigned int i = 0; i < innerCount; ++i)
+			{
+				bench_run_kernel((bench_kernel_e)kernel);
+			}
+			uint64_t cycles = bench_cycles() - startCycles;
+			double ns = bench_now_ns() - start;
+
+			nsPerOp[r] = ns / ((double)innerCount * bench_input_count);
+			cyclesPerOp[r] = (double)cycles / ((double)innerCount * bench_input_count);
+		}
+
+		qsort(nsPerOp, repCount, sizeof(double), bench_compare_double);
+		qsort(cyclesPerOp, repCount, sizeof(double), bench_compare_double);
+		double medianNs = nsPerOp[repCount / 2];
+		double medianCycles = cyclesPerOp[repCount / 2];
+
+		bench_error_t error = bench_measure_error((bench_kernel_e)kernel);
+		bool passed = error.maxUlp <= bench_max_ulp[kernel] && error.maxAngle <= bench_max_angle[kernel];
+		allPassed = allPassed && passed;
+
+		if (csv)
+		{
+			printf("%s,%s,%.2f,%.3f,%.1f,%.2f,%.3f,%.3g,%d\n",
+				bench_variant, bench_kernel_names[kernel], medianCycles, medianNs, 1e3 / medianNs,
+				error.maxUlp, error.meanUlp, error.maxAngle, passed ? 1 : 0);
+		}
+		else
+		{
+			printf("%s\n\t{\"variant\":\"%s\",\"kernel\":\"%s\",\"cycles_per_op\":%.2f,\"ns_per_op\":%.3f,\"mops_per_s\":%.1f,"
+				"\"max_ulp\":%.2f,\"mean_ulp\":%.3f,\"max_angle_rad\":%.3g,\"pass\":%s}",
+				kernel == 0 ? "" : ",",
+				bench_variant, bench_kernel_names[kernel], medianCycles, medianNs, 1e3 / medianNs,
+				error.maxUlp, error.meanUlp, error.maxAngle, passed ? "true" : "false");
+		}
+
+		if (!passed)
+		{
+			fprintf(stderr, "%s exceeds it's error bounds: %.2f ulp (max %.2f), %.3g rad (max %.3g)\n",
+				bench_kernel_names[kernel], error.maxUlp, bench_max_ulp[kernel], error.maxAngle, bench_max_angle[kernel]);
+		}
+	}
+
+	if (!csv)
+	{
+		printf("\n]\n");
+	}
+
+	return allPassed ? 0 : 1;
+}
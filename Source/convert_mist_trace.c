@@ -0,0 +1,248 @@
+//
+// convert_mist_trace.c
+// @brief Converts a binary Mist trace (Mist_StartFlushThread with Mist_FormatBinary) to chrome://tracing json.
+// The json also opens in Perfetto (ui.perfetto.dev). The trace is streamed, only the interned strings are kept in memory.
+//
+// Build:
+// gcc -O2 -std=c11 Source/convert_mist_trace.c -o convert_mist_trace
+//
+// Usage:
+// convert_mist_trace trace.mist trace.json
+//
+
+#include "3rd/Mist_Profiler.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+	char** strings; // Indexed by id
+	uint32_t stringCount;
+	uint32_t stringCapacity;
+	uint64_t sampleCount;
+} convert_state_t;
+
+static bool convert_read_varint(FILE* file, uint64_t* value)
+{
+	uint64_t result = 0;
+	for (unsigned int shift = 0; shift < 70; shift += 7)
+	{
+		int byte = getc(file);
+		if (byte == EOF)
+		{
+			return false;
+		}
+
+		result |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			*value = result;
+			return true;
+		}
+	}
+	return false;
+}
+
+static int64_t convert_unzigzag(uint64_t value)
+{
+	return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static bool convert_read_string(FILE* file, convert_state_t* state)
+{
+	uint64_t id, length;
+	if (!convert_read_varint(file, &id) || !convert_read_varint(file, &length) || id > UINT32_MAX)
+	{
+		return false;
+	}
+
+	if (id >= state->stringCapacity)
+	{
+		uint32_t capacity = state->stringCapacity == 0 ? 256 : state->stringCapacity;
+		while (capacity <= id)
+		{
+			capacity *= 2;
+		}
+		state->strings = (char**)realloc(state->strings, sizeof(char*) * capacity);
+		memset(state->strings + state->stringCapacity, 0, sizeof(char*) * (capacity - state->stringCapacity));
+		state->stringCapacity = capacity;
+	}
+
+	char* string = (char*)malloc((size_t)length + 1);
+	if (fread(string, 1, (size_t)length, file) != length)
+	{
+		free(string);
+		return false;
+	}
+	string[length] = '\0';
+
+	free(state->strings[id]);
+	state->strings[id] = string;
+	state->stringCount = (uint32_t)id + 1 > state->stringCount ? (uint32_t)id + 1 : state->stringCount;
+	return true;
+}
+
+static const char* convert_string(convert_state_t* state, uint64_t id)
+{
+	return id < state->stringCount && state->strings[id] != NULL ? state->strings[id] : "?";
+}
+
+// Escaped the same way as the json written by Mist
+static void convert_write_string(FILE* out, const char* string)
+{
+	char escape[6];
+	for (; *string != '\0'; ++string)
+	{
+		fwrite(escape, 1, Mist_JsonEscapeChar(*string, escape), out);
+	}
+}
+
+static bool convert(FILE* in, FILE* out, Mist_BinaryHeader* header, convert_state_t* state)
+{
+	double microSecondsPerTick = 1000000.0 / (double)header->ticksPerSecond;
+	uint64_t threadID = 0;
+	int64_t ticks = 0;
+
+	fputs("{\"traceEvents\":[\n", out);
+	bool first = true;
+	while (1)
+	{
+		int record = getc(in);
+		if (record == EOF)
+		{
+			break;
+		}
+
+		if (record == MIST_BINARY_RECORD_STRING)
+		{
+			if (!convert_read_string(in, state))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		if (record == MIST_BINARY_RECORD_THREAD)
+		{
+			if (!convert_read_varint(in, &threadID))
+			{
+				return false;
+			}
+			ticks = 0;
+			continue;
+		}
+
+		if (record != MIST_PROFILE_TYPE_BEGIN && record != MIST_PROFILE_TYPE_END && record != MIST_PROFILE_TYPE_INSTANT && record != MIST_PROFILE_TYPE_COUNTER)
+		{
+			fprintf(stderr, "Unknown record %d, the trace is corrupt\n", record);
+			return false;
+		}
+
+		uint64_t categoryID, nameID, delta, value = 0;
+		if (!convert_read_varint(in, &categoryID) || !convert_read_varint(in, &nameID) || !convert_read_varint(in, &delta)
+			|| (record == MIST_PROFILE_TYPE_COUNTER && !convert_read_varint(in, &value)))
+		{
+			return false;
+		}
+		ticks += convert_unzigzag(delta);
+
+		// Hardware counter deltas of the scope, -1 when the counter wasn't available
+		int64_t perf[MIST_PERF_COUNTER_COUNT];
+		bool hasPerf = false;
+		for (uint32_t i = 0; record == MIST_PROFILE_TYPE_END && i < header->perfCounterCount; ++i)
+		{
+			uint64_t perfValue;
+			if (!convert_read_varint(in, &perfValue))
+			{
+				return false;
+			}
+			perf[i] = convert_unzigzag(perfValue);
+			hasPerf = hasPerf || perf[i] >= 0;
+		}
+
+		double microSeconds = (double)(ticks - header->tickOrigin) * microSecondsPerTick + (double)header->microSecondOrigin;
+		fprintf(out, "%s{\"pid\":%" PRIu32 ",\"tid\":%" PRIu64 ",\"ts\":%.3f,\"ph\":\"%c\",\"cat\":\"",
+			first ? "" : ",\n", header->processID, threadID, microSeconds, (char)record);
+		convert_write_string(out, convert_string(state, categoryID));
+		fputs("\",\"name\":\"", out);
+		convert_write_string(out, convert_string(state, nameID));
+		if (record == MIST_PROFILE_TYPE_COUNTER)
+		{
+			fprintf(out, "\",\"args\":{\"value\":%" PRId64 "}}", convert_unzigzag(value));
+		}
+		else if (hasPerf)
+		{
+			fputs("\",\"args\":{", out);
+			bool firstArg = true;
+			for (uint32_t i = 0; i < header->perfCounterCount; ++i)
+			{
+				if (perf[i] >= 0)
+				{
+					fprintf(out, "%s\"%s\":%" PRId64, firstArg ? "" : ",", mist_PerfCounterNames[i], perf[i]);
+					firstArg = false;
+				}
+			}
+			fputs("}}", out);
+		}
+		else
+		{
+			fputs("\"}", out);
+		}
+		first = false;
+		++state->sampleCount;
+	}
+	fputs("\n]}\n", out);
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc != 3)
+	{
+		fprintf(stderr, "usage: %s trace.mist trace.json\n", argv[0]);
+		return 1;
+	}
+
+	FILE* in = fopen(argv[1], "rb");
+	Mist_BinaryHeader header;
+	if (in == NULL || fread(&header, sizeof(header), 1, in) != 1 || header.magic != MIST_BINARY_MAGIC || header.version != MIST_BINARY_VERSION || header.ticksPerSecond <= 0
+		|| header.perfCounterCount > MIST_PERF_COUNTER_COUNT)
+	{
+		fprintf(stderr, "%s isn't a binary Mist trace\n", argv[1]);
+		return 1;
+	}
+
+	FILE* out = fopen(argv[2], "wb");
+	if (out == NULL)
+	{
+		fprintf(stderr, "Failed to open %s\n", argv[2]);
+		return 1;
+	}
+
+	convert_state_t state = { 0 };
+	bool result = convert(in, out, &header, &state);
+	if (!result)
+	{
+		// Keep what was converted, a trace cut short by a crash is still useful
+		fputs("\n]}\n", out);
+		fprintf(stderr, "%s is truncated or corrupt, converted the first %" PRIu64 " samples\n", argv[1], state.sampleCount);
+	}
+	else
+	{
+		printf("%" PRIu64 " samples, %u strings\n", state.sampleCount, state.stringCount);
+	}
+
+	for (uint32_t i = 0; i < state.stringCapacity; ++i)
+	{
+		free(state.strings[i]);
+	}
+	free(state.strings);
+	fclose(in);
+	fclose(out);
+	return result ? 0 : 1;
+}
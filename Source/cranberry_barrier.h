@@ -0,0 +1,177 @@
+#ifndef __CRANBERRY_BARRIER_H
+#define __CRANBERRY_BARRIER_H
+
+#include <stdint.h>
+
+//
+// cranberry_barrier.h
+// @brief Reusable spin-then-park barrier for the dispatch/complete cycle of the worker threads.
+// Every cranb_barrier_wait blocks until threadCount threads have called it, the barrier is then immediately reusable.
+// Waiters spin on the generation with pause for a while, the frame's work is usually shorter than a wakeup, and only then park
+// in the kernel (futex on Linux, WaitOnAddress on Windows). The last thread to arrive bumps the generation and only wakes
+// the parked threads if there are any. Parking compares against the generation the thread arrived in, a release that
+// happens between the spin and the park can't be lost.
+// On Linux, define _GNU_SOURCE or _DEFAULT_SOURCE for syscall().
+//
+// Usage:
+//	cranb_barrier_t barrier;
+//	cranb_barrier_init(&barrier, workerCount + 1, cranb_default_spin_count);
+//	// Main thread, every frame:
+//	cranb_barrier_wait(&startBarrier); // Dispatch
+//	cranb_barrier_wait(&endBarrier); // Complete
+//
+
+#define cranb_default_spin_count 4096
+
+typedef struct
+{
+	uint32_t generation;
+	uint32_t remaining; // Threads that have yet to arrive in the current generation
+	uint32_t parked; // Non zero if a thread might be parked in the current generation
+	uint32_t threadCount;
+	uint32_t spinCount;
+} cranb_barrier_t;
+
+#if defined(_MSC_VER)
+#include <Windows.h>
+#include <intrin.h>
+#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#define cranb_pause() _mm_pause()
+#else
+#define cranb_pause()
+#endif
+
+static inline uint32_t cranb_load(uint32_t* value)
+{
+#if defined(_MSC_VER)
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, 0, 0);
+#else
+	return __atomic_load_n(value, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline void cranb_store(uint32_t* value, uint32_t newValue)
+{
+#if defined(_MSC_VER)
+	InterlockedExchange((volatile LONG*)value, (LONG)newValue);
+#else
+	__atomic_store_n(value, newValue, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline uint32_t cranb_exchange(uint32_t* value, uint32_t newValue)
+{
+#if defined(_MSC_VER)
+	return (uint32_t)InterlockedExchange((volatile LONG*)value, (LONG)newValue);
+#else
+	return __atomic_exchange_n(value, newValue, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline uint32_t cranb_decrement(uint32_t* value)
+{
+#if defined(_MSC_VER)
+	return (uint32_t)InterlockedDecrement((volatile LONG*)value);
+#else
+	return __atomic_sub_fetch(value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// Sleeps while *address == expected, may return spuriously.
+static inline void cranb_park(uint32_t* address, uint32_t expected)
+{
+#if defined(_MSC_VER)
+	WaitOnAddress((volatile VOID*)address, &expected, sizeof(uint32_t), INFINITE);
+#elif defined(__linux__)
+	syscall(SYS_futex, address, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+#else
+	(void)address;
+	(void)expected;
+	sched_yield();
+#endif
+}
+
+static inline void cranb_unpark_all(uint32_t* address)
+{
+#if defined(_MSC_VER)
+	WakeByAddressAll((PVOID)address);
+#elif defined(__linux__)
+	syscall(SYS_futex, address, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+#else
+	(void)address;
+#endif
+}
+
+static inline unsigned int cranb_processor_count(void)
+{
+#if defined(_MSC_VER)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (unsigned int)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (unsigned int)count : 1;
+#endif
+}
+
+static inline void cranb_barrier_init(cranb_barrier_t* barrier, uint32_t threadCount, uint32_t spinCount)
+{
+	barrier->generation = 0;
+	barrier->remaining = threadCount;
+	barrier->parked = 0;
+	barrier->threadCount = threadCount;
+	// With a single processor the thread we're waiting on can't run while we spin
+	barrier->spinCount = cranb_processor_count() > 1 ? spinCount : 0;
+}
+
+// @brief Blocks until threadCount threads have called cranb_barrier_wait.
+// Returns 1 on the thread that released the barrier, 0 on the others.
+static inline int cranb_barrier_wait(cranb_barrier_t* barrier)
+{
+	uint32_t generation = cranb_load(&barrier->generation);
+	if (cranb_decrement(&barrier->remaining) == 0)
+	{
+		// Reset before releasing, the released threads might arrive in the next generation right away
+		cranb_store(&barrier->remaining, barrier->threadCount);
+		cranb_store(&barrier->generation, generation + 1);
+		if (cranb_exchange(&barrier->parked, 0) != 0)
+		{
+			cranb_unpark_all(&barrier->generation);
+		}
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < barrier->spinCount; ++i)
+	{
+		if (cranb_load(&barrier->generation) != generation)
+		{
+			return 0;
+		}
+		cranb_pause();
+	}
+
+	while (cranb_load(&barrier->generation) == generation)
+	{
+		// Either the releaser sees parked and wakes us or we see the new generation before parking
+		cranb_store(&barrier->parked, 1);
+		if (cranb_load(&barrier->generation) != generation)
+		{
+			break;
+		}
+		cranb_park(&barrier->generation, generation);
+	}
+	return 0;
+}
+
+#endif // __CRANBERRY_BARRIER_H
@@ -0,0 +1,532 @@
+#ifndef __CRANBERRY_BROADPHASE_H
+#define __CRANBERRY_BROADPHASE_H
+
+#include "cranberry_hierarchy.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CRANBERRY_DEBUG
+#include <assert.h>
+#endif // CRANBERRY_DEBUG
+
+//
+// cranberry_broadphase.h
+// @brief Sort and sweep broadphase for a large number of entities, finds the pairs of entities whose bounds overlap.
+// The entities are sorted along x and swept, only the entities whose x intervals overlap are tested against each other.
+// A single sorted axis falls apart when a lot of entities share the same x range, a dense block of entities would test
+// thousands of candidates per entity. Entities are instead sorted by the cell of their min corner in a coarse yz grid first
+// and by x second. The sweep goes through the entity's own row of cells like a regular sort and sweep, and looks up the
+// overlapping x range of 4 of the neighbouring rows, found with a binary search within the row. Cells must be at least
+// as large as the largest bounds.
+// The sort keys are 32 bits, 8 bits of y cell, 8 bits of z cell and 16 bits of quantized x. The grid wraps around
+// every 256 cells, the entities that share a row without being neighbours are rejected by the overlap test.
+//
+// The sort order is kept between frames. Entities that barely moved are still nearly sorted, an insertion sort fixes
+// the order in a single pass. If too many entities moved, the keys are radix sorted 8 bits at a time instead, in parallel
+// over chunks of the entities. The digits that are the same for every key are skipped.
+//
+// Every step but the serial ones runs on chunks of the entities, chunks can run on different threads:
+//	cranp_gather_span // Any thread, the spans must be disjoint
+//	cranp_sort_check(chunk)
+//	cranp_sort_plan // Serial
+//	for (cranp_sort_pass_count passes)
+//		cranp_sort_histogram(chunk)
+//		cranp_sort_prefix // Serial
+//		cranp_sort_scatter(chunk)
+//		cranp_sort_next_pass // Serial
+//	cranp_sweep_prepare(chunk)
+//	cranp_sweep_begin // Serial
+//	cranp_sweep(chunk)
+// cranp_update runs all of the steps on the calling thread.
+//
+
+#define cranp_sort_pass_count 4
+#define cranp_radix_size 256
+#define cranp_grid_size 256
+#define cranp_row_count (cranp_grid_size * cranp_grid_size)
+// Quantization steps of x per cell, the 16 bits of x cover 8192 cells around the origin
+#define cranp_x_steps_per_cell 8.0f
+
+typedef struct
+{
+	float minX, minY, minZ;
+	float maxX, maxY, maxZ;
+} cranp_bounds_t;
+
+typedef struct
+{
+	uint32_t a;
+	uint32_t b;
+} cranp_pair_t;
+
+typedef struct
+{
+	uint32_t entityCount;
+	uint32_t chunkSize;
+	uint32_t chunkCount;
+	float cellSize;
+	float inverseCellSize;
+
+	// By entity, written by cranp_gather_span
+	cranp_bounds_t* bounds;
+	uint32_t* keys;
+
+	// In sorted order, kept between frames
+	uint32_t* sortedKeys;
+	uint32_t* sortedEntities;
+	uint32_t* scratchKeys;
+	uint32_t* scratchEntities;
+	cranp_bounds_t* sortedBounds;
+	uint32_t* rowStarts; // [cranp_row_count + 1] First sorted index of every row, the sweep looks up it's neighbouring rows there
+
+	uint32_t* descents; // [chunkCount] neighbours out of order, counted by cranp_sort_check
+	uint32_t* histograms; // [chunkCount][cranp_radix_size], turned into scatter offsets by cranp_sort_prefix
+	uint32_t pass;
+	bool sorted; // Set once the keys are sorted, the remaining radix steps return right away
+	bool passSkipped; // Every key has the same digit in the current pass
+
+	cranp_pair_t* pairs; // [chunkCount][chunkPairCapacity]
+	uint32_t* pairCounts; // [chunkCount] Can be larger than chunkPairCapacity, only the first chunkPairCapacity pairs are kept
+	uint32_t chunkPairCapacity;
+
+	// Stats of the last frame
+	uint32_t insertionMoves;
+	bool radixSorted;
+} cranp_broadphase_t;
+
+// @brief Creates a broadphase for entityCount entities, the entities are the indices [0, entityCount).
+// @param cellSize the size of the yz cells and the largest size of the bounds on any axis.
+// @param chunkSize the number of entities per chunk, the unit of work of the parallel steps.
+// @param chunkPairCapacity the number of pairs each chunk can report.
+// WARNING: This function allocates memory with the standard malloc. It must be released with cranp_destroy.
+static inline cranp_broadphase_t* cranp_create(uint32_t entityCount, float cellSize, uint32_t chunkSize, uint32_t chunkPairCapacity)
+{
+	cranp_broadphase_t* broadphase = (cranp_broadphase_t*)malloc(sizeof(cranp_broadphase_t));
+	broadphase->entityCount = entityCount;
+	broadphase->chunkSize = chunkSize;
+	broadphase->chunkCount = (entityCount + chunkSize - 1) / chunkSize;
+	broadphase->cellSize = cellSize;
+	broadphase->inverseCellSize = 1.0f / cellSize;
+
+	broadphase->bounds = (cranp_bounds_t*)malloc(sizeof(cranp_bounds_t) * entityCount);
+	broadphase->keys = (uint32_t*)malloc(sizeof(uint32_t) * entityCount);
+	broadphase->sortedKeys = (uint32_t*)malloc(sizeof(uint32_t) * entityCount);
+	broadphase->sortedEntities = (uint32_t*)malloc(sizeof(uint32_t) * entityCount);
+	broadphase->scratchKeys = (uint32_t*)malloc(sizeof(uint32_t) * entityCount);
+	broadphase->scratchEntities = (uint32_t*)malloc(sizeof(uint32_t) * entityCount);
+	broadphase->sortedBounds = (cranp_bounds_t*)malloc(sizeof(cranp_bounds_t) * entityCount);
+	broadphase->rowStarts = (uint32_t*)malloc(sizeof(uint32_t) * (cranp_row_count + 1));
+	broadphase->descents = (uint32_t*)malloc(sizeof(uint32_t) * broadphase->chunkCount);
+	broadphase->histograms = (uint32_t*)malloc(sizeof(uint32_t) * cranp_radix_size * broadphase->chunkCount);
+	broadphase->pairs = (cranp_pair_t*)malloc(sizeof(cranp_pair_t) * chunkPairCapacity * broadphase->chunkCount);
+	broadphase->pairCounts = (uint32_t*)malloc(sizeof(uint32_t) * broadphase->chunkCount);
+	broadphase->chunkPairCapacity = chunkPairCapacity;
+
+	for (uint32_t i = 0; i < entityCount; ++i)
+	{
+		broadphase->bounds[i] = (cranp_bounds_t) { 0 };
+		broadphase->keys[i] = 0;
+		broadphase->sortedEntities[i] = i;
+	}
+	memset(broadphase->pairCounts, 0, sizeof(uint32_t) * broadphase->chunkCount);
+	broadphase->pass = 0;
+	broadphase->sorted = true;
+	broadphase->passSkipped = false;
+	broadphase->insertionMoves = 0;
+	broadphase->radixSorted = false;
+	return broadphase;
+}
+
+static inline void cranp_destroy(cranp_broadphase_t* broadphase)
+{
+	free(broadphase->bounds);
+	free(broadphase->keys);
+	free(broadphase->sortedKeys);
+	free(broadphase->sortedEntities);
+	free(broadphase->scratchKeys);
+	free(broadphase->scratchEntities);
+	free(broadphase->sortedBounds);
+	free(broadphase->rowStarts);
+	free(broadphase->descents);
+	free(broadphase->histograms);
+	free(broadphase->pairs);
+	free(broadphase->pairCounts);
+	free(broadphase);
+}
+
+static inline uint32_t cranp_cell(cranp_broadphase_t* broadphase, float value)
+{
+	return (uint32_t)(int32_t)floorf(value * broadphase->inverseCellSize) & (cranp_grid_size - 1);
+}
+
+// Monotonic, x values that are further apart than the quantized range are clamped to it's ends.
+static inline uint32_t cranp_quantize_x(cranp_broadphase_t* broadphase, float x)
+{
+	float steps = floorf(x * broadphase->inverseCellSize * cranp_x_steps_per_cell) + 32768.0f;
+	steps = steps < 0.0f ? 0.0f : steps;
+	steps = steps > 65535.0f ? 65535.0f : steps;
+	return (uint32_t)steps;
+}
+
+static inline uint32_t cranp_row_key(uint32_t cellY, uint32_t cellZ)
+{
+	return ((cellY & (cranp_grid_size - 1)) << 24) | ((cellZ & (cranp_grid_size - 1)) << 16);
+}
+
+static inline void cranp_set_bounds(cranp_broadphase_t* broadphase, uint32_t entity, cranp_bounds_t bounds)
+{
+#ifdef CRANBERRY_DEBUG
+	assert(entity < broadphase->entityCount);
+	assert(bounds.maxX - bounds.minX <= broadphase->cellSize && bounds.maxY - bounds.minY <= broadphase->cellSize && bounds.maxZ - bounds.minZ <= broadphase->cellSize);
+#endif // CRANBERRY_DEBUG
+
+	broadphase->bounds[entity] = bounds;
+	broadphase->keys[entity] = cranp_row_key(cranp_cell(broadphase, bounds.minY), cranp_cell(broadphase, bounds.minZ)) | cranp_quantize_x(broadphase, bounds.minX);
+}
+
+// @brief Sets the bounds of the entities [entity, entity + count) from the globals of the transforms [first, first + count).
+// The bounds are a cube of radius times the global scale of the transform around it's global position.
+static inline void cranp_gather_span(cranp_broadphase_t* broadphase, cranh_hierarchy_t* hierarchy, cranh_handle_t first, uint32_t count, uint32_t entity, float radius)
+{
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		cranm_transform_t global = cranh_read_global(hierarchy, (cranh_handle_t) { .value = first.value + i });
+		float extent = fabsf(global.scale) * radius;
+		cranp_set_bounds(broadphase, entity + i, (cranp_bounds_t)
+		{
+			.minX = global.pos.x - extent, .minY = global.pos.y - extent, .minZ = global.pos.z - extent,
+			.maxX = global.pos.x + extent, .maxY = global.pos.y + extent, .maxZ = global.pos.z + extent
+		});
+	}
+}
+
+static inline uint32_t cranp_chunk_end(cranp_broadphase_t* broadphase, uint32_t chunk)
+{
+	uint32_t end = (chunk + 1) * broadphase->chunkSize;
+	return end < broadphase->entityCount ? end : broadphase->entityCount;
+}
+
+// @brief Refreshes the keys of the previous order and counts the entities that aren't sorted anymore.
+static inline void cranp_sort_check(cranp_broadphase_t* broadphase, uint32_t chunk)
+{
+	uint32_t start = chunk * broadphase->chunkSize;
+	uint32_t end = cranp_chunk_end(broadphase, chunk);
+
+	// The previous chunk is refreshing it's own keys, read the key before us from the entity
+	uint32_t previous = start > 0 ? broadphase->keys[broadphase->sortedEntities[start - 1]] : 0;
+	uint32_t descents = 0;
+	for (uint32_t i = start; i < end; ++i)
+	{
+		uint32_t key = broadphase->keys[broadphase->sortedEntities[i]];
+		broadphase->sortedKeys[i] = key;
+		descents += key < previous ? 1 : 0;
+		previous = key;
+	}
+	broadphase->descents[chunk] = descents;
+}
+
+// @brief Fixes the order with an insertion sort if the entities are nearly sorted, the radix sort is used otherwise.
+// The insertion sort gives up once it has moved more than an eighth of the entities, the radix sort then starts from where it stopped.
+static inline void cranp_sort_plan(cranp_broadphase_t* broadphase)
+{
+	uint32_t descents = 0;
+	for (uint32_t i = 0; i < broadphase->chunkCount; ++i)
+	{
+		descents += broadphase->descents[i];
+	}
+
+	broadphase->pass = 0;
+	broadphase->passSkipped = false;
+	broadphase->insertionMoves = 0;
+	broadphase->radixSorted = false;
+	broadphase->sorted = descents == 0;
+
+	uint32_t moveBudget = broadphase->entityCount / 8;
+	if (!broadphase->sorted && descents <= moveBudget)
+	{
+		uint32_t* keys = broadphase->sortedKeys;
+		uint32_t* entities = broadphase->sortedEntities;
+		uint32_t moves = 0;
+		uint32_t i = 1;
+		for (; i < broadphase->entityCount && moves <= moveBudget; ++i)
+		{
+			uint32_t key = keys[i];
+			uint32_t entity = entities[i];
+			uint32_t j = i;
+			for (; j > 0 && keys[j - 1] > key; --j)
+			{
+				keys[j] = keys[j - 1];
+				entities[j] = entities[j - 1];
+			}
+			keys[j] = key;
+			entities[j] = entity;
+			moves += i - j;
+		}
+		broadphase->insertionMoves = moves;
+		broadphase->sorted = i == broadphase->entityCount;
+	}
+	broadphase->radixSorted = !broadphase->sorted;
+}
+
+static inline void cranp_sort_histogram(cranp_broadphase_t* broadphase, uint32_t chunk)
+{
+	if (broadphase->sorted)
+	{
+		return;
+	}
+
+	uint32_t* histogram = broadphase->histograms + chunk * cranp_radix_size;
+	memset(histogram, 0, sizeof(uint32_t) * cranp_radix_size);
+
+	uint32_t shift = broadphase->pass * 8;
+	uint32_t end = cranp_chunk_end(broadphase, chunk);
+	for (uint32_t i = chunk * broadphase->chunkSize; i < end; ++i)
+	{
+		++histogram[(broadphase->sortedKeys[i] >> shift) & (cranp_radix_size - 1)];
+	}
+}
+
+// @brief Turns the histograms of the chunks into the offsets every chunk scatters it's digits to.
+static inline void cranp_sort_prefix(cranp_broadphase_t* broadphase)
+{
+	if (broadphase->sorted)
+	{
+		return;
+	}
+
+	uint32_t offset = 0;
+	broadphase->passSkipped = false;
+	for (uint32_t digit = 0; digit < cranp_radix_size; ++digit)
+	{
+		uint32_t digitStart = offset;
+		for (uint32_t chunk = 0; chunk < broadphase->chunkCount; ++chunk)
+		{
+			uint32_t* count = broadphase->histograms + chunk * cranp_radix_size + digit;
+			uint32_t chunkCount = *count;
+			*count = offset;
+			offset += chunkCount;
+		}
+		broadphase->passSkipped = broadphase->passSkipped || offset - digitStart == broadphase->entityCount;
+	}
+}
+
+static inline void cranp_sort_scatter(cranp_broadphase_t* broadphase, uint32_t chunk)
+{
+	if (broadphase->sorted || broadphase->passSkipped)
+	{
+		return;
+	}
+
+	uint32_t* offsets = broadphase->histograms + chunk * cranp_radix_size;
+	uint32_t shift = broadphase->pass * 8;
+	uint32_t end = cranp_chunk_end(broadphase, chunk);
+	for (uint32_t i = chunk * broadphase->chunkSize; i < end; ++i)
+	{
+		uint32_t key = broadphase->sortedKeys[i];
+		uint32_t destination = offsets[(key >> shift) & (cranp_radix_size - 1)]++;
+		broadphase->scratchKeys[destination] = key;
+		broadphase->scratchEntities[destination] = broadphase->sortedEntities[i];
+	}
+}
+
+static inline void cranp_sort_next_pass(cranp_broadphase_t* broadphase)
+{
+	if (broadphase->sorted)
+	{
+		return;
+	}
+
+	if (!broadphase->passSkipped)
+	{
+		uint32_t* keys = broadphase->sortedKeys;
+		broadphase->sortedKeys = broadphase->scratchKeys;
+		broadphase->scratchKeys = keys;
+
+		uint32_t* entities = broadphase->sortedEntities;
+		broadphase->sortedEntities = broadphase->scratchEntities;
+		broadphase->scratchEntities = entities;
+	}
+
+	++broadphase->pass;
+	broadphase->sorted = broadphase->pass == cranp_sort_pass_count;
+}
+
+// @brief Copies the bounds in sorted order, the sweep then reads them one after the other.
+// The rows that start in the chunk, and the empty rows before them, point to the first entity of their row.
+static inline void cranp_sweep_prepare(cranp_broadphase_t* broadphase, uint32_t chunk)
+{
+	uint32_t start = chunk * broadphase->chunkSize;
+	uint32_t end = cranp_chunk_end(broadphase, chunk);
+	uint32_t row = start > 0 ? (broadphase->sortedKeys[start - 1] >> 16) + 1 : 0;
+	for (uint32_t i = start; i < end; ++i)
+	{
+		broadphase->sortedBounds[i] = broadphase->bounds[broadphase->sortedEntities[i]];
+		for (uint32_t last = broadphase->sortedKeys[i] >> 16; row <= last; ++row)
+		{
+			broadphase->rowStarts[row] = i;
+		}
+	}
+
+	if (end == broadphase->entityCount)
+	{
+		for (; row <= cranp_row_count; ++row)
+		{
+			broadphase->rowStarts[row] = end;
+		}
+	}
+}
+
+static inline void cranp_sweep_begin(cranp_broadphase_t* broadphase)
+{
+	memset(broadphase->pairCounts, 0, sizeof(uint32_t) * broadphase->chunkCount);
+}
+
+static inline bool cranp_overlap(const cranp_bounds_t* l, const cranp_bounds_t* r)
+{
+	return l->minX <= r->maxX && r->minX <= l->maxX
+		&& l->minY <= r->maxY && r->minY <= l->maxY
+		&& l->minZ <= r->maxZ && r->minZ <= l->maxZ;
+}
+
+// First index whose key isn't less than key.
+static inline uint32_t cranp_lower_bound(const uint32_t* keys, uint32_t count, uint32_t key)
+{
+	uint32_t first = 0;
+	while (count > 0)
+	{
+		uint32_t half = count / 2;
+		if (keys[first + half] < key)
+		{
+			first += half + 1;
+			count -= half + 1;
+		}
+		else
+		{
+			count = half;
+		}
+	}
+	return first;
+}
+
+static inline void cranp_add_pair(cranp_broadphase_t* broadphase, uint32_t chunk, uint32_t a, uint32_t b)
+{
+	uint32_t* count = broadphase->pairCounts + chunk;
+	if (*count < broadphase->chunkPairCapacity)
+	{
+		broadphase->pairs[chunk * broadphase->chunkPairCapacity + *count] = (cranp_pair_t) { .a = a, .b = b };
+	}
+	++*count;
+}
+
+// @brief Reports the pairs that start in the chunk.
+// Pairs of the same row are found by the entity with the smaller key. Pairs of neighbouring rows are found by the entity
+// whose row comes first, only half of the 8 neighbours are looked up.
+static inline void cranp_sweep(cranp_broadphase_t* broadphase, uint32_t chunk)
+{
+	static const int32_t neighbours[4][2] = { { 1, -1 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+	const uint32_t* keys = broadphase->sortedKeys;
+	const cranp_bounds_t* bounds = broadphase->sortedBounds;
+	uint32_t entityCount = broadphase->entityCount;
+
+	// Entities of a row come in x order, the start of the window in the neighbouring rows only moves forward
+	uint32_t neighbourKeys[4];
+	uint32_t neighbourStarts[4];
+	uint32_t neighbourEnds[4];
+	uint32_t rowKey = 0xFFFFFFFF;
+
+	uint32_t end = cranp_chunk_end(broadphase, chunk);
+	for (uint32_t i = chunk * broadphase->chunkSize; i < end; ++i)
+	{
+		const cranp_bounds_t* current = bounds + i;
+		uint32_t maxX = cranp_quantize_x(broadphase, current->maxX);
+
+		// The bounds of the other rows can start up to a cell before us, one more step covers the rounding of the quantization
+		uint32_t x = keys[i] & 0xFFFF;
+		uint32_t minX = x > (uint32_t)cranp_x_steps_per_cell ? x - (uint32_t)cranp_x_steps_per_cell - 1 : 0;
+
+		if ((keys[i] & 0xFFFF0000) != rowKey)
+		{
+			rowKey = keys[i] & 0xFFFF0000;
+			uint32_t cellY = keys[i] >> 24;
+			uint32_t cellZ = (keys[i] >> 16) & 0xFF;
+			for (uint32_t n = 0; n < 4; ++n)
+			{
+				neighbourKeys[n] = cranp_row_key(cellY + neighbours[n][0], cellZ + neighbours[n][1]);
+				uint32_t rowStart = broadphase->rowStarts[neighbourKeys[n] >> 16];
+				neighbourEnds[n] = broadphase->rowStarts[(neighbourKeys[n] >> 16) + 1];
+				neighbourStarts[n] = rowStart + cranp_lower_bound(keys + rowStart, neighbourEnds[n] - rowStart, neighbourKeys[n] | minX);
+			}
+		}
+
+		for (uint32_t j = i + 1; j < entityCount && keys[j] <= (rowKey | maxX); ++j)
+		{
+			if (cranp_overlap(current, bounds + j))
+			{
+				cranp_add_pair(broadphase, chunk, broadphase->sortedEntities[i], broadphase->sortedEntities[j]);
+			}
+		}
+
+		for (uint32_t n = 0; n < 4; ++n)
+		{
+			uint32_t j = neighbourStarts[n];
+			for (; j < neighbourEnds[n] && keys[j] < (neighbourKeys[n] | minX); ++j);
+			neighbourStarts[n] = j;
+
+			for (; j < neighbourEnds[n] && keys[j] <= (neighbourKeys[n] | maxX); ++j)
+			{
+				if (cranp_overlap(current, bounds + j))
+				{
+					cranp_add_pair(broadphase, chunk, broadphase->sortedEntities[i], broadphase->sortedEntities[j]);
+				}
+			}
+		}
+	}
+}
+
+// @return The pairs found by the chunk, count can be larger than the chunk's pair capacity if some of the pairs didn't fit.
+static inline cranp_pair_t* cranp_read_pairs(cranp_broadphase_t* broadphase, uint32_t chunk, uint32_t* count)
+{
+	*count = broadphase->pairCounts[chunk];
+	return broadphase->pairs + chunk * broadphase->chunkPairCapacity;
+}
+
+// @brief Sorts and sweeps the entities on the calling thread, the bounds must have been set.
+static inline void cranp_update(cranp_broadphase_t* broadphase)
+{
+	for (uint32_t chunk = 0; chunk < broadphase->chunkCount; ++chunk)
+	{
+		cranp_sort_check(broadphase, chunk);
+	}
+	cranp_sort_plan(broadphase);
+
+	for (uint32_t pass = 0; pass < cranp_sort_pass_count; ++pass)
+	{
+		for (uint32_t chunk = 0; chunk < broadphase->chunkCount; ++chunk)
+		{
+			cranp_sort_histogram(broadphase, chunk);
+		}
+		cranp_sort_prefix(broadphase);
+		for (uint32_t chunk = 0; chunk < broadphase->chunkCount; ++chunk)
+		{
+			cranp_sort_scatter(broadphase, chunk);
+		}
+		cranp_sort_next_pass(broadphase);
+	}
+
+	for (uint32_t chunk = 0; chunk < broadphase->chunkCount; ++chunk)
+	{
+		cranp_sweep_prepare(broadphase, chunk);
+	}
+	cranp_sweep_begin(broadphase);
+	for (uint32_t chunk = 0; chunk < broadphase->chunkCount; ++chunk)
+	{
+		cranp_sweep(broadphase, chunk);
+	}
+}
+
+#endif // __CRANBERRY_BROADPHASE_H
@@ -3,6 +3,8 @@
 
 #include "cranberry_math.h"
 
+#include <stdbool.h>
+
 //
 // cranberry_hierarchy.h
 // @brief Cranberry hierarchy is a simple transform hierarchy focused on efficiency and simplicity.
@@ -19,12 +21,41 @@
 
 // #define CRANBERRY_HIERARCHY_IMPL to enable the implementation in a translation unit
 // #define CRANBERRY_DEBUG to enable debug checks
+// #define CRANBERRY_STATS to record what cranh_transform_locals_to_globals did in each group, see cranh_read_stats
+// #define CRANBERRY_RECORD to be able to record the adds, writes and passes of a hierarchy into a trace, see cranh_record_start
+// #define CRANBERRY_BOUNDS to aggregate the bounds of every subtree and query them, see cranh_set_local_bounds
 
 // Types
 
 typedef struct _cranh_hierarchy_t cranh_hierarchy_t;
 typedef struct { unsigned int value; } cranh_handle_t;
 
+#define cranh_invalid_handle ~0U
+#define cranh_max_throttled_root_count 32
+
+typedef struct
+{
+	// What the last cranh_transform_locals_to_globals of the group did. Only recorded with CRANBERRY_STATS.
+	unsigned int dirtyRootsProcessed;
+	unsigned int dirtyChildrenProcessed;
+	unsigned int dirtyBytesScanned;
+	unsigned int transformsComputed; // Includes the dead slots that were computed
+	unsigned int transformsSkipped; // Clean or static transforms inside of the dirty windows
+	unsigned int deadSlotsComputed; // Unused lanes of dirty blocks of 4 between the last child and the first root
+	unsigned int rootWindowSize;
+	unsigned int childWindowSize;
+
+	// Worst ancestor walk of a cranh_add_with_parent or cranh_clone_subtree in the group. Only recorded with CRANBERRY_STATS.
+	unsigned int maxAncestorWalkDepth;
+
+	// Capacity, always available.
+	unsigned int capacity;
+	unsigned int rootCount;
+	unsigned int childCount;
+	unsigned int staticCount;
+	unsigned int freeSlots;
+} cranh_stats_t;
+
 // API
 
 unsigned int cranh_group_from_handle(cranh_handle_t handle);
@@ -57,8 +88,58 @@ cranh_handle_t cranh_add(cranh_hierarchy_t* hierarchy, cranm_transform_t value);
 cranh_handle_t cranh_add_to_group(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, unsigned int group);
 cranh_handle_t cranh_add_with_parent(cranh_hierarchy_t* hierarchy, cranm_transform_t value, cranh_handle_t parent);
 
+// @brief Copies the subtree starting at sourceRoot and attaches the copy to newParent.
+// The copy is placed in newParent's group, or in sourceRoot's group as a new root if newParent is cranh_invalid_handle.
+// Subtrees whose children were added contiguously (all the descendants of a prefab added before anything else is added to the group)
+// are copied as a single block, other subtrees fall back to copying transform by transform.
+// The globals of the copy are computed from the current global of newParent, like cranh_add_with_parent computes them.
+// @return The handle to the root of the copy. When newParent is valid and the subtree isn't interleaved, the handles of the copied
+//         descendants directly follow the returned handle in the same order as the source's descendants.
+cranh_handle_t cranh_clone_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t sourceRoot, cranh_handle_t newParent);
+
 void cranh_transform_locals_to_globals(cranh_hierarchy_t* hierarchy, unsigned int group);
 
+// @brief Transforms a group's dirty transforms up to and including last, the pass resumes where the previous call stopped.
+// Lets a worker interleave the pass with it's writes, tile by tile, while the transforms are still in cache.
+// The first call of a pass also transforms the dirty roots. cranh_transform_locals_to_globals transforms the rest of the group and completes the pass.
+// Children are transformed in blocks of 4, the rest of last's block is transformed with it. Keep the tiles a multiple of 4 transforms.
+// WARNING: Until the pass completes, writes to the roots and to the children that were already transformed are left for the next pass.
+void cranh_transform_locals_to_globals_through(cranh_hierarchy_t* hierarchy, cranh_handle_t last);
+
+// @brief Transforms about maxTransforms of a group's dirty children, the pass resumes where the previous call stopped.
+// Spreads the pass of a busy group over multiple frames to hold a frame budget. The first call of a pass also transforms the dirty roots,
+// the budget only counts the children, it's spent in blocks of 4 and the last block can go over it.
+// Like cranh_transform_locals_to_globals_through, writes behind the pass are left for the next pass. cranh_transform_locals_to_globals
+// completes the pass in progress along with the writes that were left for the next one.
+// @return true if the pass completed.
+bool cranh_transform_locals_to_globals_budget(cranh_hierarchy_t* hierarchy, unsigned int group, unsigned int maxTransforms);
+
+// @brief Only updates the subtree of root on every interval-th pass of it's group, for distant or unimportant subtrees.
+// Writes to the subtree only mark it as pending, the pass that's due dirties the whole subtree at once. The subtrees of a group
+// that share an interval are staggered across the passes. Transforms added under the subtree are updated with it.
+// An interval of 1 or less updates the subtree on every pass again, the pending writes are dirtied right away.
+// WARNING: root must be a root transform.
+// @return false if the group already has cranh_max_throttled_root_count subtrees with an interval.
+bool cranh_set_update_interval(cranh_hierarchy_t* hierarchy, cranh_handle_t root, unsigned int interval);
+
+// @brief Brings the globals of handle and it's descendants up to date before they're read.
+// A pending throttled subtree is updated even if it's not due and a pass in progress is run through the subtree.
+// If writes were left for the next pass, the pass in progress is completed first.
+// WARNING: The pass is left in progress, it's completed by cranh_transform_locals_to_globals or cranh_transform_locals_to_globals_budget.
+void cranh_catch_up_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t handle);
+
+// @brief Transforms handle and it's descendants right away, for the solvers that need the fresh globals of a small subtree in the middle of a frame.
+// Only the children range of handle is transformed, the same way the pass transforms it. The writes inside of the subtree are cleared
+// from the dirty flags so that the pass doesn't transform them again. Interleaved subtrees are transformed but their flags are left to the pass.
+// Static transforms keep their baked globals.
+// If an ancestor of handle is still dirty, the path from the highest dirty ancestor is transformed first and the flags
+// are left to the pass, the subtree is transformed again by it.
+void cranh_update_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t handle);
+
+// @brief Reads the stats of a group. The pass stats describe the last call to cranh_transform_locals_to_globals for the group.
+// WARNING: Not synchronized, don't call it while the group is being transformed.
+cranh_stats_t cranh_read_stats(cranh_hierarchy_t* hierarchy, unsigned int group);
+
 // @brief Reads the local transform addressed by handle
 cranm_transform_t cranh_read_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle);
 // @brief Write the transform to the location defined by handle
@@ -72,6 +153,102 @@ cranm_transform_t cranh_read_global(cranh_hierarchy_t* hierarchy, cranh_handle_t
 // @brief Write a global transform to the location defined by the handle
 void cranh_write_global(cranh_hierarchy_t* hierarchy, cranh_handle_t transform, cranm_transform_t write);
 
+// @brief Bulk writes to the locals of the count transforms whose handles follow first, such as children added one after the other.
+// Write the locals through the returned pointer, then call cranh_write_locals_end to dirty all of them at once instead of
+// paying for the dirty marking of cranh_write_local on every transform.
+// WARNING: The transforms must either all be children or all be roots of first's group. Roots are stored from the end of
+// the group, first is the most recently added root of the range.
+// cranh_write_locals_begin doesn't modify the group, threads can write disjoint ranges of a group's locals at the same time
+// as long as a single thread calls cranh_write_locals_end for them.
+cranm_transform_t* cranh_write_locals_begin(cranh_hierarchy_t* hierarchy, cranh_handle_t first, unsigned int count);
+void cranh_write_locals_end(cranh_hierarchy_t* hierarchy, cranh_handle_t first, unsigned int count);
+
+#ifdef CRANBERRY_BOUNDS
+// Bounds are empty when min is greater than max, transforms start with empty bounds.
+typedef struct
+{
+	cranm_vec_t min;
+	cranm_vec_t max;
+} cranh_aabb_t;
+
+// @brief Sets the bounds of the transform in it's own local space, before it's transformed to global space.
+// Once a group has bounds, cranh_transform_locals_to_globals also aggregates the global bounds of every subtree of the group,
+// bottom up, whenever the pass moved something. The queries use the subtree bounds to skip the descendants that can't be hit.
+void cranh_set_local_bounds(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranh_aabb_t bounds);
+// @brief The global bounds of the transform and all of it's descendants, as of the last cranh_transform_locals_to_globals.
+cranh_aabb_t cranh_read_subtree_bounds(cranh_hierarchy_t* hierarchy, cranh_handle_t handle);
+
+// @brief Finds the transforms of a group whose global bounds are hit.
+// The queries read the bounds of the last cranh_transform_locals_to_globals of the group, they don't modify the group
+// and can run on multiple threads at the same time. Hits aren't sorted.
+// @return The number of transforms that were hit, only the first resultCapacity handles are written to results.
+// The ray is hit between origin and origin + direction * maxDistance.
+unsigned int cranh_query_ray(cranh_hierarchy_t* hierarchy, unsigned int group, cranm_vec_t origin, cranm_vec_t direction, float maxDistance, cranh_handle_t* results, unsigned int resultCapacity);
+unsigned int cranh_query_sphere(cranh_hierarchy_t* hierarchy, unsigned int group, cranm_vec_t center, float radius, cranh_handle_t* results, unsigned int resultCapacity);
+unsigned int cranh_query_box(cranh_hierarchy_t* hierarchy, unsigned int group, cranh_aabb_t box, cranh_handle_t* results, unsigned int resultCapacity);
+#endif // CRANBERRY_BOUNDS
+
+#ifdef CRANBERRY_RECORD
+// @brief Starts recording every add, write and pass of the hierarchy into a trace that replay_hierarchy.c can replay headless.
+// The transforms that already exist are recorded as adds first. Events are streamed to a temporary file per group next to path
+// so that long sessions don't have to fit in memory, and the threads transforming different groups never share a stream.
+// Clones are recorded as the adds they're made of. Partial passes, static baking and update intervals are recorded as well, local bounds aren't.
+// WARNING: Like the rest of the API, a group must only be used by a single thread at a time.
+// @return false if the temporary files couldn't be created.
+bool cranh_record_start(cranh_hierarchy_t* hierarchy, const char* path);
+// @brief Stops the recording and merges the group streams into the trace at the path given to cranh_record_start.
+// @return false if the trace couldn't be written.
+bool cranh_record_stop(cranh_hierarchy_t* hierarchy);
+#endif // CRANBERRY_RECORD
+
+// @brief Bakes the globals of the subtree starting at root and marks it static.
+// The globals are computed once from the current locals, after which cranh_transform_locals_to_globals skips the subtree
+// even if it's ancestors move. The baked transforms are cut out of the dirty intervals so the pass doesn't walk them.
+// Static transforms must be unbaked before they're written to, debug builds assert on writes to them.
+// Transforms added under a static subtree after it was baked are dynamic, bake the subtree again to include them.
+void cranh_bake_static(cranh_hierarchy_t* hierarchy, cranh_handle_t root);
+// @brief Brings a static subtree back into the dynamic hierarchy.
+// The subtree is marked dirty, it's globals are recomputed from it's locals on the next cranh_transform_locals_to_globals.
+// If a pass is in progress the subtree is left for the pass after it, with the ancestors written behind the cursor.
+void cranh_unbake_static(cranh_hierarchy_t* hierarchy, cranh_handle_t root);
+
+// Instanced hierarchies
+// An instanced hierarchy stores a single topology (the parent of every node) that is shared by every instance.
+// Only the locals and globals are stored per instance. They are interleaved in blocks of cranh_instance_lane_count instances
+// so that the same node of every instance in a block is transformed in a single 8 wide step with CRANBERRY_AVX2
+// (two 4 wide steps with CRANBERRY_SSE).
+// Unlike cranh_hierarchy_t, there is no dirty tracking. Every node of every instance is transformed when
+// cranh_instanced_locals_to_globals is called. This is intended for skeletons and prefabs that animate every frame.
+
+#define cranh_instance_lane_count 8
+
+typedef struct _cranh_instanced_t cranh_instanced_t;
+
+// @brief Create a cranh_instanced_t.
+// @param parents The parent node of each node. Parents must come before their children (parents[i] < i) and
+//        root nodes use cranh_invalid_handle as their parent. The topology is copied, parents doesn't have to outlive the hierarchy.
+// @param nodeCount The number of nodes in the topology.
+// @param instanceCount The number of instances of the topology.
+// WARNING: This function allocates memory with the standard malloc. It must be released with cranh_instanced_destroy.
+cranh_instanced_t* cranh_instanced_create(const unsigned int* parents, unsigned int nodeCount, unsigned int instanceCount);
+void cranh_instanced_destroy(cranh_instanced_t* instanced);
+
+// @brief Determines the minimum size necessary to allocate for an instanced hierarchy buffer.
+unsigned int cranh_instanced_buffer_size(unsigned int nodeCount, unsigned int instanceCount);
+// @brief Takes a buffer of at least @ref cranh_instanced_buffer_size bytes and initializes it as an instanced hierarchy.
+// WARNING: cranh_instanced_t doesn't have to point to buffer!
+cranh_instanced_t* cranh_instanced_buffer_create(void* buffer, const unsigned int* parents, unsigned int nodeCount, unsigned int instanceCount);
+
+// @brief The number of instance blocks. Blocks are the job-able chunks of an instanced hierarchy.
+unsigned int cranh_instanced_block_count(cranh_instanced_t* instanced);
+
+cranm_transform_t cranh_instanced_read_local(cranh_instanced_t* instanced, unsigned int instance, unsigned int node);
+void cranh_instanced_write_local(cranh_instanced_t* instanced, unsigned int instance, unsigned int node, cranm_transform_t write);
+cranm_transform_t cranh_instanced_read_global(cranh_instanced_t* instanced, unsigned int instance, unsigned int node);
+
+// @brief Transforms the locals of every instance in the blocks [blockStart, blockEnd) to globals.
+void cranh_instanced_locals_to_globals(cranh_instanced_t* instanced, unsigned int blockStart, unsigned int blockEnd);
+
 // IMPL
 
 #ifdef CRANBERRY_HIERARCHY_IMPL
@@ -85,22 +262,47 @@ void cranh_write_global(cranh_hierarchy_t* hierarchy, cranh_handle_t transform,
 	#include <assert.h>
 #endif // CRANBERRY_DEBUG
 
+#ifdef CRANBERRY_RECORD
+	#include <stdio.h>
+	#include "cranberry_hierarchy_trace.h"
+#endif // CRANBERRY_RECORD
+
+#ifdef CRANBERRY_BOUNDS
+	#include <float.h>
+#endif // CRANBERRY_BOUNDS
+
 #define cranh_dirty_start_flag 0x02
 #define cranh_dirty_start_bit_mask 0xAA
 #define cranh_dirty_end_flag 0x01
 #define cranh_dirty_end_bit_mask 0x55
-#define cranh_invalid_handle ~0U
 #define cranh_buffer_alignment 64
 #define cranh_group_bit_count 8
 #define cranh_max_group_count ((1 << cranh_group_bit_count) - 1)
 #define cranh_transform_bit_count (32 - cranh_group_bit_count)
 #define cranh_max_transform_count ((1 << cranh_transform_bit_count) - 1)
 
+// Set when a node's children range also contains transforms that aren't it's descendants.
+// This happens when transforms are added to other parents between the additions of the node's children.
+#define cranh_node_flag_interleaved 0x01
+// Set on baked static transforms, cranh_transform_locals_to_globals skips them.
+#define cranh_node_flag_static 0x02
+// Set on the transforms of a subtree that's only updated every few passes, see cranh_set_update_interval.
+#define cranh_node_flag_throttled 0x04
+// Temporary marker used while walking the descendants of an interleaved subtree.
+#define cranh_node_flag_descendant 0x80
+#define cranh_node_flag_static_block 0x02020202
+#define cranh_max_static_span_count 32
+// Transforms a children interval walks back when it's start is taken, writes stay O(1) when the intervals are densely nested.
+#define cranh_max_interval_start_walk 4
+
 typedef struct
 {
 	unsigned int nextGroup;
 	unsigned int groupCount;
 	unsigned int maxGroupSize;
+#ifdef CRANBERRY_RECORD
+	struct _cranh_recorder_t* recorder;
+#endif // CRANBERRY_RECORD
 } cranh_hierarchy_header_t;
 
 typedef struct
@@ -115,6 +317,11 @@ typedef struct
 	unsigned int childEnd;
 	unsigned int rootStart;
 	unsigned int rootEnd;
+	unsigned int childAlwaysDirty; // Set when a children interval couldn't get it's own start flag, the whole window is computed
+
+	// A pass that was started by cranh_transform_locals_to_globals_through, the children blocks before the cursor are done.
+	unsigned int passCursor; // cranh_invalid_handle when no pass is in progress
+	unsigned int passDirtyStack; // Intervals that are still open at the cursor
 } cranh_dirty_scheme_header_t;
 
 unsigned int cranh_group_from_handle(cranh_handle_t handle)
@@ -143,23 +350,42 @@ void cranh_dirty_reset(cranh_dirty_scheme_header_t* header)
 	header->rootEnd = 0;
 	header->childStart = cranh_invalid_handle;
 	header->childEnd = 0;
+	header->childAlwaysDirty = 0;
+	header->passCursor = cranh_invalid_handle;
+	header->passDirtyStack = 0;
 }
 
 void cranh_dirty_add_root(cranh_dirty_scheme_header_t* intervalSetHeader, unsigned int index)
 {
+#ifdef CRANBERRY_DEBUG
+	// The roots were transformed when the pass started
+	assert(intervalSetHeader->passCursor == cranh_invalid_handle);
+#endif // CRANBERRY_DEBUG
+
 	uint32_t* dirtyStream = (uint32_t*)(intervalSetHeader + 1);
 	uint32_t* dirty = dirtyStream + (index >> 4);
-	*dirty = *dirty | ((cranh_dirty_start_flag | cranh_dirty_end_flag) << ((index & 0x0F) << 1));
+	*dirty = *dirty | ((uint32_t)(cranh_dirty_start_flag | cranh_dirty_end_flag) << ((index & 0x0F) << 1));
 
 	intervalSetHeader->rootStart = index < intervalSetHeader->rootStart ? index & ~0x03 : intervalSetHeader->rootStart;
 	intervalSetHeader->rootEnd = index > intervalSetHeader->rootEnd ? index & ~0x03 : intervalSetHeader->rootEnd;
 }
 
+// Children intervals can overlap, the pass counts the start flags to know how many intervals are open.
+// Every start flag has to belong to a single interval, if two intervals shared a start the first end would close both of them.
 void cranh_dirty_add_child(cranh_dirty_scheme_header_t* intervalSetHeader, unsigned int index)
 {
+#ifdef CRANBERRY_DEBUG
+	assert(intervalSetHeader->passCursor == cranh_invalid_handle || index >= intervalSetHeader->passCursor);
+#endif // CRANBERRY_DEBUG
+
 	uint32_t* dirtyStream = (uint32_t*)(intervalSetHeader + 1);
 	uint32_t* dirty = dirtyStream + (index >> 4);
-	*dirty = *dirty | ((cranh_dirty_start_flag | cranh_dirty_end_flag) << ((index & 0x0F) << 1));
+	// An interval already starts at index, it covers us.
+	if (*dirty & ((uint32_t)cranh_dirty_start_flag << ((index & 0x0F) << 1)))
+	{
+		return;
+	}
+	*dirty = *dirty | ((uint32_t)(cranh_dirty_start_flag | cranh_dirty_end_flag) << ((index & 0x0F) << 1));
 
 	intervalSetHeader->childStart = index < intervalSetHeader->childStart ? index & ~0x03 : intervalSetHeader->childStart;
 	intervalSetHeader->childEnd = index > intervalSetHeader->childEnd ? index & ~0x03 : intervalSetHeader->childEnd;
@@ -169,28 +395,134 @@ void cranh_dirty_add_child_interval(cranh_dirty_scheme_header_t* intervalSetHead
 {
 #ifdef CRANBERRY_DEBUG
 	assert(range.start <= range.end);
+	assert(intervalSetHeader->passCursor == cranh_invalid_handle || range.start >= intervalSetHeader->passCursor);
 #endif // CRANBERRY_DEBUG
 
 	uint32_t* dirtyStream = (uint32_t*)(intervalSetHeader + 1);
-	uint32_t* dirtyStart = dirtyStream + (range.start >> 4);
-	*dirtyStart = *dirtyStart | (cranh_dirty_start_flag << ((range.start & 0x0F) << 1));
 
-	uint32_t* dirtyEnd = dirtyStream + (range.end >> 4);
-	*dirtyEnd = *dirtyEnd | (cranh_dirty_end_flag << ((range.end & 0x0F) << 1));
+	// If another interval starts at the same transform, start earlier. Recomputing a few more transforms is harmless.
+	// A pass in progress has already consumed the flags before it's cursor, we can't start behind it.
+	unsigned int first = intervalSetHeader->passCursor == cranh_invalid_handle ? 0 : intervalSetHeader->passCursor;
+	first = range.start - first > cranh_max_interval_start_walk ? range.start - cranh_max_interval_start_walk : first;
+	unsigned int start = range.start;
+	while (dirtyStream[start >> 4] & ((uint32_t)cranh_dirty_start_flag << ((start & 0x0F) << 1)))
+	{
+		if (start == first)
+		{
+			break;
+		}
+		--start;
+	}
+
+	uint32_t startFlag = (uint32_t)cranh_dirty_start_flag << ((start & 0x0F) << 1);
+	if (dirtyStream[start >> 4] & startFlag)
+	{
+		// The transforms before us (or since the cursor) already start intervals, keep the whole window dirty instead.
+		intervalSetHeader->childAlwaysDirty = 1;
+	}
+	else
+	{
+		dirtyStream[start >> 4] |= startFlag;
+
+		uint32_t* dirtyEnd = dirtyStream + (range.end >> 4);
+		*dirtyEnd = *dirtyEnd | ((uint32_t)cranh_dirty_end_flag << ((range.end & 0x0F) << 1));
+	}
 
-	intervalSetHeader->childStart = range.start < intervalSetHeader->childStart ? range.start & ~0x03 : intervalSetHeader->childStart;
+	intervalSetHeader->childStart = start < intervalSetHeader->childStart ? start & ~0x03 : intervalSetHeader->childStart;
 	intervalSetHeader->childEnd = range.end > intervalSetHeader->childEnd ? range.end & ~0x03 : intervalSetHeader->childEnd;
 }
 
+// Every transform of the range is marked as it's own interval, a block of 4 transforms is marked with a single or.
+// Like cranh_dirty_add_child, transforms that already start an interval are left alone, it covers them.
+void cranh_dirty_add_range(cranh_dirty_scheme_header_t* header, cranh_range_t range)
+{
+#ifdef CRANBERRY_DEBUG
+	assert(header->passCursor == cranh_invalid_handle || range.start >= header->passCursor);
+#endif // CRANBERRY_DEBUG
+
+	uint8_t* dirtyStream = (uint8_t*)(header + 1);
+	for (unsigned int blockIndex = range.start & ~0x03; blockIndex <= range.end; blockIndex += 4)
+	{
+		unsigned int laneStart = blockIndex < range.start ? range.start - blockIndex : 0;
+		unsigned int laneEnd = range.end - blockIndex < 4 ? range.end - blockIndex + 1 : 4;
+		uint8_t lanes = (uint8_t)((0xFF >> ((4 - laneEnd) * 2)) & (0xFF << (laneStart * 2)));
+
+		uint8_t* dirty = dirtyStream + (blockIndex >> 2);
+		uint8_t starts = *dirty & cranh_dirty_start_bit_mask;
+		*dirty |= lanes & (uint8_t)~(starts | (starts >> 1));
+	}
+}
+
 uint8_t* cranh_dirty_read(cranh_dirty_scheme_header_t* header, unsigned int index)
 {
 	return ((uint8_t*)(header + 1)) + (index >> 2);
 }
 
+// Clears the intervals that start and end in [start, end] once the transforms they cover were transformed outside of the pass.
+// Intervals are only counted, the first starts of the range are cleared along with the ends that close them.
+// The intervals that were opened before start stay open, their transforms are still transformed by the pass.
+void cranh_dirty_clear_intervals(cranh_dirty_scheme_header_t* header, unsigned int start, unsigned int end)
+{
+	uint8_t* dirtyStream = (uint8_t*)(header + 1);
+
+	unsigned int openCount = 0;
+	unsigned int closedCount = 0;
+	for (unsigned int i = start; i <= end; ++i)
+	{
+		uint8_t* dirty = dirtyStream + (i >> 2);
+		if (*dirty == 0)
+		{
+			i |= 0x03;
+			continue;
+		}
+
+		unsigned int shift = (i & 0x03) << 1;
+		openCount += (*dirty & (cranh_dirty_start_flag << shift)) ? 1 : 0;
+		if (openCount > 0 && (*dirty & (cranh_dirty_end_flag << shift)))
+		{
+			*dirty &= (uint8_t)~(cranh_dirty_end_flag << shift);
+			--openCount;
+			++closedCount;
+		}
+	}
+
+	for (unsigned int i = start; closedCount > 0; ++i)
+	{
+		uint8_t* dirty = dirtyStream + (i >> 2);
+		unsigned int shift = (i & 0x03) << 1;
+		if (*dirty & (cranh_dirty_start_flag << shift))
+		{
+			*dirty &= (uint8_t)~(cranh_dirty_start_flag << shift);
+			--closedCount;
+		}
+	}
+}
+
+typedef struct
+{
+	unsigned int root;
+	unsigned int interval;
+	unsigned int passesSinceUpdate;
+	unsigned int pending; // Set when the subtree was written to since it was last dirtied
+} cranh_throttle_t;
+
 typedef struct
 {
 	unsigned int currentChildTransformCount;
 	unsigned int currentRootTransformCount; // We keep track of the global transforms so we can easily just memcpy them
+	unsigned int staticTransformCount; // The pass only looks at the node flags if the group has static transforms
+	unsigned int staticSpanCount;
+	cranh_range_t staticSpans[cranh_max_static_span_count]; // Sorted runs of consecutive static children, the children intervals skip them
+	unsigned int activeDirtyScheme; // The other dirty scheme collects the writes behind a pass in progress
+	unsigned int throttledRootCount; // Writes only look for a throttled subtree if the group has some
+	cranh_throttle_t throttledRoots[cranh_max_throttled_root_count];
+#ifdef CRANBERRY_STATS
+	cranh_stats_t stats;
+#endif // CRANBERRY_STATS
+#ifdef CRANBERRY_BOUNDS
+	unsigned int boundedTransformCount; // The subtree bounds are only aggregated if the group has bounds
+	unsigned int boundsDirty; // Set when a global or local bounds changed since the last aggregation
+#endif // CRANBERRY_BOUNDS
 } cranh_group_header_t;
 
 // Buffer format:
@@ -199,7 +531,16 @@ typedef struct
 // global transforms [maxTransformCount]
 // parent handles [maxTransformCount]
 // max child start + end [maxTransformCount]
-// dirty scheme
+// dirty schemes [2]
+// node flags [maxTransformCount]
+// local bounds [maxTransformCount] (CRANBERRY_BOUNDS)
+// subtree bounds [maxTransformCount] (CRANBERRY_BOUNDS)
+
+// The pass works on blocks of 4 transforms, the last root block has to stay inside the buffers.
+unsigned int cranh_round_group_size(unsigned int maxGroupTransformCount)
+{
+	return (maxGroupTransformCount + 3) & ~0x03;
+}
 
 unsigned int cranh_individual_buffer_size(unsigned int maxGroupTransformCount)
 {
@@ -209,12 +550,17 @@ unsigned int cranh_individual_buffer_size(unsigned int maxGroupTransformCount)
 			sizeof(cranm_transform_t) +
 			sizeof(cranh_handle_t) +
 			sizeof(cranh_range_t)) * maxGroupTransformCount +
-		cranh_dirty_scheme_size(maxGroupTransformCount) + cranh_buffer_alignment; // Add 64 bytes, we might need that for alignment
+		cranh_dirty_scheme_size(maxGroupTransformCount) * 2 +
+		sizeof(uint8_t) * maxGroupTransformCount +
+#ifdef CRANBERRY_BOUNDS
+		sizeof(cranh_aabb_t) * 2 * maxGroupTransformCount +
+#endif // CRANBERRY_BOUNDS
+		cranh_buffer_alignment; // Add 64 bytes, we might need that for alignment
 }
 
 unsigned int cranh_buffer_size(unsigned int groupBufferCount, unsigned int maxGroupTransformCount)
 {
-	size_t bufferSize = cranh_individual_buffer_size(maxGroupTransformCount);
+	size_t bufferSize = cranh_individual_buffer_size(cranh_round_group_size(maxGroupTransformCount));
 	return (unsigned int)(bufferSize * groupBufferCount + sizeof(cranh_hierarchy_header_t));
 }
 
@@ -237,10 +583,28 @@ cranh_hierarchy_t* cranh_create(unsigned int groupCount, unsigned int maxGroupTr
 
 void cranh_destroy(cranh_hierarchy_t* hierarchy)
 {
+#ifdef CRANBERRY_RECORD
+	// Don't lose a recording that wasn't stopped
+	if (((cranh_hierarchy_header_t*)hierarchy)->recorder != NULL)
+	{
+		cranh_record_stop(hierarchy);
+	}
+#endif // CRANBERRY_RECORD
+
 	free(hierarchy);
 }
 
 cranh_dirty_scheme_header_t* cranh_get_dirty_scheme(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group);
+cranh_dirty_scheme_header_t* cranh_get_next_dirty_scheme(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group);
+#ifdef CRANBERRY_BOUNDS
+cranh_aabb_t* cranh_get_local_bounds(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group, unsigned int index);
+cranh_aabb_t* cranh_get_subtree_bounds(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group, unsigned int index);
+
+cranh_aabb_t cranh_empty_aabb(void)
+{
+	return (cranh_aabb_t) { .min = { FLT_MAX, FLT_MAX, FLT_MAX }, .max = { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+}
+#endif // CRANBERRY_BOUNDS
 void cranh_group_create(cranh_hierarchy_t* hierarchy, void* groupBuffer)
 {
 	// We add the size of the header because we don't want to align the header.
@@ -256,7 +620,29 @@ void cranh_group_create(cranh_hierarchy_t* hierarchy, void* groupBuffer)
 	cranh_group_header_t* groupHeader = (cranh_group_header_t*)groupBuffer;
 	groupHeader->currentChildTransformCount = 0;
 	groupHeader->currentRootTransformCount = 0;
+	groupHeader->staticTransformCount = 0;
+	groupHeader->staticSpanCount = 0;
+	groupHeader->activeDirtyScheme = 0;
+	groupHeader->throttledRootCount = 0;
+#ifdef CRANBERRY_STATS
+	memset(&groupHeader->stats, 0, sizeof(cranh_stats_t));
+#endif // CRANBERRY_STATS
 	cranh_dirty_reset(cranh_get_dirty_scheme(hierarchy, groupHeader));
+	cranh_dirty_reset(cranh_get_next_dirty_scheme(hierarchy, groupHeader));
+
+#ifdef CRANBERRY_BOUNDS
+	groupHeader->boundedTransformCount = 0;
+	groupHeader->boundsDirty = 0;
+
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	cranh_aabb_t* localBounds = cranh_get_local_bounds(hierarchy, groupHeader, 0);
+	cranh_aabb_t* subtreeBounds = cranh_get_subtree_bounds(hierarchy, groupHeader, 0);
+	for (unsigned int i = 0; i < maxGroupSize; ++i)
+	{
+		localBounds[i] = cranh_empty_aabb();
+		subtreeBounds[i] = cranh_empty_aabb();
+	}
+#endif // CRANBERRY_BOUNDS
 }
 
 cranh_hierarchy_t* cranh_buffer_create(void* buffer, unsigned int groupCount, unsigned int maxGroupSize)
@@ -266,6 +652,8 @@ cranh_hierarchy_t* cranh_buffer_create(void* buffer, unsigned int groupCount, un
 	assert(maxGroupSize < cranh_max_transform_count);
 #endif // CRANBERRY_DEBUG
 
+	maxGroupSize = cranh_round_group_size(maxGroupSize);
+
 	unsigned int bufferSize = cranh_buffer_size(groupCount, maxGroupSize);
 	unsigned int groupSize = cranh_individual_buffer_size(maxGroupSize);
 
@@ -327,288 +715,2354 @@ cranh_range_t* cranh_get_children_range(cranh_hierarchy_t* hierarchy, cranh_grou
 	return (cranh_range_t*)bufferStart + index;
 }
 
-// Dirty scheme is the fifth buffer
-cranh_dirty_scheme_header_t* cranh_get_dirty_scheme(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group)
+// Dirty schemes are the fifth buffer, the active one is used by the pass.
+cranh_dirty_scheme_header_t* cranh_get_dirty_scheme_at(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group, unsigned int scheme)
 {
 	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
 
 	uint8_t* bufferStart = (uint8_t*)group;
 	bufferStart += sizeof(cranh_group_header_t) + (sizeof(cranm_transform_t) * 2 + sizeof(cranh_handle_t) + sizeof(cranh_range_t)) * maxGroupSize;
+	bufferStart += cranh_dirty_scheme_size(maxGroupSize) * scheme;
 	return (cranh_dirty_scheme_header_t*)bufferStart;
 }
 
-cranh_handle_t cranh_add(cranh_hierarchy_t* hierarchy, cranm_transform_t transform)
+cranh_dirty_scheme_header_t* cranh_get_dirty_scheme(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group)
 {
-	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)hierarchy;
-
-	unsigned int group = hierarchyHeader->nextGroup;
-	hierarchyHeader->nextGroup = (hierarchyHeader->nextGroup + 1) % hierarchyHeader->groupCount;
-	return cranh_add_to_group(hierarchy, transform, group);
+	return cranh_get_dirty_scheme_at(hierarchy, group, group->activeDirtyScheme);
 }
 
-cranh_handle_t cranh_add_to_group(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, unsigned int group)
+cranh_dirty_scheme_header_t* cranh_get_next_dirty_scheme(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group)
 {
-	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
-
-	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
-	++header->currentRootTransformCount;
-	unsigned int transformHandle = maxGroupSize - header->currentRootTransformCount;
-
-#ifdef CRANBERRY_DEBUG
-	// If our transform handle is less than our child transform count, that means our memory has overflwed.
-	assert(transformHandle > header->currentChildTransformCount);
-#endif // CRANBERRY_DEBUG
-
-	cranm_transform_t* local = cranh_get_local(hierarchy, header, transformHandle);
-	cranm_transform_t* global = cranh_get_global(hierarchy, header, transformHandle);
-	cranh_handle_t* parent = cranh_get_parent(hierarchy, header, transformHandle);
-
-	parent->value = cranh_invalid_handle;
-	*global = transform;
-	*local = transform;
-
-	// dirty setup
-	cranh_range_t* currentChildrenRange = cranh_get_children_range(hierarchy, header, transformHandle);
-	currentChildrenRange->start = cranh_invalid_handle;
-	currentChildrenRange->end = 0;
+	return cranh_get_dirty_scheme_at(hierarchy, group, group->activeDirtyScheme ^ 1);
+}
 
-	return cranh_create_handle(group, transformHandle);
+// The pass has already consumed the flags of the roots and of the children before it's cursor,
+// writes to them are left for the next pass.
+cranh_dirty_scheme_header_t* cranh_get_write_dirty_scheme(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group, unsigned int index)
+{
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, group);
+	if (dirtyScheme->passCursor != cranh_invalid_handle && (index < dirtyScheme->passCursor || index >= group->currentChildTransformCount))
+	{
+		return cranh_get_next_dirty_scheme(hierarchy, group);
+	}
+	return dirtyScheme;
 }
 
-cranh_handle_t cranh_add_with_parent(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, cranh_handle_t parentHandle)
+// Subtrees that weren't part of their ancestors' intervals, such as unbaked or cloned ones, are dirtied for the next pass while
+// a pass is in progress. An ancestor written behind the cursor is only transformed by the next pass, the subtree has to follow it.
+cranh_dirty_scheme_header_t* cranh_get_subtree_dirty_scheme(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group)
 {
-	unsigned int parentGroup = cranh_group_from_handle(parentHandle);
-	unsigned int parentIndex = cranh_index_from_handle(parentHandle);
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, group);
+	return dirtyScheme->passCursor != cranh_invalid_handle ? cranh_get_next_dirty_scheme(hierarchy, group) : dirtyScheme;
+}
 
-	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, parentGroup);
-	unsigned int transformHandle = header->currentChildTransformCount;
-	++header->currentChildTransformCount;
+bool cranh_dirty_is_empty(cranh_dirty_scheme_header_t* header)
+{
+	return header->rootStart == cranh_invalid_handle && header->childStart == cranh_invalid_handle && header->childAlwaysDirty == 0;
+}
 
-#ifdef CRANBERRY_DEBUG
+// Node flags are the sixth buffer, they're cold. The pass only reads them for dirty blocks of groups with static transforms.
+uint8_t* cranh_get_flags(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group, unsigned int index)
+{
 	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
 
-	assert(transformHandle < maxGroupSize);
-	assert(
-		   (parentIndex < header->currentChildTransformCount && parentIndex < transformHandle)
-		|| maxGroupSize - parentIndex <= header->currentRootTransformCount);
-#endif // CRANBERRY_DEBUG
+	uint8_t* bufferStart = (uint8_t*)cranh_get_dirty_scheme_at(hierarchy, group, 0);
+	bufferStart += cranh_dirty_scheme_size(maxGroupSize) * 2;
+	return bufferStart + index;
+}
 
-	cranm_transform_t* local = cranh_get_local(hierarchy, header, transformHandle);
-	cranm_transform_t* global = cranh_get_global(hierarchy, header, transformHandle);
-	cranh_handle_t* parent = cranh_get_parent(hierarchy, header, transformHandle);
+#ifdef CRANBERRY_BOUNDS
+// Bounds are the seventh and eighth buffers, only the aggregation and the queries read them.
+cranh_aabb_t* cranh_get_local_bounds(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group, unsigned int index)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	return (cranh_aabb_t*)cranh_get_flags(hierarchy, group, maxGroupSize) + index;
+}
 
-	*parent = parentHandle;
-	*global = cranm_transform(transform, *cranh_get_global(hierarchy, header, parentIndex));
-	*local = transform;
+cranh_aabb_t* cranh_get_subtree_bounds(cranh_hierarchy_t* hierarchy, cranh_group_header_t* group, unsigned int index)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	return cranh_get_local_bounds(hierarchy, group, maxGroupSize) + index;
+}
+#endif // CRANBERRY_BOUNDS
 
-	cranh_range_t* currentChildrenRange = cranh_get_children_range(hierarchy, header, transformHandle);
-	currentChildrenRange->start = cranh_invalid_handle;
-	currentChildrenRange->end = 0;
+// Extends the children range of parentHandle and all of it's ancestors to include the newly added range.
+void cranh_add_to_ancestor_ranges(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_handle_t parentHandle, cranh_range_t range)
+{
+#ifdef CRANBERRY_STATS
+	unsigned int depth = 0;
+#endif // CRANBERRY_STATS
 
 	// Update all of the parents
 	while (parentHandle.value != cranh_invalid_handle)
 	{
+#ifdef CRANBERRY_STATS
+		++depth;
+#endif // CRANBERRY_STATS
+
 		// We don't actually need the parent group, all children should be in the same group
 		// unsigned int searchParentGroup = cranh_group_from_handle(parentHandle);
 		unsigned int searchParentIndex = cranh_index_from_handle(parentHandle);
 
 		cranh_range_t* parentChildrenRange = cranh_get_children_range(hierarchy, header, searchParentIndex);
 
-		parentChildrenRange->start = parentChildrenRange->start == cranh_invalid_handle ? transformHandle : parentChildrenRange->start;
+		// If something else was added since our last child, our range now includes transforms that aren't our descendants.
+		if (parentChildrenRange->start != cranh_invalid_handle && parentChildrenRange->end + 1 != range.start)
+		{
+			*cranh_get_flags(hierarchy, header, searchParentIndex) |= cranh_node_flag_interleaved;
+		}
+
+		parentChildrenRange->start = parentChildrenRange->start == cranh_invalid_handle ? range.start : parentChildrenRange->start;
 #ifdef CRANBERRY_DEBUG
-		assert(parentChildrenRange->start <= transformHandle);
+		assert(parentChildrenRange->start <= range.start);
 #endif // CRANBERRY_DEBUG
-		parentChildrenRange->end = parentChildrenRange->end < transformHandle ? transformHandle : parentChildrenRange->end;
+		parentChildrenRange->end = parentChildrenRange->end < range.end ? range.end : parentChildrenRange->end;
 
 		parentHandle = *cranh_get_parent(hierarchy, header, searchParentIndex);
 	}
 
-	return cranh_create_handle(parentGroup, transformHandle);
+#ifdef CRANBERRY_STATS
+	header->stats.maxAncestorWalkDepth = depth > header->stats.maxAncestorWalkDepth ? depth : header->stats.maxAncestorWalkDepth;
+#endif // CRANBERRY_STATS
 }
 
-cranm_transform_t cranh_read_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+// Rebuilds the static spans that overlap range from the node flags, after transforms in range were baked or unbaked.
+// Runs that don't fit in the span list are only skipped lane by lane by the pass.
+void cranh_static_spans_update(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_range_t range)
 {
-	unsigned int group = cranh_group_from_handle(handle);
-	unsigned int index = cranh_index_from_handle(handle);
+	uint8_t* flags = cranh_get_flags(hierarchy, header, 0);
 
-	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
-#ifdef CRANBERRY_DEBUG
-	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
-	assert(index < header->currentChildTransformCount || maxGroupSize - index < header->currentRootTransformCount);
-#endif // CRANBERRY_DEBUG
+	// Runs can continue past the range, they're rebuilt whole.
+	while (range.start > 0 && (flags[range.start - 1] & cranh_node_flag_static))
+	{
+		--range.start;
+	}
+	while (range.end + 1 < header->currentChildTransformCount && (flags[range.end + 1] & cranh_node_flag_static))
+	{
+		++range.end;
+	}
 
-	cranh_handle_t parentHandle = *cranh_get_parent(hierarchy, header, index);
-	if (parentHandle.value != cranh_invalid_handle)
+	unsigned int spanCount = 0;
+	for (unsigned int i = 0; i < header->staticSpanCount; ++i)
 	{
-		// We don't need the parent group, it should be in the same group as the child
-		// unsigned int parentGroup = cranh_group_from_handle(parentHandle);
-		unsigned int parentIndex = cranh_index_from_handle(parentHandle);
-		return cranm_inverse_transform(*cranh_get_global(hierarchy, header, index), *cranh_get_global(hierarchy, header, parentIndex));
+		if (header->staticSpans[i].end < range.start || header->staticSpans[i].start > range.end)
+		{
+			header->staticSpans[spanCount++] = header->staticSpans[i];
+		}
 	}
-	else
+	header->staticSpanCount = spanCount;
+
+	for (unsigned int i = range.start; i <= range.end && header->staticSpanCount < cranh_max_static_span_count; ++i)
 	{
-		return *cranh_get_global(hierarchy, header, index);
+		if (!(flags[i] & cranh_node_flag_static))
+		{
+			continue;
+		}
+
+		cranh_range_t span = { .start = i, .end = i };
+		while (span.end < range.end && (flags[span.end + 1] & cranh_node_flag_static))
+		{
+			++span.end;
+		}
+		i = span.end;
+
+		// Keep the spans sorted, the intervals are cut in a single walk.
+		unsigned int insert = header->staticSpanCount;
+		for (; insert > 0 && header->staticSpans[insert - 1].start > span.start; --insert)
+		{
+			header->staticSpans[insert] = header->staticSpans[insert - 1];
+		}
+		header->staticSpans[insert] = span;
+		++header->staticSpanCount;
 	}
 }
 
-void cranh_write_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranm_transform_t write)
+// Adds a children interval without the static spans it contains, the pass never walks the baked transforms.
+void cranh_dirty_add_dynamic_interval(cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme, cranh_range_t range)
 {
-	unsigned int group = cranh_group_from_handle(handle);
-	unsigned int index = cranh_index_from_handle(handle);
+	for (unsigned int i = 0; i < header->staticSpanCount; ++i)
+	{
+		cranh_range_t span = header->staticSpans[i];
+		if (span.start > range.end)
+		{
+			break;
+		}
+		else if (span.end < range.start)
+		{
+			continue;
+		}
 
-	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+		if (span.start > range.start)
+		{
+			cranh_dirty_add_child_interval(dirtyScheme, (cranh_range_t) { .start = range.start, .end = span.start - 1 });
+		}
 
-#ifdef CRANBERRY_DEBUG
-	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
-	assert(index < header->currentChildTransformCount || maxGroupSize - index < header->currentRootTransformCount);
-#endif // CRANBERRY_DEBUG
+		if (span.end >= range.end)
+		{
+			return;
+		}
+		range.start = span.end + 1;
+	}
 
-	*cranh_get_local(hierarchy, header, index) = write;
+	cranh_dirty_add_child_interval(dirtyScheme, range);
+}
 
-	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
-	cranh_range_t* childrenRange = cranh_get_children_range(hierarchy, header, index);
+#ifdef CRANBERRY_RECORD
+#define cranh_record_buffer_size (64 * 1024)
 
-	// If we're a transform at the end of the buffer, we're a root
-	if (index > header->currentChildTransformCount)
-	{
-		cranh_dirty_add_root(dirtyScheme, index);
-	}
-	else
+typedef struct
+{
+	FILE* file;
+	uint8_t* buffer;
+	unsigned int bufferSize;
+	unsigned int eventCount;
+	uint64_t streamSize;
+	uint32_t* ordinals; // Index -> order in which the transform was added to the group
+	uint32_t ordinalCount;
+	uint32_t lastOrdinal;
+	bool failed;
+} cranh_group_recorder_t;
+
+typedef struct _cranh_recorder_t
+{
+	char* path;
+	cranh_group_recorder_t* groups;
+} cranh_recorder_t;
+
+void cranh_record_temp_path(char* out, size_t outSize, const char* path, unsigned int group)
+{
+	snprintf(out, outSize, "%s.group%u.tmp", path, group);
+}
+
+void cranh_record_flush(cranh_group_recorder_t* recorder)
+{
+	if (recorder->bufferSize > 0 && fwrite(recorder->buffer, 1, recorder->bufferSize, recorder->file) != recorder->bufferSize)
 	{
-		cranh_dirty_add_child(dirtyScheme, index);
+		recorder->failed = true;
 	}
+	recorder->streamSize += recorder->bufferSize;
+	recorder->bufferSize = 0;
+}
 
-	if (childrenRange->start != cranh_invalid_handle)
+// Returns where the next event goes, there's always room for cranh_trace_max_event_size bytes.
+uint8_t* cranh_record_begin_event(cranh_group_recorder_t* recorder, cranh_trace_op_e op)
+{
+	if (recorder->bufferSize + cranh_trace_max_event_size > cranh_record_buffer_size)
 	{
-		cranh_dirty_add_child_interval(dirtyScheme, *childrenRange);
+		cranh_record_flush(recorder);
 	}
+
+	++recorder->eventCount;
+	uint8_t* out = recorder->buffer + recorder->bufferSize;
+	*out = (uint8_t)op;
+	return out + 1;
 }
 
-cranm_transform_t cranh_read_global(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+void cranh_record_end_event(cranh_group_recorder_t* recorder, uint8_t* end)
 {
-	unsigned int group = cranh_group_from_handle(handle);
-	unsigned int index = cranh_index_from_handle(handle);
-
-	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
-#ifdef CRANBERRY_DEBUG
-	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
-	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
-#endif // CRANBERRY_DEBUG
+	recorder->bufferSize = (unsigned int)(end - recorder->buffer);
+}
 
-	return *cranh_get_global(hierarchy, header, index);
+cranh_group_recorder_t* cranh_record_group(cranh_hierarchy_t* hierarchy, unsigned int group)
+{
+	cranh_recorder_t* recorder = ((cranh_hierarchy_header_t*)hierarchy)->recorder;
+	return recorder != NULL ? &recorder->groups[group] : NULL;
 }
 
-void cranh_write_global(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranm_transform_t write)
+void cranh_record_add(cranh_hierarchy_t* hierarchy, unsigned int group, unsigned int index, cranh_handle_t parent, cranm_transform_t local)
 {
-	unsigned int group = cranh_group_from_handle(handle);
-	unsigned int index = cranh_index_from_handle(handle);
+	cranh_group_recorder_t* recorder = cranh_record_group(hierarchy, group);
+	if (recorder == NULL)
+	{
+		return;
+	}
 
-	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
-#ifdef CRANBERRY_DEBUG
-	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
-	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
-#endif // CRANBERRY_DEBUG
+	uint8_t* out;
+	if (parent.value == cranh_invalid_handle)
+	{
+		out = cranh_record_begin_event(recorder, cranh_trace_op_add_root);
+	}
+	else
+	{
+		out = cranh_record_begin_event(recorder, cranh_trace_op_add_child);
+		out = cranh_trace_write_varint(out, recorder->ordinals[cranh_index_from_handle(parent)]);
+	}
+	out = cranh_trace_write_transform(out, local);
+	cranh_record_end_event(recorder, out);
 
-	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+	recorder->ordinals[index] = recorder->ordinalCount++;
+}
 
-	// If we're a child transform index, that means we have a parent
-	if (index < header->currentChildTransformCount)
+void cranh_record_write(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranh_trace_op_e op, cranm_transform_t write)
+{
+	cranh_group_recorder_t* recorder = cranh_record_group(hierarchy, cranh_group_from_handle(handle));
+	if (recorder == NULL)
+	{
+		return;
+	}
+
+	uint32_t ordinal = recorder->ordinals[cranh_index_from_handle(handle)];
+	uint8_t* out = cranh_record_begin_event(recorder, op);
+	out = cranh_trace_write_varint(out, cranh_trace_zigzag((int32_t)(ordinal - recorder->lastOrdinal)));
+	out = cranh_trace_write_transform(out, write);
+	cranh_record_end_event(recorder, out);
+
+	recorder->lastOrdinal = ordinal;
+}
+
+void cranh_record_pass(cranh_hierarchy_t* hierarchy, unsigned int group)
+{
+	cranh_group_recorder_t* recorder = cranh_record_group(hierarchy, group);
+	if (recorder == NULL)
+	{
+		return;
+	}
+
+	cranh_record_end_event(recorder, cranh_record_begin_event(recorder, cranh_trace_op_pass));
+}
+
+// Records the calls that work on a subtree or run the pass through a transform. Only set_update_interval has an argument.
+void cranh_record_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranh_trace_op_e op, uint32_t argument)
+{
+	cranh_group_recorder_t* recorder = cranh_record_group(hierarchy, cranh_group_from_handle(handle));
+	if (recorder == NULL)
+	{
+		return;
+	}
+
+	uint8_t* out = cranh_record_begin_event(recorder, op);
+	out = cranh_trace_write_varint(out, recorder->ordinals[cranh_index_from_handle(handle)]);
+	if (op == cranh_trace_op_set_update_interval)
+	{
+		out = cranh_trace_write_varint(out, argument);
+	}
+	cranh_record_end_event(recorder, out);
+}
+
+void cranh_record_budget(cranh_hierarchy_t* hierarchy, unsigned int group, unsigned int maxTransforms, bool completed)
+{
+	cranh_group_recorder_t* recorder = cranh_record_group(hierarchy, group);
+	if (recorder == NULL)
+	{
+		return;
+	}
+
+	uint8_t* out = cranh_record_begin_event(recorder, cranh_trace_op_pass_budget);
+	out = cranh_trace_write_varint(out, maxTransforms);
+	*out++ = completed ? 1 : 0;
+	cranh_record_end_event(recorder, out);
+}
+
+void cranh_record_free(cranh_recorder_t* recorder, unsigned int groupCount)
+{
+	for (unsigned int i = 0; i < groupCount; ++i)
+	{
+		cranh_group_recorder_t* group = &recorder->groups[i];
+		if (group->file != NULL)
+		{
+			fclose(group->file);
+			char tempPath[1024];
+			cranh_record_temp_path(tempPath, sizeof(tempPath), recorder->path, i);
+			remove(tempPath);
+		}
+		free(group->buffer);
+		free(group->ordinals);
+	}
+	free(recorder->groups);
+	free(recorder->path);
+	free(recorder);
+}
+
+bool cranh_record_start(cranh_hierarchy_t* hierarchy, const char* path)
+{
+	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)hierarchy;
+#ifdef CRANBERRY_DEBUG
+	assert(hierarchyHeader->recorder == NULL);
+#endif // CRANBERRY_DEBUG
+
+	unsigned int groupCount = hierarchyHeader->groupCount;
+	unsigned int maxGroupSize = hierarchyHeader->maxGroupSize;
+
+	cranh_recorder_t* recorder = (cranh_recorder_t*)malloc(sizeof(cranh_recorder_t));
+	size_t pathLength = strlen(path) + 1;
+	recorder->path = (char*)malloc(pathLength);
+	memcpy(recorder->path, path, pathLength);
+	recorder->groups = (cranh_group_recorder_t*)calloc(groupCount, sizeof(cranh_group_recorder_t));
+
+	for (unsigned int i = 0; i < groupCount; ++i)
+	{
+		cranh_group_recorder_t* group = &recorder->groups[i];
+		char tempPath[1024];
+		cranh_record_temp_path(tempPath, sizeof(tempPath), path, i);
+		group->file = fopen(tempPath, "w+b");
+		group->buffer = (uint8_t*)malloc(cranh_record_buffer_size);
+		group->ordinals = (uint32_t*)malloc(sizeof(uint32_t) * maxGroupSize);
+
+		if (group->file == NULL)
+		{
+			cranh_record_free(recorder, groupCount);
+			return false;
+		}
+	}
+	hierarchyHeader->recorder = recorder;
+
+	// Record what's already in the hierarchy, roots first. Children always come after their parent.
+	for (unsigned int i = 0; i < groupCount; ++i)
+	{
+		cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, i);
+		for (unsigned int root = 0; root < header->currentRootTransformCount; ++root)
+		{
+			unsigned int index = maxGroupSize - 1 - root;
+			cranh_record_add(hierarchy, i, index, (cranh_handle_t) { .value = cranh_invalid_handle }, *cranh_get_local(hierarchy, header, index));
+		}
+
+		for (unsigned int index = 0; index < header->currentChildTransformCount; ++index)
+		{
+			cranh_record_add(hierarchy, i, index, *cranh_get_parent(hierarchy, header, index), *cranh_get_local(hierarchy, header, index));
+		}
+	}
+
+	return true;
+}
+
+bool cranh_record_stop(cranh_hierarchy_t* hierarchy)
+{
+	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)hierarchy;
+	cranh_recorder_t* recorder = hierarchyHeader->recorder;
+	hierarchyHeader->recorder = NULL;
+#ifdef CRANBERRY_DEBUG
+	assert(recorder != NULL);
+#endif // CRANBERRY_DEBUG
+
+	bool succeeded = true;
+	FILE* trace = fopen(recorder->path, "wb");
+	succeeded = trace != NULL;
+
+	cranh_trace_header_t traceHeader =
+	{
+		.magic = cranh_trace_magic,
+		.version = cranh_trace_version,
+		.groupCount = hierarchyHeader->groupCount,
+		.maxGroupSize = hierarchyHeader->maxGroupSize
+	};
+	succeeded = succeeded && fwrite(&traceHeader, sizeof(traceHeader), 1, trace) == 1;
+
+	for (unsigned int i = 0; i < hierarchyHeader->groupCount && succeeded; ++i)
+	{
+		cranh_group_recorder_t* group = &recorder->groups[i];
+		cranh_record_flush(group);
+
+		cranh_trace_stream_header_t streamHeader = { .group = i, .eventCount = group->eventCount, .size = group->streamSize };
+		succeeded = !group->failed && fwrite(&streamHeader, sizeof(streamHeader), 1, trace) == 1;
+
+		// Copy the group's temporary stream into the trace, the record buffer is free now
+		succeeded = succeeded && fflush(group->file) == 0 && fseek(group->file, 0, SEEK_SET) == 0;
+		for (size_t read; succeeded && (read = fread(group->buffer, 1, cranh_record_buffer_size, group->file)) > 0;)
+		{
+			succeeded = fwrite(group->buffer, 1, read, trace) == read;
+		}
+	}
+
+	if (trace != NULL)
+	{
+		succeeded = fclose(trace) == 0 && succeeded;
+	}
+
+	cranh_record_free(recorder, hierarchyHeader->groupCount);
+	return succeeded;
+}
+#endif // CRANBERRY_RECORD
+
+cranh_handle_t cranh_add(cranh_hierarchy_t* hierarchy, cranm_transform_t transform)
+{
+	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)hierarchy;
+
+	unsigned int group = hierarchyHeader->nextGroup;
+	hierarchyHeader->nextGroup = (hierarchyHeader->nextGroup + 1) % hierarchyHeader->groupCount;
+	return cranh_add_to_group(hierarchy, transform, group);
+}
+
+cranh_handle_t cranh_add_to_group(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, unsigned int group)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+	++header->currentRootTransformCount;
+	unsigned int transformHandle = maxGroupSize - header->currentRootTransformCount;
+
+#ifdef CRANBERRY_DEBUG
+	// If our transform handle is less than our child transform count, that means our memory has overflwed.
+	assert(transformHandle > header->currentChildTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	cranm_transform_t* local = cranh_get_local(hierarchy, header, transformHandle);
+	cranm_transform_t* global = cranh_get_global(hierarchy, header, transformHandle);
+	cranh_handle_t* parent = cranh_get_parent(hierarchy, header, transformHandle);
+
+	parent->value = cranh_invalid_handle;
+	*global = transform;
+	*local = transform;
+
+	// dirty setup
+	cranh_range_t* currentChildrenRange = cranh_get_children_range(hierarchy, header, transformHandle);
+	currentChildrenRange->start = cranh_invalid_handle;
+	currentChildrenRange->end = 0;
+
+	*cranh_get_flags(hierarchy, header, transformHandle) = 0;
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_add(hierarchy, group, transformHandle, *parent, transform);
+#endif // CRANBERRY_RECORD
+
+	return cranh_create_handle(group, transformHandle);
+}
+
+cranh_handle_t cranh_add_with_parent(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, cranh_handle_t parentHandle)
+{
+	unsigned int parentGroup = cranh_group_from_handle(parentHandle);
+	unsigned int parentIndex = cranh_index_from_handle(parentHandle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, parentGroup);
+	unsigned int transformHandle = header->currentChildTransformCount;
+	++header->currentChildTransformCount;
+
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+
+	assert(transformHandle < maxGroupSize);
+	assert(
+		   (parentIndex < header->currentChildTransformCount && parentIndex < transformHandle)
+		|| maxGroupSize - parentIndex <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	cranm_transform_t* local = cranh_get_local(hierarchy, header, transformHandle);
+	cranm_transform_t* global = cranh_get_global(hierarchy, header, transformHandle);
+	cranh_handle_t* parent = cranh_get_parent(hierarchy, header, transformHandle);
+
+	*parent = parentHandle;
+	*global = cranm_transform(transform, *cranh_get_global(hierarchy, header, parentIndex));
+	*local = transform;
+
+	cranh_range_t* currentChildrenRange = cranh_get_children_range(hierarchy, header, transformHandle);
+	currentChildrenRange->start = cranh_invalid_handle;
+	currentChildrenRange->end = 0;
+
+	// Children of a throttled subtree are updated with it
+	*cranh_get_flags(hierarchy, header, transformHandle) = *cranh_get_flags(hierarchy, header, parentIndex) & cranh_node_flag_throttled;
+
+	cranh_add_to_ancestor_ranges(hierarchy, header, parentHandle, (cranh_range_t) { .start = transformHandle, .end = transformHandle });
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_add(hierarchy, parentGroup, transformHandle, parentHandle, transform);
+#endif // CRANBERRY_RECORD
+
+	return cranh_create_handle(parentGroup, transformHandle);
+}
+
+// Parents of a copied block either point to the root of the source subtree or to a transform inside the block.
+// Both the group and index of the handles can be offset with a single add.
+void cranh_rebase_parents(cranh_handle_t* parents, unsigned int count, cranh_handle_t sourceRoot, cranh_handle_t newRoot, unsigned int handleOffset)
+{
+	unsigned int i = 0;
+#ifdef CRANBERRY_SSE
+	__m128i sourceRootValue = _mm_set1_epi32((int)sourceRoot.value);
+	__m128i newRootValue = _mm_set1_epi32((int)newRoot.value);
+	__m128i offset = _mm_set1_epi32((int)handleOffset);
+	for (; i + 4 <= count; i += 4)
+	{
+		__m128i parent = _mm_loadu_si128((__m128i*)(parents + i));
+		__m128i isRoot = _mm_cmpeq_epi32(parent, sourceRootValue);
+		__m128i rebased = _mm_add_epi32(parent, offset);
+		_mm_storeu_si128((__m128i*)(parents + i), _mm_or_si128(_mm_and_si128(isRoot, newRootValue), _mm_andnot_si128(isRoot, rebased)));
+	}
+#endif // CRANBERRY_SSE
+
+	for (; i < count; ++i)
+	{
+		parents[i].value = parents[i].value == sourceRoot.value ? newRoot.value : parents[i].value + handleOffset;
+	}
+}
+
+// Empty children ranges are left untouched.
+void cranh_rebase_ranges(cranh_range_t* ranges, unsigned int count, unsigned int indexOffset)
+{
+	unsigned int i = 0;
+#ifdef CRANBERRY_SSE
+	__m128i invalid = _mm_set1_epi32((int)cranh_invalid_handle);
+	__m128i offset = _mm_set1_epi32((int)indexOffset);
+	for (; i + 2 <= count; i += 2)
+	{
+		__m128i range = _mm_loadu_si128((__m128i*)(ranges + i));
+		__m128i isEmpty = _mm_cmpeq_epi32(_mm_shuffle_epi32(range, _MM_SHUFFLE(2, 2, 0, 0)), invalid);
+		_mm_storeu_si128((__m128i*)(ranges + i), _mm_add_epi32(range, _mm_andnot_si128(isEmpty, offset)));
+	}
+#endif // CRANBERRY_SSE
+
+	for (; i < count; ++i)
+	{
+		if (ranges[i].start != cranh_invalid_handle)
+		{
+			ranges[i].start += indexOffset;
+			ranges[i].end += indexOffset;
+		}
+	}
+}
+
+#ifdef CRANBERRY_BOUNDS
+void cranh_copy_local_bounds(cranh_hierarchy_t* hierarchy, cranh_handle_t source, cranh_handle_t destination)
+{
+	cranh_group_header_t* sourceHeader = cranh_retrieve_group_header(hierarchy, cranh_group_from_handle(source));
+	cranh_aabb_t bounds = *cranh_get_local_bounds(hierarchy, sourceHeader, cranh_index_from_handle(source));
+	if (bounds.min.x <= bounds.max.x)
+	{
+		cranh_set_local_bounds(hierarchy, destination, bounds);
+	}
+}
+#endif // CRANBERRY_BOUNDS
+
+// Interleaved subtrees have transforms in their range that aren't part of the subtree, we have to pick out the descendants one by one.
+// sourceRange is the range of the source before the new root was added, the new root might be one of it's descendants.
+cranh_handle_t cranh_clone_interleaved_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t sourceRoot, cranh_range_t sourceRange, cranh_handle_t newRoot)
+{
+	unsigned int sourceGroup = cranh_group_from_handle(sourceRoot);
+	cranh_group_header_t* sourceHeader = cranh_retrieve_group_header(hierarchy, sourceGroup);
+
+	unsigned int count = sourceRange.end - sourceRange.start + 1;
+	cranh_handle_t* clones = (cranh_handle_t*)malloc(sizeof(cranh_handle_t) * count);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		unsigned int sourceIndex = sourceRange.start + i;
+		cranh_handle_t parent = *cranh_get_parent(hierarchy, sourceHeader, sourceIndex);
+		unsigned int parentIndex = cranh_index_from_handle(parent);
+
+		cranh_handle_t newParent = { .value = cranh_invalid_handle };
+		if (parent.value == sourceRoot.value)
+		{
+			newParent = newRoot;
+		}
+		else if (parent.value != cranh_invalid_handle && parentIndex >= sourceRange.start && parentIndex < sourceIndex)
+		{
+			newParent = clones[parentIndex - sourceRange.start];
+		}
+
+		clones[i].value = cranh_invalid_handle;
+		if (newParent.value != cranh_invalid_handle)
+		{
+			clones[i] = cranh_add_with_parent(hierarchy, *cranh_get_local(hierarchy, sourceHeader, sourceIndex), newParent);
+#ifdef CRANBERRY_BOUNDS
+			cranh_copy_local_bounds(hierarchy, cranh_create_handle(sourceGroup, sourceIndex), clones[i]);
+#endif // CRANBERRY_BOUNDS
+		}
+	}
+
+	free(clones);
+	return newRoot;
+}
+
+cranh_handle_t cranh_clone_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t sourceRoot, cranh_handle_t newParent)
+{
+	unsigned int sourceGroup = cranh_group_from_handle(sourceRoot);
+	unsigned int sourceIndex = cranh_index_from_handle(sourceRoot);
+	cranh_group_header_t* sourceHeader = cranh_retrieve_group_header(hierarchy, sourceGroup);
+
+	cranm_transform_t rootLocal = *cranh_get_local(hierarchy, sourceHeader, sourceIndex);
+	cranh_range_t sourceRange = *cranh_get_children_range(hierarchy, sourceHeader, sourceIndex);
+	bool isInterleaved = (*cranh_get_flags(hierarchy, sourceHeader, sourceIndex) & cranh_node_flag_interleaved) != 0;
+	unsigned int blockCount = sourceRange.start == cranh_invalid_handle ? 0 : sourceRange.end - sourceRange.start + 1;
+
+	if (newParent.value == cranh_invalid_handle || isInterleaved || blockCount == 0)
+	{
+		cranh_handle_t newRoot = newParent.value == cranh_invalid_handle ?
+			cranh_add_to_group(hierarchy, rootLocal, sourceGroup) :
+			cranh_add_with_parent(hierarchy, rootLocal, newParent);
+#ifdef CRANBERRY_BOUNDS
+		cranh_copy_local_bounds(hierarchy, sourceRoot, newRoot);
+#endif // CRANBERRY_BOUNDS
+
+		if (isInterleaved)
+		{
+			return cranh_clone_interleaved_subtree(hierarchy, sourceRoot, sourceRange, newRoot);
+		}
+		else if (blockCount == 0)
+		{
+			return newRoot;
+		}
+	}
+
+	unsigned int group = newParent.value == cranh_invalid_handle ? sourceGroup : cranh_group_from_handle(newParent);
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+
+	// The root and it's descendants are laid out as a single contiguous block.
+	// If the new root was added as a root transform, it's already in place at the end of the buffer.
+	unsigned int rootIndex;
+	if (newParent.value == cranh_invalid_handle)
+	{
+		rootIndex = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize - header->currentRootTransformCount;
+	}
+	else
+	{
+		rootIndex = header->currentChildTransformCount;
+		++header->currentChildTransformCount;
+	}
+	unsigned int blockStart = header->currentChildTransformCount;
+	header->currentChildTransformCount += blockCount;
+
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(header->currentChildTransformCount < maxGroupSize - header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	cranh_handle_t newRoot = cranh_create_handle(group, rootIndex);
+	if (newParent.value != cranh_invalid_handle)
+	{
+		unsigned int parentIndex = cranh_index_from_handle(newParent);
+
+		*cranh_get_parent(hierarchy, header, rootIndex) = newParent;
+		*cranh_get_local(hierarchy, header, rootIndex) = rootLocal;
+		*cranh_get_global(hierarchy, header, rootIndex) = cranm_transform(rootLocal, *cranh_get_global(hierarchy, header, parentIndex));
+	}
+	uint8_t throttledFlag = newParent.value == cranh_invalid_handle ? 0 : *cranh_get_flags(hierarchy, header, cranh_index_from_handle(newParent)) & cranh_node_flag_throttled;
+	*cranh_get_flags(hierarchy, header, rootIndex) = throttledFlag;
+
+	memcpy(cranh_get_local(hierarchy, header, blockStart), cranh_get_local(hierarchy, sourceHeader, sourceRange.start), sizeof(cranm_transform_t) * blockCount);
+	memcpy(cranh_get_parent(hierarchy, header, blockStart), cranh_get_parent(hierarchy, sourceHeader, sourceRange.start), sizeof(cranh_handle_t) * blockCount);
+	memcpy(cranh_get_children_range(hierarchy, header, blockStart), cranh_get_children_range(hierarchy, sourceHeader, sourceRange.start), sizeof(cranh_range_t) * blockCount);
+	memcpy(cranh_get_flags(hierarchy, header, blockStart), cranh_get_flags(hierarchy, sourceHeader, sourceRange.start), sizeof(uint8_t) * blockCount);
+
+	// Clones are always dynamic, even if the source was baked, and they're only throttled if their new parent is.
+	uint8_t* cloneFlags = cranh_get_flags(hierarchy, header, blockStart);
+	for (unsigned int i = 0; i < blockCount; ++i)
+	{
+		cloneFlags[i] = (cloneFlags[i] & ~(cranh_node_flag_static | cranh_node_flag_throttled)) | throttledFlag;
+	}
+
+	unsigned int handleOffset = cranh_create_handle(group, blockStart).value - cranh_create_handle(sourceGroup, sourceRange.start).value;
+	cranh_rebase_parents(cranh_get_parent(hierarchy, header, blockStart), blockCount, sourceRoot, newRoot, handleOffset);
+	cranh_rebase_ranges(cranh_get_children_range(hierarchy, header, blockStart), blockCount, blockStart - sourceRange.start);
+
+	// Parents come before their children in the block, the globals are computed from the new root down like cranh_add_with_parent computes them.
+	cranm_transform_t* locals = cranh_get_local(hierarchy, header, 0);
+	cranm_transform_t* globals = cranh_get_global(hierarchy, header, 0);
+	cranh_handle_t* parents = cranh_get_parent(hierarchy, header, 0);
+	for (unsigned int i = blockStart; i < blockStart + blockCount; ++i)
+	{
+		globals[i] = cranm_transform(locals[i], globals[cranh_index_from_handle(parents[i])]);
+	}
+
+	cranh_range_t blockRange = { .start = blockStart, .end = blockStart + blockCount - 1 };
+	*cranh_get_children_range(hierarchy, header, rootIndex) = blockRange;
+	cranh_add_to_ancestor_ranges(hierarchy, header, newParent, (cranh_range_t) { .start = rootIndex, .end = blockRange.end });
+
+	cranh_dirty_add_child_interval(cranh_get_subtree_dirty_scheme(hierarchy, header), blockRange);
+
+#ifdef CRANBERRY_BOUNDS
+	if (newParent.value != cranh_invalid_handle)
+	{
+		cranh_copy_local_bounds(hierarchy, sourceRoot, newRoot);
+	}
+	for (unsigned int i = 0; i < blockCount; ++i)
+	{
+		cranh_copy_local_bounds(hierarchy, cranh_create_handle(sourceGroup, sourceRange.start + i), cranh_create_handle(group, blockStart + i));
+	}
+#endif // CRANBERRY_BOUNDS
+
+#ifdef CRANBERRY_RECORD
+	// The block is recorded as the adds it replaces, parents always come before their children in the block.
+	if (newParent.value != cranh_invalid_handle)
+	{
+		cranh_record_add(hierarchy, group, rootIndex, newParent, rootLocal);
+	}
+	for (unsigned int i = blockStart; i <= blockRange.end; ++i)
+	{
+		cranh_record_add(hierarchy, group, i, *cranh_get_parent(hierarchy, header, i), *cranh_get_local(hierarchy, header, i));
+	}
+#endif // CRANBERRY_RECORD
+
+	return newRoot;
+}
+
+cranh_throttle_t* cranh_find_throttle(cranh_group_header_t* header, unsigned int rootIndex)
+{
+	for (unsigned int i = 0; i < header->throttledRootCount; ++i)
+	{
+		if (header->throttledRoots[i].root == rootIndex)
+		{
+			return &header->throttledRoots[i];
+		}
+	}
+	return NULL;
+}
+
+unsigned int cranh_find_root(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, unsigned int index)
+{
+	for (cranh_handle_t parent = *cranh_get_parent(hierarchy, header, index); parent.value != cranh_invalid_handle; parent = *cranh_get_parent(hierarchy, header, index))
+	{
+		index = cranh_index_from_handle(parent);
+	}
+	return index;
+}
+
+// Writes to a throttled subtree only mark it's root as pending, the whole subtree is dirtied once it's due.
+void cranh_throttle_defer(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, unsigned int index)
+{
+	cranh_throttle_t* throttle = cranh_find_throttle(header, cranh_find_root(hierarchy, header, index));
+#ifdef CRANBERRY_DEBUG
+	assert(throttle != NULL);
+#endif // CRANBERRY_DEBUG
+	throttle->pending = 1;
+}
+
+void cranh_throttle_dirty(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme, cranh_throttle_t* throttle)
+{
+	cranh_dirty_add_root(dirtyScheme, throttle->root);
+
+	// The range might contain transforms that aren't ours, recomputing them is harmless.
+	cranh_range_t range = *cranh_get_children_range(hierarchy, header, throttle->root);
+	if (range.start != cranh_invalid_handle)
+	{
+		cranh_dirty_add_dynamic_interval(header, dirtyScheme, range);
+	}
+
+	throttle->pending = 0;
+	throttle->passesSinceUpdate = 0;
+}
+
+// Dirties the pending throttled subtrees that are due, before the pass starts.
+void cranh_throttle_flush(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme)
+{
+	for (unsigned int i = 0; i < header->throttledRootCount; ++i)
+	{
+		cranh_throttle_t* throttle = &header->throttledRoots[i];
+		throttle->passesSinceUpdate += throttle->passesSinceUpdate < throttle->interval ? 1 : 0;
+		if (throttle->pending && throttle->passesSinceUpdate >= throttle->interval)
+		{
+			cranh_throttle_dirty(hierarchy, header, dirtyScheme, throttle);
+		}
+	}
+}
+
+cranm_transform_t cranh_read_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+{
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	// Static globals don't follow their locals, the stored local is the only up to date one.
+	if (header->staticTransformCount > 0 && (*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_static))
+	{
+		return *cranh_get_local(hierarchy, header, index);
+	}
+
+	cranh_handle_t parentHandle = *cranh_get_parent(hierarchy, header, index);
+	if (parentHandle.value != cranh_invalid_handle)
+	{
+		// We don't need the parent group, it should be in the same group as the child
+		// unsigned int parentGroup = cranh_group_from_handle(parentHandle);
+		unsigned int parentIndex = cranh_index_from_handle(parentHandle);
+		return cranm_inverse_transform(*cranh_get_global(hierarchy, header, index), *cranh_get_global(hierarchy, header, parentIndex));
+	}
+	else
+	{
+		return *cranh_get_global(hierarchy, header, index);
+	}
+}
+
+void cranh_write_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranm_transform_t write)
+{
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_DEBUG
+	// Static transforms keep their baked globals, unbake them before moving them.
+	assert(header->staticTransformCount == 0 || !(*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_static));
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_write(hierarchy, handle, cranh_trace_op_write_local, write);
+#endif // CRANBERRY_RECORD
+
+	*cranh_get_local(hierarchy, header, index) = write;
+
+	// Static transforms stay out of the dirty windows
+	if (header->staticTransformCount > 0 && (*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_static))
+	{
+		return;
+	}
+
+	if (header->throttledRootCount > 0 && (*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_throttled))
+	{
+		cranh_throttle_defer(hierarchy, header, index);
+		return;
+	}
+
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_write_dirty_scheme(hierarchy, header, index);
+	cranh_range_t* childrenRange = cranh_get_children_range(hierarchy, header, index);
+
+	// If we're a transform at the end of the buffer, we're a root
+	if (index > header->currentChildTransformCount)
+	{
+		cranh_dirty_add_root(dirtyScheme, index);
+	}
+	else
+	{
+		cranh_dirty_add_child(dirtyScheme, index);
+	}
+
+	if (childrenRange->start != cranh_invalid_handle)
+	{
+		cranh_dirty_add_dynamic_interval(header, dirtyScheme, *childrenRange);
+	}
+}
+
+cranm_transform_t cranh_read_global(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+{
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	return *cranh_get_global(hierarchy, header, index);
+}
+
+void cranh_write_global(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranm_transform_t write)
+{
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_DEBUG
+	// Static transforms keep their baked globals, unbake them before moving them.
+	assert(header->staticTransformCount == 0 || !(*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_static));
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_write(hierarchy, handle, cranh_trace_op_write_global, write);
+#endif // CRANBERRY_RECORD
+
+	// If we're a child transform index, that means we have a parent
+	if (index < header->currentChildTransformCount)
 	{
 		cranh_handle_t parentHandle = *cranh_get_parent(hierarchy, header, index);
 
-		// Parent should be in the same group as the child
-		// unsigned int parentGroup = cranh_group_from_handle(parentHandle);
-		unsigned int parentIndex = cranh_index_from_handle(parentHandle);
+		// Parent should be in the same group as the child
+		// unsigned int parentGroup = cranh_group_from_handle(parentHandle);
+		unsigned int parentIndex = cranh_index_from_handle(parentHandle);
+
+		*cranh_get_local(hierarchy, header, index) = cranm_inverse_transform(write, *cranh_get_global(hierarchy, header, parentIndex));
+	}
+	else
+	{
+		*cranh_get_local(hierarchy, header, index) = write;
+	}
+
+	// Static transforms stay out of the dirty windows
+	if (header->staticTransformCount > 0 && (*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_static))
+	{
+		return;
+	}
+
+	if (header->throttledRootCount > 0 && (*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_throttled))
+	{
+		cranh_throttle_defer(hierarchy, header, index);
+		return;
+	}
+
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_write_dirty_scheme(hierarchy, header, index);
+	if (index < header->currentChildTransformCount)
+	{
+		cranh_dirty_add_child(dirtyScheme, index);
+	}
+	else
+	{
+		cranh_dirty_add_root(dirtyScheme, index);
+	}
+
+	cranh_range_t* childrenRange = cranh_get_children_range(hierarchy, header, index);
+	if (childrenRange->start != cranh_invalid_handle)
+	{
+		cranh_dirty_add_dynamic_interval(header, dirtyScheme, *childrenRange);
+	}
+}
+
+cranm_transform_t* cranh_write_locals_begin(cranh_hierarchy_t* hierarchy, cranh_handle_t first, unsigned int count)
+{
+	unsigned int group = cranh_group_from_handle(first);
+	unsigned int index = cranh_index_from_handle(first);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index + count <= header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#else
+	(void)count;
+#endif // CRANBERRY_DEBUG
+
+	return cranh_get_local(hierarchy, header, index);
+}
+
+void cranh_write_locals_end(cranh_hierarchy_t* hierarchy, cranh_handle_t first, unsigned int count)
+{
+	if (count == 0)
+	{
+		return;
+	}
+
+	unsigned int group = cranh_group_from_handle(first);
+	unsigned int index = cranh_index_from_handle(first);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+	cranh_range_t range = { .start = index, .end = index + count - 1 };
+
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(range.end < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+	assert(range.end < maxGroupSize);
+	for (unsigned int i = range.start; i <= range.end && header->staticTransformCount > 0; ++i)
+	{
+		// Static transforms keep their baked globals, unbake them before moving them.
+		assert(!(*cranh_get_flags(hierarchy, header, i) & cranh_node_flag_static));
+	}
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	for (unsigned int i = range.start; i <= range.end; ++i)
+	{
+		cranh_record_write(hierarchy, cranh_create_handle(group, i), cranh_trace_op_write_local, *cranh_get_local(hierarchy, header, i));
+	}
+#endif // CRANBERRY_RECORD
+
+	// Throttled transforms mark their roots, the range is only dirtied if some of it isn't throttled.
+	// Recomputing the throttled transforms with the rest is harmless, they're recomputed again once they're due.
+	if (header->throttledRootCount > 0)
+	{
+		uint8_t* flags = cranh_get_flags(hierarchy, header, range.start);
+		cranh_handle_t* parents = cranh_get_parent(hierarchy, header, range.start);
+		unsigned int throttledCount = 0;
+		unsigned int deferredParent = cranh_invalid_handle;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			if (flags[i] & cranh_node_flag_throttled)
+			{
+				// Siblings share their root
+				if (parents[i].value == cranh_invalid_handle || parents[i].value != deferredParent)
+				{
+					cranh_throttle_defer(hierarchy, header, range.start + i);
+					deferredParent = parents[i].value;
+				}
+				++throttledCount;
+			}
+		}
+
+		if (throttledCount == count)
+		{
+			return;
+		}
+	}
+
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_write_dirty_scheme(hierarchy, header, index);
+	cranh_dirty_add_range(dirtyScheme, range);
+	if (index < header->currentChildTransformCount)
+	{
+		dirtyScheme->childStart = range.start < dirtyScheme->childStart ? range.start & ~0x03 : dirtyScheme->childStart;
+		dirtyScheme->childEnd = range.end > dirtyScheme->childEnd ? range.end & ~0x03 : dirtyScheme->childEnd;
+	}
+	else
+	{
+		dirtyScheme->rootStart = range.start < dirtyScheme->rootStart ? range.start & ~0x03 : dirtyScheme->rootStart;
+		dirtyScheme->rootEnd = range.end > dirtyScheme->rootEnd ? range.end & ~0x03 : dirtyScheme->rootEnd;
+	}
+
+	// A single interval covers the descendants of the whole range, the transforms in between that aren't descendants are recomputed harmlessly.
+	cranh_range_t descendants = { .start = cranh_invalid_handle, .end = 0 };
+	cranh_range_t* childrenRange = cranh_get_children_range(hierarchy, header, range.start);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (childrenRange[i].start != cranh_invalid_handle)
+		{
+			descendants.start = childrenRange[i].start < descendants.start ? childrenRange[i].start : descendants.start;
+			descendants.end = childrenRange[i].end > descendants.end ? childrenRange[i].end : descendants.end;
+		}
+	}
+
+	if (descendants.start != cranh_invalid_handle)
+	{
+		cranh_dirty_add_dynamic_interval(header, dirtyScheme, descendants);
+	}
+}
+
+// Descendants in a children range always come after their parents.
+// If the range is interleaved, we have to tag the descendants as we go to tell them apart from the other transforms.
+bool cranh_is_descendant(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, unsigned int rootIndex, cranh_range_t range, bool isInterleaved, unsigned int index)
+{
+	if (!isInterleaved)
+	{
+		return true;
+	}
+
+	unsigned int parentIndex = cranh_index_from_handle(*cranh_get_parent(hierarchy, header, index));
+	bool isDescendant = parentIndex == rootIndex ||
+		(parentIndex >= range.start && parentIndex < index && (*cranh_get_flags(hierarchy, header, parentIndex) & cranh_node_flag_descendant));
+	if (isDescendant)
+	{
+		*cranh_get_flags(hierarchy, header, index) |= cranh_node_flag_descendant;
+	}
+	return isDescendant;
+}
+
+void cranh_clear_descendant_flags(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_range_t range)
+{
+	uint8_t* flags = cranh_get_flags(hierarchy, header, 0);
+	for (unsigned int i = range.start; i <= range.end; ++i)
+	{
+		flags[i] &= ~cranh_node_flag_descendant;
+	}
+}
+
+void cranh_bake_static(cranh_hierarchy_t* hierarchy, cranh_handle_t root)
+{
+	unsigned int group = cranh_group_from_handle(root);
+	unsigned int rootIndex = cranh_index_from_handle(root);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(rootIndex < header->currentChildTransformCount || maxGroupSize - rootIndex <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_subtree(hierarchy, root, cranh_trace_op_bake_static, 0);
+#endif // CRANBERRY_RECORD
+
+	uint8_t* rootFlags = cranh_get_flags(hierarchy, header, rootIndex);
+	cranh_handle_t rootParent = *cranh_get_parent(hierarchy, header, rootIndex);
+	if (rootParent.value != cranh_invalid_handle)
+	{
+		unsigned int parentIndex = cranh_index_from_handle(rootParent);
+		*cranh_get_global(hierarchy, header, rootIndex) = cranm_transform(*cranh_get_local(hierarchy, header, rootIndex), *cranh_get_global(hierarchy, header, parentIndex));
+	}
+	else
+	{
+		*cranh_get_global(hierarchy, header, rootIndex) = *cranh_get_local(hierarchy, header, rootIndex);
+	}
+	header->staticTransformCount += (*rootFlags & cranh_node_flag_static) ? 0 : 1;
+	*rootFlags |= cranh_node_flag_static;
+#ifdef CRANBERRY_BOUNDS
+	header->boundsDirty |= header->boundedTransformCount > 0;
+#endif // CRANBERRY_BOUNDS
+
+	cranh_range_t range = *cranh_get_children_range(hierarchy, header, rootIndex);
+	if (range.start == cranh_invalid_handle)
+	{
+		if (rootIndex < header->currentChildTransformCount)
+		{
+			cranh_static_spans_update(hierarchy, header, (cranh_range_t) { .start = rootIndex, .end = rootIndex });
+		}
+		return;
+	}
+
+	bool isInterleaved = (*rootFlags & cranh_node_flag_interleaved) != 0;
+	for (unsigned int i = range.start; i <= range.end; ++i)
+	{
+		if (cranh_is_descendant(hierarchy, header, rootIndex, range, isInterleaved, i))
+		{
+			unsigned int parentIndex = cranh_index_from_handle(*cranh_get_parent(hierarchy, header, i));
+			*cranh_get_global(hierarchy, header, i) = cranm_transform(*cranh_get_local(hierarchy, header, i), *cranh_get_global(hierarchy, header, parentIndex));
+
+			uint8_t* flags = cranh_get_flags(hierarchy, header, i);
+			header->staticTransformCount += (*flags & cranh_node_flag_static) ? 0 : 1;
+			*flags |= cranh_node_flag_static;
+		}
+	}
+
+	if (isInterleaved)
+	{
+		cranh_clear_descendant_flags(hierarchy, header, range);
+	}
+
+	// Children come after their parents, a child root and it's children form a single span if nothing is interleaved.
+	range.start = rootIndex < header->currentChildTransformCount ? rootIndex : range.start;
+	cranh_static_spans_update(hierarchy, header, range);
+}
+
+void cranh_unbake_static(cranh_hierarchy_t* hierarchy, cranh_handle_t root)
+{
+	unsigned int group = cranh_group_from_handle(root);
+	unsigned int rootIndex = cranh_index_from_handle(root);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(rootIndex < header->currentChildTransformCount || maxGroupSize - rootIndex <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_subtree(hierarchy, root, cranh_trace_op_unbake_static, 0);
+#endif // CRANBERRY_RECORD
+
+	uint8_t* rootFlags = cranh_get_flags(hierarchy, header, rootIndex);
+	header->staticTransformCount -= (*rootFlags & cranh_node_flag_static) ? 1 : 0;
+	*rootFlags &= ~cranh_node_flag_static;
+
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_subtree_dirty_scheme(hierarchy, header);
+	if (rootIndex < header->currentChildTransformCount)
+	{
+		cranh_dirty_add_child(dirtyScheme, rootIndex);
+	}
+	else
+	{
+		cranh_dirty_add_root(dirtyScheme, rootIndex);
+	}
+
+	cranh_range_t range = *cranh_get_children_range(hierarchy, header, rootIndex);
+	if (range.start == cranh_invalid_handle)
+	{
+		if (rootIndex < header->currentChildTransformCount)
+		{
+			cranh_static_spans_update(hierarchy, header, (cranh_range_t) { .start = rootIndex, .end = rootIndex });
+		}
+		return;
+	}
+
+	bool isInterleaved = (*rootFlags & cranh_node_flag_interleaved) != 0;
+	for (unsigned int i = range.start; i <= range.end; ++i)
+	{
+		if (cranh_is_descendant(hierarchy, header, rootIndex, range, isInterleaved, i))
+		{
+			uint8_t* flags = cranh_get_flags(hierarchy, header, i);
+			header->staticTransformCount -= (*flags & cranh_node_flag_static) ? 1 : 0;
+			*flags &= ~cranh_node_flag_static;
+		}
+	}
+
+	if (isInterleaved)
+	{
+		cranh_clear_descendant_flags(hierarchy, header, range);
+	}
+
+	cranh_range_t spanRange = range;
+	spanRange.start = rootIndex < header->currentChildTransformCount ? rootIndex : range.start;
+	cranh_static_spans_update(hierarchy, header, spanRange);
+
+	// The range might contain transforms that aren't ours, recomputing them is harmless.
+	cranh_dirty_add_dynamic_interval(header, dirtyScheme, range);
+}
+
+bool cranh_block_has_static(uint8_t* flags)
+{
+	uint32_t blockFlags;
+	memcpy(&blockFlags, flags, sizeof(uint32_t));
+	return (blockFlags & cranh_node_flag_static_block) != 0;
+}
+
+uint8_t cranh_bit_count(uint8_t i)
+{
+	i = ((i >> 1) & 0x55) + (i & 0x55);
+	i = ((i >> 2) & 0x33) + (i & 0x33);
+	i = ((i >> 4) & 0x0F) + (i & 0x0F);
+	return i;
+}
+
+#ifdef CRANBERRY_STATS
+// Records a scanned byte of the dirty stream, the pass only looks at the lanes in [laneStart, laneEnd).
+// Lanes outside of [liveStart, liveEnd) don't hold a transform. Returns the number of live transforms that were computed.
+unsigned int cranh_stats_add_block(cranh_stats_t* stats, unsigned int blockIndex, unsigned int laneStart, unsigned int laneEnd, unsigned int liveStart, unsigned int liveEnd, bool isDirty, uint8_t* flags)
+{
+	++stats->dirtyBytesScanned;
+
+	unsigned int liveComputed = 0;
+	for (unsigned int i = laneStart; i < laneEnd; ++i)
+	{
+		bool isLive = blockIndex + i >= liveStart && blockIndex + i < liveEnd;
+		if (!isDirty || (flags[i] & cranh_node_flag_static))
+		{
+			++stats->transformsSkipped;
+		}
+		else
+		{
+			++stats->transformsComputed;
+			stats->deadSlotsComputed += isLive ? 0 : 1;
+			liveComputed += isLive ? 1 : 0;
+		}
+	}
+	return liveComputed;
+}
+
+void cranh_stats_begin_pass(cranh_stats_t* stats, cranh_dirty_scheme_header_t* dirtyScheme)
+{
+	stats->dirtyRootsProcessed = 0;
+	stats->dirtyChildrenProcessed = 0;
+	stats->dirtyBytesScanned = 0;
+	stats->transformsComputed = 0;
+	stats->transformsSkipped = 0;
+	stats->deadSlotsComputed = 0;
+	stats->rootWindowSize = dirtyScheme->rootStart == cranh_invalid_handle ? 0 : dirtyScheme->rootEnd - dirtyScheme->rootStart + 4;
+	stats->childWindowSize = dirtyScheme->childStart == cranh_invalid_handle ? 0 : dirtyScheme->childEnd - dirtyScheme->childStart + 4;
+}
+#endif // CRANBERRY_STATS
+
+// Transforms the dirty roots and opens the pass, the children are transformed by cranh_pass_children.
+void cranh_pass_begin(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme)
+{
+	// The last block of children and the first block of roots can be the same block, neither pass can touch the other's lanes.
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	unsigned int firstRoot = maxGroupSize - header->currentRootTransformCount;
+
+	if (header->throttledRootCount > 0)
+	{
+		cranh_throttle_flush(hierarchy, header, dirtyScheme);
+	}
+
+#ifdef CRANBERRY_STATS
+	cranh_stats_begin_pass(&header->stats, dirtyScheme);
+#endif // CRANBERRY_STATS
+
+	// Transform root transforms
+	{
+		uint8_t* rootStart = cranh_dirty_read(dirtyScheme, dirtyScheme->rootStart);
+		uint8_t* rootEnd = cranh_dirty_read(dirtyScheme, dirtyScheme->rootEnd);
+
+		cranm_transform_t* localIter = cranh_get_local(hierarchy, header, dirtyScheme->rootStart);
+		cranm_transform_t* globalIter = cranh_get_global(hierarchy, header, dirtyScheme->rootStart);
+		uint8_t* flagIter = cranh_get_flags(hierarchy, header, dirtyScheme->rootStart);
+
+		unsigned int dirtyStack = 0;
+		unsigned int blockIndex = dirtyScheme->rootStart;
+		for (uint8_t* iter = rootStart; iter <= rootEnd; ++iter, localIter += 4, globalIter += 4, flagIter += 4, blockIndex += 4)
+		{
+			unsigned int laneStart = blockIndex < firstRoot ? firstRoot - blockIndex : 0;
+			// Lanes are 2 bits each, the flags of the children lanes are left for the children pass.
+			uint8_t childFlags = (uint8_t)((1 << (laneStart * 2)) - 1);
+			uint8_t rootFlags = *iter & ~childFlags;
+
+			dirtyStack += cranh_bit_count(rootFlags & cranh_dirty_start_bit_mask);
+			if (dirtyStack > 0)
+			{
+				if (laneStart == 0 && (header->staticTransformCount == 0 || !cranh_block_has_static(flagIter)))
+				{
+					memcpy(globalIter, localIter, sizeof(cranm_transform_t) * 4);
+				}
+				else
+				{
+					for (unsigned int i = laneStart; i < 4; ++i)
+					{
+						if (!(flagIter[i] & cranh_node_flag_static))
+						{
+							*(globalIter + i) = *(localIter + i);
+						}
+					}
+				}
+			}
+#ifdef CRANBERRY_STATS
+			header->stats.dirtyRootsProcessed += cranh_stats_add_block(&header->stats, blockIndex, laneStart, 4, firstRoot, maxGroupSize, dirtyStack > 0, flagIter);
+#endif // CRANBERRY_STATS
+			dirtyStack -= cranh_bit_count(rootFlags & cranh_dirty_end_bit_mask);
+			// Consume the flags, they would otherwise unbalance the intervals of the next step.
+			*iter &= childFlags;
+		}
+	}
+
+	dirtyScheme->rootStart = cranh_invalid_handle;
+	dirtyScheme->rootEnd = 0;
+	dirtyScheme->passCursor = 0;
+	dirtyScheme->passDirtyStack = 0;
+}
+
+// Transforms the dirty children of the blocks between the cursor and end.
+// Stops early once maxTransforms children were transformed, the cursor is left after the last block that was transformed.
+void cranh_pass_children(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme, unsigned int end, unsigned int maxTransforms)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	unsigned int firstRoot = maxGroupSize - header->currentRootTransformCount;
+
+	// Blocks before childStart are clean, blocks past childEnd are clean for now.
+	unsigned int start = dirtyScheme->passCursor > dirtyScheme->childStart ? dirtyScheme->passCursor : dirtyScheme->childStart;
+	unsigned int last = end - 1 < dirtyScheme->childEnd ? (end - 1) & ~0x03 : dirtyScheme->childEnd;
+	dirtyScheme->passCursor = ((end + 3) & ~0x03) > dirtyScheme->passCursor ? (end + 3) & ~0x03 : dirtyScheme->passCursor;
+	if (dirtyScheme->childStart == cranh_invalid_handle || start > last)
+	{
+		return;
+	}
+
+	{
+		uint8_t* childStart = cranh_dirty_read(dirtyScheme, start);
+		uint8_t* childEnd = cranh_dirty_read(dirtyScheme, last);
+
+		cranm_transform_t* localIter = cranh_get_local(hierarchy, header, start);
+		cranm_transform_t* globalIter = cranh_get_global(hierarchy, header, start);
+		cranh_handle_t* parentIter = cranh_get_parent(hierarchy, header, start);
+		uint8_t* flagIter = cranh_get_flags(hierarchy, header, start);
+
+		unsigned int dirtyStack = dirtyScheme->passDirtyStack;
+		unsigned int blockIndex = start;
+		unsigned int transformCount = 0;
+		for (uint8_t* iter = childStart; iter <= childEnd; ++iter, localIter += 4, globalIter += 4, parentIter += 4, flagIter += 4, blockIndex += 4)
+		{
+			unsigned int laneEnd = firstRoot - blockIndex < 4 ? firstRoot - blockIndex : 4;
+
+			dirtyStack += cranh_bit_count(*iter & cranh_dirty_start_bit_mask);
+			if (dirtyStack + dirtyScheme->childAlwaysDirty > 0)
+			{
+				transformCount += laneEnd;
+				bool hasStatic = header->staticTransformCount > 0 && cranh_block_has_static(flagIter);
+				for (unsigned int i = 0; i < laneEnd; ++i)
+				{
+					if (hasStatic && (flagIter[i] & cranh_node_flag_static))
+					{
+						continue;
+					}
+
+					unsigned int parentIndex = cranh_index_from_handle(*(parentIter + i));
+
+#ifdef CRANBERRY_DEBUG
+					// Blocks of 4 can extend past our last child, those transforms are unused.
+					intptr_t currentTransformIndex = localIter + i - cranh_get_local(hierarchy, header, 0);
+					assert(
+						currentTransformIndex >= header->currentChildTransformCount
+						|| (parentIndex < header->currentChildTransformCount && parentIndex < currentTransformIndex)
+						|| maxGroupSize - parentIndex <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+					cranm_transform_t* parent = cranh_get_global(hierarchy, header, parentIndex);
+					*(globalIter + i) = cranm_transform(*(localIter + i), *parent);
+				}
+			}
+#ifdef CRANBERRY_STATS
+			header->stats.dirtyChildrenProcessed += cranh_stats_add_block(&header->stats, blockIndex, 0, laneEnd, 0, header->currentChildTransformCount, dirtyStack + dirtyScheme->childAlwaysDirty > 0, flagIter);
+#endif // CRANBERRY_STATS
+			dirtyStack -= cranh_bit_count(*iter & cranh_dirty_end_bit_mask);
+			// Consume the flags, they would otherwise unbalance the intervals of the next step.
+			*iter = 0;
+
+			if (transformCount >= maxTransforms)
+			{
+				dirtyScheme->passCursor = blockIndex + 4;
+				break;
+			}
+		}
+		dirtyScheme->passDirtyStack = dirtyStack;
+	}
+}
+
+#ifdef CRANBERRY_BOUNDS
+bool cranh_is_empty_aabb(cranh_aabb_t bounds)
+{
+	return bounds.min.x > bounds.max.x;
+}
+
+cranh_aabb_t cranh_merge_aabb(cranh_aabb_t l, cranh_aabb_t r)
+{
+	return (cranh_aabb_t)
+	{
+		.min = { fminf(l.min.x, r.min.x), fminf(l.min.y, r.min.y), fminf(l.min.z, r.min.z) },
+		.max = { fmaxf(l.max.x, r.max.x), fmaxf(l.max.y, r.max.y), fmaxf(l.max.z, r.max.z) }
+	};
+}
+
+// The extent of the rotated box is the extent multiplied by the absolute of the rotation matrix.
+cranh_aabb_t cranh_transform_aabb(cranh_aabb_t bounds, cranm_transform_t transform)
+{
+	if (cranh_is_empty_aabb(bounds))
+	{
+		return bounds;
+	}
+
+	cranm_quat_t q = transform.rot;
+	float rotation[3][3] =
+	{
+		{ 1.0f - 2.0f * (q.y * q.y + q.z * q.z), 2.0f * (q.x * q.y - q.z * q.w), 2.0f * (q.x * q.z + q.y * q.w) },
+		{ 2.0f * (q.x * q.y + q.z * q.w), 1.0f - 2.0f * (q.x * q.x + q.z * q.z), 2.0f * (q.y * q.z - q.x * q.w) },
+		{ 2.0f * (q.x * q.z - q.y * q.w), 2.0f * (q.y * q.z + q.x * q.w), 1.0f - 2.0f * (q.x * q.x + q.y * q.y) }
+	};
+
+	// Negative scales mirror the center, the extent is symmetric
+	float scale = transform.scale * 0.5f;
+	float extentScale = fabsf(scale);
+	float center[3] = { (bounds.min.x + bounds.max.x) * scale, (bounds.min.y + bounds.max.y) * scale, (bounds.min.z + bounds.max.z) * scale };
+	float extent[3] = { (bounds.max.x - bounds.min.x) * extentScale, (bounds.max.y - bounds.min.y) * extentScale, (bounds.max.z - bounds.min.z) * extentScale };
+	float pos[3] = { transform.pos.x, transform.pos.y, transform.pos.z };
+
+	float min[3];
+	float max[3];
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		float c = pos[i] + rotation[i][0] * center[0] + rotation[i][1] * center[1] + rotation[i][2] * center[2];
+		float e = fabsf(rotation[i][0]) * extent[0] + fabsf(rotation[i][1]) * extent[1] + fabsf(rotation[i][2]) * extent[2];
+		min[i] = c - e;
+		max[i] = c + e;
+	}
+
+	return (cranh_aabb_t) { .min = { min[0], min[1], min[2] }, .max = { max[0], max[1], max[2] } };
+}
+
+void cranh_set_local_bounds(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranh_aabb_t bounds)
+{
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	cranh_aabb_t* localBounds = cranh_get_local_bounds(hierarchy, header, index);
+	header->boundedTransformCount -= cranh_is_empty_aabb(*localBounds) ? 0 : 1;
+	header->boundedTransformCount += cranh_is_empty_aabb(bounds) ? 0 : 1;
+	*localBounds = cranh_is_empty_aabb(bounds) ? cranh_empty_aabb() : bounds;
+	header->boundsDirty = 1;
+}
+
+cranh_aabb_t cranh_read_subtree_bounds(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+{
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	return *cranh_get_subtree_bounds(hierarchy, header, index);
+}
+
+// Children always come after their parents and roots are never children,
+// walking the children backwards completes every subtree before it's added to it's parent.
+void cranh_aggregate_bounds(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	unsigned int firstRoot = maxGroupSize - header->currentRootTransformCount;
+
+	cranh_aabb_t* localBounds = cranh_get_local_bounds(hierarchy, header, 0);
+	cranh_aabb_t* subtreeBounds = cranh_get_subtree_bounds(hierarchy, header, 0);
+	cranm_transform_t* globals = cranh_get_global(hierarchy, header, 0);
+	cranh_handle_t* parents = cranh_get_parent(hierarchy, header, 0);
+
+	for (unsigned int i = 0; i < header->currentChildTransformCount; ++i)
+	{
+		subtreeBounds[i] = cranh_transform_aabb(localBounds[i], globals[i]);
+	}
+	for (unsigned int i = firstRoot; i < maxGroupSize; ++i)
+	{
+		subtreeBounds[i] = cranh_transform_aabb(localBounds[i], globals[i]);
+	}
+
+	for (unsigned int i = header->currentChildTransformCount; i-- > 0;)
+	{
+		if (!cranh_is_empty_aabb(subtreeBounds[i]))
+		{
+			unsigned int parentIndex = cranh_index_from_handle(parents[i]);
+			subtreeBounds[parentIndex] = cranh_merge_aabb(subtreeBounds[parentIndex], subtreeBounds[i]);
+		}
+	}
+
+	header->boundsDirty = 0;
+}
+
+typedef enum
+{
+	cranh_query_type_ray,
+	cranh_query_type_sphere,
+	cranh_query_type_box
+} cranh_query_type_e;
+
+typedef struct
+{
+	cranh_query_type_e type;
+	cranm_vec_t a; // Ray origin, sphere center or box min
+	cranm_vec_t b; // Ray inverse direction or box max
+	float radius; // Ray max distance or sphere radius
+} cranh_query_t;
+
+bool cranh_query_test(const cranh_query_t* query, cranh_aabb_t bounds)
+{
+	if (cranh_is_empty_aabb(bounds))
+	{
+		return false;
+	}
+
+	switch (query->type)
+	{
+	case cranh_query_type_ray:
+	{
+		// Slab test, the min and max ignore the NaNs of the axes the ray is parallel to
+		float tMin = 0.0f;
+		float tMax = query->radius;
+		float origin[3] = { query->a.x, query->a.y, query->a.z };
+		float inverseDirection[3] = { query->b.x, query->b.y, query->b.z };
+		float min[3] = { bounds.min.x, bounds.min.y, bounds.min.z };
+		float max[3] = { bounds.max.x, bounds.max.y, bounds.max.z };
+		for (unsigned int i = 0; i < 3; ++i)
+		{
+			float t0 = (min[i] - origin[i]) * inverseDirection[i];
+			float t1 = (max[i] - origin[i]) * inverseDirection[i];
+			tMin = fmaxf(tMin, fminf(t0, t1));
+			tMax = fminf(tMax, fmaxf(t0, t1));
+		}
+		return tMin <= tMax;
+	}
+	case cranh_query_type_sphere:
+	{
+		float x = query->a.x - fmaxf(bounds.min.x, fminf(query->a.x, bounds.max.x));
+		float y = query->a.y - fmaxf(bounds.min.y, fminf(query->a.y, bounds.max.y));
+		float z = query->a.z - fmaxf(bounds.min.z, fminf(query->a.z, bounds.max.z));
+		return x * x + y * y + z * z <= query->radius * query->radius;
+	}
+	case cranh_query_type_box:
+	default:
+		return query->a.x <= bounds.max.x && bounds.min.x <= query->b.x
+			&& query->a.y <= bounds.max.y && bounds.min.y <= query->b.y
+			&& query->a.z <= bounds.max.z && bounds.min.z <= query->b.z;
+	}
+}
+
+// Subtrees that don't have interleaved children are stored as a single block, when their bounds are missed the whole block is skipped.
+// The skipped blocks are all disjoint and start after the transform being visited, we keep the next few sorted from the last to the first.
+// If there are more of them, the transforms of the others are tested one by one.
+#define cranh_query_max_skip_count 32
+
+unsigned int cranh_query(cranh_hierarchy_t* hierarchy, unsigned int group, const cranh_query_t* query, cranh_handle_t* results, unsigned int resultCapacity)
+{
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	unsigned int rootCount = header->currentRootTransformCount;
+	unsigned int transformCount = rootCount + header->currentChildTransformCount;
+
+	cranh_aabb_t* localBounds = cranh_get_local_bounds(hierarchy, header, 0);
+	cranh_aabb_t* subtreeBounds = cranh_get_subtree_bounds(hierarchy, header, 0);
+	cranm_transform_t* globals = cranh_get_global(hierarchy, header, 0);
+	cranh_range_t* childrenRanges = cranh_get_children_range(hierarchy, header, 0);
+	uint8_t* flags = cranh_get_flags(hierarchy, header, 0);
+
+	cranh_range_t skips[cranh_query_max_skip_count];
+	unsigned int skipCount = 0;
+	unsigned int hitCount = 0;
+
+	// Roots are visited first, their descendants are all children
+	for (unsigned int i = 0; i < transformCount; ++i)
+	{
+		unsigned int index = i < rootCount ? maxGroupSize - 1 - i : i - rootCount;
+		if (skipCount > 0 && skips[skipCount - 1].start == index)
+		{
+			--skipCount;
+			i += skips[skipCount].end - index;
+			continue;
+		}
+
+		if (!cranh_query_test(query, subtreeBounds[index]))
+		{
+			cranh_range_t childrenRange = childrenRanges[index];
+			if (childrenRange.start != cranh_invalid_handle && !(flags[index] & cranh_node_flag_interleaved) && skipCount < cranh_query_max_skip_count)
+			{
+				unsigned int insert = skipCount++;
+				for (; insert > 0 && skips[insert - 1].start < childrenRange.start; --insert)
+				{
+					skips[insert] = skips[insert - 1];
+				}
+				skips[insert] = childrenRange;
+			}
+			continue;
+		}
+
+		if (!cranh_is_empty_aabb(localBounds[index]) && cranh_query_test(query, cranh_transform_aabb(localBounds[index], globals[index])))
+		{
+			if (hitCount < resultCapacity)
+			{
+				results[hitCount] = cranh_create_handle(group, index);
+			}
+			++hitCount;
+		}
+	}
+	return hitCount;
+}
+
+unsigned int cranh_query_ray(cranh_hierarchy_t* hierarchy, unsigned int group, cranm_vec_t origin, cranm_vec_t direction, float maxDistance, cranh_handle_t* results, unsigned int resultCapacity)
+{
+	cranh_query_t query = { .type = cranh_query_type_ray, .a = origin, .b = { 1.0f / direction.x, 1.0f / direction.y, 1.0f / direction.z }, .radius = maxDistance };
+	return cranh_query(hierarchy, group, &query, results, resultCapacity);
+}
+
+unsigned int cranh_query_sphere(cranh_hierarchy_t* hierarchy, unsigned int group, cranm_vec_t center, float radius, cranh_handle_t* results, unsigned int resultCapacity)
+{
+	cranh_query_t query = { .type = cranh_query_type_sphere, .a = center, .radius = radius };
+	return cranh_query(hierarchy, group, &query, results, resultCapacity);
+}
+
+unsigned int cranh_query_box(cranh_hierarchy_t* hierarchy, unsigned int group, cranh_aabb_t box, cranh_handle_t* results, unsigned int resultCapacity)
+{
+	cranh_query_t query = { .type = cranh_query_type_box, .a = box.min, .b = box.max };
+	return cranh_query(hierarchy, group, &query, results, resultCapacity);
+}
+#endif // CRANBERRY_BOUNDS
+
+// Completes the pass, the writes that were left for the next pass become the group's dirty scheme.
+void cranh_pass_end(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme)
+{
+#ifdef CRANBERRY_STATS
+	// A tiled pass can grow the window after it started
+	header->stats.childWindowSize = dirtyScheme->childStart == cranh_invalid_handle ? 0 : dirtyScheme->childEnd - dirtyScheme->childStart + 4;
+#endif // CRANBERRY_STATS
+
+	cranh_dirty_reset(dirtyScheme);
+	header->activeDirtyScheme ^= 1;
+
+#ifdef CRANBERRY_BOUNDS
+	if (header->boundsDirty)
+	{
+		cranh_aggregate_bounds(hierarchy, header);
+	}
+#else
+	(void)hierarchy;
+#endif // CRANBERRY_BOUNDS
+}
+
+#ifdef CRANBERRY_BOUNDS
+// A tiled pass in progress might have already consumed it's windows, assume it moved something.
+void cranh_bounds_mark_pass(cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme)
+{
+	header->boundsDirty |= header->boundedTransformCount > 0 && (!cranh_dirty_is_empty(dirtyScheme) || dirtyScheme->passCursor != cranh_invalid_handle);
+}
+#endif // CRANBERRY_BOUNDS
+
+// The full pass, cranh_catch_up_subtree runs it without recording it a second time.
+void cranh_pass_complete(cranh_hierarchy_t* hierarchy, unsigned int group)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+
+	// A pass in progress is completed first, the writes it left behind get a pass of their own.
+	if (dirtyScheme->passCursor != cranh_invalid_handle)
+	{
+#ifdef CRANBERRY_BOUNDS
+		cranh_bounds_mark_pass(header, dirtyScheme);
+#endif // CRANBERRY_BOUNDS
+
+		cranh_pass_children(hierarchy, header, dirtyScheme, maxGroupSize, maxGroupSize);
+		cranh_pass_end(hierarchy, header, dirtyScheme);
+
+		dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+		if (cranh_dirty_is_empty(dirtyScheme))
+		{
+			return;
+		}
+	}
+
+#ifdef CRANBERRY_BOUNDS
+	cranh_bounds_mark_pass(header, dirtyScheme);
+#endif // CRANBERRY_BOUNDS
+
+	cranh_pass_begin(hierarchy, header, dirtyScheme);
+	cranh_pass_children(hierarchy, header, dirtyScheme, maxGroupSize, maxGroupSize);
+	cranh_pass_end(hierarchy, header, dirtyScheme);
+}
+
+void cranh_transform_locals_to_globals(cranh_hierarchy_t* hierarchy, unsigned int group)
+{
+#ifdef CRANBERRY_RECORD
+	cranh_record_pass(hierarchy, group);
+#endif // CRANBERRY_RECORD
+
+	cranh_pass_complete(hierarchy, group);
+}
+
+void cranh_transform_locals_to_globals_through(cranh_hierarchy_t* hierarchy, cranh_handle_t last)
+{
+#ifdef CRANBERRY_RECORD
+	cranh_record_subtree(hierarchy, last, cranh_trace_op_pass_through, 0);
+#endif // CRANBERRY_RECORD
+
+	unsigned int index = cranh_index_from_handle(last);
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, cranh_group_from_handle(last));
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+
+#ifdef CRANBERRY_DEBUG
+	assert(index < header->currentChildTransformCount);
+#endif // CRANBERRY_DEBUG
+
+	if (dirtyScheme->passCursor == cranh_invalid_handle)
+	{
+		cranh_pass_begin(hierarchy, header, dirtyScheme);
+	}
+	cranh_pass_children(hierarchy, header, dirtyScheme, index + 1, ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize);
+}
+
+bool cranh_transform_locals_to_globals_budget(cranh_hierarchy_t* hierarchy, unsigned int group, unsigned int maxTransforms)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+
+#ifdef CRANBERRY_BOUNDS
+	cranh_bounds_mark_pass(header, dirtyScheme);
+#endif // CRANBERRY_BOUNDS
 
-		*cranh_get_local(hierarchy, header, index) = cranm_inverse_transform(write, *cranh_get_global(hierarchy, header, parentIndex));
-		cranh_dirty_add_child(dirtyScheme, index);
-	}
-	else
+	if (dirtyScheme->passCursor == cranh_invalid_handle)
 	{
-		*cranh_get_local(hierarchy, header, index) = write;
-		cranh_dirty_add_root(dirtyScheme, index);
+		cranh_pass_begin(hierarchy, header, dirtyScheme);
 	}
+	cranh_pass_children(hierarchy, header, dirtyScheme, maxGroupSize, maxTransforms);
 
-	cranh_range_t* childrenRange = cranh_get_children_range(hierarchy, header, index);
-	if (childrenRange->start != cranh_invalid_handle)
+	// The window can grow ahead of the cursor between the calls
+	bool completed = dirtyScheme->childStart == cranh_invalid_handle || dirtyScheme->passCursor > dirtyScheme->childEnd;
+#ifdef CRANBERRY_RECORD
+	cranh_record_budget(hierarchy, group, maxTransforms, completed);
+#endif // CRANBERRY_RECORD
+
+	if (completed)
 	{
-		cranh_dirty_add_child_interval(dirtyScheme, *childrenRange);
+		cranh_pass_end(hierarchy, header, dirtyScheme);
 	}
+	return completed;
 }
 
-uint8_t cranh_bit_count(uint8_t i)
+bool cranh_set_update_interval(cranh_hierarchy_t* hierarchy, cranh_handle_t root, unsigned int interval)
 {
-	i = ((i >> 1) & 0x55) + (i & 0x55);
-	i = ((i >> 2) & 0x33) + (i & 0x33);
-	i = ((i >> 4) & 0x0F) + (i & 0x0F);
-	return i;
+	unsigned int group = cranh_group_from_handle(root);
+	unsigned int rootIndex = cranh_index_from_handle(root);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(maxGroupSize - rootIndex <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_subtree(hierarchy, root, cranh_trace_op_set_update_interval, interval);
+#endif // CRANBERRY_RECORD
+
+	cranh_throttle_t* throttle = cranh_find_throttle(header, rootIndex);
+	if (throttle != NULL && interval > 1)
+	{
+		throttle->interval = interval;
+		return true;
+	}
+	else if (throttle == NULL && interval <= 1)
+	{
+		return true;
+	}
+	else if (throttle == NULL && header->throttledRootCount == cranh_max_throttled_root_count)
+	{
+		return false;
+	}
+
+	if (throttle == NULL)
+	{
+		// Subtrees that share an interval start out of phase so that they aren't all due on the same pass
+		throttle = &header->throttledRoots[header->throttledRootCount];
+		*throttle = (cranh_throttle_t) { .root = rootIndex, .interval = interval, .passesSinceUpdate = header->throttledRootCount % interval, .pending = 0 };
+		++header->throttledRootCount;
+	}
+	else
+	{
+		if (throttle->pending)
+		{
+			cranh_throttle_dirty(hierarchy, header, cranh_get_subtree_dirty_scheme(hierarchy, header), throttle);
+		}
+		*throttle = header->throttledRoots[--header->throttledRootCount];
+	}
+
+	uint8_t throttledFlag = interval > 1 ? cranh_node_flag_throttled : 0;
+	uint8_t* rootFlags = cranh_get_flags(hierarchy, header, rootIndex);
+	*rootFlags = (*rootFlags & ~cranh_node_flag_throttled) | throttledFlag;
+
+	cranh_range_t range = *cranh_get_children_range(hierarchy, header, rootIndex);
+	if (range.start == cranh_invalid_handle)
+	{
+		return true;
+	}
+
+	bool isInterleaved = (*rootFlags & cranh_node_flag_interleaved) != 0;
+	for (unsigned int i = range.start; i <= range.end; ++i)
+	{
+		if (cranh_is_descendant(hierarchy, header, rootIndex, range, isInterleaved, i))
+		{
+			uint8_t* flags = cranh_get_flags(hierarchy, header, i);
+			*flags = (*flags & ~cranh_node_flag_throttled) | throttledFlag;
+		}
+	}
+
+	if (isInterleaved)
+	{
+		cranh_clear_descendant_flags(hierarchy, header, range);
+	}
+	return true;
 }
 
-void cranh_transform_locals_to_globals(cranh_hierarchy_t* hierarchy, unsigned int group)
+void cranh_catch_up_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
 {
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
 	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_subtree(hierarchy, handle, cranh_trace_op_catch_up_subtree, 0);
+#endif // CRANBERRY_RECORD
+
+	// Make the pending subtree due, the next pass dirties it
+	cranh_throttle_t* throttle = NULL;
+	if (header->throttledRootCount > 0 && (*cranh_get_flags(hierarchy, header, index) & cranh_node_flag_throttled))
+	{
+		throttle = cranh_find_throttle(header, cranh_find_root(hierarchy, header, index));
+		throttle->passesSinceUpdate = throttle->pending ? throttle->interval : throttle->passesSinceUpdate;
+	}
+
+	// The pass in progress has already gone past the writes that were left for the next pass
 	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+	bool isDue = throttle != NULL && throttle->pending;
+	if (dirtyScheme->passCursor != cranh_invalid_handle && (isDue || !cranh_dirty_is_empty(cranh_get_next_dirty_scheme(hierarchy, header))))
+	{
+		cranh_pass_complete(hierarchy, group);
+		dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+		isDue = throttle != NULL && throttle->pending;
+	}
 
-	// Transform root transforms
+	if (dirtyScheme->passCursor == cranh_invalid_handle)
 	{
-		uint8_t* rootStart = cranh_dirty_read(dirtyScheme, dirtyScheme->rootStart);
-		uint8_t* rootEnd = cranh_dirty_read(dirtyScheme, dirtyScheme->rootEnd);
+		if (!isDue && cranh_dirty_is_empty(dirtyScheme))
+		{
+			return;
+		}
+		cranh_pass_begin(hierarchy, header, dirtyScheme);
+	}
 
-		cranm_transform_t* localIter = cranh_get_local(hierarchy, header, dirtyScheme->rootStart);
-		cranm_transform_t* globalIter = cranh_get_global(hierarchy, header, dirtyScheme->rootStart);
+	// Roots are transformed when the pass starts, their descendants are in their children range
+	unsigned int last = index < header->currentChildTransformCount ? index : 0;
+	cranh_range_t range = *cranh_get_children_range(hierarchy, header, index);
+	last = range.start != cranh_invalid_handle && range.end > last ? range.end : last;
+	if (index < header->currentChildTransformCount || range.start != cranh_invalid_handle)
+	{
+		cranh_pass_children(hierarchy, header, dirtyScheme, last + 1, ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize);
+	}
+}
 
-		unsigned int dirtyStack = 0;
-		for (uint8_t* iter = rootStart; iter <= rootEnd; ++iter, localIter += 4, globalIter += 4)
+// Finds the highest transform on the path from index to it's root that the pass of dirtyScheme still has to transform.
+// The flags are counted per block like the pass counts them, a transform that shares a block with a dirty one is dirty as well.
+// Returns cranh_invalid_handle if the whole path is clean.
+unsigned int cranh_dirty_find_highest(cranh_hierarchy_t* hierarchy, cranh_group_header_t* header, cranh_dirty_scheme_header_t* dirtyScheme, unsigned int index)
+{
+	cranh_handle_t* parents = cranh_get_parent(hierarchy, header, 0);
+	unsigned int highest = cranh_invalid_handle;
+
+	// The intervals open at a block are counted once up to our block, our ancestors come before us and walk the count back.
+	// The blocks before the cursor were consumed by the pass in progress.
+	bool hasChildren = dirtyScheme->childStart != cranh_invalid_handle;
+	unsigned int start = dirtyScheme->passCursor != cranh_invalid_handle && dirtyScheme->passCursor > dirtyScheme->childStart ? dirtyScheme->passCursor : dirtyScheme->childStart;
+	int openCount = dirtyScheme->passCursor != cranh_invalid_handle ? (int)dirtyScheme->passDirtyStack : 0;
+	unsigned int blockIndex = start;
+
+	unsigned int current = index;
+	for (; current < header->currentChildTransformCount; current = cranh_index_from_handle(parents[current]))
+	{
+		unsigned int currentBlock = current & ~0x03;
+		if (!hasChildren || currentBlock < start || currentBlock > dirtyScheme->childEnd)
 		{
-			dirtyStack += cranh_bit_count(*iter & cranh_dirty_start_bit_mask);
-			if (dirtyStack > 0)
-			{
-				memcpy(globalIter, localIter, sizeof(cranm_transform_t) * 4);
-			}
-			dirtyStack -= cranh_bit_count(*iter & cranh_dirty_end_bit_mask);
+			continue;
+		}
+
+		for (; blockIndex < currentBlock; blockIndex += 4)
+		{
+			uint8_t flags = *cranh_dirty_read(dirtyScheme, blockIndex);
+			openCount += cranh_bit_count(flags & cranh_dirty_start_bit_mask) - cranh_bit_count(flags & cranh_dirty_end_bit_mask);
+		}
+		for (; blockIndex > currentBlock; blockIndex -= 4)
+		{
+			uint8_t flags = *cranh_dirty_read(dirtyScheme, blockIndex - 4);
+			openCount -= cranh_bit_count(flags & cranh_dirty_start_bit_mask) - cranh_bit_count(flags & cranh_dirty_end_bit_mask);
 		}
+
+		if (dirtyScheme->childAlwaysDirty > 0 || openCount + cranh_bit_count(*cranh_dirty_read(dirtyScheme, currentBlock) & cranh_dirty_start_bit_mask) > 0)
+		{
+			highest = current;
+		}
+	}
+
+	// current is our root now
+	if (dirtyScheme->rootStart != cranh_invalid_handle && (*cranh_dirty_read(dirtyScheme, current) & (cranh_dirty_start_flag << ((current & 0x03) << 1))))
+	{
+		highest = current;
+	}
+	return highest;
+}
+
+// Both transforms are on the same path, roots are above every child and children are above the ones that come after them.
+bool cranh_is_above(cranh_group_header_t* header, unsigned int index, unsigned int other)
+{
+	return other == cranh_invalid_handle || index >= header->currentChildTransformCount || (other < header->currentChildTransformCount && index < other);
+}
+
+void cranh_update_subtree(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+{
+	unsigned int group = cranh_group_from_handle(handle);
+	unsigned int index = cranh_index_from_handle(handle);
+
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
+#ifdef CRANBERRY_DEBUG
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	assert(index < header->currentChildTransformCount || maxGroupSize - index <= header->currentRootTransformCount);
+#endif // CRANBERRY_DEBUG
+
+#ifdef CRANBERRY_RECORD
+	cranh_record_subtree(hierarchy, handle, cranh_trace_op_update_subtree, 0);
+#endif // CRANBERRY_RECORD
+
+	uint8_t* flags = cranh_get_flags(hierarchy, header, 0);
+	if (header->staticTransformCount > 0 && (flags[index] & cranh_node_flag_static))
+	{
+		return;
+	}
+
+	cranm_transform_t* locals = cranh_get_local(hierarchy, header, 0);
+	cranm_transform_t* globals = cranh_get_global(hierarchy, header, 0);
+	cranh_handle_t* parents = cranh_get_parent(hierarchy, header, 0);
+
+	// If one of our ancestors is still dirty, our parent's global is stale. The path is transformed from the highest dirty
+	// ancestor and the flags are left to the pass, the intervals of our ancestors cover more than our subtree.
+	// Our own writes are done once we're transformed, they're cleared with the rest of the subtree.
+	unsigned int highest = cranh_invalid_handle;
+	cranh_handle_t parent = parents[index];
+	if (parent.value != cranh_invalid_handle)
+	{
+		unsigned int parentIndex = cranh_index_from_handle(parent);
+		highest = cranh_dirty_find_highest(hierarchy, header, cranh_get_dirty_scheme(hierarchy, header), parentIndex);
+		unsigned int nextHighest = cranh_dirty_find_highest(hierarchy, header, cranh_get_next_dirty_scheme(hierarchy, header), parentIndex);
+		highest = nextHighest != cranh_invalid_handle && cranh_is_above(header, nextHighest, highest) ? nextHighest : highest;
 	}
+	bool isPathDirty = highest != cranh_invalid_handle;
 
-	// Children transforms
+	// The path is marked from us up to it's top, then transformed top down in the order of the children.
+	unsigned int top = isPathDirty ? highest : index;
+	unsigned int first = index;
+	for (unsigned int i = index; i != top && i < header->currentChildTransformCount; i = cranh_index_from_handle(parents[i]))
 	{
-		uint8_t* childStart = cranh_dirty_read(dirtyScheme, dirtyScheme->childStart);
-		uint8_t* childEnd = cranh_dirty_read(dirtyScheme, dirtyScheme->childEnd);
+		flags[i] |= cranh_node_flag_descendant;
+		first = i;
+	}
 
-		cranm_transform_t* localIter = cranh_get_local(hierarchy, header, dirtyScheme->childStart);
-		cranm_transform_t* globalIter = cranh_get_global(hierarchy, header, dirtyScheme->childStart);
-		cranh_handle_t* parentIter = cranh_get_parent(hierarchy, header, dirtyScheme->childStart);
+	if (top < header->currentChildTransformCount)
+	{
+		flags[top] |= cranh_node_flag_descendant;
+		first = top;
+	}
+	else if ((flags[top] & cranh_node_flag_static) == 0)
+	{
+		globals[top] = locals[top];
+	}
 
-		unsigned int dirtyStack = 0;
-		for (uint8_t* iter = childStart; iter <= childEnd; ++iter, localIter += 4, globalIter += 4, parentIter += 4)
+	for (unsigned int i = first; i <= index; ++i)
+	{
+		if ((flags[i] & cranh_node_flag_descendant) == 0)
 		{
-			dirtyStack += cranh_bit_count(*iter & cranh_dirty_start_bit_mask);
-			if (dirtyStack > 0)
-			{
-				for (unsigned int i = 0; i < 4; ++i)
-				{
-					unsigned int parentIndex = cranh_index_from_handle(*(parentIter + i));
+			continue;
+		}
+
+		flags[i] &= ~cranh_node_flag_descendant;
+		if ((flags[i] & cranh_node_flag_static) == 0)
+		{
+			globals[i] = parents[i].value != cranh_invalid_handle ? cranm_transform(locals[i], globals[cranh_index_from_handle(parents[i])]) : locals[i];
+		}
+	}
+#ifdef CRANBERRY_BOUNDS
+	header->boundsDirty |= header->boundedTransformCount > 0;
+#endif // CRANBERRY_BOUNDS
+
+	cranh_range_t range = *cranh_get_children_range(hierarchy, header, index);
+	if (range.start == cranh_invalid_handle)
+	{
+		return;
+	}
+
+	bool isInterleaved = (flags[index] & cranh_node_flag_interleaved) != 0;
+	bool hasStatic = header->staticTransformCount > 0;
+	for (unsigned int i = range.start; i <= range.end; ++i)
+	{
+		// Static transforms are still marked, their dynamic children are part of the interleaved subtree.
+		if (!cranh_is_descendant(hierarchy, header, index, range, isInterleaved, i) || (hasStatic && (flags[i] & cranh_node_flag_static)))
+		{
+			continue;
+		}
+
+		globals[i] = cranm_transform(locals[i], globals[cranh_index_from_handle(parents[i])]);
+	}
+
+	if (isInterleaved)
+	{
+		cranh_clear_descendant_flags(hierarchy, header, range);
+		return;
+	}
+
+	// Every transform of the range was transformed, the intervals inside of it are done.
+	// The pass in progress has already consumed the flags before it's cursor.
+	// The intervals of a dirty path are split around static spans, the fragments inside of our range still belong to it.
+	if (isPathDirty)
+	{
+		return;
+	}
+
+	cranh_dirty_scheme_header_t* dirtyScheme = cranh_get_dirty_scheme(hierarchy, header);
+	unsigned int start = dirtyScheme->passCursor != cranh_invalid_handle && dirtyScheme->passCursor > range.start ? dirtyScheme->passCursor : range.start;
+	if (start <= range.end)
+	{
+		cranh_dirty_clear_intervals(dirtyScheme, start, range.end);
+	}
+	cranh_dirty_clear_intervals(cranh_get_next_dirty_scheme(hierarchy, header), range.start, range.end);
+}
+
+cranh_stats_t cranh_read_stats(cranh_hierarchy_t* hierarchy, unsigned int group)
+{
+	cranh_group_header_t* header = cranh_retrieve_group_header(hierarchy, group);
 
+	cranh_stats_t stats;
+#ifdef CRANBERRY_STATS
+	stats = header->stats;
+#else
+	memset(&stats, 0, sizeof(cranh_stats_t));
+#endif // CRANBERRY_STATS
+
+	stats.capacity = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	stats.rootCount = header->currentRootTransformCount;
+	stats.childCount = header->currentChildTransformCount;
+	stats.staticCount = header->staticTransformCount;
+	stats.freeSlots = stats.capacity - stats.rootCount - stats.childCount;
+	return stats;
+}
+
+// Instanced hierarchies
+
+typedef struct
+{
+	unsigned int nodeCount;
+	unsigned int instanceCount;
+	unsigned int blockCount;
+} cranh_instanced_header_t;
+
+// A single node for cranh_instance_lane_count instances.
+typedef struct
+{
+	float rotX[cranh_instance_lane_count];
+	float rotY[cranh_instance_lane_count];
+	float rotZ[cranh_instance_lane_count];
+	float rotW[cranh_instance_lane_count];
+	float posX[cranh_instance_lane_count];
+	float posY[cranh_instance_lane_count];
+	float posZ[cranh_instance_lane_count];
+	float scale[cranh_instance_lane_count];
+} cranh_lane_transform_t;
+
+// Buffer format:
+// header
+// parent indices [nodeCount]
+// local lane transforms [blockCount][nodeCount]
+// global lane transforms [blockCount][nodeCount]
+// Blocks are stored one after the other so that a block's parents are close to it's children.
+
+unsigned int cranh_instanced_buffer_size(unsigned int nodeCount, unsigned int instanceCount)
+{
+	unsigned int blockCount = (instanceCount + cranh_instance_lane_count - 1) / cranh_instance_lane_count;
+	return
+		sizeof(cranh_instanced_header_t) +
+		sizeof(unsigned int) * nodeCount +
+		sizeof(cranh_lane_transform_t) * 2 * nodeCount * blockCount + cranh_buffer_alignment; // Add 64 bytes, we might need that for alignment
+}
+
+cranh_instanced_t* cranh_instanced_create(const unsigned int* parents, unsigned int nodeCount, unsigned int instanceCount)
+{
+	void* buffer = malloc(cranh_instanced_buffer_size(nodeCount, instanceCount));
+	return cranh_instanced_buffer_create(buffer, parents, nodeCount, instanceCount);
+}
+
+void cranh_instanced_destroy(cranh_instanced_t* instanced)
+{
+	free(instanced);
+}
+
+cranh_instanced_t* cranh_instanced_buffer_create(void* buffer, const unsigned int* parents, unsigned int nodeCount, unsigned int instanceCount)
+{
 #ifdef CRANBERRY_DEBUG
-					unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	for (unsigned int i = 0; i < nodeCount; ++i)
+	{
+		assert(parents[i] == cranh_invalid_handle || parents[i] < i);
+	}
+#endif // CRANBERRY_DEBUG
 
-					intptr_t currentTransformIndex = localIter - cranh_get_local(hierarchy, header, dirtyScheme->childStart);
-					assert(
-						(parentIndex < header->currentChildTransformCount && parentIndex < currentTransformIndex)
-						|| maxGroupSize - parentIndex <= header->currentRootTransformCount);
+	// Zero out our buffer before we work with it
+	memset(buffer, 0, cranh_instanced_buffer_size(nodeCount, instanceCount));
+
+	cranh_instanced_header_t* header = (cranh_instanced_header_t*)buffer;
+	header->nodeCount = nodeCount;
+	header->instanceCount = instanceCount;
+	header->blockCount = (instanceCount + cranh_instance_lane_count - 1) / cranh_instance_lane_count;
+
+	memcpy(header + 1, parents, sizeof(unsigned int) * nodeCount);
+	return (cranh_instanced_t*)header;
+}
+
+unsigned int cranh_instanced_block_count(cranh_instanced_t* instanced)
+{
+	return ((cranh_instanced_header_t*)instanced)->blockCount;
+}
+
+unsigned int* cranh_instanced_get_parents(cranh_instanced_t* instanced)
+{
+	return (unsigned int*)((cranh_instanced_header_t*)instanced + 1);
+}
+
+// Locals are the first lane buffer
+cranh_lane_transform_t* cranh_instanced_get_locals(cranh_instanced_t* instanced, unsigned int block)
+{
+	cranh_instanced_header_t* header = (cranh_instanced_header_t*)instanced;
+
+	intptr_t bufferAddress = (intptr_t)(cranh_instanced_get_parents(instanced) + header->nodeCount);
+	bufferAddress += cranh_buffer_alignment - bufferAddress % cranh_buffer_alignment;
+	return (cranh_lane_transform_t*)bufferAddress + block * header->nodeCount;
+}
+
+// Globals are the second lane buffer
+cranh_lane_transform_t* cranh_instanced_get_globals(cranh_instanced_t* instanced, unsigned int block)
+{
+	cranh_instanced_header_t* header = (cranh_instanced_header_t*)instanced;
+	return cranh_instanced_get_locals(instanced, block) + header->blockCount * header->nodeCount;
+}
+
+cranm_transform_t cranh_lane_read(cranh_lane_transform_t* lanes, unsigned int lane)
+{
+	return (cranm_transform_t)
+	{
+		.rot = {.x = lanes->rotX[lane], .y = lanes->rotY[lane], .z = lanes->rotZ[lane], .w = lanes->rotW[lane] },
+		.pos = {.x = lanes->posX[lane], .y = lanes->posY[lane], .z = lanes->posZ[lane], .w = 0.0f },
+		.scale = lanes->scale[lane]
+	};
+}
+
+cranm_transform_t cranh_instanced_read_local(cranh_instanced_t* instanced, unsigned int instance, unsigned int node)
+{
+#ifdef CRANBERRY_DEBUG
+	assert(instance < ((cranh_instanced_header_t*)instanced)->instanceCount);
+	assert(node < ((cranh_instanced_header_t*)instanced)->nodeCount);
 #endif // CRANBERRY_DEBUG
 
-					cranm_transform_t* parent = cranh_get_global(hierarchy, header, parentIndex);
-					*(globalIter + i) = cranm_transform(*(localIter + i), *parent);
-				}
+	cranh_lane_transform_t* lanes = cranh_instanced_get_locals(instanced, instance / cranh_instance_lane_count) + node;
+	return cranh_lane_read(lanes, instance % cranh_instance_lane_count);
+}
+
+cranm_transform_t cranh_instanced_read_global(cranh_instanced_t* instanced, unsigned int instance, unsigned int node)
+{
+#ifdef CRANBERRY_DEBUG
+	assert(instance < ((cranh_instanced_header_t*)instanced)->instanceCount);
+	assert(node < ((cranh_instanced_header_t*)instanced)->nodeCount);
+#endif // CRANBERRY_DEBUG
+
+	cranh_lane_transform_t* lanes = cranh_instanced_get_globals(instanced, instance / cranh_instance_lane_count) + node;
+	return cranh_lane_read(lanes, instance % cranh_instance_lane_count);
+}
+
+void cranh_instanced_write_local(cranh_instanced_t* instanced, unsigned int instance, unsigned int node, cranm_transform_t write)
+{
+#ifdef CRANBERRY_DEBUG
+	assert(instance < ((cranh_instanced_header_t*)instanced)->instanceCount);
+	assert(node < ((cranh_instanced_header_t*)instanced)->nodeCount);
+#endif // CRANBERRY_DEBUG
+
+	cranh_lane_transform_t* lanes = cranh_instanced_get_locals(instanced, instance / cranh_instance_lane_count) + node;
+	unsigned int lane = instance % cranh_instance_lane_count;
+	lanes->rotX[lane] = write.rot.x;
+	lanes->rotY[lane] = write.rot.y;
+	lanes->rotZ[lane] = write.rot.z;
+	lanes->rotW[lane] = write.rot.w;
+	lanes->posX[lane] = write.pos.x;
+	lanes->posY[lane] = write.pos.y;
+	lanes->posZ[lane] = write.pos.z;
+	lanes->scale[lane] = write.scale;
+}
+
+cranm_lanes_transform_t cranh_lane_load(cranh_lane_transform_t* lanes, unsigned int lane)
+{
+	return (cranm_lanes_transform_t)
+	{
+		.rot = {.x = cranm_lanes_load(lanes->rotX + lane), .y = cranm_lanes_load(lanes->rotY + lane), .z = cranm_lanes_load(lanes->rotZ + lane), .w = cranm_lanes_load(lanes->rotW + lane) },
+		.pos = {.x = cranm_lanes_load(lanes->posX + lane), .y = cranm_lanes_load(lanes->posY + lane), .z = cranm_lanes_load(lanes->posZ + lane) },
+		.scale = cranm_lanes_load(lanes->scale + lane)
+	};
+}
+
+void cranh_lane_store(cranh_lane_transform_t* lanes, unsigned int lane, cranm_lanes_transform_t write)
+{
+	cranm_lanes_store(lanes->rotX + lane, write.rot.x);
+	cranm_lanes_store(lanes->rotY + lane, write.rot.y);
+	cranm_lanes_store(lanes->rotZ + lane, write.rot.z);
+	cranm_lanes_store(lanes->rotW + lane, write.rot.w);
+	cranm_lanes_store(lanes->posX + lane, write.pos.x);
+	cranm_lanes_store(lanes->posY + lane, write.pos.y);
+	cranm_lanes_store(lanes->posZ + lane, write.pos.z);
+	cranm_lanes_store(lanes->scale + lane, write.scale);
+}
+
+// cranm_transform(local, parent) for every lane, cranm_lane_width lanes at a time.
+// 8 wide with CRANBERRY_AVX2, 4 wide with CRANBERRY_SSE and one at a time otherwise.
+void cranh_lane_transform(cranh_lane_transform_t* local, cranh_lane_transform_t* parent, cranh_lane_transform_t* global)
+{
+	for (unsigned int i = 0; i < cranh_instance_lane_count; i += cranm_lane_width)
+	{
+		cranh_lane_store(global, i, cranm_lanes_transform(cranh_lane_load(local, i), cranh_lane_load(parent, i)));
+	}
+}
+
+void cranh_instanced_locals_to_globals(cranh_instanced_t* instanced, unsigned int blockStart, unsigned int blockEnd)
+{
+	cranh_instanced_header_t* header = (cranh_instanced_header_t*)instanced;
+	unsigned int* parents = cranh_instanced_get_parents(instanced);
+
+#ifdef CRANBERRY_DEBUG
+	assert(blockStart <= blockEnd && blockEnd <= header->blockCount);
+#endif // CRANBERRY_DEBUG
+
+	for (unsigned int block = blockStart; block < blockEnd; ++block)
+	{
+		cranh_lane_transform_t* locals = cranh_instanced_get_locals(instanced, block);
+		cranh_lane_transform_t* globals = cranh_instanced_get_globals(instanced, block);
+
+		// Parents always come before their children, their globals are always ready by the time we reach the child.
+		for (unsigned int node = 0; node < header->nodeCount; ++node)
+		{
+			unsigned int parent = parents[node];
+			if (parent == cranh_invalid_handle)
+			{
+				memcpy(globals + node, locals + node, sizeof(cranh_lane_transform_t));
+			}
+			else
+			{
+				cranh_lane_transform(locals + node, globals + parent, globals + node);
 			}
-			dirtyStack -= cranh_bit_count(*iter & cranh_dirty_end_bit_mask);
 		}
 	}
-
-	cranh_dirty_reset(dirtyScheme);
 }
 
-
 #endif // CRANBERRY_HIERARCHY_IMPL
 
 #endif // __CRANBERRY_HIERARCHY_H
@@ -0,0 +1,556 @@
+#ifndef __CRANBERRY_HIERARCHY_BACKENDS_H
+#define __CRANBERRY_HIERARCHY_BACKENDS_H
+
+#include "cranberry_math.h"
+
+//
+// cranberry_hierarchy_backends.h
+// @brief Reference transform hierarchy strategies behind the core cranh_* API of cranberry_hierarchy.h.
+// They exist to be compared against cranberry_hierarchy.h on identical workloads (see bench_hierarchy.c), not to be shipped.
+// Every backend keeps the groups and handles of cranberry_hierarchy.h, a group is an independent forest that can be
+// transformed on it's own thread, and the same stale-until-cranh_transform_locals_to_globals semantics.
+//
+// cranh_backend_pointer_tree: Every transform is it's own heap allocation linked to it's parent, first child and next sibling.
+//                             The pass recurses from every root and recomputes every transform.
+// cranh_backend_dirty_flags: The same pointer tree with a dirty flag per transform. The pass still visits every transform
+//                            but only recomputes the dirty ones and the descendants of a recomputed transform.
+// cranh_backend_level_order: Flat arrays sorted by depth, every parent comes before it's children and the siblings of a level
+//                            are contiguous. The order is rebuilt by the pass when transforms were added. A changed flag
+//                            is propagated from parents to children in a single linear sweep.
+// cranh_backend_recompute_all: Flat arrays in insertion order, a parent is always added before it's children.
+//                              The pass recomputes every transform in a single linear sweep without any dirty tracking.
+//
+// Only the core API is implemented: cranh_create, cranh_destroy, cranh_add, cranh_add_to_group, cranh_add_with_parent,
+// cranh_transform_locals_to_globals, cranh_read_local, cranh_write_local, cranh_read_global, cranh_write_global and cranh_group_from_handle.
+// Buffers, clones, static baking, stats and instanced hierarchies are only available in cranberry_hierarchy.h.
+//
+
+// #define CRANBERRY_HIERARCHY_BACKEND to one of the cranh_backend_* values to select the backend
+// #define CRANBERRY_HIERARCHY_BACKENDS_IMPL to enable the implementation in a translation unit
+// #define CRANBERRY_DEBUG to enable debug checks
+
+#ifdef __CRANBERRY_HIERARCHY_H
+#error cranberry_hierarchy_backends.h implements the cranh_* API and cannot be included with cranberry_hierarchy.h
+#endif // __CRANBERRY_HIERARCHY_H
+
+#define cranh_backend_pointer_tree 1
+#define cranh_backend_dirty_flags 2
+#define cranh_backend_level_order 3
+#define cranh_backend_recompute_all 4
+
+#ifndef CRANBERRY_HIERARCHY_BACKEND
+#define CRANBERRY_HIERARCHY_BACKEND cranh_backend_recompute_all
+#endif // CRANBERRY_HIERARCHY_BACKEND
+
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_pointer_tree
+#define cranh_backend_name "pointer_tree"
+#elif CRANBERRY_HIERARCHY_BACKEND == cranh_backend_dirty_flags
+#define cranh_backend_name "dirty_flags"
+#elif CRANBERRY_HIERARCHY_BACKEND == cranh_backend_level_order
+#define cranh_backend_name "level_order"
+#elif CRANBERRY_HIERARCHY_BACKEND == cranh_backend_recompute_all
+#define cranh_backend_name "recompute_all"
+#else
+#error Unknown CRANBERRY_HIERARCHY_BACKEND
+#endif
+
+// Types
+
+typedef struct _cranh_hierarchy_t cranh_hierarchy_t;
+typedef struct { unsigned int value; } cranh_handle_t;
+
+#define cranh_invalid_handle ~0U
+
+// API
+
+unsigned int cranh_group_from_handle(cranh_handle_t handle);
+
+// @brief Create a cranh_hierarchy_t.
+// @param groupBufferCount determines the number of transform "groups" the hierarchy supports.
+// @param maxGroupTransformCount Determines the maximum number of transforms this hierarchy can support per group.
+// WARNING: This function allocates memory with the standard malloc. It must be released with cranh_destroy.
+cranh_hierarchy_t* cranh_create(unsigned int groupBufferCount, unsigned int maxGroupTransformCount);
+void cranh_destroy(cranh_hierarchy_t* hierarchy);
+
+cranh_handle_t cranh_add(cranh_hierarchy_t* hierarchy, cranm_transform_t value);
+cranh_handle_t cranh_add_to_group(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, unsigned int group);
+cranh_handle_t cranh_add_with_parent(cranh_hierarchy_t* hierarchy, cranm_transform_t value, cranh_handle_t parent);
+
+void cranh_transform_locals_to_globals(cranh_hierarchy_t* hierarchy, unsigned int group);
+
+cranm_transform_t cranh_read_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle);
+void cranh_write_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranm_transform_t write);
+cranm_transform_t cranh_read_global(cranh_hierarchy_t* hierarchy, cranh_handle_t transform);
+void cranh_write_global(cranh_hierarchy_t* hierarchy, cranh_handle_t transform, cranm_transform_t write);
+
+// IMPL
+
+#ifdef CRANBERRY_HIERARCHY_BACKENDS_IMPL
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#ifdef CRANBERRY_DEBUG
+	#include <assert.h>
+#endif // CRANBERRY_DEBUG
+
+#define cranh_group_bit_count 8
+#define cranh_transform_bit_count (32 - cranh_group_bit_count)
+#define cranh_max_transform_count ((1 << cranh_transform_bit_count) - 1)
+
+#define cranh_backend_is_pointer_tree (CRANBERRY_HIERARCHY_BACKEND == cranh_backend_pointer_tree || CRANBERRY_HIERARCHY_BACKEND == cranh_backend_dirty_flags)
+
+typedef struct _cranh_node_t
+{
+	cranm_transform_t local;
+	cranm_transform_t global;
+	struct _cranh_node_t* parent;
+	struct _cranh_node_t* firstChild;
+	struct _cranh_node_t* lastChild;
+	struct _cranh_node_t* nextSibling;
+	bool isDirty;
+} cranh_node_t;
+
+typedef struct
+{
+	unsigned int transformCount;
+
+	// Pointer trees, indexed by handle
+	cranh_node_t** nodes;
+	cranh_node_t* firstRoot;
+	cranh_node_t* lastRoot;
+
+	// Flat arrays, indexed by handle
+	cranm_transform_t* locals;
+	cranm_transform_t* globals;
+	unsigned int* parents;
+
+	// Level order. Locals and globals are stored in level order, handles are redirected through slots.
+	// The parents are the slots of the parents.
+	unsigned int* slots; // handle index -> slot
+	unsigned int* depths; // handle index -> depth
+	uint8_t* changed; // slot -> dirty or moved with it's parent
+	unsigned int levelOrderCount; // Transforms added after the last rebuild are appended in insertion order
+} cranh_group_t;
+
+typedef struct
+{
+	unsigned int nextGroup;
+	unsigned int groupCount;
+	unsigned int maxGroupSize;
+	cranh_group_t* groups;
+} cranh_hierarchy_header_t;
+
+unsigned int cranh_group_from_handle(cranh_handle_t handle)
+{
+	return (handle.value >> cranh_transform_bit_count);
+}
+
+unsigned int cranh_index_from_handle(cranh_handle_t handle)
+{
+	return handle.value & cranh_max_transform_count;
+}
+
+cranh_handle_t cranh_create_handle(unsigned int group, unsigned int index)
+{
+	return (cranh_handle_t) { .value = (group << cranh_transform_bit_count) | index };
+}
+
+cranh_group_t* cranh_retrieve_group(cranh_hierarchy_t* hierarchy, unsigned int group)
+{
+	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)hierarchy;
+#ifdef CRANBERRY_DEBUG
+	assert(group < hierarchyHeader->groupCount);
+#endif // CRANBERRY_DEBUG
+	return &hierarchyHeader->groups[group];
+}
+
+cranh_hierarchy_t* cranh_create(unsigned int groupCount, unsigned int maxGroupTransformCount)
+{
+	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)malloc(sizeof(cranh_hierarchy_header_t));
+	hierarchyHeader->nextGroup = 0;
+	hierarchyHeader->groupCount = groupCount;
+	hierarchyHeader->maxGroupSize = maxGroupTransformCount;
+	hierarchyHeader->groups = (cranh_group_t*)calloc(groupCount, sizeof(cranh_group_t));
+
+	for (unsigned int i = 0; i < groupCount; ++i)
+	{
+		cranh_group_t* group = &hierarchyHeader->groups[i];
+#if cranh_backend_is_pointer_tree
+		group->nodes = (cranh_node_t**)malloc(sizeof(cranh_node_t*) * maxGroupTransformCount);
+#else
+		group->locals = (cranm_transform_t*)malloc(sizeof(cranm_transform_t) * maxGroupTransformCount);
+		group->globals = (cranm_transform_t*)malloc(sizeof(cranm_transform_t) * maxGroupTransformCount);
+		group->parents = (unsigned int*)malloc(sizeof(unsigned int) * maxGroupTransformCount);
+#endif // cranh_backend_is_pointer_tree
+
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_level_order
+		group->slots = (unsigned int*)malloc(sizeof(unsigned int) * maxGroupTransformCount);
+		group->depths = (unsigned int*)malloc(sizeof(unsigned int) * maxGroupTransformCount);
+		group->changed = (uint8_t*)malloc(maxGroupTransformCount);
+#endif // cranh_backend_level_order
+	}
+
+	return (cranh_hierarchy_t*)hierarchyHeader;
+}
+
+void cranh_destroy(cranh_hierarchy_t* hierarchy)
+{
+	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)hierarchy;
+	for (unsigned int i = 0; i < hierarchyHeader->groupCount; ++i)
+	{
+		cranh_group_t* group = &hierarchyHeader->groups[i];
+		if (group->nodes != NULL)
+		{
+			for (unsigned int n = 0; n < group->transformCount; ++n)
+			{
+				free(group->nodes[n]);
+			}
+		}
+
+		free(group->nodes);
+		free(group->locals);
+		free(group->globals);
+		free(group->parents);
+		free(group->slots);
+		free(group->depths);
+		free(group->changed);
+	}
+
+	free(hierarchyHeader->groups);
+	free(hierarchyHeader);
+}
+
+// The flat backends address their arrays through this, level order redirects the handle to it's slot.
+unsigned int cranh_slot_from_index(cranh_group_t* group, unsigned int index)
+{
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_level_order
+	return group->slots[index];
+#else
+	(void)group;
+	return index;
+#endif // cranh_backend_level_order
+}
+
+void cranh_mark_dirty(cranh_group_t* group, unsigned int index)
+{
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_dirty_flags
+	group->nodes[index]->isDirty = true;
+#elif CRANBERRY_HIERARCHY_BACKEND == cranh_backend_level_order
+	group->changed[group->slots[index]] = 1;
+#else
+	// The other backends recompute everything
+	(void)group;
+	(void)index;
+#endif
+}
+
+cranh_handle_t cranh_add_internal(cranh_group_t* group, unsigned int groupIndex, cranm_transform_t transform, unsigned int parentIndex, unsigned int maxGroupSize)
+{
+	unsigned int index = group->transformCount++;
+#ifdef CRANBERRY_DEBUG
+	assert(index < maxGroupSize);
+	assert(parentIndex == cranh_invalid_handle || parentIndex < index);
+#else
+	(void)maxGroupSize;
+#endif // CRANBERRY_DEBUG
+
+#if cranh_backend_is_pointer_tree
+	cranh_node_t* node = (cranh_node_t*)malloc(sizeof(cranh_node_t));
+	node->local = transform;
+	node->firstChild = NULL;
+	node->lastChild = NULL;
+	node->nextSibling = NULL;
+	node->isDirty = false;
+	group->nodes[index] = node;
+
+	if (parentIndex == cranh_invalid_handle)
+	{
+		node->parent = NULL;
+		node->global = transform;
+		if (group->lastRoot != NULL)
+		{
+			group->lastRoot->nextSibling = node;
+		}
+		else
+		{
+			group->firstRoot = node;
+		}
+		group->lastRoot = node;
+	}
+	else
+	{
+		cranh_node_t* parent = group->nodes[parentIndex];
+		node->parent = parent;
+		node->global = cranm_transform(transform, parent->global);
+		if (parent->lastChild != NULL)
+		{
+			parent->lastChild->nextSibling = node;
+		}
+		else
+		{
+			parent->firstChild = node;
+		}
+		parent->lastChild = node;
+	}
+#else
+	// New transforms are appended, the level order is rebuilt by the next pass
+	unsigned int slot = index;
+	unsigned int parentSlot = parentIndex == cranh_invalid_handle ? cranh_invalid_handle : cranh_slot_from_index(group, parentIndex);
+
+	group->locals[slot] = transform;
+	group->globals[slot] = parentSlot == cranh_invalid_handle ? transform : cranm_transform(transform, group->globals[parentSlot]);
+	group->parents[slot] = parentSlot;
+
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_level_order
+	group->slots[index] = slot;
+	group->depths[index] = parentIndex == cranh_invalid_handle ? 0 : group->depths[parentIndex] + 1;
+	group->changed[slot] = 0;
+#endif // cranh_backend_level_order
+#endif // cranh_backend_is_pointer_tree
+
+	return cranh_create_handle(groupIndex, index);
+}
+
+cranh_handle_t cranh_add(cranh_hierarchy_t* hierarchy, cranm_transform_t transform)
+{
+	cranh_hierarchy_header_t* hierarchyHeader = (cranh_hierarchy_header_t*)hierarchy;
+
+	unsigned int group = hierarchyHeader->nextGroup;
+	hierarchyHeader->nextGroup = (hierarchyHeader->nextGroup + 1) % hierarchyHeader->groupCount;
+	return cranh_add_to_group(hierarchy, transform, group);
+}
+
+cranh_handle_t cranh_add_to_group(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, unsigned int group)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	return cranh_add_internal(cranh_retrieve_group(hierarchy, group), group, transform, cranh_invalid_handle, maxGroupSize);
+}
+
+cranh_handle_t cranh_add_with_parent(cranh_hierarchy_t* hierarchy, cranm_transform_t transform, cranh_handle_t parentHandle)
+{
+	unsigned int maxGroupSize = ((cranh_hierarchy_header_t*)hierarchy)->maxGroupSize;
+	unsigned int group = cranh_group_from_handle(parentHandle);
+	return cranh_add_internal(cranh_retrieve_group(hierarchy, group), group, transform, cranh_index_from_handle(parentHandle), maxGroupSize);
+}
+
+cranm_transform_t cranh_read_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+{
+	cranh_group_t* group = cranh_retrieve_group(hierarchy, cranh_group_from_handle(handle));
+	unsigned int index = cranh_index_from_handle(handle);
+#ifdef CRANBERRY_DEBUG
+	assert(index < group->transformCount);
+#endif // CRANBERRY_DEBUG
+
+#if cranh_backend_is_pointer_tree
+	return group->nodes[index]->local;
+#else
+	return group->locals[cranh_slot_from_index(group, index)];
+#endif // cranh_backend_is_pointer_tree
+}
+
+void cranh_write_local(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranm_transform_t write)
+{
+	cranh_group_t* group = cranh_retrieve_group(hierarchy, cranh_group_from_handle(handle));
+	unsigned int index = cranh_index_from_handle(handle);
+#ifdef CRANBERRY_DEBUG
+	assert(index < group->transformCount);
+#endif // CRANBERRY_DEBUG
+
+#if cranh_backend_is_pointer_tree
+	group->nodes[index]->local = write;
+#else
+	group->locals[cranh_slot_from_index(group, index)] = write;
+#endif // cranh_backend_is_pointer_tree
+	cranh_mark_dirty(group, index);
+}
+
+cranm_transform_t cranh_read_global(cranh_hierarchy_t* hierarchy, cranh_handle_t handle)
+{
+	cranh_group_t* group = cranh_retrieve_group(hierarchy, cranh_group_from_handle(handle));
+	unsigned int index = cranh_index_from_handle(handle);
+#ifdef CRANBERRY_DEBUG
+	assert(index < group->transformCount);
+#endif // CRANBERRY_DEBUG
+
+#if cranh_backend_is_pointer_tree
+	return group->nodes[index]->global;
+#else
+	return group->globals[cranh_slot_from_index(group, index)];
+#endif // cranh_backend_is_pointer_tree
+}
+
+void cranh_write_global(cranh_hierarchy_t* hierarchy, cranh_handle_t handle, cranm_transform_t write)
+{
+	cranh_group_t* group = cranh_retrieve_group(hierarchy, cranh_group_from_handle(handle));
+	unsigned int index = cranh_index_from_handle(handle);
+#ifdef CRANBERRY_DEBUG
+	assert(index < group->transformCount);
+#endif // CRANBERRY_DEBUG
+
+#if cranh_backend_is_pointer_tree
+	cranh_node_t* node = group->nodes[index];
+	node->local = node->parent != NULL ? cranm_inverse_transform(write, node->parent->global) : write;
+#else
+	unsigned int slot = cranh_slot_from_index(group, index);
+	unsigned int parentSlot = group->parents[slot];
+	group->locals[slot] = parentSlot != cranh_invalid_handle ? cranm_inverse_transform(write, group->globals[parentSlot]) : write;
+#endif // cranh_backend_is_pointer_tree
+	cranh_mark_dirty(group, index);
+}
+
+// Passes
+
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_pointer_tree
+void cranh_transform_node(cranh_node_t* node, const cranm_transform_t* parentGlobal)
+{
+	node->global = parentGlobal != NULL ? cranm_transform(node->local, *parentGlobal) : node->local;
+	for (cranh_node_t* child = node->firstChild; child != NULL; child = child->nextSibling)
+	{
+		cranh_transform_node(child, &node->global);
+	}
+}
+#endif // cranh_backend_pointer_tree
+
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_dirty_flags
+void cranh_transform_node(cranh_node_t* node, const cranm_transform_t* parentGlobal, bool parentChanged)
+{
+	bool changed = node->isDirty || parentChanged;
+	if (changed)
+	{
+		node->global = parentGlobal != NULL ? cranm_transform(node->local, *parentGlobal) : node->local;
+		node->isDirty = false;
+	}
+
+	for (cranh_node_t* child = node->firstChild; child != NULL; child = child->nextSibling)
+	{
+		cranh_transform_node(child, &node->global, changed);
+	}
+}
+#endif // cranh_backend_dirty_flags
+
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_level_order
+// Counting sort of every transform by depth. Siblings keep their insertion order within a level.
+void cranh_rebuild_level_order(cranh_group_t* group)
+{
+	unsigned int count = group->transformCount;
+	unsigned int maxDepth = 0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		maxDepth = group->depths[i] > maxDepth ? group->depths[i] : maxDepth;
+	}
+
+	unsigned int* levelStarts = (unsigned int*)calloc(maxDepth + 2, sizeof(unsigned int));
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		++levelStarts[group->depths[i] + 1];
+	}
+	for (unsigned int d = 1; d <= maxDepth + 1; ++d)
+	{
+		levelStarts[d] += levelStarts[d - 1];
+	}
+
+	cranm_transform_t* locals = (cranm_transform_t*)malloc(sizeof(cranm_transform_t) * count);
+	cranm_transform_t* globals = (cranm_transform_t*)malloc(sizeof(cranm_transform_t) * count);
+	unsigned int* parents = (unsigned int*)malloc(sizeof(unsigned int) * count);
+	uint8_t* changed = (uint8_t*)malloc(count);
+	unsigned int* slots = (unsigned int*)malloc(sizeof(unsigned int) * count);
+
+	// Handles are visited in insertion order, parents get their new slot before their children
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		unsigned int oldSlot = group->slots[i];
+		unsigned int newSlot = levelStarts[group->depths[i]]++;
+		slots[i] = newSlot;
+
+		unsigned int oldParentSlot = group->parents[oldSlot];
+		locals[newSlot] = group->locals[oldSlot];
+		globals[newSlot] = group->globals[oldSlot];
+		changed[newSlot] = group->changed[oldSlot];
+		parents[newSlot] = oldParentSlot;
+	}
+
+	// Parents were stored as old slots, map them through the parent's handle
+	unsigned int* oldSlotToIndex = (unsigned int*)malloc(sizeof(unsigned int) * count);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		oldSlotToIndex[group->slots[i]] = i;
+	}
+	for (unsigned int s = 0; s < count; ++s)
+	{
+		parents[s] = parents[s] == cranh_invalid_handle ? cranh_invalid_handle : slots[oldSlotToIndex[parents[s]]];
+	}
+
+	memcpy(group->locals, locals, sizeof(cranm_transform_t) * count);
+	memcpy(group->globals, globals, sizeof(cranm_transform_t) * count);
+	memcpy(group->parents, parents, sizeof(unsigned int) * count);
+	memcpy(group->changed, changed, count);
+	memcpy(group->slots, slots, sizeof(unsigned int) * count);
+	group->levelOrderCount = count;
+
+	free(levelStarts);
+	free(locals);
+	free(globals);
+	free(parents);
+	free(changed);
+	free(slots);
+	free(oldSlotToIndex);
+}
+#endif // cranh_backend_level_order
+
+void cranh_transform_locals_to_globals(cranh_hierarchy_t* hierarchy, unsigned int groupIndex)
+{
+	cranh_group_t* group = cranh_retrieve_group(hierarchy, groupIndex);
+
+#if CRANBERRY_HIERARCHY_BACKEND == cranh_backend_pointer_tree
+	for (cranh_node_t* root = group->firstRoot; root != NULL; root = root->nextSibling)
+	{
+		cranh_transform_node(root, NULL);
+	}
+#elif CRANBERRY_HIERARCHY_BACKEND == cranh_backend_dirty_flags
+	for (cranh_node_t* root = group->firstRoot; root != NULL; root = root->nextSibling)
+	{
+		cranh_transform_node(root, NULL, false);
+	}
+#elif CRANBERRY_HIERARCHY_BACKEND == cranh_backend_level_order
+	if (group->levelOrderCount != group->transformCount)
+	{
+		cranh_rebuild_level_order(group);
+	}
+
+	for (unsigned int s = 0; s < group->transformCount; ++s)
+	{
+		unsigned int parentSlot = group->parents[s];
+		if (parentSlot == cranh_invalid_handle)
+		{
+			if (group->changed[s])
+			{
+				group->globals[s] = group->locals[s];
+			}
+		}
+		else
+		{
+			group->changed[s] |= group->changed[parentSlot];
+			if (group->changed[s])
+			{
+				group->globals[s] = cranm_transform(group->locals[s], group->globals[parentSlot]);
+			}
+		}
+	}
+
+	// Parents come before their children, every slot has been read by it's children by now
+	memset(group->changed, 0, group->transformCount);
+#elif CRANBERRY_HIERARCHY_BACKEND == cranh_backend_recompute_all
+	for (unsigned int i = 0; i < group->transformCount; ++i)
+	{
+		unsigned int parent = group->parents[i];
+		group->globals[i] = parent == cranh_invalid_handle ? group->locals[i] : cranm_transform(group->locals[i], group->globals[parent]);
+	}
+#endif
+}
+
+#endif // CRANBERRY_HIERARCHY_BACKENDS_IMPL
+
+#endif // __CRANBERRY_HIERARCHY_BACKENDS_H
@@ -0,0 +1,126 @@
+#ifndef __CRANBERRY_HIERARCHY_TRACE_H
+#define __CRANBERRY_HIERARCHY_TRACE_H
+
+#include "cranberry_math.h"
+
+#include <stdint.h>
+#include <string.h>
+
+//
+// cranberry_hierarchy_trace.h
+// @brief Binary format of the hierarchy traces recorded with CRANBERRY_RECORD (see cranh_record_start) and replayed by replay_hierarchy.c.
+//
+// A trace starts with a cranh_trace_header_t, followed by one stream per group: a cranh_trace_stream_header_t and it's events.
+// Groups don't share transforms, a group's stream holds every event of that group in the order they happened.
+//
+// Every event is a 1 byte cranh_trace_op_e followed by:
+//   add_root:                   transform
+//   add_child:                  varint parent ordinal, transform
+//   write_local, write_global:  zigzag varint ordinal delta from the previous event's ordinal, transform
+//   pass:                       nothing
+//   pass_through:               varint ordinal of last
+//   pass_budget:                varint maxTransforms, 1 byte set if the pass completed
+//   bake_static, unbake_static: varint ordinal of the root
+//   set_update_interval:        varint ordinal of the root, varint interval
+//   catch_up_subtree:           varint ordinal
+//   update_subtree:             varint ordinal
+// Ordinals number the transforms of a group in the order they were added. Unlike handles they are the same for every
+// backend. Transforms are 8 floats: rot xyzw, pos xyz and scale, in the byte order of the recording machine.
+//
+
+#define cranh_trace_magic 0x54485243 // "CRHT"
+#define cranh_trace_version 1
+#define cranh_trace_transform_size (sizeof(float) * 8)
+#define cranh_trace_max_event_size (1 + 5 + cranh_trace_transform_size)
+
+typedef enum
+{
+	cranh_trace_op_add_root,
+	cranh_trace_op_add_child,
+	cranh_trace_op_write_local,
+	cranh_trace_op_write_global,
+	cranh_trace_op_pass,
+	cranh_trace_op_bake_static,
+	cranh_trace_op_unbake_static,
+	cranh_trace_op_pass_through,
+	cranh_trace_op_pass_budget,
+	cranh_trace_op_set_update_interval,
+	cranh_trace_op_catch_up_subtree,
+	cranh_trace_op_update_subtree,
+	cranh_trace_op_count
+} cranh_trace_op_e;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t groupCount;
+	uint32_t maxGroupSize;
+} cranh_trace_header_t;
+
+typedef struct
+{
+	uint32_t group;
+	uint32_t eventCount;
+	uint64_t size;
+} cranh_trace_stream_header_t;
+
+static inline uint8_t* cranh_trace_write_varint(uint8_t* out, uint32_t value)
+{
+	while (value >= 0x80)
+	{
+		*out++ = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	*out++ = (uint8_t)value;
+	return out;
+}
+
+static inline const uint8_t* cranh_trace_read_varint(const uint8_t* in, uint32_t* value)
+{
+	uint32_t result = 0;
+	for (unsigned int shift = 0; shift < 35; shift += 7)
+	{
+		uint8_t byte = *in++;
+		result |= (uint32_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+		{
+			break;
+		}
+	}
+	*value = result;
+	return in;
+}
+
+// Physics writes transforms in order, the delta to the previous ordinal is usually 1 and fits in a byte.
+static inline uint32_t cranh_trace_zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t cranh_trace_unzigzag(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline uint8_t* cranh_trace_write_transform(uint8_t* out, cranm_transform_t transform)
+{
+	float values[8] = { transform.rot.x, transform.rot.y, transform.rot.z, transform.rot.w, transform.pos.x, transform.pos.y, transform.pos.z, transform.scale };
+	memcpy(out, values, cranh_trace_transform_size);
+	return out + cranh_trace_transform_size;
+}
+
+static inline const uint8_t* cranh_trace_read_transform(const uint8_t* in, cranm_transform_t* transform)
+{
+	float values[8];
+	memcpy(values, in, cranh_trace_transform_size);
+	*transform = (cranm_transform_t)
+	{
+		.rot = { values[0], values[1], values[2], values[3] },
+		.pos = { values[4], values[5], values[6], 0.0f },
+		.scale = values[7]
+	};
+	return in + cranh_trace_transform_size;
+}
+
+#endif // __CRANBERRY_HIERARCHY_TRACE_H
@@ -11,10 +11,25 @@
 
 #endif // CRANBERRY_SSE
 
+#ifdef CRANBERRY_AVX2
+#include <immintrin.h>
+#endif // CRANBERRY_AVX2
+
 #ifdef CRANBERRY_DEBUG
 #include <assert.h>
 #endif // CRANBERRY_DEBUG
 
+#ifdef CRANBERRY_MATH_DEBUG_SLOW
+#include <assert.h>
+#include <float.h>
+
+// The SSE kernels are checked against the scalar code with a tolerance rather than exact equality,
+// a different operation order or FMA contraction changes the last few bits.
+#ifndef CRANBERRY_MATH_DEBUG_MAX_ULP
+#define CRANBERRY_MATH_DEBUG_MAX_ULP 8.0f
+#endif // CRANBERRY_MATH_DEBUG_MAX_ULP
+#endif // CRANBERRY_MATH_DEBUG_SLOW
+
 // Types
 
 typedef struct
@@ -39,94 +54,151 @@ typedef struct
 	float m[16];
 } cranm_mat4x4_t;
 
+// Lanes hold cranm_lane_width floats of independent values, the lane types are structures of arrays
+// of cranm_lane_width vectors, quaternions or transforms.
+#if defined(CRANBERRY_AVX2)
+typedef __m256 cranm_lanes_t;
+#define cranm_lane_width 8
+#elif defined(CRANBERRY_SSE)
+typedef __m128 cranm_lanes_t;
+#define cranm_lane_width 4
+#else
+typedef float cranm_lanes_t;
+#define cranm_lane_width 1
+#endif // CRANBERRY_AVX2
+
+typedef struct
+{
+	cranm_lanes_t x, y, z;
+} cranm_lanes_vec_t;
+
+typedef struct
+{
+	cranm_lanes_t x, y, z, w;
+} cranm_lanes_quat_t;
+
+typedef struct
+{
+	cranm_lanes_quat_t rot;
+	cranm_lanes_vec_t pos;
+	cranm_lanes_t scale;
+} cranm_lanes_transform_t;
+
 // API
 
-inline cranm_vec_t cranm_add3(cranm_vec_t l, cranm_vec_t r);
-inline cranm_vec_t cranm_sub3(cranm_vec_t l, cranm_vec_t r);
-inline cranm_vec_t cranm_scale(cranm_vec_t l, float s);
-inline cranm_vec_t cranm_scale3(cranm_vec_t l, cranm_vec_t r);
-inline cranm_vec_t cranm_cross(cranm_vec_t l, cranm_vec_t r);
-inline cranm_vec_t cranm_normalize3(cranm_vec_t v);
-inline cranm_vec_t cranm_recriprocal3(cranm_vec_t v);
-
-inline cranm_vec_t cranm_quat_t_xyz(cranm_quat_t q);
-inline cranm_quat_t cranm_axis_angleq(cranm_vec_t axis, float angle);
-inline cranm_quat_t cranm_mulq(cranm_quat_t l, cranm_quat_t r);
-inline cranm_quat_t cranm_inverse_mulq(cranm_quat_t l, cranm_quat_t r);
-inline cranm_quat_t cranm_inverseq(cranm_quat_t q);
-inline cranm_vec_t cranm_rot3(cranm_vec_t v, cranm_quat_t r);
-inline cranm_vec_t cranm_inverse_rot3(cranm_vec_t v, cranm_quat_t r);
-
-inline cranm_mat4x4_t cranm_identity4x4();
-inline cranm_mat4x4_t cranm_mul4x4(cranm_mat4x4_t l, cranm_mat4x4_t r);
-inline cranm_mat4x4_t cranm_perspective(float near, float far, float fov);
-
-inline cranm_transform_t cranm_transform(cranm_transform_t t, cranm_transform_t by);
-inline cranm_transform_t cranm_inverse_transform(cranm_transform_t t, cranm_transform_t by);
+static inline cranm_vec_t cranm_add3(cranm_vec_t l, cranm_vec_t r);
+static inline cranm_vec_t cranm_sub3(cranm_vec_t l, cranm_vec_t r);
+static inline cranm_vec_t cranm_scale(cranm_vec_t l, float s);
+static inline cranm_vec_t cranm_scale3(cranm_vec_t l, cranm_vec_t r);
+static inline cranm_vec_t cranm_cross(cranm_vec_t l, cranm_vec_t r);
+static inline cranm_vec_t cranm_normalize3(cranm_vec_t v);
+static inline cranm_vec_t cranm_recriprocal3(cranm_vec_t v);
+
+static inline cranm_vec_t cranm_quat_t_xyz(cranm_quat_t q);
+static inline cranm_quat_t cranm_axis_angleq(cranm_vec_t axis, float angle);
+static inline cranm_quat_t cranm_mulq(cranm_quat_t l, cranm_quat_t r);
+static inline cranm_quat_t cranm_inverse_mulq(cranm_quat_t l, cranm_quat_t r);
+static inline cranm_quat_t cranm_inverseq(cranm_quat_t q);
+static inline cranm_vec_t cranm_rot3(cranm_vec_t v, cranm_quat_t r);
+static inline cranm_vec_t cranm_inverse_rot3(cranm_vec_t v, cranm_quat_t r);
+
+static inline cranm_mat4x4_t cranm_identity4x4();
+static inline cranm_mat4x4_t cranm_mul4x4(cranm_mat4x4_t l, cranm_mat4x4_t r);
+static inline cranm_mat4x4_t cranm_perspective(float near, float far, float fov);
+// @brief Extracts the left, right, bottom, top, near and far planes of a column major view projection.
+// xyz is the normal pointing into the frustum and w the distance, a point p is inside a plane when dot(p, xyz) + w >= 0.
+static inline void cranm_frustum_planes(cranm_mat4x4_t viewProjection, cranm_vec_t planes[6]);
+
+static inline cranm_transform_t cranm_transform(cranm_transform_t t, cranm_transform_t by);
+static inline cranm_transform_t cranm_inverse_transform(cranm_transform_t t, cranm_transform_t by);
+
+// @brief Loads and stores cranm_lane_width floats, the address has to be aligned to sizeof(cranm_lanes_t).
+static inline cranm_lanes_t cranm_lanes_load(const float* f);
+static inline void cranm_lanes_store(float* f, cranm_lanes_t l);
+static inline cranm_lanes_t cranm_lanes_set1(float f);
+static inline cranm_lanes_t cranm_lanes_add(cranm_lanes_t l, cranm_lanes_t r);
+static inline cranm_lanes_t cranm_lanes_sub(cranm_lanes_t l, cranm_lanes_t r);
+static inline cranm_lanes_t cranm_lanes_mul(cranm_lanes_t l, cranm_lanes_t r);
+
+static inline cranm_lanes_quat_t cranm_lanes_mulq(cranm_lanes_quat_t l, cranm_lanes_quat_t r);
+static inline cranm_lanes_vec_t cranm_lanes_rot3(cranm_lanes_vec_t v, cranm_lanes_quat_t r);
+// @brief Same math as cranm_transform, for every lane at once.
+static inline cranm_lanes_transform_t cranm_lanes_transform(cranm_lanes_transform_t t, cranm_lanes_transform_t by);
 
 // IMPL
 
-inline cranm_vec_t cranm_add3(cranm_vec_t l, cranm_vec_t r)
+#ifdef CRANBERRY_MATH_DEBUG_SLOW
+// Components are compared in ULPs of the largest component, the product of two quaternions
+// keeps the magnitude of it's inputs even when single components cancel out.
+static inline int cranm_debug_nearq(cranm_quat_t l, cranm_quat_t r)
+{
+	float magnitude = fmaxf(fmaxf(fabsf(r.x), fabsf(r.y)), fmaxf(fabsf(r.z), fabsf(r.w)));
+	float tolerance = CRANBERRY_MATH_DEBUG_MAX_ULP * FLT_EPSILON * magnitude;
+	return fabsf(l.x - r.x) <= tolerance && fabsf(l.y - r.y) <= tolerance && fabsf(l.z - r.z) <= tolerance && fabsf(l.w - r.w) <= tolerance;
+}
+#endif // CRANBERRY_MATH_DEBUG_SLOW
+
+static inline cranm_vec_t cranm_add3(cranm_vec_t l, cranm_vec_t r)
 {
 #ifdef CRANBERRY_SSE
-	__m128 lv = _mm_load_ps((float*)&l);
-	__m128 rv = _mm_load_ps((float*)&r);
+	__m128 lv = _mm_loadu_ps((float*)&l);
+	__m128 rv = _mm_loadu_ps((float*)&r);
 
 	cranm_vec_t result;
-	_mm_store_ps((float*)&result, _mm_add_ps(lv, rv));
+	_mm_storeu_ps((float*)&result, _mm_add_ps(lv, rv));
 	return result;
 #else
 	return (cranm_vec_t) { .x = l.x + r.x, l.y + r.y, l.z + r.z };
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_vec_t cranm_sub3(cranm_vec_t l, cranm_vec_t r)
+static inline cranm_vec_t cranm_sub3(cranm_vec_t l, cranm_vec_t r)
 {
 #ifdef CRANBERRY_SSE
-	__m128 lv = _mm_load_ps((float*)&l);
-	__m128 rv = _mm_load_ps((float*)&r);
+	__m128 lv = _mm_loadu_ps((float*)&l);
+	__m128 rv = _mm_loadu_ps((float*)&r);
 
 	cranm_vec_t result;
-	_mm_store_ps((float*)&result, _mm_sub_ps(lv, rv));
+	_mm_storeu_ps((float*)&result, _mm_sub_ps(lv, rv));
 	return result;
 #else
 	return (cranm_vec_t) { .x = l.x - r.x, l.y - r.y, l.z - r.z };
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_vec_t cranm_scale(cranm_vec_t l, float s)
+static inline cranm_vec_t cranm_scale(cranm_vec_t l, float s)
 {
 #ifdef CRANBERRY_SSE
 	__m128 sv = _mm_set1_ps(s);
-	__m128 lv = _mm_load_ps((float*)&l);
+	__m128 lv = _mm_loadu_ps((float*)&l);
 
 	cranm_vec_t result;
-	_mm_store_ps((float*)&result, _mm_mul_ps(sv, lv));
+	_mm_storeu_ps((float*)&result, _mm_mul_ps(sv, lv));
 	return result;
 #else
 	return (cranm_vec_t) { .x = l.x * s, .y = l.y * s, .z = l.z * s };
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_vec_t cranm_scale3(cranm_vec_t l, cranm_vec_t r)
+static inline cranm_vec_t cranm_scale3(cranm_vec_t l, cranm_vec_t r)
 {
 #ifdef CRANBERRY_SSE
-	__m128 lv = _mm_load_ps((float*)&l);
-	__m128 rv = _mm_load_ps((float*)&r);
+	__m128 lv = _mm_loadu_ps((float*)&l);
+	__m128 rv = _mm_loadu_ps((float*)&r);
 
 	cranm_vec_t result;
-	_mm_store_ps((float*)&result, _mm_mul_ps(lv, rv));
+	_mm_storeu_ps((float*)&result, _mm_mul_ps(lv, rv));
 	return result;
 #else
 	return (cranm_vec_t) { .x = l.x * r.x, .y = l.y * r.y, .z = l.z * r.z };
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_vec_t cranm_cross(cranm_vec_t l, cranm_vec_t r)
+static inline cranm_vec_t cranm_cross(cranm_vec_t l, cranm_vec_t r)
 {
 #ifdef CRANBERRY_SSE
-	__m128 lv = _mm_load_ps((float*)&l);
-	__m128 rv = _mm_load_ps((float*)&r);
+	__m128 lv = _mm_loadu_ps((float*)&l);
+	__m128 rv = _mm_loadu_ps((float*)&r);
 
 	__m128 l1 = cranm_shuffle_sse(lv, _MM_SHUFFLE(0, 0, 2, 1));
 	__m128 l2 = cranm_shuffle_sse(lv, _MM_SHUFFLE(0, 1, 0, 2));
@@ -137,7 +209,7 @@ inline cranm_vec_t cranm_cross(cranm_vec_t l, cranm_vec_t r)
 	__m128 lm = _mm_mul_ps(l1, r1);
 	__m128 rm = _mm_mul_ps(l2, r2);
 	cranm_vec_t result;
-	_mm_store_ps((float*)&result, _mm_sub_ps(lm, rm));
+	_mm_storeu_ps((float*)&result, _mm_sub_ps(lm, rm));
 
 	return result;
 #else
@@ -150,35 +222,35 @@ inline cranm_vec_t cranm_cross(cranm_vec_t l, cranm_vec_t r)
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_vec_t cranm_normalize3(cranm_vec_t v)
+static inline cranm_vec_t cranm_normalize3(cranm_vec_t v)
 {
 	float rm = 1.0f / sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
 	return (cranm_vec_t) { .x = v.x * rm, .y = v.y * rm, .z = v.z * rm };
 }
 
-inline cranm_vec_t cranm_recriprocal3(cranm_vec_t v)
+static inline cranm_vec_t cranm_recriprocal3(cranm_vec_t v)
 {
 #ifdef CRANBERRY_SSE
-	__m128 lv = _mm_load_ps((float*)&v);
+	__m128 lv = _mm_loadu_ps((float*)&v);
 
 	cranm_vec_t result;
-	_mm_store_ps((float*)&result, _mm_rcp_ps(lv));
+	_mm_storeu_ps((float*)&result, _mm_rcp_ps(lv));
 	return result;
 #else
 	return (cranm_vec_t) { .x = 1.0f / v.x, .y = 1.0f / v.y, .z = 1.0f / v.z };
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_vec_t cranm_quat_t_xyz(cranm_quat_t q)
+static inline cranm_vec_t cranm_quat_t_xyz(cranm_quat_t q)
 {
 	return (cranm_vec_t) { .x = q.x, .y = q.y, .z = q.z, .w = 0.0f };
 }
 
-inline cranm_quat_t cranm_mulq(cranm_quat_t l, cranm_quat_t r)
+static inline cranm_quat_t cranm_mulq(cranm_quat_t l, cranm_quat_t r)
 {
 #ifdef CRANBERRY_SSE
-	__m128 q = _mm_load_ps((float*)&r);
-	__m128 s = _mm_load_ps((float*)&l);
+	__m128 q = _mm_loadu_ps((float*)&r);
+	__m128 s = _mm_loadu_ps((float*)&l);
 
 	__m128 w = cranm_shuffle_sse(s, _MM_SHUFFLE(3, 3, 3, 3));
 	__m128 x = cranm_shuffle_sse(s, _MM_SHUFFLE(0, 0, 0, 0));
@@ -195,7 +267,7 @@ inline cranm_quat_t cranm_mulq(cranm_quat_t l, cranm_quat_t r)
 	f = _mm_add_ps(f, _mm_xor_ps(rz, _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f)));
 
 	cranm_quat_t result;
-	_mm_store_ps((float*)&result, f);
+	_mm_storeu_ps((float*)&result, f);
 
 #ifdef CRANBERRY_MATH_DEBUG_SLOW
 	cranm_quat_t test = 
@@ -206,7 +278,7 @@ inline cranm_quat_t cranm_mulq(cranm_quat_t l, cranm_quat_t r)
 		.w = l.w * r.w - l.x * r.x - l.y * r.y - l.z * r.z
 	};
 
-	assert(result.x == test.x && result.y == test.y && result.z == test.z && result.w == test.w);
+	assert(cranm_debug_nearq(result, test));
 #endif // CRANBERRY_MATH_DEBUG_SLOW
 
 	return result;
@@ -221,11 +293,11 @@ inline cranm_quat_t cranm_mulq(cranm_quat_t l, cranm_quat_t r)
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_quat_t cranm_inverse_mulq(cranm_quat_t l, cranm_quat_t r)
+static inline cranm_quat_t cranm_inverse_mulq(cranm_quat_t l, cranm_quat_t r)
 {
 #ifdef CRANBERRY_SSE
-	__m128 q = _mm_load_ps((float*)&r);
-	__m128 s = _mm_load_ps((float*)&l);
+	__m128 q = _mm_loadu_ps((float*)&r);
+	__m128 s = _mm_loadu_ps((float*)&l);
 
 	__m128 w = cranm_shuffle_sse(s, _MM_SHUFFLE(3, 3, 3, 3));
 	w = _mm_xor_ps(w, _mm_set_ps(0.0f, -0.0f, -0.0f, -0.0f));
@@ -244,7 +316,7 @@ inline cranm_quat_t cranm_inverse_mulq(cranm_quat_t l, cranm_quat_t r)
 	f = _mm_add_ps(f, _mm_xor_ps(rz, _mm_set_ps(0.0f, 0.0f, 0.0f, -0.0f)));
 
 	cranm_quat_t result;
-	_mm_store_ps((float*)&result, f);
+	_mm_storeu_ps((float*)&result, f);
 
 #ifdef CRANBERRY_MATH_DEBUG_SLOW
 	cranm_quat_t test =
@@ -255,7 +327,7 @@ inline cranm_quat_t cranm_inverse_mulq(cranm_quat_t l, cranm_quat_t r)
 		.w =  l.w * r.w + l.x * r.x + l.y * r.y + l.z * r.z
 	};
 
-	assert(result.x == test.x && result.y == test.y && result.z == test.z && result.w == test.w);
+	assert(cranm_debug_nearq(result, test));
 #endif // CRANBERRY_MATH_DEBUG_SLOW
 
 	return result;
@@ -270,19 +342,19 @@ inline cranm_quat_t cranm_inverse_mulq(cranm_quat_t l, cranm_quat_t r)
 #endif // CRANBERRY_SSE
 }
 
-inline cranm_quat_t cranm_axis_angleq(cranm_vec_t axis, float angle)
+static inline cranm_quat_t cranm_axis_angleq(cranm_vec_t axis, float angle)
 {
 	float cr = cosf(angle * 0.5f);
 	float sr = sinf(angle * 0.5f);
 	return (cranm_quat_t) { .w = cr, .x = axis.x * sr, .y = axis.y * sr, .z = axis.z * sr };
 }
 
-inline cranm_quat_t cranm_inverseq(cranm_quat_t q)
+static inline cranm_quat_t cranm_inverseq(cranm_quat_t q)
 {
 	return (cranm_quat_t) { .x = -q.x, .y = -q.y, .z = -q.z, .w = q.w };
 }
 
-inline cranm_vec_t cranm_rot3(cranm_vec_t v, cranm_quat_t r)
+static inline cranm_vec_t cranm_rot3(cranm_vec_t v, cranm_quat_t r)
 {
 	cranm_vec_t t = cranm_scale(cranm_quat_t_xyz(r), 2.0f);
 	t = cranm_cross(t, v);
@@ -291,7 +363,7 @@ inline cranm_vec_t cranm_rot3(cranm_vec_t v, cranm_quat_t r)
 	return cranm_add3(res, cranm_cross(cranm_quat_t_xyz(r), t));
 }
 
-inline cranm_vec_t cranm_inverse_rot3(cranm_vec_t v, cranm_quat_t r)
+static inline cranm_vec_t cranm_inverse_rot3(cranm_vec_t v, cranm_quat_t r)
 {
 	cranm_vec_t t = cranm_scale(cranm_quat_t_xyz(r), -2.0f);
 	t = cranm_cross(t, v);
@@ -300,14 +372,14 @@ inline cranm_vec_t cranm_inverse_rot3(cranm_vec_t v, cranm_quat_t r)
 	return cranm_add3(res, cranm_cross(cranm_scale(cranm_quat_t_xyz(r), -1.0f), t));
 }
 
-inline cranm_mat4x4_t cranm_identity4x4()
+static inline cranm_mat4x4_t cranm_identity4x4()
 {
 	cranm_mat4x4_t mat;
 	mat.m[0] = mat.m[5] = mat.m[10] = mat.m[15] = 1.0f;
 	return mat;
 }
 
-inline cranm_mat4x4_t cranm_mul4x4(cranm_mat4x4_t l, cranm_mat4x4_t r)
+static inline cranm_mat4x4_t cranm_mul4x4(cranm_mat4x4_t l, cranm_mat4x4_t r)
 {
 	cranm_mat4x4_t mat;
 
@@ -327,7 +399,7 @@ inline cranm_mat4x4_t cranm_mul4x4(cranm_mat4x4_t l, cranm_mat4x4_t r)
 	return mat;
 }
 
-inline cranm_mat4x4_t cranm_perspective(float near, float far, float fov)
+static inline cranm_mat4x4_t cranm_perspective(float near, float far, float fov)
 {
 	float s = 1.0f / tanf(fov * 3.14159265358979f / 360.0f);
 
@@ -341,7 +413,24 @@ inline cranm_mat4x4_t cranm_perspective(float near, float far, float fov)
 	return mat;
 }
 
-inline cranm_transform_t cranm_transform(cranm_transform_t t, cranm_transform_t by)
+static inline void cranm_frustum_planes(cranm_mat4x4_t viewProjection, cranm_vec_t planes[6])
+{
+	float* m = viewProjection.m;
+	// clip = m * v, the planes are the last row plus or minus the other rows
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		planes[i * 2] = (cranm_vec_t) { m[3] + m[i], m[7] + m[4 + i], m[11] + m[8 + i], m[15] + m[12 + i] };
+		planes[i * 2 + 1] = (cranm_vec_t) { m[3] - m[i], m[7] - m[4 + i], m[11] - m[8 + i], m[15] - m[12 + i] };
+	}
+
+	for (unsigned int i = 0; i < 6; ++i)
+	{
+		float inverseLength = 1.0f / sqrtf(planes[i].x * planes[i].x + planes[i].y * planes[i].y + planes[i].z * planes[i].z);
+		planes[i] = (cranm_vec_t) { planes[i].x * inverseLength, planes[i].y * inverseLength, planes[i].z * inverseLength, planes[i].w * inverseLength };
+	}
+}
+
+static inline cranm_transform_t cranm_transform(cranm_transform_t t, cranm_transform_t by)
 {
 	return (cranm_transform_t)
 	{
@@ -351,7 +440,7 @@ inline cranm_transform_t cranm_transform(cranm_transform_t t, cranm_transform_t
 	};
 }
 
-inline cranm_transform_t cranm_inverse_transform(cranm_transform_t t, cranm_transform_t by)
+static inline cranm_transform_t cranm_inverse_transform(cranm_transform_t t, cranm_transform_t by)
 {
 	float inverseScale = 1.0f / by.scale;
 
@@ -363,4 +452,123 @@ inline cranm_transform_t cranm_inverse_transform(cranm_transform_t t, cranm_tran
 	};
 }
 
+// Lanes
+
+static inline cranm_lanes_t cranm_lanes_load(const float* f)
+{
+#if defined(CRANBERRY_AVX2)
+	return _mm256_load_ps(f);
+#elif defined(CRANBERRY_SSE)
+	return _mm_load_ps(f);
+#else
+	return *f;
+#endif // CRANBERRY_AVX2
+}
+
+static inline void cranm_lanes_store(float* f, cranm_lanes_t l)
+{
+#if defined(CRANBERRY_AVX2)
+	_mm256_store_ps(f, l);
+#elif defined(CRANBERRY_SSE)
+	_mm_store_ps(f, l);
+#else
+	*f = l;
+#endif // CRANBERRY_AVX2
+}
+
+static inline cranm_lanes_t cranm_lanes_set1(float f)
+{
+#if defined(CRANBERRY_AVX2)
+	return _mm256_set1_ps(f);
+#elif defined(CRANBERRY_SSE)
+	return _mm_set1_ps(f);
+#else
+	return f;
+#endif // CRANBERRY_AVX2
+}
+
+static inline cranm_lanes_t cranm_lanes_add(cranm_lanes_t l, cranm_lanes_t r)
+{
+#if defined(CRANBERRY_AVX2)
+	return _mm256_add_ps(l, r);
+#elif defined(CRANBERRY_SSE)
+	return _mm_add_ps(l, r);
+#else
+	return l + r;
+#endif // CRANBERRY_AVX2
+}
+
+static inline cranm_lanes_t cranm_lanes_sub(cranm_lanes_t l, cranm_lanes_t r)
+{
+#if defined(CRANBERRY_AVX2)
+	return _mm256_sub_ps(l, r);
+#elif defined(CRANBERRY_SSE)
+	return _mm_sub_ps(l, r);
+#else
+	return l - r;
+#endif // CRANBERRY_AVX2
+}
+
+static inline cranm_lanes_t cranm_lanes_mul(cranm_lanes_t l, cranm_lanes_t r)
+{
+#if defined(CRANBERRY_AVX2)
+	return _mm256_mul_ps(l, r);
+#elif defined(CRANBERRY_SSE)
+	return _mm_mul_ps(l, r);
+#else
+	return l * r;
+#endif // CRANBERRY_AVX2
+}
+
+static inline cranm_lanes_quat_t cranm_lanes_mulq(cranm_lanes_quat_t l, cranm_lanes_quat_t r)
+{
+	// l.w * r.x + l.x * r.w - l.y * r.z + l.z * r.y, in the same order as cranm_mulq
+	return (cranm_lanes_quat_t)
+	{
+		.x = cranm_lanes_add(cranm_lanes_sub(cranm_lanes_add(cranm_lanes_mul(l.w, r.x), cranm_lanes_mul(l.x, r.w)), cranm_lanes_mul(l.y, r.z)), cranm_lanes_mul(l.z, r.y)),
+		.y = cranm_lanes_sub(cranm_lanes_add(cranm_lanes_add(cranm_lanes_mul(l.w, r.y), cranm_lanes_mul(l.x, r.z)), cranm_lanes_mul(l.y, r.w)), cranm_lanes_mul(l.z, r.x)),
+		.z = cranm_lanes_add(cranm_lanes_add(cranm_lanes_sub(cranm_lanes_mul(l.w, r.z), cranm_lanes_mul(l.x, r.y)), cranm_lanes_mul(l.y, r.x)), cranm_lanes_mul(l.z, r.w)),
+		.w = cranm_lanes_sub(cranm_lanes_sub(cranm_lanes_sub(cranm_lanes_mul(l.w, r.w), cranm_lanes_mul(l.x, r.x)), cranm_lanes_mul(l.y, r.y)), cranm_lanes_mul(l.z, r.z))
+	};
+}
+
+static inline cranm_lanes_vec_t cranm_lanes_cross(cranm_lanes_t lx, cranm_lanes_t ly, cranm_lanes_t lz, cranm_lanes_vec_t r)
+{
+	return (cranm_lanes_vec_t)
+	{
+		.x = cranm_lanes_sub(cranm_lanes_mul(ly, r.z), cranm_lanes_mul(lz, r.y)),
+		.y = cranm_lanes_sub(cranm_lanes_mul(lz, r.x), cranm_lanes_mul(lx, r.z)),
+		.z = cranm_lanes_sub(cranm_lanes_mul(lx, r.y), cranm_lanes_mul(ly, r.x))
+	};
+}
+
+static inline cranm_lanes_vec_t cranm_lanes_rot3(cranm_lanes_vec_t v, cranm_lanes_quat_t r)
+{
+	// t = 2 * cross(r.xyz, v), v + r.w * t + cross(r.xyz, t)
+	cranm_lanes_t two = cranm_lanes_set1(2.0f);
+	cranm_lanes_vec_t t = cranm_lanes_cross(r.x, r.y, r.z, v);
+	t = (cranm_lanes_vec_t) { .x = cranm_lanes_mul(two, t.x), .y = cranm_lanes_mul(two, t.y), .z = cranm_lanes_mul(two, t.z) };
+
+	cranm_lanes_vec_t c = cranm_lanes_cross(r.x, r.y, r.z, t);
+	return (cranm_lanes_vec_t)
+	{
+		.x = cranm_lanes_add(cranm_lanes_add(v.x, cranm_lanes_mul(r.w, t.x)), c.x),
+		.y = cranm_lanes_add(cranm_lanes_add(v.y, cranm_lanes_mul(r.w, t.y)), c.y),
+		.z = cranm_lanes_add(cranm_lanes_add(v.z, cranm_lanes_mul(r.w, t.z)), c.z)
+	};
+}
+
+static inline cranm_lanes_transform_t cranm_lanes_transform(cranm_lanes_transform_t t, cranm_lanes_transform_t by)
+{
+	cranm_lanes_vec_t scaled = { .x = cranm_lanes_mul(t.pos.x, by.scale), .y = cranm_lanes_mul(t.pos.y, by.scale), .z = cranm_lanes_mul(t.pos.z, by.scale) };
+	cranm_lanes_vec_t rotated = cranm_lanes_rot3(scaled, by.rot);
+
+	return (cranm_lanes_transform_t)
+	{
+		.rot = cranm_lanes_mulq(t.rot, by.rot),
+		.pos = { .x = cranm_lanes_add(rotated.x, by.pos.x), .y = cranm_lanes_add(rotated.y, by.pos.y), .z = cranm_lanes_add(rotated.z, by.pos.z) },
+		.scale = cranm_lanes_mul(t.scale, by.scale)
+	};
+}
+
 #endif // __CRANBERRY_MATH_H
@@ -0,0 +1,260 @@
+#ifndef __CRANBERRY_TASKS_H
+#define __CRANBERRY_TASKS_H
+
+#include "cranberry_barrier.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+//
+// cranberry_tasks.h
+// @brief Small task graph for the worker threads. Tasks start as soon as the tasks they depend on are done instead of
+// waiting for a whole phase to complete, a worker that runs out of work for it's own chain picks up the ready tasks of the others.
+// The graph is built once and run every frame, crant_graph_reset only resets the dependency counters and queues the tasks without dependencies.
+// Ready tasks are queued first in first out, in the order they became ready.
+// Idle workers spin for a while and then park like cranb_barrier_wait, every queued task or the end of the run wakes them.
+//
+// Usage:
+//	crant_graph_t* graph = crant_graph_create(taskCount, dependencyCount, cranb_default_spin_count);
+//	uint32_t a = crant_graph_add(graph, work, data);
+//	uint32_t b = crant_graph_add(graph, work, data);
+//	crant_graph_depend(graph, a, b); // b runs after a
+//	// Every frame, once the previous run is done:
+//	crant_graph_reset(graph);
+//	// On every worker:
+//	crant_graph_work(graph); // Returns once every task ran
+//
+
+#define crant_invalid_task 0xFFFFFFFF
+
+typedef void(*crant_task_func_t)(void* data);
+
+typedef struct
+{
+	crant_task_func_t func;
+	void* data;
+	uint32_t dependencyCount;
+	uint32_t pending; // Dependencies that haven't completed in the current run
+	uint32_t firstDependent; // Index in the dependents, the list is chained through nextDependent
+} crant_task_t;
+
+typedef struct
+{
+	uint32_t task;
+	uint32_t nextDependent;
+} crant_dependent_t;
+
+typedef struct
+{
+	crant_task_t* tasks;
+	uint32_t taskCount;
+	uint32_t taskCapacity;
+
+	crant_dependent_t* dependents;
+	uint32_t dependentCount;
+	uint32_t dependentCapacity;
+
+	// Every task is queued once per run, the queue never wraps. Slots are crant_invalid_task until their task is written.
+	uint32_t* queue;
+	uint32_t queueHead;
+	uint32_t queueTail;
+
+	uint32_t remaining; // Tasks that haven't completed in the current run
+	uint32_t signal; // Bumped when a task is queued or the run completes, idle workers park on it
+	uint32_t parked;
+	uint32_t spinCount;
+} crant_graph_t;
+
+static inline uint32_t crant_increment(uint32_t* value)
+{
+#if defined(_MSC_VER)
+	return (uint32_t)InterlockedIncrement((volatile LONG*)value) - 1;
+#else
+	return __atomic_fetch_add(value, 1, __ATOMIC_SEQ_CST);
+#endif
+}
+
+static inline bool crant_compare_exchange(uint32_t* value, uint32_t expected, uint32_t newValue)
+{
+#if defined(_MSC_VER)
+	return (uint32_t)InterlockedCompareExchange((volatile LONG*)value, (LONG)newValue, (LONG)expected) == expected;
+#else
+	return __atomic_compare_exchange_n(value, &expected, newValue, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#endif
+}
+
+// @brief Creates an empty graph that can hold taskCapacity tasks and dependencyCapacity dependencies.
+// WARNING: This function allocates memory with the standard malloc. It must be released with crant_graph_destroy.
+static inline crant_graph_t* crant_graph_create(uint32_t taskCapacity, uint32_t dependencyCapacity, uint32_t spinCount)
+{
+	crant_graph_t* graph = (crant_graph_t*)malloc(sizeof(crant_graph_t));
+	graph->tasks = (crant_task_t*)malloc(sizeof(crant_task_t) * taskCapacity);
+	graph->taskCount = 0;
+	graph->taskCapacity = taskCapacity;
+	graph->dependents = (crant_dependent_t*)malloc(sizeof(crant_dependent_t) * dependencyCapacity);
+	graph->dependentCount = 0;
+	graph->dependentCapacity = dependencyCapacity;
+	graph->queue = (uint32_t*)malloc(sizeof(uint32_t) * taskCapacity);
+	graph->queueHead = 0;
+	graph->queueTail = 0;
+	graph->remaining = 0;
+	graph->signal = 0;
+	graph->parked = 0;
+	// With a single processor the task we're waiting on can't run while we spin
+	graph->spinCount = cranb_processor_count() > 1 ? spinCount : 0;
+	return graph;
+}
+
+static inline void crant_graph_destroy(crant_graph_t* graph)
+{
+	free(graph->tasks);
+	free(graph->dependents);
+	free(graph->queue);
+	free(graph);
+}
+
+// @return The index of the task, used to declare it's dependencies.
+static inline uint32_t crant_graph_add(crant_graph_t* graph, crant_task_func_t func, void* data)
+{
+	if (graph->taskCount == graph->taskCapacity)
+	{
+		return crant_invalid_task;
+	}
+
+	uint32_t task = graph->taskCount++;
+	graph->tasks[task] = (crant_task_t) { .func = func, .data = data, .dependencyCount = 0, .pending = 0, .firstDependent = crant_invalid_task };
+	return task;
+}
+
+// @brief after only starts once before completed.
+// @return false if the graph is out of dependencies.
+static inline bool crant_graph_depend(crant_graph_t* graph, uint32_t before, uint32_t after)
+{
+	if (graph->dependentCount == graph->dependentCapacity)
+	{
+		return false;
+	}
+
+	uint32_t dependent = graph->dependentCount++;
+	graph->dependents[dependent] = (crant_dependent_t) { .task = after, .nextDependent = graph->tasks[before].firstDependent };
+	graph->tasks[before].firstDependent = dependent;
+	graph->tasks[after].dependencyCount++;
+	return true;
+}
+
+static inline void crant_graph_queue(crant_graph_t* graph, uint32_t task)
+{
+	uint32_t slot = crant_increment(&graph->queueTail);
+	cranb_store(&graph->queue[slot], task);
+	crant_increment(&graph->signal);
+	if (cranb_exchange(&graph->parked, 0) != 0)
+	{
+		cranb_unpark_all(&graph->signal);
+	}
+}
+
+// @brief Starts a new run of the graph.
+// WARNING: The previous run must be complete and the workers must not be in crant_graph_work yet, reset before dispatching them.
+static inline void crant_graph_reset(crant_graph_t* graph)
+{
+	graph->queueHead = 0;
+	graph->queueTail = 0;
+	graph->remaining = graph->taskCount;
+	for (uint32_t i = 0; i < graph->taskCount; ++i)
+	{
+		graph->queue[i] = crant_invalid_task;
+		graph->tasks[i].pending = graph->tasks[i].dependencyCount;
+	}
+
+	for (uint32_t i = 0; i < graph->taskCount; ++i)
+	{
+		if (graph->tasks[i].dependencyCount == 0)
+		{
+			graph->queue[graph->queueTail++] = i;
+		}
+	}
+}
+
+static inline bool crant_graph_pop(crant_graph_t* graph, uint32_t* task)
+{
+	uint32_t head = cranb_load(&graph->queueHead);
+	while (head < cranb_load(&graph->queueTail))
+	{
+		if (crant_compare_exchange(&graph->queueHead, head, head + 1))
+		{
+			// The slot is claimed before it's task is written, the writer is right behind us
+			while ((*task = cranb_load(&graph->queue[head])) == crant_invalid_task)
+			{
+				cranb_pause();
+			}
+			return true;
+		}
+		head = cranb_load(&graph->queueHead);
+	}
+	return false;
+}
+
+static inline void crant_graph_complete(crant_graph_t* graph, uint32_t task)
+{
+	for (uint32_t dependent = graph->tasks[task].firstDependent; dependent != crant_invalid_task; dependent = graph->dependents[dependent].nextDependent)
+	{
+		uint32_t after = graph->dependents[dependent].task;
+		if (cranb_decrement(&graph->tasks[after].pending) == 0)
+		{
+			crant_graph_queue(graph, after);
+		}
+	}
+
+	if (cranb_decrement(&graph->remaining) == 0)
+	{
+		crant_increment(&graph->signal);
+		if (cranb_exchange(&graph->parked, 0) != 0)
+		{
+			cranb_unpark_all(&graph->signal);
+		}
+	}
+}
+
+// @brief Runs the ready tasks of the graph until every task of the run has completed.
+// Call it from every worker, the threads return together once the last task completes.
+static inline void crant_graph_work(crant_graph_t* graph)
+{
+	while (1)
+	{
+		// Read the signal before looking for work, a task queued after the check bumps it and we won't park
+		uint32_t signal = cranb_load(&graph->signal);
+
+		uint32_t task;
+		if (crant_graph_pop(graph, &task))
+		{
+			graph->tasks[task].func(graph->tasks[task].data);
+			crant_graph_complete(graph, task);
+			continue;
+		}
+
+		if (cranb_load(&graph->remaining) == 0)
+		{
+			return;
+		}
+
+		uint32_t i = 0;
+		for (; i < graph->spinCount && cranb_load(&graph->signal) == signal; ++i)
+		{
+			cranb_pause();
+		}
+
+		while (i == graph->spinCount && cranb_load(&graph->signal) == signal)
+		{
+			// Same handshake as cranb_barrier_wait, either the signaler sees parked or we see the new signal
+			cranb_store(&graph->parked, 1);
+			if (cranb_load(&graph->signal) != signal)
+			{
+				break;
+			}
+			cranb_park(&graph->signal, signal);
+		}
+	}
+}
+
+#endif // __CRANBERRY_TASKS_H
@@ -1,13 +1,22 @@
 #include "game_cfg.h"
 #include "game.h"
 
+#include "cranberry_barrier.h"
+#include "cranberry_broadphase.h"
 #include "cranberry_hierarchy.h"
 #include "cranberry_math.h"
+#include "cranberry_tasks.h"
 
 #include "3rd/Mist_Profiler.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+
+#ifdef CRANBERRY_AVX2
+#include <immintrin.h>
+#endif // CRANBERRY_AVX2
 
 #include <Windows.h>
 #include <assert.h>
@@ -17,6 +26,23 @@ static float randf(float min, float max)
 	return ((float)rand() / (float)RAND_MAX) * (max - min) + min;
 }
 
+#ifndef CRANBERRY_AVX2
+// rand() shares it's state between threads, the physics has it's own generator per tile and lane.
+static uint32_t phys_xorshift(uint32_t x)
+{
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+// [-1, 1) from the top 24 bits
+static float phys_signed_unit(uint32_t x)
+{
+	return (float)(x >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+#endif // CRANBERRY_AVX2
+
 #define PI 3.14159f
 #define cube_half_dimension 30
 #define max_entity_group_count ((cube_half_dimension * 2) * (cube_half_dimension * 2) * (cube_half_dimension * 2) + 10)
@@ -28,98 +54,994 @@ const float phys_gravity_a = -9.807f;
 const float phys_floor_y = -5.0f;
 
 const float phys_fixed_tick = 0.016f;
+// Fraction of the sliding velocity lost every time an entity hits the floor
+const float phys_floor_friction = 0.2f;
+
+// Integrating in the space of the entities' parent skips the inverse transform to their locals,
+// the entities then follow their parent when it moves instead of staying put in the world.
+const bool phys_parent_space = false;
+
+// The entities of a group are integrated 8 at a time, the arrays are padded to a multiple of 8.
+#define phys_lane_count 8
+#define phys_padded_entity_count ((max_entity_group_count + phys_lane_count - 1) & ~(phys_lane_count - 1))
 
-static float phys_vel_x[max_group_count][max_entity_group_count];
-static float phys_vel_y[max_group_count][max_entity_group_count];
-static float phys_vel_z[max_group_count][max_entity_group_count];
-static float phys_bounce[max_group_count][max_entity_group_count];
+// Global positions, or positions relative to the parent with phys_parent_space
+static float phys_pos_x[max_group_count][phys_padded_entity_count];
+static float phys_pos_y[max_group_count][phys_padded_entity_count];
+static float phys_pos_z[max_group_count][phys_padded_entity_count];
+static float phys_vel_x[max_group_count][phys_padded_entity_count];
+static float phys_vel_y[max_group_count][phys_padded_entity_count];
+static float phys_vel_z[max_group_count][phys_padded_entity_count];
+static float phys_bounce[max_group_count][phys_padded_entity_count];
 
-static cranh_handle_t phys_handle[max_group_count][max_entity_group_count];
+// The entities of a group are children of the same parent, added one after the other. Their handles follow phys_first.
+static cranh_handle_t phys_first[max_group_count];
+static cranh_handle_t phys_parent[max_group_count];
 
 static uint32_t phys_entity_count[max_group_count] = { 0 };
 
-static cranh_handle_t render_handles[max_entity_count];
+// Entities that barely moved for a while go to sleep, they skip the integration and their locals aren't written or dirtied
+// so the transform pass skips them too. A sleeping entity acts as a static body in the contacts until an entity faster than
+// phys_sleep_speed touches it.
+const bool phys_sleep = true;
+const float phys_sleep_speed = 0.5f;
+// Distance from where the entity started to rest, catches the entities that creep slowly
+const float phys_sleep_drift = 0.01f;
+#define phys_sleep_tick_count 32
+#define phys_lane_block_count (phys_padded_entity_count / phys_lane_count)
+static uint8_t phys_rest_ticks[max_group_count][phys_padded_entity_count];
+static float phys_rest_x[max_group_count][phys_padded_entity_count];
+static float phys_rest_y[max_group_count][phys_padded_entity_count];
+static float phys_rest_z[max_group_count][phys_padded_entity_count];
+// A bit per lane of every block of phys_lane_count entities
+static uint8_t phys_awake_lanes[max_group_count][phys_lane_block_count];
+// Lanes integrated by the last tick, only those are dirtied and gathered
+static uint8_t phys_moved_lanes[max_group_count][phys_lane_block_count];
+
+// The entities collide with each other, the broadphase sorts and sweeps their bounds once the transforms are done and
+// the contacts are resolved before the next tick. Contacts are resolved in global space, they're ignored when integrating in the parent's space.
+const bool phys_entity_contacts = true;
+// The entities are spheres of their global scale, cube corners can go through each other
+const float phys_contact_radius = 1.0f;
+// Larger than the bounds of the entities
+const float phys_broadphase_cell_size = 0.0625f;
+#define phys_broadphase_chunk_size 16384
+#define phys_broadphase_max_chunk_count ((max_entity_count + phys_broadphase_chunk_size - 1) / phys_broadphase_chunk_size)
+#define phys_broadphase_chunk_pair_capacity (phys_broadphase_chunk_size * 2)
+static cranp_broadphase_t* phys_broadphase;
+static uint32_t phys_broadphase_chunks[phys_broadphase_max_chunk_count];
+// The broadphase entities of a group start at the group's offset
+static uint32_t phys_entity_offset[max_group_count];
+static uint32_t phys_contact_count;
+
 static uint32_t render_count = 0;
+// The workers fill the buffer of the tick they're simulating while the main thread uploads the buffer of the previous tick.
+// The third buffer holds the tick before that, a renderer can still be reading it.
+#define render_instance_buffer_count 3
+static game_instance_t render_instance_buffers[render_instance_buffer_count][max_entity_count];
+static unsigned int render_instance_buffer_index = 0; // The buffer being filled by the workers
+static game_instance_t* render_instance_buffer;
+static uint32_t render_instance_counts[render_instance_buffer_count];
+static bool render_instances_ready = false;
 
-void phys_tick(unsigned int group);
+// The workers simulate the next tick while the main thread renders the previous one, between game_tick_begin and game_tick_end.
+// The main thread never reads the hierarchy during a tick, the instance buffers are the snapshot of the finished ticks.
+const bool game_pipelined_frames = true;
+static bool game_tick_in_flight = false;
 
-HANDLE transform_threads[max_group_count];
-volatile LONG transform_shutdown = 0;
-volatile LONG transform_done_count = 0;
-CONDITION_VARIABLE transforms_done;
-CONDITION_VARIABLE transform_enabled;
-DWORD threadIds[max_group_count];
-DWORD WINAPI transform_tick_group(LPVOID lparam)
+// Entities per tile, a multiple of phys_lane_count and of the hierarchy's blocks of 4
+#define game_tile_entity_count 512
+#define game_max_tile_count ((max_entity_group_count + game_tile_entity_count - 1) / game_tile_entity_count)
+
+// A tile runs the physics, the transforms and the culling of it's entities one after the other
+// instead of sweeping the whole group once per stage, the tile is still in cache for the next stage.
+// The tiles of a group are chained, the tiles of different groups run on any worker.
+// Otherwise the physics tiles of a group run in parallel, the group's transform pass waits for all of them
+// and the culling tiles wait for the pass. Each group only waits on it's own stages.
+// Either way, the instance generation waits for the scan of the survivor counts of every tile.
+const bool game_fused_pipeline = true;
+
+typedef struct
 {
-	CRITICAL_SECTION unusedCritical;
-	InitializeCriticalSection(&unusedCritical);
+	unsigned int group;
+	uint32_t start;
+	uint32_t count;
+} game_tile_t;
+static game_tile_t game_tiles[max_group_count][game_max_tile_count];
+static uint32_t game_tile_count[max_group_count];
 
-	InterlockedIncrement(&transform_done_count);
+static uint32_t phys_rng[max_group_count][game_max_tile_count][phys_lane_count];
+// The parent the tile's locals were last computed from, the sleeping entities of the tile wake up when it moves
+static cranm_transform_t phys_tile_parent[max_group_count][game_max_tile_count];
 
-	unsigned int group = (unsigned int)lparam;
-	while (1)
+// The instances outside of the view are culled 8 at a time. The tiles count their survivors and a scan turns the counts into
+// offsets in the instance buffer, the instance generation then writes the visible instances next to each other without synchronizing.
+const bool render_frustum_culling = true;
+#define render_visibility_word_count (game_tile_entity_count / 32)
+static uint32_t render_visibility[max_group_count][game_max_tile_count][render_visibility_word_count];
+static uint32_t render_visible_count[max_group_count][game_max_tile_count];
+static uint32_t render_tile_offset[max_group_count][game_max_tile_count];
+static cranm_vec_t render_frustum[6]; // Of the tick being simulated
+
+void phys_tick(game_tile_t* tile);
+void phys_dirty_moved(unsigned int group, uint32_t start, uint32_t count);
+void phys_gather_bounds(game_tile_t* tile);
+void phys_resolve_contacts(void);
+void render_cull(game_tile_t* tile);
+void render_gen_instances(game_tile_t* tile);
+
+static crant_graph_t* game_graph;
+
+static void game_fused_task(void* data)
+{
+	MIST_PROFILE_BEGIN("game", "fused_task");
+	game_tile_t* tile = (game_tile_t*)data;
+	cranh_handle_t first = { .value = phys_first[tile->group].value + tile->start };
+	phys_tick(tile);
+	phys_dirty_moved(tile->group, tile->start, tile->count);
+	cranh_transform_locals_to_globals_through(transform_hierarchy, (cranh_handle_t) { .value = first.value + tile->count - 1 });
+	render_cull(tile);
+	phys_gather_bounds(tile);
+
+	if (tile->start + tile->count == phys_entity_count[tile->group])
 	{
-		EnterCriticalSection(&unusedCritical);
-		SleepConditionVariableCS(&transform_enabled, &unusedCritical, INFINITE);
-		LeaveCriticalSection(&unusedCritical);
+		// Completes the pass, the group's other dirty transforms are after the entities
+		cranh_transform_locals_to_globals(transform_hierarchy, tile->group);
+	}
+	MIST_PROFILE_END("game", "fused_task");
+}
 
-		if (transform_shutdown == 1)
+static void game_phys_task(void* data)
+{
+	MIST_PROFILE_BEGIN("game", "phys_task");
+	phys_tick((game_tile_t*)data);
+	MIST_PROFILE_END("game", "phys_task");
+}
+
+// The physics tiles of the group only wrote the locals, they're dirtied here by a single thread.
+static void game_transform_task(void* data)
+{
+	MIST_PROFILE_BEGIN("game", "transform_task");
+	unsigned int group = ((game_tile_t*)data)->group;
+	phys_dirty_moved(group, 0, phys_entity_count[group]);
+	cranh_transform_locals_to_globals(transform_hierarchy, group);
+	MIST_PROFILE_END("game", "transform_task");
+}
+
+static void game_cull_task(void* data)
+{
+	MIST_PROFILE_BEGIN("game", "cull_task");
+	render_cull((game_tile_t*)data);
+	phys_gather_bounds((game_tile_t*)data);
+	MIST_PROFILE_END("game", "cull_task");
+}
+
+static void game_scan_task(void* data)
+{
+	(void)data;
+	MIST_PROFILE_BEGIN("game", "scan_task");
+	uint32_t offset = 0;
+	for (unsigned int i = 0; i < max_group_count; ++i)
+	{
+		for (uint32_t t = 0; t < game_tile_count[i]; ++t)
 		{
-			break;
+			render_tile_offset[i][t] = offset;
+			offset += render_visible_count[i][t];
 		}
+	}
+	render_instance_counts[render_instance_buffer_index] = offset;
+	MIST_PROFILE_END("game", "scan_task");
+}
+
+static void game_gen_instances_task(void* data)
+{
+	MIST_PROFILE_BEGIN("game", "gen_instances_task");
+	render_gen_instances((game_tile_t*)data);
+	MIST_PROFILE_END("game", "gen_instances_task");
+}
+
+static void phys_sort_check_task(void* data)
+{
+	MIST_PROFILE_BEGIN("phys", "sort_check_task");
+	cranp_sort_check(phys_broadphase, *(uint32_t*)data);
+	MIST_PROFILE_END("phys", "sort_check_task");
+}
+
+static void phys_sort_plan_task(void* data)
+{
+	(void)data;
+	MIST_PROFILE_BEGIN("phys", "sort_plan_task");
+	cranp_sort_plan(phys_broadphase);
+	MIST_PROFILE_END("phys", "sort_plan_task");
+}
+
+static void phys_sort_histogram_task(void* data)
+{
+	MIST_PROFILE_BEGIN("phys", "sort_histogram_task");
+	cranp_sort_histogram(phys_broadphase, *(uint32_t*)data);
+	MIST_PROFILE_END("phys", "sort_histogram_task");
+}
+
+static void phys_sort_prefix_task(void* data)
+{
+	(void)data;
+	cranp_sort_prefix(phys_broadphase);
+}
 
-		MIST_PROFILE_BEGIN("game", "phys_thread_tick");
-		phys_tick(group);
-		MIST_PROFILE_END("game", "phys_thread_tick");
+static void phys_sort_scatter_task(void* data)
+{
+	MIST_PROFILE_BEGIN("phys", "sort_scatter_task");
+	cranp_sort_scatter(phys_broadphase, *(uint32_t*)data);
+	MIST_PROFILE_END("phys", "sort_scatter_task");
+}
 
-		MIST_PROFILE_BEGIN("game", "transform_thread_tick");
-		cranh_transform_locals_to_globals(transform_hierarchy, group);
-		MIST_PROFILE_END("game", "transform_thread_tick");
+static void phys_sort_next_pass_task(void* data)
+{
+	(void)data;
+	cranp_sort_next_pass(phys_broadphase);
+}
 
-		InterlockedIncrement(&transform_done_count);
-		if (transform_done_count == max_group_count)
+static void phys_sweep_prepare_task(void* data)
+{
+	MIST_PROFILE_BEGIN("phys", "sweep_prepare_task");
+	cranp_sweep_prepare(phys_broadphase, *(uint32_t*)data);
+	MIST_PROFILE_END("phys", "sweep_prepare_task");
+}
+
+static void phys_sweep_begin_task(void* data)
+{
+	(void)data;
+	cranp_sweep_begin(phys_broadphase);
+}
+
+static void phys_sweep_task(void* data)
+{
+	MIST_PROFILE_BEGIN("phys", "sweep_task");
+	cranp_sweep(phys_broadphase, *(uint32_t*)data);
+	MIST_PROFILE_END("phys", "sweep_task");
+}
+
+static void phys_contact_task(void* data)
+{
+	(void)data;
+	MIST_PROFILE_BEGIN("phys", "contact_task");
+	phys_resolve_contacts();
+	MIST_PROFILE_END("phys", "contact_task");
+}
+
+// The graph is sized for every task and dependency up front, running out means the sizes in game_build_graph are wrong.
+static uint32_t game_graph_add(crant_graph_t* graph, crant_task_func_t func, void* data)
+{
+	uint32_t task = crant_graph_add(graph, func, data);
+	assert(task != crant_invalid_task);
+	return task;
+}
+
+static void game_graph_depend(crant_graph_t* graph, uint32_t before, uint32_t after)
+{
+	bool added = crant_graph_depend(graph, before, after);
+	assert(added);
+	(void)added;
+}
+
+// Every step of a chunk waits for the serial step before it, the serial steps wait for every chunk.
+static uint32_t game_add_chunk_step(crant_graph_t* graph, uint32_t before, crant_task_func_t chunkStep, crant_task_func_t serialStep)
+{
+	uint32_t after = game_graph_add(graph, serialStep, NULL);
+	for (uint32_t c = 0; c < phys_broadphase->chunkCount; ++c)
+	{
+		uint32_t task = game_graph_add(graph, chunkStep, &phys_broadphase_chunks[c]);
+		game_graph_depend(graph, before, task);
+		game_graph_depend(graph, task, after);
+	}
+	return after;
+}
+
+static void game_build_graph(void)
+{
+	uint32_t tileCount = 0;
+	for (unsigned int i = 0; i < max_group_count; ++i)
+	{
+		tileCount += game_tile_count[i];
+	}
+
+	// Check, histogram, scatter, prepare and sweep steps per chunk
+	uint32_t broadphaseStepCount = phys_entity_contacts ? 3 + cranp_sort_pass_count * 2 : 0;
+	uint32_t broadphaseChunkCount = phys_entity_contacts ? phys_broadphase->chunkCount : 0;
+	game_graph = crant_graph_create(
+		tileCount * 3 + max_group_count + 1 + (broadphaseChunkCount + 1) * broadphaseStepCount + 1,
+		tileCount * 4 + broadphaseChunkCount * broadphaseStepCount * 2 + 1,
+		cranb_default_spin_count);
+
+	uint32_t scan = game_graph_add(game_graph, game_scan_task, NULL);
+	for (unsigned int i = 0; i < max_group_count; ++i)
+	{
+		if (game_fused_pipeline)
 		{
-			WakeConditionVariable(&transforms_done);
+			uint32_t previous = crant_invalid_task;
+			for (uint32_t t = 0; t < game_tile_count[i]; ++t)
+			{
+				uint32_t task = game_graph_add(game_graph, game_fused_task, &game_tiles[i][t]);
+				if (previous != crant_invalid_task)
+				{
+					game_graph_depend(game_graph, previous, task);
+				}
+				previous = task;
+			}
+			game_graph_depend(game_graph, previous, scan);
+		}
+		else
+		{
+			uint32_t transform = game_graph_add(game_graph, game_transform_task, &game_tiles[i][0]);
+			for (uint32_t t = 0; t < game_tile_count[i]; ++t)
+			{
+				game_graph_depend(game_graph, game_graph_add(game_graph, game_phys_task, &game_tiles[i][t]), transform);
+
+				uint32_t cull = game_graph_add(game_graph, game_cull_task, &game_tiles[i][t]);
+				game_graph_depend(game_graph, transform, cull);
+				game_graph_depend(game_graph, cull, scan);
+			}
+		}
+
+		for (uint32_t t = 0; t < game_tile_count[i]; ++t)
+		{
+			game_graph_depend(game_graph, scan, game_graph_add(game_graph, game_gen_instances_task, &game_tiles[i][t]));
 		}
 	}
 
+	if (phys_entity_contacts)
+	{
+		// The scan waits for every tile, the bounds have all been gathered once it's done
+		uint32_t step = game_add_chunk_step(game_graph, scan, phys_sort_check_task, phys_sort_plan_task);
+		for (uint32_t pass = 0; pass < cranp_sort_pass_count; ++pass)
+		{
+			step = game_add_chunk_step(game_graph, step, phys_sort_histogram_task, phys_sort_prefix_task);
+			step = game_add_chunk_step(game_graph, step, phys_sort_scatter_task, phys_sort_next_pass_task);
+		}
+		step = game_add_chunk_step(game_graph, step, phys_sweep_prepare_task, phys_sweep_begin_task);
+		step = game_add_chunk_step(game_graph, step, phys_sweep_task, phys_contact_task);
+	}
+}
+
+// The workers aren't tied to a group, there's one per processor left by the main thread.
+// WaitForMultipleObjects waits on 64 threads at most.
+#define game_max_worker_count 64
+static unsigned int game_worker_count;
+HANDLE transform_threads[game_max_worker_count];
+volatile LONG transform_shutdown = 0;
+// The main thread and the workers meet at the start barrier to dispatch a frame and at the end barrier once it's done
+cranb_barrier_t transform_start_barrier;
+cranb_barrier_t transform_end_barrier;
+DWORD threadIds[game_max_worker_count];
+DWORD WINAPI transform_worker(LPVOID lparam)
+{
+	(void)lparam;
+	while (1)
+	{
+		cranb_barrier_wait(&transform_start_barrier);
+		if (transform_shutdown == 1)
+		{
+			break;
+		}
+
+		crant_graph_work(game_graph);
+
+		cranb_barrier_wait(&transform_end_barrier);
+	}
+
 	Mist_FlushThreadBuffer();
 
 	return 0;
 }
 
-void phys_tick(unsigned int group)
+// Gravity and the floor in the space the entities are integrated in
+typedef struct
 {
+	float gravity[3];
+	float floorNormal[3];
+	float floorDistance;
+
+	// Maps the integrated positions to the locals, only used when integrating in global space
+	float toLocal[3][3];
+	float toLocalOffset[3];
+	cranm_quat_t parentRot;
+} phys_space_t;
+
+static phys_space_t phys_compute_space(cranm_transform_t parent)
+{
+	phys_space_t space;
+	if (phys_parent_space)
+	{
+		float inverseScale = 1.0f / parent.scale;
+		cranm_vec_t gravity = cranm_scale(cranm_inverse_rot3((cranm_vec_t) { .y = phys_gravity_a }, parent.rot), inverseScale);
+		cranm_vec_t up = cranm_inverse_rot3((cranm_vec_t) { .y = 1.0f }, parent.rot);
+
+		space.gravity[0] = gravity.x; space.gravity[1] = gravity.y; space.gravity[2] = gravity.z;
+		space.floorNormal[0] = up.x; space.floorNormal[1] = up.y; space.floorNormal[2] = up.z;
+		space.floorDistance = (phys_floor_y - parent.pos.y) * inverseScale;
+	}
+	else
 	{
-		for (uint32_t i = 0; i < phys_entity_count[group]; ++i)
+		space.gravity[0] = 0.0f; space.gravity[1] = phys_gravity_a; space.gravity[2] = 0.0f;
+		space.floorNormal[0] = 0.0f; space.floorNormal[1] = 1.0f; space.floorNormal[2] = 0.0f;
+		space.floorDistance = phys_floor_y;
+
+		// local = inverse_rot(global - parent.pos, parent.rot) / parent.scale, the columns are the inverse rotated axes
+		cranm_vec_t axes[3] = { { .x = 1.0f }, { .y = 1.0f }, { .z = 1.0f } };
+		for (unsigned int c = 0; c < 3; ++c)
 		{
-			cranm_transform_t global_transform = cranh_read_global(transform_hierarchy, phys_handle[group][i]);
+			cranm_vec_t column = cranm_scale(cranm_inverse_rot3(axes[c], parent.rot), 1.0f / parent.scale);
+			space.toLocal[0][c] = column.x;
+			space.toLocal[1][c] = column.y;
+			space.toLocal[2][c] = column.z;
+		}
 
-			// Apply gravity
+		for (unsigned int r = 0; r < 3; ++r)
+		{
+			space.toLocalOffset[r] = -(space.toLocal[r][0] * parent.pos.x + space.toLocal[r][1] * parent.pos.y + space.toLocal[r][2] * parent.pos.z);
+		}
+	}
+	space.parentRot = parent.rot;
+	return space;
+}
+
+// Writes the integrated lanes to the locals, the lanes that hit the floor get a random rotation.
+static void phys_write_lanes(phys_space_t* space, cranm_transform_t* locals, unsigned int laneCount, float x[phys_lane_count], float y[phys_lane_count], float z[phys_lane_count],
+	unsigned int hitMask, float rot[4][phys_lane_count])
+{
+	for (unsigned int l = 0; l < laneCount; ++l)
+	{
+		if (phys_parent_space)
+		{
+			locals[l].pos.x = x[l];
+			locals[l].pos.y = y[l];
+			locals[l].pos.z = z[l];
+		}
+		else
+		{
+			locals[l].pos.x = space->toLocal[0][0] * x[l] + space->toLocal[0][1] * y[l] + space->toLocal[0][2] * z[l] + space->toLocalOffset[0];
+			locals[l].pos.y = space->toLocal[1][0] * x[l] + space->toLocal[1][1] * y[l] + space->toLocal[1][2] * z[l] + space->toLocalOffset[1];
+			locals[l].pos.z = space->toLocal[2][0] * x[l] + space->toLocal[2][1] * y[l] + space->toLocal[2][2] * z[l] + space->toLocalOffset[2];
+		}
+
+		if (hitMask & (1 << l))
+		{
+			cranm_quat_t random = { .x = rot[0][l], .y = rot[1][l], .z = rot[2][l], .w = rot[3][l] };
+			// A random rotation in the parent's space is as random as one in global space
+			locals[l].rot = phys_parent_space ? random : cranm_inverse_mulq(random, space->parentRot);
+		}
+	}
+}
+
+static bool phys_is_awake(unsigned int group, uint32_t entity)
+{
+	return (phys_awake_lanes[group][entity / phys_lane_count] & (1 << (entity % phys_lane_count))) != 0;
+}
+
+static float phys_speed_squared(unsigned int group, uint32_t entity)
+{
+	return phys_vel_x[group][entity] * phys_vel_x[group][entity] + phys_vel_y[group][entity] * phys_vel_y[group][entity] + phys_vel_z[group][entity] * phys_vel_z[group][entity];
+}
+
+static void phys_wake(unsigned int group, uint32_t entity)
+{
+	phys_awake_lanes[group][entity / phys_lane_count] |= (uint8_t)(1 << (entity % phys_lane_count));
+	phys_rest_ticks[group][entity] = 0;
+}
+
+// Counts the ticks the awake lanes spent nearly still, the lanes that rested for phys_sleep_tick_count ticks go to sleep.
+// @return The lanes that are still awake.
+static uint8_t phys_rest_lanes(unsigned int group, uint32_t first, uint8_t awake)
+{
+	for (unsigned int l = 0; l < phys_lane_count; ++l)
+	{
+		uint32_t e = first + l;
+		if ((awake & (1 << l)) == 0)
+		{
+			continue;
+		}
+
+		float speedSquared = phys_speed_squared(group, e);
+		float dx = phys_pos_x[group][e] - phys_rest_x[group][e];
+		float dy = phys_pos_y[group][e] - phys_rest_y[group][e];
+		float dz = phys_pos_z[group][e] - phys_rest_z[group][e];
+		if (speedSquared < phys_sleep_speed * phys_sleep_speed && dx * dx + dy * dy + dz * dz < phys_sleep_drift * phys_sleep_drift)
+		{
+			if (++phys_rest_ticks[group][e] >= phys_sleep_tick_count)
 			{
-				phys_vel_y[group][i] = phys_vel_y[group][i] + phys_gravity_a * phys_fixed_tick;
+				awake &= (uint8_t)~(1 << l);
+				phys_vel_x[group][e] = 0.0f;
+				phys_vel_y[group][e] = 0.0f;
+				phys_vel_z[group][e] = 0.0f;
 			}
+		}
+		else
+		{
+			phys_rest_ticks[group][e] = 0;
+			phys_rest_x[group][e] = phys_pos_x[group][e];
+			phys_rest_y[group][e] = phys_pos_y[group][e];
+			phys_rest_z[group][e] = phys_pos_z[group][e];
+		}
+	}
+	return awake;
+}
+
+#ifdef CRANBERRY_AVX2
+// All ones in the lanes whose bit is set
+static __m256 phys_lane_mask8(uint8_t lanes)
+{
+	__m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+	return _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32(lanes), bits), bits));
+}
+
+static __m256 phys_signed_unit8(__m256i* rng)
+{
+	__m256i x = *rng;
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 13));
+	x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 17));
+	x = _mm256_xor_si256(x, _mm256_slli_epi32(x, 5));
+	*rng = x;
+
+	__m256 unit = _mm256_cvtepi32_ps(_mm256_srli_epi32(x, 8));
+	return _mm256_sub_ps(_mm256_mul_ps(unit, _mm256_set1_ps(2.0f / 16777216.0f)), _mm256_set1_ps(1.0f));
+}
+#endif // CRANBERRY_AVX2
+
+// Integrates the awake entities of the tile and writes their locals, the caller dirties them with phys_dirty_moved.
+void phys_tick(game_tile_t* tile)
+{
+	unsigned int group = tile->group;
+	uint32_t start = tile->start;
+	uint32_t count = tile->count;
+	uint32_t tileIndex = start / game_tile_entity_count;
+	uint32_t* tileRng = phys_rng[group][tileIndex];
+	cranm_transform_t parent = cranh_read_global(transform_hierarchy, phys_parent[group]);
+	phys_space_t space = phys_compute_space(parent);
+
+	// The locals of the sleeping entities no longer put them where they are
+	if (!phys_parent_space && memcmp(&parent, &phys_tile_parent[group][tileIndex], sizeof(cranm_transform_t)) != 0)
+	{
+		phys_tile_parent[group][tileIndex] = parent;
+		for (uint32_t i = start; i < start + count; ++i)
+		{
+			phys_wake(group, i);
+		}
+	}
+	uint8_t* awakeLanes = phys_awake_lanes[group] + start / phys_lane_count;
+	uint8_t* movedLanes = phys_moved_lanes[group] + start / phys_lane_count;
+
+	cranh_handle_t first = { .value = phys_first[group].value + start };
+	cranm_transform_t* locals = cranh_write_locals_begin(transform_hierarchy, first, count);
+
+	float* posX = phys_pos_x[group] + start;
+	float* posY = phys_pos_y[group] + start;
+	float* posZ = phys_pos_z[group] + start;
+	float* velX = phys_vel_x[group] + start;
+	float* velY = phys_vel_y[group] + start;
+	float* velZ = phys_vel_z[group] + start;
+	float* bounce = phys_bounce[group] + start;
 
-			// Apply velocity
+	float x[phys_lane_count], y[phys_lane_count], z[phys_lane_count];
+	float rot[4][phys_lane_count];
+
+#ifdef CRANBERRY_AVX2
+	__m256 dt = _mm256_set1_ps(phys_fixed_tick);
+	__m256 dvX = _mm256_set1_ps(space.gravity[0] * phys_fixed_tick);
+	__m256 dvY = _mm256_set1_ps(space.gravity[1] * phys_fixed_tick);
+	__m256 dvZ = _mm256_set1_ps(space.gravity[2] * phys_fixed_tick);
+	__m256 nX = _mm256_set1_ps(space.floorNormal[0]);
+	__m256 nY = _mm256_set1_ps(space.floorNormal[1]);
+	__m256 nZ = _mm256_set1_ps(space.floorNormal[2]);
+	__m256 floorDistance = _mm256_set1_ps(space.floorDistance);
+	__m256 one = _mm256_set1_ps(1.0f);
+	__m256 allLanes = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+	__m256 slowImpact = _mm256_set1_ps(phys_sleep ? -phys_sleep_speed : 0.0f);
+	__m256 friction = _mm256_set1_ps(phys_floor_friction);
+	__m256i rng = _mm256_loadu_si256((__m256i*)tileRng);
+
+	for (uint32_t i = 0; i < count; i += phys_lane_count)
+	{
+		uint8_t awake = awakeLanes[i / phys_lane_count];
+		movedLanes[i / phys_lane_count] = awake;
+		if (awake == 0)
+		{
+			continue;
+		}
+
+		// Apply gravity and velocity
+		__m256 vx = _mm256_add_ps(_mm256_loadu_ps(velX + i), dvX);
+		__m256 vy = _mm256_add_ps(_mm256_loadu_ps(velY + i), dvY);
+		__m256 vz = _mm256_add_ps(_mm256_loadu_ps(velZ + i), dvZ);
+		__m256 px = _mm256_add_ps(_mm256_loadu_ps(posX + i), _mm256_mul_ps(vx, dt));
+		__m256 py = _mm256_add_ps(_mm256_loadu_ps(posY + i), _mm256_mul_ps(vy, dt));
+		__m256 pz = _mm256_add_ps(_mm256_loadu_ps(posZ + i), _mm256_mul_ps(vz, dt));
+
+		// The sleeping lanes keep their state
+		__m256 awakeMask = allLanes;
+		if (awake != 0xFF)
+		{
+			awakeMask = phys_lane_mask8(awake);
+			vx = _mm256_blendv_ps(_mm256_loadu_ps(velX + i), vx, awakeMask);
+			vy = _mm256_blendv_ps(_mm256_loadu_ps(velY + i), vy, awakeMask);
+			vz = _mm256_blendv_ps(_mm256_loadu_ps(velZ + i), vz, awakeMask);
+			px = _mm256_blendv_ps(_mm256_loadu_ps(posX + i), px, awakeMask);
+			py = _mm256_blendv_ps(_mm256_loadu_ps(posY + i), py, awakeMask);
+			pz = _mm256_blendv_ps(_mm256_loadu_ps(posZ + i), pz, awakeMask);
+		}
+
+		// Apply collision, push the entities below the floor back on it, flip their velocity along the floor's normal
+		// and slow down their sliding. With phys_sleep the slow impacts don't bounce, the entities come to rest on the floor.
+		__m256 height = _mm256_sub_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, nX), _mm256_mul_ps(py, nY)), _mm256_mul_ps(pz, nZ)), floorDistance);
+		__m256 hit = _mm256_and_ps(awakeMask, _mm256_cmp_ps(height, _mm256_setzero_ps(), _CMP_LT_OQ));
+		unsigned int hitMask = (unsigned int)_mm256_movemask_ps(hit);
+		if (hitMask != 0)
+		{
+			__m256 penetration = _mm256_and_ps(hit, height);
+			px = _mm256_sub_ps(px, _mm256_mul_ps(penetration, nX));
+			py = _mm256_sub_ps(py, _mm256_mul_ps(penetration, nY));
+			pz = _mm256_sub_ps(pz, _mm256_mul_ps(penetration, nZ));
+
+			__m256 normalVelocity = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, nX), _mm256_mul_ps(vy, nY)), _mm256_mul_ps(vz, nZ));
+			__m256 laneBounce = _mm256_andnot_ps(_mm256_cmp_ps(normalVelocity, slowImpact, _CMP_GT_OQ), _mm256_loadu_ps(bounce + i));
+			__m256 flip = _mm256_and_ps(hit, _mm256_mul_ps(_mm256_add_ps(one, laneBounce), normalVelocity));
+			__m256 drag = _mm256_and_ps(hit, friction);
+			__m256 tx = _mm256_sub_ps(vx, _mm256_mul_ps(normalVelocity, nX));
+			__m256 ty = _mm256_sub_ps(vy, _mm256_mul_ps(normalVelocity, nY));
+			__m256 tz = _mm256_sub_ps(vz, _mm256_mul_ps(normalVelocity, nZ));
+			vx = _mm256_sub_ps(vx, _mm256_add_ps(_mm256_mul_ps(flip, nX), _mm256_mul_ps(drag, tx)));
+			vy = _mm256_sub_ps(vy, _mm256_add_ps(_mm256_mul_ps(flip, nY), _mm256_mul_ps(drag, ty)));
+			vz = _mm256_sub_ps(vz, _mm256_add_ps(_mm256_mul_ps(flip, nZ), _mm256_mul_ps(drag, tz)));
+
+			__m256 qx = phys_signed_unit8(&rng);
+			__m256 qy = phys_signed_unit8(&rng);
+			__m256 qz = phys_signed_unit8(&rng);
+			__m256 qw = phys_signed_unit8(&rng);
+			__m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(qx, qx), _mm256_mul_ps(qy, qy)), _mm256_add_ps(_mm256_mul_ps(qz, qz), _mm256_mul_ps(qw, qw)));
+			__m256 inverseLength = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_max_ps(lengthSquared, _mm256_set1_ps(1e-12f))));
+			_mm256_storeu_ps(rot[0], _mm256_mul_ps(qx, inverseLength));
+			_mm256_storeu_ps(rot[1], _mm256_mul_ps(qy, inverseLength));
+			_mm256_storeu_ps(rot[2], _mm256_mul_ps(qz, inverseLength));
+			_mm256_storeu_ps(rot[3], _mm256_mul_ps(qw, inverseLength));
+		}
+
+		_mm256_storeu_ps(velX + i, vx);
+		_mm256_storeu_ps(velY + i, vy);
+		_mm256_storeu_ps(velZ + i, vz);
+		_mm256_storeu_ps(posX + i, px);
+		_mm256_storeu_ps(posY + i, py);
+		_mm256_storeu_ps(posZ + i, pz);
+
+		_mm256_storeu_ps(x, px);
+		_mm256_storeu_ps(y, py);
+		_mm256_storeu_ps(z, pz);
+		unsigned int laneCount = count - i < phys_lane_count ? count - i : phys_lane_count;
+		phys_write_lanes(&space, locals + i, laneCount, x, y, z, hitMask, rot);
+		awakeLanes[i / phys_lane_count] = phys_sleep ? phys_rest_lanes(group, start + i, awake) : awake;
+	}
+
+	_mm256_storeu_si256((__m256i*)tileRng, rng);
+#else
+	// Same steps as the AVX2 path, one lane at a time
+	for (uint32_t i = 0; i < count; i += phys_lane_count)
+	{
+		uint8_t awake = awakeLanes[i / phys_lane_count];
+		movedLanes[i / phys_lane_count] = awake;
+		if (awake == 0)
+		{
+			continue;
+		}
+
+		unsigned int hitMask = 0;
+		for (unsigned int l = 0; l < phys_lane_count; ++l)
+		{
+			uint32_t e = i + l;
+			if ((awake & (1 << l)) == 0)
 			{
-				cranm_vec_t dv = cranm_scale((cranm_vec_t) { .x = phys_vel_x[group][i], .y = phys_vel_y[group][i], .z = phys_vel_z[group][i] }, phys_fixed_tick);
-				global_transform.pos = cranm_add3(global_transform.pos, dv);
+				x[l] = posX[e];
+				y[l] = posY[e];
+				z[l] = posZ[e];
+				continue;
 			}
 
-			// Apply collision
+			velX[e] += space.gravity[0] * phys_fixed_tick;
+			velY[e] += space.gravity[1] * phys_fixed_tick;
+			velZ[e] += space.gravity[2] * phys_fixed_tick;
+			posX[e] += velX[e] * phys_fixed_tick;
+			posY[e] += velY[e] * phys_fixed_tick;
+			posZ[e] += velZ[e] * phys_fixed_tick;
+
+			float height = posX[e] * space.floorNormal[0] + posY[e] * space.floorNormal[1] + posZ[e] * space.floorNormal[2] - space.floorDistance;
+			if (height < 0.0f)
+			{
+				hitMask |= 1 << l;
+				posX[e] -= height * space.floorNormal[0];
+				posY[e] -= height * space.floorNormal[1];
+				posZ[e] -= height * space.floorNormal[2];
+
+				float normalVelocity = velX[e] * space.floorNormal[0] + velY[e] * space.floorNormal[1] + velZ[e] * space.floorNormal[2];
+				float laneBounce = phys_sleep && normalVelocity > -phys_sleep_speed ? 0.0f : bounce[e];
+				float flip = (1.0f + laneBounce) * normalVelocity;
+				float tangentX = velX[e] - normalVelocity * space.floorNormal[0];
+				float tangentY = velY[e] - normalVelocity * space.floorNormal[1];
+				float tangentZ = velZ[e] - normalVelocity * space.floorNormal[2];
+				velX[e] -= flip * space.floorNormal[0] + phys_floor_friction * tangentX;
+				velY[e] -= flip * space.floorNormal[1] + phys_floor_friction * tangentY;
+				velZ[e] -= flip * space.floorNormal[2] + phys_floor_friction * tangentZ;
+			}
+			x[l] = posX[e];
+			y[l] = posY[e];
+			z[l] = posZ[e];
+		}
+
+		if (hitMask != 0)
+		{
+			for (unsigned int c = 0; c < 4; ++c)
+			{
+				for (unsigned int l = 0; l < phys_lane_count; ++l)
+				{
+					tileRng[l] = phys_xorshift(tileRng[l]);
+					rot[c][l] = phys_signed_unit(tileRng[l]);
+				}
+			}
+
+			for (unsigned int l = 0; l < phys_lane_count; ++l)
 			{
-				// We only deal with the floor, once we hit the floor, clamp position, flip velocity
-				if (global_transform.pos.y < phys_floor_y)
+				float lengthSquared = rot[0][l] * rot[0][l] + rot[1][l] * rot[1][l] + rot[2][l] * rot[2][l] + rot[3][l] * rot[3][l];
+				float inverseLength = 1.0f / sqrtf(lengthSquared > 1e-12f ? lengthSquared : 1e-12f);
+				for (unsigned int c = 0; c < 4; ++c)
 				{
-					phys_vel_y[group][i] = -phys_vel_y[group][i] * phys_bounce[group][i];
-					global_transform.pos.y = phys_floor_y;
+					rot[c][l] *= inverseLength;
+				}
+			}
+		}
+
+		unsigned int laneCount = count - i < phys_lane_count ? count - i : phys_lane_count;
+		phys_write_lanes(&space, locals + i, laneCount, x, y, z, hitMask, rot);
+		awakeLanes[i / phys_lane_count] = phys_sleep ? phys_rest_lanes(group, start + i, awake) : awake;
+	}
+#endif // CRANBERRY_AVX2
+}
+
+// Finds the next run of entities in [*cursor, end) that moved in the last tick and moves the cursor past it.
+// @return The number of entities in the run, 0 once there are none left.
+static uint32_t phys_next_moved_run(unsigned int group, uint32_t* cursor, uint32_t end, uint32_t* runStart)
+{
+	const uint8_t* moved = phys_moved_lanes[group];
+	uint32_t i = *cursor;
+	// Whole blocks are skipped at once when the rest of the block is the same
+	while (i < end && (moved[i / phys_lane_count] & (1 << (i % phys_lane_count))) == 0)
+	{
+		i = (moved[i / phys_lane_count] >> (i % phys_lane_count)) == 0 ? (i | (phys_lane_count - 1)) + 1 : i + 1;
+	}
+	*runStart = i < end ? i : end;
+
+	while (i < end && (moved[i / phys_lane_count] & (1 << (i % phys_lane_count))) != 0)
+	{
+		i = (i % phys_lane_count) == 0 && moved[i / phys_lane_count] == 0xFF ? i + phys_lane_count : i + 1;
+	}
+	*cursor = i < end ? i : end;
+	return *cursor - *runStart;
+}
+
+// Dirties the locals written by phys_tick, the sleeping entities stay clean.
+void phys_dirty_moved(unsigned int group, uint32_t start, uint32_t count)
+{
+	uint32_t cursor = start;
+	uint32_t runStart;
+	uint32_t runCount;
+	while ((runCount = phys_next_moved_run(group, &cursor, start + count, &runStart)) != 0)
+	{
+		cranh_write_locals_end(transform_hierarchy, (cranh_handle_t) { .value = phys_first[group].value + runStart }, runCount);
+	}
+}
+
+// Sets the broadphase bounds of the tile's entities from their globals, after the transforms of the tile are done.
+void phys_gather_bounds(game_tile_t* tile)
+{
+	if (!phys_entity_contacts)
+	{
+		return;
+	}
+
+	// The bounds of the sleeping entities are still in the broadphase from when they last moved
+	uint32_t cursor = tile->start;
+	uint32_t runStart;
+	uint32_t runCount;
+	while ((runCount = phys_next_moved_run(tile->group, &cursor, tile->start + tile->count, &runStart)) != 0)
+	{
+		cranh_handle_t first = { .value = phys_first[tile->group].value + runStart };
+		cranp_gather_span(phys_broadphase, transform_hierarchy, first, runCount, phys_entity_offset[tile->group] + runStart, phys_contact_radius);
+	}
+}
+
+static void phys_entity_from_id(uint32_t id, unsigned int* group, uint32_t* entity)
+{
+	unsigned int g = max_group_count - 1;
+	while (phys_entity_offset[g] > id)
+	{
+		--g;
+	}
+	*group = g;
+	*entity = id - phys_entity_offset[g];
+}
+
+// Pushes the overlapping entities apart and bounces them off each other, the next tick integrates from there.
+// The contacts involve any two entities of any group, they're resolved one after the other.
+void phys_resolve_contacts(void)
+{
+	if (phys_parent_space)
+	{
+		return;
+	}
+
+	uint32_t contactCount = 0;
+	for (uint32_t c = 0; c < phys_broadphase->chunkCount; ++c)
+	{
+		uint32_t pairCount;
+		cranp_pair_t* pairs = cranp_read_pairs(phys_broadphase, c, &pairCount);
+		pairCount = pairCount < phys_broadphase->chunkPairCapacity ? pairCount : phys_broadphase->chunkPairCapacity;
+		for (uint32_t i = 0; i < pairCount; ++i)
+		{
+			unsigned int groupA, groupB;
+			uint32_t a, b;
+			phys_entity_from_id(pairs[i].a, &groupA, &a);
+			phys_entity_from_id(pairs[i].b, &groupB, &b);
+
+			float dx = phys_pos_x[groupB][b] - phys_pos_x[groupA][a];
+			float dy = phys_pos_y[groupB][b] - phys_pos_y[groupA][a];
+			float dz = phys_pos_z[groupB][b] - phys_pos_z[groupA][a];
+			float distanceSquared = dx * dx + dy * dy + dz * dz;
+
+			// The bounds are cubes around the spheres
+			cranp_bounds_t* boundsA = &phys_broadphase->bounds[pairs[i].a];
+			cranp_bounds_t* boundsB = &phys_broadphase->bounds[pairs[i].b];
+			float radii = (boundsA->maxX - boundsA->minX + boundsB->maxX - boundsB->minX) * 0.5f;
+			if (distanceSquared >= radii * radii || distanceSquared == 0.0f)
+			{
+				continue;
+			}
+
+			// A sleeping entity only wakes up if it's hit fast enough, otherwise it doesn't budge
+			bool awakeA = phys_is_awake(groupA, a);
+			bool awakeB = phys_is_awake(groupB, b);
+			if (!awakeA && !awakeB)
+			{
+				continue;
+			}
+
+			if (!awakeA && phys_speed_squared(groupB, b) > phys_sleep_speed * phys_sleep_speed)
+			{
+				phys_wake(groupA, a);
+				awakeA = true;
+			}
+			else if (!awakeB && phys_speed_squared(groupA, a) > phys_sleep_speed * phys_sleep_speed)
+			{
+				phys_wake(groupB, b);
+				awakeB = true;
+			}
+			++contactCount;
+
+			float distance = sqrtf(distanceSquared);
+			float nx = dx / distance, ny = dy / distance, nz = dz / distance;
+
+			// Equal masses, each awake entity takes it's share of the push and of the impulse
+			float shareA = awakeA ? (awakeB ? 0.5f : 1.0f) : 0.0f;
+			float shareB = 1.0f - shareA;
+
+			float penetration = radii - distance;
+			phys_pos_x[groupA][a] -= nx * penetration * shareA; phys_pos_y[groupA][a] -= ny * penetration * shareA; phys_pos_z[groupA][a] -= nz * penetration * shareA;
+			phys_pos_x[groupB][b] += nx * penetration * shareB; phys_pos_y[groupB][b] += ny * penetration * shareB; phys_pos_z[groupB][b] += nz * penetration * shareB;
 
-					cranm_vec_t randV = { .x = randf(-1.0f, 1.0f),.y = randf(-1.0f, 1.0f),.z = randf(-1.0f, 1.0f) };
-					global_transform.rot = cranm_axis_angleq(cranm_normalize3(randV), randf(0.0f, 2.0f * PI));
+			float normalVelocity = (phys_vel_x[groupB][b] - phys_vel_x[groupA][a]) * nx + (phys_vel_y[groupB][b] - phys_vel_y[groupA][a]) * ny + (phys_vel_z[groupB][b] - phys_vel_z[groupA][a]) * nz;
+			if (normalVelocity < 0.0f)
+			{
+				// Slow contacts don't bounce, the entities resting on each other settle instead of jittering
+				float bounce = phys_bounce[groupA][a] < phys_bounce[groupB][b] ? phys_bounce[groupA][a] : phys_bounce[groupB][b];
+				bounce = phys_sleep && -normalVelocity < phys_sleep_speed ? 0.0f : bounce;
+				float impulse = -(1.0f + bounce) * normalVelocity;
+				float impulseA = impulse * shareA;
+				float impulseB = impulse * shareB;
+				phys_vel_x[groupA][a] -= nx * impulseA; phys_vel_y[groupA][a] -= ny * impulseA; phys_vel_z[groupA][a] -= nz * impulseA;
+				phys_vel_x[groupB][b] += nx * impulseB; phys_vel_y[groupB][b] += ny * impulseB; phys_vel_z[groupB][b] += nz * impulseB;
+			}
+		}
+	}
+	phys_contact_count = contactCount;
+}
+
+static uint32_t render_bit_count(uint32_t bits)
+{
+	bits = bits - ((bits >> 1) & 0x55555555);
+	bits = (bits & 0x33333333) + ((bits >> 2) & 0x33333333);
+	return (((bits + (bits >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+}
+
+// Marks the entities of the tile whose bounding sphere touches the frustum and counts them.
+void render_cull(game_tile_t* tile)
+{
+	uint32_t tileIndex = tile->start / game_tile_entity_count;
+	uint32_t* visibility = render_visibility[tile->group][tileIndex];
+	uint32_t visibleCount = 0;
+
+	float x[phys_lane_count], y[phys_lane_count], z[phys_lane_count], radius[phys_lane_count];
+	for (uint32_t i = 0; i < tile->count; i += phys_lane_count)
+	{
+		unsigned int laneCount = tile->count - i < phys_lane_count ? tile->count - i : phys_lane_count;
+		for (unsigned int l = 0; l < phys_lane_count; ++l)
+		{
+			// The padding lanes repeat the last entity, they're masked out of the result
+			unsigned int lane = l < laneCount ? l : laneCount - 1;
+			cranm_transform_t global = cranh_read_global(transform_hierarchy, (cranh_handle_t) { .value = phys_first[tile->group].value + tile->start + i + lane });
+			x[l] = global.pos.x;
+			y[l] = global.pos.y;
+			z[l] = global.pos.z;
+			// The cubes span [-scale, scale] on every axis, their bounding sphere reaches the corners
+			radius[l] = global.scale * 1.7320508f;
+		}
+
+		unsigned int visibleMask = (1 << laneCount) - 1;
+		if (render_frustum_culling)
+		{
+#ifdef CRANBERRY_AVX2
+			__m256 px = _mm256_loadu_ps(x);
+			__m256 py = _mm256_loadu_ps(y);
+			__m256 pz = _mm256_loadu_ps(z);
+			__m256 negativeRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(radius));
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+			for (unsigned int p = 0; p < 6; ++p)
+			{
+				__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, _mm256_set1_ps(render_frustum[p].x)), _mm256_mul_ps(py, _mm256_set1_ps(render_frustum[p].y))),
+					_mm256_add_ps(_mm256_mul_ps(pz, _mm256_set1_ps(render_frustum[p].z)), _mm256_set1_ps(render_frustum[p].w)));
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negativeRadius, _CMP_GE_OQ));
+			}
+			visibleMask &= (unsigned int)_mm256_movemask_ps(inside);
+#else
+			// Same steps as the AVX2 path, one lane at a time
+			unsigned int insideMask = 0;
+			for (unsigned int l = 0; l < phys_lane_count; ++l)
+			{
+				bool inside = true;
+				for (unsigned int p = 0; p < 6; ++p)
+				{
+					float distance = x[l] * render_frustum[p].x + y[l] * render_frustum[p].y + z[l] * render_frustum[p].z + render_frustum[p].w;
+					inside = inside && distance >= -radius[l];
 				}
+				insideMask |= inside ? 1 << l : 0;
 			}
+			visibleMask &= insideMask;
+#endif // CRANBERRY_AVX2
+		}
 
-			cranh_write_global(transform_hierarchy, phys_handle[group][i], global_transform);
+		// 4 groups of 8 lanes per word
+		if ((i & 31) == 0)
+		{
+			visibility[i >> 5] = 0;
+		}
+		visibility[i >> 5] |= visibleMask << (i & 31);
+		visibleCount += render_bit_count(visibleMask);
+	}
+
+	render_visible_count[tile->group][tileIndex] = visibleCount;
+}
+
+// Writes the visible entities of the tile at the tile's offset in the instance buffer.
+void render_gen_instances(game_tile_t* tile)
+{
+	uint32_t tileIndex = tile->start / game_tile_entity_count;
+	uint32_t* visibility = render_visibility[tile->group][tileIndex];
+	game_instance_t* instances = render_instance_buffer + render_tile_offset[tile->group][tileIndex];
+	for (uint32_t i = 0; i < tile->count; i += 32)
+	{
+		for (uint32_t bits = visibility[i >> 5], bit = 0; bits != 0; bits >>= 1, ++bit)
+		{
+			if (bits & 1)
+			{
+				*instances++ = (game_instance_t)
+				{
+					.transform = cranh_read_global(transform_hierarchy, (cranh_handle_t) { .value = phys_first[tile->group].value + tile->start + i + bit }),
+					.color = { 1.0f, 0.7f, 0.0f }
+				};
+			}
 		}
 	}
 }
@@ -128,6 +1050,10 @@ void game_init(void)
 {
 	transform_hierarchy = cranh_create(max_group_count, max_entity_group_count);
 
+#ifdef CRANBERRY_RECORD
+	cranh_record_start(transform_hierarchy, "game_hierarchy_trace.bin");
+#endif // CRANBERRY_RECORD
+
 	for (int i = 0; i < max_group_count; i++)
 	{
 		cranm_vec_t randV = { .x = randf(-1.0f, 1.0f),.y = randf(-1.0f, 1.0f),.z = randf(-1.0f, 1.0f), 0.0f };
@@ -139,6 +1065,7 @@ void game_init(void)
 		};
 
 		cranh_handle_t h = cranh_add(transform_hierarchy, t);
+		phys_parent[i] = h;
 
 		for(int cx = -cube_half_dimension; cx < cube_half_dimension; ++cx)
 		{
@@ -155,89 +1082,197 @@ void game_init(void)
 					};
 
 					cranh_handle_t ch = cranh_add_with_parent(transform_hierarchy, c, h);
-					render_handles[render_count] = ch;
 					render_count++;
 
-					phys_handle[i][phys_entity_count[i]] = ch;
+					if (phys_entity_count[i] == 0)
+					{
+						phys_first[i] = ch;
+					}
+					assert(ch.value == phys_first[i].value + phys_entity_count[i]);
+
+					cranm_vec_t pos = phys_parent_space ? c.pos : cranh_read_global(transform_hierarchy, ch).pos;
+					phys_pos_x[i][phys_entity_count[i]] = pos.x;
+					phys_pos_y[i][phys_entity_count[i]] = pos.y;
+					phys_pos_z[i][phys_entity_count[i]] = pos.z;
 					phys_vel_x[i][phys_entity_count[i]] = 0.0f;
 					phys_vel_y[i][phys_entity_count[i]] = 0.0f;
 					phys_vel_z[i][phys_entity_count[i]] = 0.0f;
 					phys_bounce[i][phys_entity_count[i]] = randf(0.95f, 0.99f);
+					phys_rest_x[i][phys_entity_count[i]] = pos.x;
+					phys_rest_y[i][phys_entity_count[i]] = pos.y;
+					phys_rest_z[i][phys_entity_count[i]] = pos.z;
 					phys_entity_count[i]++;
 				}
 			}
 		}
 	}
 
-	InitializeConditionVariable(&transform_enabled);
-	InitializeConditionVariable(&transforms_done);
+	memset(phys_awake_lanes, 0xFF, sizeof(phys_awake_lanes));
 	for (unsigned int i = 0; i < max_group_count; ++i)
+	{
+		for (unsigned int l = 0; l < phys_lane_count; ++l)
+		{
+			uint32_t seed = ((uint32_t)rand() << 16) ^ (uint32_t)rand() ^ (l + 1) * 0x9E3779B9;
+			for (uint32_t t = 0; t < game_max_tile_count; ++t)
+			{
+				// Scramble the seed per tile so that the streams of neighbouring tiles aren't correlated
+				uint32_t x = seed + t * 0x85EBCA6B;
+				x = (x ^ (x >> 16)) * 0x7FEB352D;
+				x = (x ^ (x >> 15)) * 0x846CA68B;
+				x ^= x >> 16;
+				phys_rng[i][t][l] = x == 0 ? 1 : x;
+			}
+		}
+
+		phys_entity_offset[i] = i > 0 ? phys_entity_offset[i - 1] + phys_entity_count[i - 1] : 0;
+		for (uint32_t start = 0; start < phys_entity_count[i]; start += game_tile_entity_count)
+		{
+			uint32_t count = phys_entity_count[i] - start < game_tile_entity_count ? phys_entity_count[i] - start : game_tile_entity_count;
+			game_tiles[i][game_tile_count[i]++] = (game_tile_t) { .group = i, .start = start, .count = count };
+		}
+	}
+
+	if (phys_entity_contacts)
+	{
+		uint32_t entityCount = phys_entity_offset[max_group_count - 1] + phys_entity_count[max_group_count - 1];
+		phys_broadphase = cranp_create(entityCount, phys_broadphase_cell_size, phys_broadphase_chunk_size, phys_broadphase_chunk_pair_capacity);
+		for (uint32_t c = 0; c < phys_broadphase->chunkCount; ++c)
+		{
+			phys_broadphase_chunks[c] = c;
+		}
+	}
+	game_build_graph();
+
+	unsigned int processorCount = cranb_processor_count();
+	game_worker_count = processorCount > 1 ? processorCount - 1 : 1;
+	game_worker_count = game_worker_count < game_max_worker_count ? game_worker_count : game_max_worker_count;
+
+	cranb_barrier_init(&transform_start_barrier, game_worker_count + 1, cranb_default_spin_count);
+	cranb_barrier_init(&transform_end_barrier, game_worker_count + 1, cranb_default_spin_count);
+	for (unsigned int i = 0; i < game_worker_count; ++i)
 	{
 		transform_threads[i] = CreateThread(
 			NULL,
 			0,
-			transform_tick_group,
-			(LPVOID)i,
+			transform_worker,
+			NULL,
 			0,
 			&threadIds[i]
 		);
 	}
-
-	// Wait for all our threads to acknowledge they started
-	while (transform_done_count < max_group_count) {};
-	InterlockedExchange(&transform_done_count, 0);
 }
 
-void game_tick()
+static void game_dispatch_tick(cranm_mat4x4_t viewProjection)
 {
-	MIST_PROFILE_BEGIN("game", "game_tick");
+	cranm_frustum_planes(viewProjection, render_frustum);
+	render_instance_buffer_index = (render_instance_buffer_index + 1) % render_instance_buffer_count;
+	render_instance_buffer = render_instance_buffers[render_instance_buffer_index];
+	crant_graph_reset(game_graph);
+	cranb_barrier_wait(&transform_start_barrier);
+	game_tick_in_flight = true;
+}
 
+static void game_complete_tick(void)
+{
 	MIST_PROFILE_BEGIN("game", "thread_tick");
+	cranb_barrier_wait(&transform_end_barrier);
+	game_tick_in_flight = false;
+	render_instances_ready = true;
+	MIST_PROFILE_END("game", "thread_tick");
 
-	WakeAllConditionVariable(&transform_enabled);
-	
-	if (transform_done_count < max_group_count)
+#ifdef CRANBERRY_STATS
+	cranh_stats_t total = { 0 };
+	for (unsigned int i = 0; i < max_group_count; ++i)
 	{
-		CRITICAL_SECTION unusedCritical;
-		InitializeCriticalSection(&unusedCritical);
+		cranh_stats_t stats = cranh_read_stats(transform_hierarchy, i);
+		total.transformsComputed += stats.transformsComputed;
+		total.transformsSkipped += stats.transformsSkipped;
+		total.deadSlotsComputed += stats.deadSlotsComputed;
+		total.dirtyBytesScanned += stats.dirtyBytesScanned;
+	}
 
-		EnterCriticalSection(&unusedCritical);
-		SleepConditionVariableCS(&transforms_done, &unusedCritical, INFINITE);
-		LeaveCriticalSection(&unusedCritical);
+	MIST_PROFILE_COUNTER("cranh", "transforms_computed", total.transformsComputed);
+	MIST_PROFILE_COUNTER("cranh", "transforms_skipped", total.transformsSkipped);
+	MIST_PROFILE_COUNTER("cranh", "dead_slots_computed", total.deadSlotsComputed);
+	MIST_PROFILE_COUNTER("cranh", "dirty_bytes_scanned", total.dirtyBytesScanned);
+#endif // CRANBERRY_STATS
 
-		assert(transform_done_count == max_group_count);
-		InterlockedExchange(&transform_done_count, 0);
+	if (phys_entity_contacts)
+	{
+		MIST_PROFILE_COUNTER("phys", "contacts", phys_contact_count);
+		MIST_PROFILE_COUNTER("phys", "sort_insertion_moves", phys_broadphase->insertionMoves);
+		MIST_PROFILE_COUNTER("phys", "sort_radix", phys_broadphase->radixSorted ? 1 : 0);
 	}
 
-	MIST_PROFILE_END("game", "thread_tick");
+	if (phys_sleep)
+	{
+		uint32_t awakeCount = 0;
+		for (unsigned int i = 0; i < max_group_count; ++i)
+		{
+			for (uint32_t b = 0; b * phys_lane_count < phys_entity_count[i]; ++b)
+			{
+				// The padding lanes of the last block aren't entities
+				uint32_t laneCount = phys_entity_count[i] - b * phys_lane_count;
+				uint32_t lanes = laneCount < phys_lane_count ? (1u << laneCount) - 1 : 0xFF;
+				awakeCount += render_bit_count(phys_awake_lanes[i][b] & lanes);
+			}
+		}
+		MIST_PROFILE_COUNTER("phys", "awake_entities", awakeCount);
+	}
+}
+
+unsigned int game_tick_begin(cranm_mat4x4_t viewProjection, game_instance_t** instances)
+{
+	MIST_PROFILE_FRAME();
+	MIST_PROFILE_BEGIN("game", "game_tick_begin");
+
+	// Nothing has been simulated yet the first time around, the first tick isn't overlapped
+	if (!game_pipelined_frames || !render_instances_ready)
+	{
+		game_dispatch_tick(viewProjection);
+		game_complete_tick();
+	}
+
+	*instances = render_instance_buffer;
+	uint32_t instanceCount = render_instance_counts[render_instance_buffer_index];
+	if (game_pipelined_frames)
+	{
+		game_dispatch_tick(viewProjection);
+	}
+
+	MIST_PROFILE_COUNTER("game", "visible_instances", instanceCount);
+	MIST_PROFILE_COUNTER("game", "culled_instances", render_count - instanceCount);
+	MIST_PROFILE_END("game", "game_tick_begin");
+	return instanceCount;
+}
 
-	MIST_PROFILE_END("game", "game_tick");
+void game_tick_end(void)
+{
+	if (game_tick_in_flight)
+	{
+		game_complete_tick();
+	}
 }
 
 void game_cleanup(void)
 {
+	game_tick_end();
 	InterlockedExchange(&transform_shutdown, 1);
-	WakeAllConditionVariable(&transform_enabled);
-	WaitForMultipleObjects(max_group_count, transform_threads, TRUE, INFINITE);
-	for (unsigned int i = 0; i < max_group_count; i++)
+	cranb_barrier_wait(&transform_start_barrier);
+	WaitForMultipleObjects(game_worker_count, transform_threads, TRUE, INFINITE);
+	for (unsigned int i = 0; i < game_worker_count; i++)
 	{
 		CloseHandle(transform_threads[i]);
 	}
-	cranh_destroy(transform_hierarchy);
-}
 
-unsigned int game_gen_instance_buffer(game_instance_t* buffer, unsigned int maxSize)
-{
-	MIST_PROFILE_BEGIN("game", "game_gen_instance_buffer");
-	assert(render_count <= maxSize);
-	for (uint32_t i = 0; i < render_count; i++)
+#ifdef CRANBERRY_RECORD
+	cranh_record_stop(transform_hierarchy);
+#endif // CRANBERRY_RECORD
+
+	crant_graph_destroy(game_graph);
+	if (phys_entity_contacts)
 	{
-		buffer[i] = (game_instance_t)
-		{
-			.transform = cranh_read_global(transform_hierarchy, render_handles[i]),
-			.color = { 1.0f, 0.7f, 0.0f }
-		};
+		cranp_destroy(phys_broadphase);
 	}
-	MIST_PROFILE_END("game", "game_gen_instance_buffer");
-	return render_count;
-}
\ No newline at end of file
+	cranh_destroy(transform_hierarchy);
+}
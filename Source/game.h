@@ -9,7 +9,11 @@ typedef struct
 } game_instance_t;
 
 void game_init(void);
-void game_tick();
+// @brief Starts a tick and returns the instances to render this frame, the instances outside of viewProjection are culled.
+// With pipelined frames, the instances are the ones of the previous tick and the workers simulate the next tick until game_tick_end.
+// Upload the instances in between. The instances stay valid until the second game_tick_begin after this one.
+// @return The number of instances.
+unsigned int game_tick_begin(cranm_mat4x4_t viewProjection, game_instance_t** instances);
+// @brief Waits for the tick started by game_tick_begin.
+void game_tick_end(void);
 void game_cleanup(void);
-
-unsigned int game_gen_instance_buffer(game_instance_t* buffer, unsigned int maxSize);
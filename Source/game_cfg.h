@@ -3,9 +3,15 @@
 #define CRANBERRY_ENABLE_TESTS
 // #define CRANBERRY_DEBUG
 // #define CRANBERRY_MATH_DEBUG_SLOW
+// #define CRANBERRY_STATS
+// #define CRANBERRY_RECORD
+// #define CRANBERRY_BOUNDS
 #define CRANBERRY_SSE
+// #define CRANBERRY_AVX2 // Integrates the physics and transforms the instanced hierarchies 8 at a time, needs /arch:AVX2
 
 #define MIST_PROFILE_ENABLED
+// #define MIST_PROFILE_STATS
+// #define MIST_PROFILE_PERF_COUNTERS
 
 #define _CRT_SECURE_NO_WARNINGS
 
@@ -4,6 +4,7 @@
 
 #define CRANBERRY_HIERARCHY_IMPL
 #include "cranberry_hierarchy.h"
+#include "cranberry_broadphase.h"
 #include "cranberry_math.h"
 
 #include <stdio.h>
@@ -20,9 +21,307 @@
 #include "3rd/Mist_Profiler.h"
 
 #ifdef CRANBERRY_ENABLE_TESTS
+#include "cranberry_barrier.h"
+#include "cranberry_tasks.h"
+
+#include <Windows.h>
 #include <assert.h>
 #include <string.h>
 
+// Clones are transformed as soon as they're added, they can be read and written to before the pass
+static void test_clone(cranm_transform_t p, cranm_transform_t c)
+{
+	cranh_hierarchy_t* hierarchy = cranh_create(2, 5);
+	cranh_handle_t parent = cranh_add(hierarchy, p);
+	cranh_add_with_parent(hierarchy, c, parent);
+
+	cranh_handle_t clone = cranh_clone_subtree(hierarchy, parent, parent);
+	cranh_handle_t cloneChild = { .value = clone.value + 1 };
+	cranm_transform_t cloneChildExpected = cranm_transform(c, cranm_transform(p, p));
+	cranm_transform_t cloneChildGlobal = cranh_read_global(hierarchy, cloneChild);
+	assert(memcmp(&cloneChildGlobal, &cloneChildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(clone));
+
+	cloneChildGlobal = cranh_read_global(hierarchy, cloneChild);
+	assert(memcmp(&cloneChildGlobal, &cloneChildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	cranh_add_with_parent(hierarchy, c, parent);
+	clone = cranh_clone_subtree(hierarchy, parent, parent);
+	cloneChild.value = clone.value + 1;
+
+	cranh_handle_t grandchild = cranh_add_with_parent(hierarchy, c, cloneChild);
+	cranm_transform_t grandchildExpected = cranm_transform(c, cloneChildExpected);
+	cranm_transform_t grandchildGlobal = cranh_read_global(hierarchy, grandchild);
+	assert(memcmp(&grandchildGlobal, &grandchildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_write_global(hierarchy, cloneChild, p);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cloneChildGlobal = cranh_read_global(hierarchy, cloneChild);
+	assert(fabsf(cloneChildGlobal.pos.x - p.pos.x) < 0.001f && fabsf(cloneChildGlobal.scale - p.scale) < 0.001f);
+	grandchildExpected = cranm_transform(c, p);
+	grandchildGlobal = cranh_read_global(hierarchy, grandchild);
+	assert(fabsf(grandchildGlobal.pos.x - grandchildExpected.pos.x) < 0.001f && fabsf(grandchildGlobal.scale - grandchildExpected.scale) < 0.001f);
+
+	cranh_destroy(hierarchy);
+}
+
+// Baked transforms keep their globals when their parent moves, until they're unbaked
+static void test_static(cranm_transform_t p, cranm_transform_t c, cranm_transform_t t)
+{
+	cranh_hierarchy_t* hierarchy = cranh_create(2, 5);
+	cranh_handle_t parent = cranh_add(hierarchy, p);
+	cranh_handle_t child = cranh_add_with_parent(hierarchy, c, parent);
+
+	cranh_bake_static(hierarchy, child);
+	cranh_write_local(hierarchy, parent, c);
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(parent));
+
+	cranm_transform_t staticGlobal = cranh_read_global(hierarchy, child);
+	assert(memcmp(&staticGlobal, &t, sizeof(cranm_transform_t)) == 0);
+
+	cranh_unbake_static(hierarchy, child);
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(parent));
+
+	cranm_transform_t unbakedGlobal = cranh_read_global(hierarchy, child);
+	cranm_transform_t unbakedExpected = cranm_transform(c, c);
+	assert(memcmp(&unbakedGlobal, &unbakedExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+}
+
+// The slots of a group add up to it's capacity and the pass counts at least the transforms it processed
+static void test_stats(cranm_transform_t p, cranm_transform_t c)
+{
+	cranh_hierarchy_t* hierarchy = cranh_create(2, 5);
+	cranh_handle_t parent = cranh_add(hierarchy, p);
+	cranh_add_with_parent(hierarchy, c, parent);
+
+	cranh_write_local(hierarchy, parent, c);
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(parent));
+
+	cranh_stats_t stats = cranh_read_stats(hierarchy, cranh_group_from_handle(parent));
+	assert(stats.rootCount + stats.childCount + stats.freeSlots == stats.capacity);
+#ifdef CRANBERRY_STATS
+	assert(stats.transformsComputed >= stats.dirtyChildrenProcessed + stats.dirtyRootsProcessed);
+	assert(stats.maxAncestorWalkDepth == 1);
+#endif // CRANBERRY_STATS
+
+	cranh_destroy(hierarchy);
+}
+
+#define test_broadphase_entity_count 256
+
+static float test_random(float min, float max)
+{
+	return min + (max - min) * (float)rand() / (float)RAND_MAX;
+}
+
+// Entities straddle the cells around 0 and some are a whole grid away, they share rows without being neighbours
+static cranp_bounds_t test_random_bounds(void)
+{
+	float size = test_random(0.1f, 1.0f);
+	float x = test_random(-6.0f, 6.0f);
+	float y = test_random(-3.0f, 3.0f) + (rand() % 8 == 0 ? 256.0f : 0.0f);
+	float z = test_random(-3.0f, 3.0f) - (rand() % 8 == 0 ? 256.0f : 0.0f);
+	return (cranp_bounds_t) { x, y, z, x + size, y + size, z + size };
+}
+
+// Every overlapping pair is reported once, and only those
+static void test_broadphase_pairs(cranp_broadphase_t* broadphase, cranp_bounds_t* bounds, uint8_t* found)
+{
+	memset(found, 0, test_broadphase_entity_count * test_broadphase_entity_count);
+	for (uint32_t chunk = 0; chunk < broadphase->chunkCount; ++chunk)
+	{
+		uint32_t count;
+		cranp_pair_t* pairs = cranp_read_pairs(broadphase, chunk, &count);
+		assert(count <= broadphase->chunkPairCapacity);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			uint32_t a = pairs[i].a < pairs[i].b ? pairs[i].a : pairs[i].b;
+			uint32_t b = pairs[i].a < pairs[i].b ? pairs[i].b : pairs[i].a;
+			assert(found[a * test_broadphase_entity_count + b] == 0);
+			found[a * test_broadphase_entity_count + b] = 1;
+		}
+	}
+
+	for (uint32_t a = 0; a < test_broadphase_entity_count; ++a)
+	{
+		for (uint32_t b = a + 1; b < test_broadphase_entity_count; ++b)
+		{
+			assert(found[a * test_broadphase_entity_count + b] == (cranp_overlap(bounds + a, bounds + b) ? 1 : 0));
+		}
+	}
+}
+
+// The pairs match a brute force test after a fresh sort, a nearly sorted frame and a frame where everything moved
+static void test_broadphase(unsigned int seed)
+{
+	srand(seed);
+	cranp_bounds_t bounds[test_broadphase_entity_count];
+	uint8_t* found = (uint8_t*)malloc(test_broadphase_entity_count * test_broadphase_entity_count);
+	cranp_broadphase_t* broadphase = cranp_create(test_broadphase_entity_count, 1.0f, 32, 1024);
+
+	for (uint32_t i = 0; i < test_broadphase_entity_count; ++i)
+	{
+		bounds[i] = test_random_bounds();
+		cranp_set_bounds(broadphase, i, bounds[i]);
+	}
+	cranp_update(broadphase);
+	test_broadphase_pairs(broadphase, bounds, found);
+
+	// A few entities nudged, the insertion sort fixes the order
+	for (uint32_t i = 0; i < test_broadphase_entity_count; i += 16)
+	{
+		float offset = test_random(-0.2f, 0.2f);
+		bounds[i].minX += offset;
+		bounds[i].maxX += offset;
+		cranp_set_bounds(broadphase, i, bounds[i]);
+	}
+	cranp_update(broadphase);
+	assert(!broadphase->radixSorted);
+	test_broadphase_pairs(broadphase, bounds, found);
+
+	for (uint32_t i = 0; i < test_broadphase_entity_count; ++i)
+	{
+		bounds[i] = test_random_bounds();
+		cranp_set_bounds(broadphase, i, bounds[i]);
+	}
+	cranp_update(broadphase);
+	assert(broadphase->radixSorted);
+	test_broadphase_pairs(broadphase, bounds, found);
+
+	cranp_destroy(broadphase);
+	free(found);
+}
+
+#define test_barrier_thread_count 4
+#define test_barrier_generation_count 2048
+
+static cranb_barrier_t test_barrier;
+static uint32_t test_barrier_arrivals; // Counts down once per thread and generation
+static uint32_t test_barrier_releases; // Counts down once per release
+
+// Every thread sees the arrivals of the whole generation once it's released, the second wait keeps the next generation out until all of them checked
+static DWORD WINAPI test_barrier_worker(LPVOID lparam)
+{
+	(void)lparam;
+	for (uint32_t generation = 0; generation < test_barrier_generation_count; ++generation)
+	{
+		cranb_decrement(&test_barrier_arrivals);
+		if (cranb_barrier_wait(&test_barrier))
+		{
+			cranb_decrement(&test_barrier_releases);
+		}
+
+		assert(cranb_load(&test_barrier_arrivals) == (test_barrier_generation_count - generation - 1) * test_barrier_thread_count);
+		if (cranb_barrier_wait(&test_barrier))
+		{
+			cranb_decrement(&test_barrier_releases);
+		}
+	}
+	return 0;
+}
+
+// The barrier is reused over thousands of generations, once spinning and once parking right away
+static void test_barrier_generations(uint32_t spinCount)
+{
+	cranb_barrier_init(&test_barrier, test_barrier_thread_count, spinCount);
+	test_barrier_arrivals = test_barrier_generation_count * test_barrier_thread_count;
+	test_barrier_releases = test_barrier_generation_count * 2;
+
+	HANDLE threads[test_barrier_thread_count - 1];
+	for (uint32_t i = 0; i < test_barrier_thread_count - 1; ++i)
+	{
+		DWORD threadId;
+		threads[i] = CreateThread(NULL, 0, test_barrier_worker, NULL, 0, &threadId);
+	}
+	test_barrier_worker(NULL);
+	WaitForMultipleObjects(test_barrier_thread_count - 1, threads, TRUE, INFINITE);
+	for (uint32_t i = 0; i < test_barrier_thread_count - 1; ++i)
+	{
+		CloseHandle(threads[i]);
+	}
+
+	assert(test_barrier_arrivals == 0 && test_barrier_releases == 0);
+	assert(test_barrier.generation == test_barrier_generation_count * 2);
+}
+
+#define test_task_count 8
+#define test_task_worker_count 3
+
+static uint32_t test_task_clock;
+static uint32_t test_task_order[test_task_count];
+static uint32_t test_task_indices[test_task_count];
+
+static void test_task(void* data)
+{
+	uint32_t task = *(uint32_t*)data;
+	test_task_order[task] = crant_increment(&test_task_clock);
+}
+
+static DWORD WINAPI test_task_worker(LPVOID lparam)
+{
+	crant_graph_work((crant_graph_t*)lparam);
+	return 0;
+}
+
+// Tasks run after their dependencies on every run, the graph refuses tasks and dependencies past it's capacity
+static void test_tasks(void)
+{
+	// 0 and 1 join into 2, which forks into 3 and 4, they join into 5 and 6 runs last. 7 is on it's own.
+	static const uint32_t dependencies[][2] = { { 0, 2 }, { 1, 2 }, { 2, 3 }, { 2, 4 }, { 3, 5 }, { 4, 5 }, { 5, 6 } };
+	uint32_t dependencyCount = sizeof(dependencies) / sizeof(dependencies[0]);
+
+	crant_graph_t* graph = crant_graph_create(test_task_count, dependencyCount, cranb_default_spin_count);
+	for (uint32_t i = 0; i < test_task_count; ++i)
+	{
+		test_task_indices[i] = i;
+		assert(crant_graph_add(graph, test_task, &test_task_indices[i]) == i);
+	}
+	assert(crant_graph_add(graph, test_task, NULL) == crant_invalid_task);
+
+	for (uint32_t i = 0; i < dependencyCount; ++i)
+	{
+		assert(crant_graph_depend(graph, dependencies[i][0], dependencies[i][1]));
+	}
+	assert(!crant_graph_depend(graph, 6, 7));
+	assert(graph->tasks[7].dependencyCount == 0);
+
+	HANDLE threads[test_task_worker_count];
+	for (uint32_t run = 0; run < 64; ++run)
+	{
+		test_task_clock = 0;
+		memset(test_task_order, 0xFF, sizeof(test_task_order));
+
+		crant_graph_reset(graph);
+		for (uint32_t i = 0; i < test_task_worker_count; ++i)
+		{
+			DWORD threadId;
+			threads[i] = CreateThread(NULL, 0, test_task_worker, graph, 0, &threadId);
+		}
+		crant_graph_work(graph);
+		WaitForMultipleObjects(test_task_worker_count, threads, TRUE, INFINITE);
+		for (uint32_t i = 0; i < test_task_worker_count; ++i)
+		{
+			CloseHandle(threads[i]);
+		}
+
+		assert(test_task_clock == test_task_count);
+		for (uint32_t i = 0; i < dependencyCount; ++i)
+		{
+			assert(test_task_order[dependencies[i][0]] < test_task_order[dependencies[i][1]]);
+		}
+	}
+
+	crant_graph_destroy(graph);
+}
+
 void test()
 {
 	cranm_transform_t c = { .pos = {.x = 5.0f,.y = 0.0f,.z = 0.0f},.rot = {0},.scale = 1.0f };
@@ -43,6 +342,423 @@ void test()
 
 	cranh_destroy(hierarchy);
 
+	test_clone(p, c);
+	test_static(p, c, t);
+	test_stats(p, c);
+
+	// The first root and the unused transforms at the end of the last block pass the debug checks.
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	child = cranh_add_with_parent(hierarchy, c, parent);
+
+	cranh_write_local(hierarchy, parent, p);
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(parent));
+
+	cranm_transform_t parentLocal = cranh_read_local(hierarchy, parent);
+	assert(memcmp(&parentLocal, &p, sizeof(cranm_transform_t)) == 0);
+	childGlobal = cranh_read_global(hierarchy, child);
+	assert(memcmp(&childGlobal, &t, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// Groups that aren't a multiple of 4 transforms have room for the last block of roots.
+	hierarchy = cranh_create(1, 5);
+	parent = cranh_add(hierarchy, p);
+	child = cranh_add_with_parent(hierarchy, c, parent);
+
+	cranh_write_local(hierarchy, parent, p);
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(parent));
+
+	childGlobal = cranh_read_global(hierarchy, child);
+	assert(memcmp(&childGlobal, &t, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// The intervals consumed by a pass don't end the intervals of the next pass early.
+	hierarchy = cranh_create(1, 16);
+	cranh_handle_t firstRoot = cranh_add(hierarchy, p);
+	cranh_handle_t secondRoot = cranh_add(hierarchy, p);
+	cranh_handle_t lastChild = { 0 };
+	for (unsigned int i = 0; i < 6; ++i)
+	{
+		cranh_add_with_parent(hierarchy, c, firstRoot);
+	}
+	for (unsigned int i = 0; i < 6; ++i)
+	{
+		lastChild = cranh_add_with_parent(hierarchy, c, secondRoot);
+	}
+
+	cranh_write_local(hierarchy, firstRoot, p);
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(firstRoot));
+	cranh_write_local(hierarchy, secondRoot, t);
+	cranh_transform_locals_to_globals(hierarchy, cranh_group_from_handle(secondRoot));
+
+	cranm_transform_t lastChildGlobal = cranh_read_global(hierarchy, lastChild);
+	cranm_transform_t lastChildExpected = cranm_transform(c, t);
+	assert(memcmp(&lastChildGlobal, &lastChildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// The dirty child and the children range of it's parent both start at the same transform
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	child = cranh_add_with_parent(hierarchy, c, parent);
+	cranh_handle_t sibling = child;
+	for (unsigned int i = 0; i < 8; ++i)
+	{
+		sibling = cranh_add_with_parent(hierarchy, c, parent);
+	}
+	cranh_write_local(hierarchy, child, c);
+	cranh_write_local(hierarchy, parent, c);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranm_transform_t siblingGlobal = cranh_read_global(hierarchy, sibling);
+	cranm_transform_t siblingExpected = cranm_transform(c, c);
+	assert(memcmp(&siblingGlobal, &siblingExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// The last children and the first roots share a block of 4, passing one doesn't touch the other
+	hierarchy = cranh_create(1, 8);
+	parent = cranh_add(hierarchy, p);
+	cranh_handle_t otherRoot = cranh_add(hierarchy, c);
+	for (unsigned int i = 0; i < 5; ++i)
+	{
+		child = cranh_add_with_parent(hierarchy, c, parent);
+	}
+	cranh_write_local(hierarchy, otherRoot, c);
+	cranh_write_local(hierarchy, child, c);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	childGlobal = cranh_read_global(hierarchy, child);
+	assert(memcmp(&childGlobal, &t, sizeof(cranm_transform_t)) == 0);
+	cranm_transform_t otherRootGlobal = cranh_read_global(hierarchy, otherRoot);
+	assert(memcmp(&otherRootGlobal, &c, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// Bulk writes dirty the written transforms and their descendants
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	cranh_handle_t first = cranh_add_with_parent(hierarchy, c, parent);
+	for (unsigned int i = 0; i < 5; ++i)
+	{
+		cranh_add_with_parent(hierarchy, c, parent);
+	}
+	cranh_handle_t grandchild = cranh_add_with_parent(hierarchy, c, (cranh_handle_t) { .value = first.value + 2 });
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranh_handle_t bulkFirst = { .value = first.value + 1 };
+	cranm_transform_t* bulkLocals = cranh_write_locals_begin(hierarchy, bulkFirst, 4);
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		bulkLocals[i] = p;
+	}
+	cranh_write_locals_end(hierarchy, bulkFirst, 4);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranm_transform_t bulkGlobal = cranh_read_global(hierarchy, (cranh_handle_t) { .value = first.value + 4 });
+	cranm_transform_t bulkExpected = cranm_transform(p, p);
+	assert(memcmp(&bulkGlobal, &bulkExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranm_transform_t grandchildGlobal = cranh_read_global(hierarchy, grandchild);
+	cranm_transform_t grandchildExpected = cranm_transform(c, bulkExpected);
+	assert(memcmp(&grandchildGlobal, &grandchildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranm_transform_t firstGlobal = cranh_read_global(hierarchy, first);
+	assert(memcmp(&firstGlobal, &t, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// A tiled pass can be written to ahead of it's cursor
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	first = cranh_add_with_parent(hierarchy, c, parent);
+	for (unsigned int i = 0; i < 7; ++i)
+	{
+		cranh_add_with_parent(hierarchy, c, parent);
+	}
+	grandchild = cranh_add_with_parent(hierarchy, c, (cranh_handle_t) { .value = first.value + 1 });
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranh_write_local(hierarchy, parent, c);
+	cranh_transform_locals_to_globals_through(hierarchy, (cranh_handle_t) { .value = first.value + 3 });
+	cranh_write_local(hierarchy, (cranh_handle_t) { .value = first.value + 5 }, p);
+	cranh_transform_locals_to_globals_through(hierarchy, (cranh_handle_t) { .value = first.value + 7 });
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranm_transform_t tileExpected = cranm_transform(c, c);
+	firstGlobal = cranh_read_global(hierarchy, first);
+	assert(memcmp(&firstGlobal, &tileExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranm_transform_t tileWriteGlobal = cranh_read_global(hierarchy, (cranh_handle_t) { .value = first.value + 5 });
+	cranm_transform_t tileWriteExpected = cranm_transform(p, c);
+	assert(memcmp(&tileWriteGlobal, &tileWriteExpected, sizeof(cranm_transform_t)) == 0);
+
+	grandchildGlobal = cranh_read_global(hierarchy, grandchild);
+	grandchildExpected = cranm_transform(c, tileExpected);
+	assert(memcmp(&grandchildGlobal, &grandchildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// A budgeted pass resumes where it stopped, writes behind it are left for the next pass
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	first = cranh_add_with_parent(hierarchy, c, parent);
+	for (unsigned int i = 0; i < 7; ++i)
+	{
+		cranh_add_with_parent(hierarchy, c, parent);
+	}
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranh_write_local(hierarchy, parent, c);
+	assert(!cranh_transform_locals_to_globals_budget(hierarchy, 0, 4));
+	cranm_transform_t budgetGlobal = cranh_read_global(hierarchy, (cranh_handle_t) { .value = first.value + 4 });
+	assert(memcmp(&budgetGlobal, &t, sizeof(cranm_transform_t)) == 0);
+
+	cranh_write_local(hierarchy, first, p);
+	assert(cranh_transform_locals_to_globals_budget(hierarchy, 0, 4));
+	budgetGlobal = cranh_read_global(hierarchy, (cranh_handle_t) { .value = first.value + 4 });
+	assert(memcmp(&budgetGlobal, &tileExpected, sizeof(cranm_transform_t)) == 0);
+	firstGlobal = cranh_read_global(hierarchy, first);
+	assert(memcmp(&firstGlobal, &tileExpected, sizeof(cranm_transform_t)) == 0);
+
+	assert(cranh_transform_locals_to_globals_budget(hierarchy, 0, 4));
+	firstGlobal = cranh_read_global(hierarchy, first);
+	assert(memcmp(&firstGlobal, &tileWriteExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// Throttled subtrees are only updated on their interval, unless they're caught up before being read
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	child = cranh_add_with_parent(hierarchy, c, parent);
+	assert(cranh_set_update_interval(hierarchy, parent, 3));
+
+	cranh_write_local(hierarchy, parent, c);
+	for (unsigned int i = 0; i < 2; ++i)
+	{
+		cranh_transform_locals_to_globals(hierarchy, 0);
+		childGlobal = cranh_read_global(hierarchy, child);
+		assert(memcmp(&childGlobal, &t, sizeof(cranm_transform_t)) == 0);
+	}
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	childGlobal = cranh_read_global(hierarchy, child);
+	assert(memcmp(&childGlobal, &tileExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_write_local(hierarchy, child, p);
+	cranh_catch_up_subtree(hierarchy, child);
+	childGlobal = cranh_read_global(hierarchy, child);
+	assert(memcmp(&childGlobal, &tileWriteExpected, sizeof(cranm_transform_t)) == 0);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranh_destroy(hierarchy);
+
+	// A subtree unbaked during a pass follows the write of it's ancestor that was left for the next pass
+	cranm_transform_t u = { .pos = {.x = 1.0f,.y = 0.0f,.z = 0.0f},.rot = {0},.scale = 1.0f };
+	hierarchy = cranh_create(1, 16);
+	cranh_handle_t unbakedRoot = cranh_add(hierarchy, u);
+	parent = cranh_add_with_parent(hierarchy, u, unbakedRoot);
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		child = cranh_add_with_parent(hierarchy, u, parent);
+	}
+	// The baked subtree fills the second block, the pass stops before it and resumes after it
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		cranh_add_with_parent(hierarchy, u, child);
+	}
+	cranh_add_with_parent(hierarchy, u, parent);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	cranh_bake_static(hierarchy, child);
+
+	cranm_transform_t written = { .pos = {.x = 10.0f,.y = 0.0f,.z = 0.0f},.rot = {0},.scale = 1.0f };
+	cranh_write_local(hierarchy, unbakedRoot, u);
+	assert(!cranh_transform_locals_to_globals_budget(hierarchy, 0, 4));
+	cranh_write_local(hierarchy, parent, written);
+	cranh_unbake_static(hierarchy, child);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranm_transform_t unbakedChildExpected = cranm_transform(u, cranm_transform(written, u));
+	cranm_transform_t unbakedChildGlobal = cranh_read_global(hierarchy, child);
+	assert(unbakedChildGlobal.pos.x == 12.0f && memcmp(&unbakedChildGlobal, &unbakedChildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// An updated subtree is visible right away and the pass doesn't transform it again
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	child = cranh_add_with_parent(hierarchy, c, parent);
+	for (unsigned int i = 0; i < 8; ++i)
+	{
+		grandchild = cranh_add_with_parent(hierarchy, c, child);
+	}
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	cranh_write_global(hierarchy, child, c);
+	cranh_update_subtree(hierarchy, child);
+	childGlobal = cranh_read_global(hierarchy, child);
+	grandchildGlobal = cranh_read_global(hierarchy, grandchild);
+	grandchildExpected = cranm_transform(c, childGlobal);
+	assert(memcmp(&grandchildGlobal, &grandchildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_transform_locals_to_globals(hierarchy, 0);
+#ifdef CRANBERRY_STATS
+	// Only the child's own block is transformed again
+	cranh_stats_t stats = cranh_read_stats(hierarchy, 0);
+	assert(stats.dirtyChildrenProcessed == 4);
+#endif // CRANBERRY_STATS
+
+	cranh_destroy(hierarchy);
+
+	// A subtree updated under a written ancestor is transformed from it, the ancestor's interval is left to the pass
+	hierarchy = cranh_create(1, 16);
+	cranh_handle_t root = cranh_add(hierarchy, u);
+	parent = cranh_add_with_parent(hierarchy, u, root);
+	child = cranh_add_with_parent(hierarchy, u, parent);
+	cranh_handle_t staticChild = cranh_add_with_parent(hierarchy, u, child);
+	for (unsigned int i = 0; i < 3; ++i)
+	{
+		cranh_add_with_parent(hierarchy, u, staticChild);
+	}
+	grandchild = cranh_add_with_parent(hierarchy, u, child);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	cranh_bake_static(hierarchy, staticChild);
+
+	cranh_write_local(hierarchy, parent, written);
+	cranh_update_subtree(hierarchy, child);
+	grandchildExpected = cranm_transform(u, cranm_transform(u, cranm_transform(written, u)));
+	grandchildGlobal = cranh_read_global(hierarchy, grandchild);
+	assert(memcmp(&grandchildGlobal, &grandchildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	grandchildGlobal = cranh_read_global(hierarchy, grandchild);
+	assert(grandchildGlobal.pos.x == 13.0f && memcmp(&grandchildGlobal, &grandchildExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+	// Baked subtrees are cut out of their parent's dirty interval
+	hierarchy = cranh_create(1, 32);
+	parent = cranh_add(hierarchy, p);
+	child = cranh_add_with_parent(hierarchy, c, parent);
+	cranh_handle_t staticRoot = cranh_add_with_parent(hierarchy, c, parent);
+	for (unsigned int i = 0; i < 8; i++)
+	{
+		cranh_add_with_parent(hierarchy, c, staticRoot);
+	}
+	cranh_handle_t dynamicChild = cranh_add_with_parent(hierarchy, c, parent);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	cranh_bake_static(hierarchy, staticRoot);
+
+	// The budget is only spent on the blocks with dynamic children, the block holding only baked children is never visited
+	cranh_write_local(hierarchy, parent, c);
+	assert(!cranh_transform_locals_to_globals_budget(hierarchy, 0, 4));
+	assert(cranh_transform_locals_to_globals_budget(hierarchy, 0, 4));
+	cranm_transform_t staticGlobal = cranh_read_global(hierarchy, (cranh_handle_t) { .value = staticRoot.value + 8 });
+	cranm_transform_t staticExpected = cranm_transform(c, cranm_transform(c, p));
+	assert(memcmp(&staticGlobal, &staticExpected, sizeof(cranm_transform_t)) == 0);
+	cranm_transform_t dynamicGlobal = cranh_read_global(hierarchy, dynamicChild);
+	cranm_transform_t dynamicExpected = cranm_transform(c, c);
+	assert(memcmp(&dynamicGlobal, &dynamicExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_unbake_static(hierarchy, staticRoot);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	staticGlobal = cranh_read_global(hierarchy, (cranh_handle_t) { .value = staticRoot.value + 8 });
+	staticExpected = cranm_transform(c, cranm_transform(c, c));
+	assert(memcmp(&staticGlobal, &staticExpected, sizeof(cranm_transform_t)) == 0);
+
+	cranh_destroy(hierarchy);
+
+#ifdef CRANBERRY_BOUNDS
+	// Subtree bounds follow their moving descendants, missed subtrees are skipped
+	hierarchy = cranh_create(1, 16);
+	parent = cranh_add(hierarchy, p);
+	child = cranh_add_with_parent(hierarchy, c, parent);
+	cranh_aabb_t unitBounds = { .min = { -1.0f, -1.0f, -1.0f, 0.0f }, .max = { 1.0f, 1.0f, 1.0f, 0.0f } };
+	cranh_set_local_bounds(hierarchy, child, unitBounds);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+
+	// The child is at x = 30 with a scale of 5
+	cranh_aabb_t subtreeBounds = cranh_read_subtree_bounds(hierarchy, parent);
+	assert(subtreeBounds.min.x == 25.0f && subtreeBounds.max.x == 35.0f);
+
+	cranh_handle_t hits[2];
+	assert(cranh_query_sphere(hierarchy, 0, (cranm_vec_t) { 30.0f, 0.0f, 0.0f, 0.0f }, 1.0f, hits, 2) == 1 && hits[0].value == child.value);
+
+	// The ray stops short of the child's box, then reaches it
+	cranm_vec_t rayOrigin = { 0.0f, 0.0f, 0.0f, 0.0f };
+	cranm_vec_t rayDirection = { 1.0f, 0.0f, 0.0f, 0.0f };
+	assert(cranh_query_ray(hierarchy, 0, rayOrigin, rayDirection, 20.0f, hits, 2) == 0);
+	assert(cranh_query_ray(hierarchy, 0, rayOrigin, rayDirection, 30.0f, hits, 2) == 1);
+
+	cranh_write_local(hierarchy, parent, c);
+	cranh_transform_locals_to_globals(hierarchy, 0);
+	cranh_aabb_t movedBox = { .min = { 9.0f, -1.0f, -1.0f, 0.0f }, .max = { 11.0f, 1.0f, 1.0f, 0.0f } };
+	assert(cranh_query_box(hierarchy, 0, movedBox, hits, 2) == 1 && hits[0].value == child.value);
+	assert(cranh_query_box(hierarchy, 0, unitBounds, hits, 2) == 0);
+
+	cranh_destroy(hierarchy);
+#endif // CRANBERRY_BOUNDS
+
+	unsigned int parents[] = { cranh_invalid_handle, 0 };
+	cranh_instanced_t* instanced = cranh_instanced_create(parents, 2, cranh_instance_lane_count + 1);
+	for (unsigned int i = 0; i < cranh_instance_lane_count + 1; ++i)
+	{
+		cranh_instanced_write_local(instanced, i, 0, p);
+		cranh_instanced_write_local(instanced, i, 1, c);
+	}
+	cranh_instanced_locals_to_globals(instanced, 0, cranh_instanced_block_count(instanced));
+
+	cranm_transform_t instanceGlobal = cranh_instanced_read_global(instanced, cranh_instance_lane_count, 1);
+	assert(memcmp(&instanceGlobal, &t, sizeof(cranm_transform_t)) == 0);
+
+	cranh_instanced_destroy(instanced);
+
+	// The view looks down +z, a point in front of the camera is inside every plane
+	cranm_vec_t frustum[6];
+	cranm_frustum_planes(cranm_perspective(0.1f, 100.0f, 90.0f), frustum);
+	cranm_vec_t points[] = { { 0.0f, 0.0f, 10.0f, 0.0f }, { 0.0f, 0.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 200.0f, 0.0f }, { 20.0f, 0.0f, 10.0f, 0.0f } };
+	for (unsigned int i = 0; i < 4; ++i)
+	{
+		bool inside = true;
+		for (unsigned int plane = 0; plane < 6; ++plane)
+		{
+			inside = inside && points[i].x * frustum[plane].x + points[i].y * frustum[plane].y + points[i].z * frustum[plane].z + frustum[plane].w >= 0.0f;
+		}
+		assert(inside == (i == 0));
+	}
+
+	// Pairs are found within a row of cells and across neighbouring rows, chunks of 2 entities
+	cranp_broadphase_t* broadphase = cranp_create(4, 1.0f, 2, 4);
+	cranp_set_bounds(broadphase, 0, (cranp_bounds_t) { 0.0f, 0.0f, 0.0f, 0.5f, 0.5f, 0.5f });
+	cranp_set_bounds(broadphase, 1, (cranp_bounds_t) { 0.4f, 0.4f, 0.0f, 0.9f, 0.9f, 0.5f });
+	cranp_set_bounds(broadphase, 2, (cranp_bounds_t) { 0.6f, 0.8f, 0.0f, 1.0f, 1.3f, 0.5f });
+	cranp_set_bounds(broadphase, 3, (cranp_bounds_t) { 10.0f, 0.0f, 0.0f, 10.5f, 0.5f, 0.5f });
+	cranp_update(broadphase);
+
+	uint32_t pairCounts[2];
+	cranp_read_pairs(broadphase, 0, &pairCounts[0]);
+	cranp_read_pairs(broadphase, 1, &pairCounts[1]);
+	assert(pairCounts[0] + pairCounts[1] == 2);
+
+	cranp_set_bounds(broadphase, 3, (cranp_bounds_t) { 0.1f, 0.1f, 0.1f, 0.3f, 0.3f, 0.3f });
+	cranp_update(broadphase);
+	cranp_read_pairs(broadphase, 0, &pairCounts[0]);
+	cranp_read_pairs(broadphase, 1, &pairCounts[1]);
+	assert(pairCounts[0] + pairCounts[1] == 3);
+
+	cranp_destroy(broadphase);
+
+	for (unsigned int seed = 1; seed <= 8; ++seed)
+	{
+		test_broadphase(seed);
+	}
+
+	test_barrier_generations(cranb_default_spin_count);
+	test_barrier_generations(0);
+	test_tasks();
 }
 
 #define cranberry_tests() test()
@@ -59,7 +775,6 @@ const uint8_t render_SampleCount = 4;
 static sg_draw_state render_DrawState;
 
 #define render_MaxInstanceCount 5000000
-game_instance_t render_InstanceBuffer[render_MaxInstanceCount];
 
 typedef struct
 {
@@ -71,6 +786,7 @@ typedef struct
 void core_init(void)
 {
 	Mist_ProfileInit();
+	Mist_StartFlushThread("game_trace.mist", 10, Mist_FormatBinary);
 
 	stm_setup();
 
@@ -162,10 +878,12 @@ void core_frame(void)
 	int width = sapp_width();
 	int height = sapp_height();
 
-	game_tick();
+	cranm_mat4x4_t viewProjection = cranm_perspective(0.1f, 100.0f, 90.0f);
 
-	unsigned int instanceCount = game_gen_instance_buffer(render_InstanceBuffer, render_MaxInstanceCount);
-	sg_update_buffer(render_DrawState.vertex_buffers[0], render_InstanceBuffer, instanceCount * sizeof(game_instance_t));
+	// The workers simulate the next tick until game_tick_end
+	game_instance_t* instances;
+	unsigned int instanceCount = game_tick_begin(viewProjection, &instances);
+	sg_update_buffer(render_DrawState.vertex_buffers[0], instances, instanceCount * sizeof(game_instance_t));
 
 	sg_pass_action passAction =
 	{
@@ -173,11 +891,12 @@ void core_frame(void)
 	};
 	sg_begin_default_pass(&passAction, (int)width, (int)height);
 	sg_apply_draw_state(&render_DrawState);
-	sg_apply_uniform_block(SG_SHADERSTAGE_VS, 0, &(render_params_t){.aspect = (float)width / height, .viewProjection = cranm_perspective(0.1f, 100.0f, 90.0f)}, sizeof(render_params_t));
+	sg_apply_uniform_block(SG_SHADERSTAGE_VS, 0, &(render_params_t){.aspect = (float)width / height, .viewProjection = viewProjection}, sizeof(render_params_t));
 	sg_draw(0, 36, instanceCount);
 	sg_end_pass();
 	sg_commit();
 
+	game_tick_end();
 }
 
 void core_cleanup(void)
@@ -186,19 +905,11 @@ void core_cleanup(void)
 
 	sg_shutdown();
 
-	FILE* fileHandle = fopen("game_chrome_trace.json", "w");
-
-	char* print = 0;
-	size_t bufferSize = 0;
 	Mist_FlushThreadBuffer();
-	Mist_FlushAlloc(&print, &bufferSize);
-
-	fprintf(fileHandle, "%s", mist_ProfilePreface);
-	fprintf(fileHandle, "%s", print);
-	fprintf(fileHandle, "%s", mist_ProfilePostface);
-
-	Mist_Free(print);
-	fclose(fileHandle);
+	Mist_StopFlushThread();
+#ifdef MIST_PROFILE_STATS
+	Mist_PrintStats(stdout, false);
+#endif // MIST_PROFILE_STATS
 	Mist_ProfileTerminate();
 }
 
@@ -0,0 +1,427 @@
+//
+// replay_hierarchy.c
+// @brief Replays a hierarchy trace recorded with CRANBERRY_RECORD (see cranh_record_start) headless and at full speed.
+// The groups are replayed round robin, one pass at a time, the way the game threads advance them every frame.
+// Works against cranberry_hierarchy.h or, with CRANBERRY_HIERARCHY_BACKEND, against any backend of cranberry_hierarchy_backends.h.
+// The trace is streamed from disk, only a small buffer per group is kept in memory.
+//
+// Build:
+// gcc -O2 -std=c11 -DCRANBERRY_SSE Source/replay_hierarchy.c -lm -o replay_hierarchy
+//
+// Usage:
+// replay_hierarchy [--csv] [--repeat n] trace.bin
+//
+// The times are the median of the repeats. pass_ns counts the passes, the partial passes and the subtree updates, mutate_ns counts the
+// adds, writes, static baking and update intervals. passes only counts the passes that completed.
+// The checksum sums the final globals, it should match between builds up to floating point differences.
+// The other backends only have full passes, they skip the partial passes, subtree updates, static baking and update intervals
+// and run a full pass where a budgeted pass completed.
+//
+
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
+#ifdef CRANBERRY_HIERARCHY_BACKEND
+#define CRANBERRY_HIERARCHY_BACKENDS_IMPL
+#include "cranberry_hierarchy_backends.h"
+#else
+#define CRANBERRY_HIERARCHY_IMPL
+#include "cranberry_hierarchy.h"
+#define cranh_backend_name "groups"
+#endif // CRANBERRY_HIERARCHY_BACKEND
+#include "cranberry_hierarchy_trace.h"
+#include "cranberry_math.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define replay_buffer_size (64 * 1024)
+#define replay_max_rep_count 64
+
+typedef struct
+{
+	FILE* file;
+	uint64_t offset; // Where the stream starts in the trace
+	uint64_t size;
+	uint64_t remaining; // Bytes left to read from the file
+	uint8_t* buffer;
+	unsigned int bufferStart;
+	unsigned int bufferEnd;
+	cranh_handle_t* handles; // Ordinal -> handle
+	uint32_t handleCount;
+	uint32_t handleCapacity;
+	uint32_t lastOrdinal;
+} replay_stream_t;
+
+typedef struct
+{
+	uint64_t events;
+	uint64_t adds;
+	uint64_t writes;
+	uint64_t passes;
+	double totalNs;
+	double passNs;
+	double mutateNs;
+	double checksum;
+} replay_result_t;
+
+static double replay_now_ns(void)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (double)time.tv_sec * 1e9 + (double)time.tv_nsec;
+}
+
+static bool replay_rewind(replay_stream_t* stream)
+{
+	stream->remaining = stream->size;
+	stream->bufferStart = 0;
+	stream->bufferEnd = 0;
+	stream->handleCount = 0;
+	stream->lastOrdinal = 0;
+	return fseeko(stream->file, (off_t)stream->offset, SEEK_SET) == 0;
+}
+
+// Makes sure a whole event is in the buffer, events are never larger than cranh_trace_max_event_size.
+static void replay_fill(replay_stream_t* stream)
+{
+	unsigned int buffered = stream->bufferEnd - stream->bufferStart;
+	if (buffered >= cranh_trace_max_event_size || stream->remaining == 0)
+	{
+		return;
+	}
+
+	memmove(stream->buffer, stream->buffer + stream->bufferStart, buffered);
+	size_t toRead = replay_buffer_size - buffered;
+	toRead = toRead < stream->remaining ? toRead : (size_t)stream->remaining;
+	size_t read = fread(stream->buffer + buffered, 1, toRead, stream->file);
+	stream->remaining -= read;
+	stream->bufferStart = 0;
+	stream->bufferEnd = buffered + (unsigned int)read;
+
+	if (read != toRead)
+	{
+		// A truncated trace ends the stream
+		stream->remaining = 0;
+	}
+}
+
+static bool replay_is_done(replay_stream_t* stream)
+{
+	return stream->bufferStart == stream->bufferEnd && stream->remaining == 0;
+}
+
+// Ordinals come from the trace, a corrupt trace could address a transform that doesn't exist.
+static cranh_handle_t replay_handle(replay_stream_t* stream, unsigned int group, uint32_t ordinal)
+{
+	if (ordinal >= stream->handleCount)
+	{
+		fprintf(stderr, "Event in group %u addresses transform %u but the group only has %u, the trace is corrupt\n", group, ordinal, stream->handleCount);
+		exit(1);
+	}
+	return stream->handles[ordinal];
+}
+
+// Replays the events of a group up to and including it's next completed pass.
+static void replay_group(cranh_hierarchy_t* hierarchy, unsigned int group, replay_stream_t* stream, replay_result_t* result)
+{
+	while (1)
+	{
+		replay_fill(stream);
+		if (replay_is_done(stream))
+		{
+			return;
+		}
+
+		const uint8_t* in = stream->buffer + stream->bufferStart;
+		cranh_trace_op_e op = (cranh_trace_op_e)*in++;
+		++result->events;
+
+		cranm_transform_t transform;
+		uint32_t value = 0;
+		uint32_t argument = 0;
+		switch (op)
+		{
+		case cranh_trace_op_add_root:
+			in = cranh_trace_read_transform(in, &transform);
+			break;
+		case cranh_trace_op_add_child:
+		case cranh_trace_op_write_local:
+		case cranh_trace_op_write_global:
+			in = cranh_trace_read_varint(in, &value);
+			in = cranh_trace_read_transform(in, &transform);
+			break;
+		case cranh_trace_op_pass:
+			break;
+		case cranh_trace_op_pass_budget:
+			in = cranh_trace_read_varint(in, &value);
+			argument = *in++;
+			break;
+		case cranh_trace_op_set_update_interval:
+			in = cranh_trace_read_varint(in, &value);
+			in = cranh_trace_read_varint(in, &argument);
+			break;
+		case cranh_trace_op_pass_through:
+		case cranh_trace_op_bake_static:
+		case cranh_trace_op_unbake_static:
+		case cranh_trace_op_catch_up_subtree:
+		case cranh_trace_op_update_subtree:
+			in = cranh_trace_read_varint(in, &value);
+			break;
+		default:
+			fprintf(stderr, "Unknown event %d in group %u, the trace is corrupt\n", (int)op, group);
+			exit(1);
+		}
+		stream->bufferStart = (unsigned int)(in - stream->buffer);
+
+		if ((op == cranh_trace_op_add_root || op == cranh_trace_op_add_child) && stream->handleCount == stream->handleCapacity)
+		{
+			fprintf(stderr, "Group %u has more than %u transforms, the trace is corrupt\n", group, stream->handleCapacity);
+			exit(1);
+		}
+
+		double start = replay_now_ns();
+		bool isPass = false;
+		bool completed = false;
+		switch (op)
+		{
+		case cranh_trace_op_add_root:
+			stream->handles[stream->handleCount++] = cranh_add_to_group(hierarchy, transform, group);
+			++result->adds;
+			break;
+		case cranh_trace_op_add_child:
+			stream->handles[stream->handleCount++] = cranh_add_with_parent(hierarchy, transform, replay_handle(stream, group, value));
+			++result->adds;
+			break;
+		case cranh_trace_op_write_local:
+		case cranh_trace_op_write_global:
+		{
+			uint32_t ordinal = stream->lastOrdinal + (uint32_t)cranh_trace_unzigzag(value);
+			stream->lastOrdinal = ordinal;
+			if (op == cranh_trace_op_write_local)
+			{
+				cranh_write_local(hierarchy, replay_handle(stream, group, ordinal), transform);
+			}
+			else
+			{
+				cranh_write_global(hierarchy, replay_handle(stream, group, ordinal), transform);
+			}
+			++result->writes;
+			break;
+		}
+		case cranh_trace_op_pass:
+			cranh_transform_locals_to_globals(hierarchy, group);
+			isPass = true;
+			completed = true;
+			break;
+		case cranh_trace_op_pass_budget:
+#ifdef CRANBERRY_HIERARCHY_BACKEND
+			if (argument != 0)
+			{
+				cranh_transform_locals_to_globals(hierarchy, group);
+			}
+#else
+			cranh_transform_locals_to_globals_budget(hierarchy, group, value);
+#endif // CRANBERRY_HIERARCHY_BACKEND
+			isPass = true;
+			completed = argument != 0;
+			break;
+#ifndef CRANBERRY_HIERARCHY_BACKEND
+		case cranh_trace_op_pass_through:
+			cranh_transform_locals_to_globals_through(hierarchy, replay_handle(stream, group, value));
+			isPass = true;
+			break;
+		case cranh_trace_op_catch_up_subtree:
+			cranh_catch_up_subtree(hierarchy, replay_handle(stream, group, value));
+			isPass = true;
+			break;
+		case cranh_trace_op_update_subtree:
+			cranh_update_subtree(hierarchy, replay_handle(stream, group, value));
+			isPass = true;
+			break;
+		case cranh_trace_op_bake_static:
+			cranh_bake_static(hierarchy, replay_handle(stream, group, value));
+			break;
+		case cranh_trace_op_unbake_static:
+			cranh_unbake_static(hierarchy, replay_handle(stream, group, value));
+			break;
+		case cranh_trace_op_set_update_interval:
+			cranh_set_update_interval(hierarchy, replay_handle(stream, group, value), argument);
+			break;
+#endif // CRANBERRY_HIERARCHY_BACKEND
+		default:
+			break;
+		}
+
+		double elapsed = replay_now_ns() - start;
+		result->passNs += isPass ? elapsed : 0.0;
+		result->mutateNs += isPass ? 0.0 : elapsed;
+		if (completed)
+		{
+			++result->passes;
+			return;
+		}
+	}
+}
+
+static replay_result_t replay(cranh_trace_header_t* header, replay_stream_t* streams)
+{
+	replay_result_t result = { 0 };
+	cranh_hierarchy_t* hierarchy = cranh_create(header->groupCount, header->maxGroupSize);
+
+	for (unsigned int g = 0; g < header->groupCount; ++g)
+	{
+		if (!replay_rewind(&streams[g]))
+		{
+			fprintf(stderr, "Failed to seek to the stream of group %u\n", g);
+			exit(1);
+		}
+	}
+
+	double start = replay_now_ns();
+	bool done = false;
+	while (!done)
+	{
+		done = true;
+		for (unsigned int g = 0; g < header->groupCount; ++g)
+		{
+			if (!replay_is_done(&streams[g]))
+			{
+				replay_group(hierarchy, g, &streams[g], &result);
+				done = false;
+			}
+		}
+	}
+	result.totalNs = replay_now_ns() - start;
+
+	for (unsigned int g = 0; g < header->groupCount; ++g)
+	{
+		for (uint32_t i = 0; i < streams[g].handleCount; ++i)
+		{
+			cranm_transform_t global = cranh_read_global(hierarchy, streams[g].handles[i]);
+			result.checksum += (double)global.pos.x + (double)global.pos.y + (double)global.pos.z + (double)global.scale;
+		}
+	}
+
+	cranh_destroy(hierarchy);
+	return result;
+}
+
+static int replay_compare_double(const void* l, const void* r)
+{
+	double ld = *(const double*)l;
+	double rd = *(const double*)r;
+	return ld < rd ? -1 : (ld > rd ? 1 : 0);
+}
+
+int main(int argc, char** argv)
+{
+	bool csv = false;
+	unsigned int repCount = 1;
+	const char* path = NULL;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--csv") == 0)
+		{
+			csv = true;
+		}
+		else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc)
+		{
+			repCount = (unsigned int)atoi(argv[++i]);
+			repCount = repCount < 1 ? 1 : (repCount > replay_max_rep_count ? replay_max_rep_count : repCount);
+		}
+		else if (path == NULL && argv[i][0] != '-')
+		{
+			path = argv[i];
+		}
+		else
+		{
+			path = NULL;
+			break;
+		}
+	}
+
+	if (path == NULL)
+	{
+		fprintf(stderr, "usage: %s [--csv] [--repeat n] trace.bin\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(path, "rb");
+	cranh_trace_header_t header;
+	if (file == NULL || fread(&header, sizeof(header), 1, file) != 1 || header.magic != cranh_trace_magic || header.version != cranh_trace_version)
+	{
+		fprintf(stderr, "%s isn't a hierarchy trace\n", path);
+		return 1;
+	}
+
+	// Every group reads it's stream through it's own file handle
+	replay_stream_t* streams = (replay_stream_t*)calloc(header.groupCount, sizeof(replay_stream_t));
+	uint64_t offset = sizeof(header);
+	for (unsigned int g = 0; g < header.groupCount; ++g)
+	{
+		cranh_trace_stream_header_t streamHeader;
+		if (fseeko(file, (off_t)offset, SEEK_SET) != 0 || fread(&streamHeader, sizeof(streamHeader), 1, file) != 1 || streamHeader.group != g)
+		{
+			fprintf(stderr, "%s is truncated\n", path);
+			return 1;
+		}
+
+		replay_stream_t* stream = &streams[g];
+		stream->file = fopen(path, "rb");
+		stream->offset = offset + sizeof(streamHeader);
+		stream->size = streamHeader.size;
+		stream->buffer = (uint8_t*)malloc(replay_buffer_size);
+		stream->handles = (cranh_handle_t*)malloc(sizeof(cranh_handle_t) * header.maxGroupSize);
+		stream->handleCapacity = header.maxGroupSize;
+		offset = stream->offset + stream->size;
+	}
+	fclose(file);
+
+	replay_result_t results[replay_max_rep_count];
+	double totalNs[replay_max_rep_count];
+	double passNs[replay_max_rep_count];
+	double mutateNs[replay_max_rep_count];
+	for (unsigned int r = 0; r < repCount; ++r)
+	{
+		results[r] = replay(&header, streams);
+		totalNs[r] = results[r].totalNs;
+		passNs[r] = results[r].passNs;
+		mutateNs[r] = results[r].mutateNs;
+	}
+	qsort(totalNs, repCount, sizeof(double), replay_compare_double);
+	qsort(passNs, repCount, sizeof(double), replay_compare_double);
+	qsort(mutateNs, repCount, sizeof(double), replay_compare_double);
+
+	replay_result_t* result = &results[0];
+	double medianPassNs = passNs[repCount / 2];
+	if (csv)
+	{
+		printf("backend,groups,events,adds,writes,passes,total_ns,pass_ns,mutate_ns,ns_per_pass,checksum\n");
+		printf("%s,%u,%llu,%llu,%llu,%llu,%.0f,%.0f,%.0f,%.1f,%.6g\n",
+			cranh_backend_name, header.groupCount,
+			(unsigned long long)result->events, (unsigned long long)result->adds, (unsigned long long)result->writes, (unsigned long long)result->passes,
+			totalNs[repCount / 2], medianPassNs, mutateNs[repCount / 2], result->passes > 0 ? medianPassNs / (double)result->passes : 0.0, result->checksum);
+	}
+	else
+	{
+		printf("{\"backend\":\"%s\",\"groups\":%u,\"events\":%llu,\"adds\":%llu,\"writes\":%llu,\"passes\":%llu,"
+			"\"total_ns\":%.0f,\"pass_ns\":%.0f,\"mutate_ns\":%.0f,\"ns_per_pass\":%.1f,\"checksum\":%.6g}\n",
+			cranh_backend_name, header.groupCount,
+			(unsigned long long)result->events, (unsigned long long)result->adds, (unsigned long long)result->writes, (unsigned long long)result->passes,
+			totalNs[repCount / 2], medianPassNs, mutateNs[repCount / 2], result->passes > 0 ? medianPassNs / (double)result->passes : 0.0, result->checksum);
+	}
+
+	for (unsigned int g = 0; g < header.groupCount; ++g)
+	{
+		fclose(streams[g].file);
+		free(streams[g].buffer);
+		free(streams[g].handles);
+	}
+	free(streams);
+	return 0;
+}